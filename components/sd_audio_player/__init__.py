@@ -0,0 +1,125 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome import automation
+from esphome.components import speaker
+from esphome.const import (
+    CONF_ID,
+    CONF_PATH,
+    CONF_POSITION,
+    CONF_SPEAKER,
+    CONF_TRIGGER_ID,
+)
+from .. import sd_mmc_card
+
+CONF_BUFFER_SIZE = "buffer_size"
+CONF_READ_SIZE = "read_size"
+CONF_ON_FINISHED = "on_finished"
+
+DEPENDENCIES = ["sd_mmc_card", "speaker"]
+
+sd_audio_player_ns = cg.esphome_ns.namespace("sd_audio_player")
+SdAudioPlayer = sd_audio_player_ns.class_("SdAudioPlayer", cg.Component)
+
+FinishedTrigger = sd_audio_player_ns.class_("FinishedTrigger", automation.Trigger.template())
+SdAudioPlayerPlayAction = sd_audio_player_ns.class_("SdAudioPlayerPlayAction", automation.Action)
+SdAudioPlayerStopAction = sd_audio_player_ns.class_("SdAudioPlayerStopAction", automation.Action)
+SdAudioPlayerPauseAction = sd_audio_player_ns.class_("SdAudioPlayerPauseAction", automation.Action)
+SdAudioPlayerResumeAction = sd_audio_player_ns.class_("SdAudioPlayerResumeAction", automation.Action)
+SdAudioPlayerSeekAction = sd_audio_player_ns.class_("SdAudioPlayerSeekAction", automation.Action)
+SdAudioPlayerIsPlayingCondition = sd_audio_player_ns.class_("SdAudioPlayerIsPlayingCondition", automation.Condition)
+
+
+def validate_sizes(config):
+    if config[CONF_READ_SIZE] * 2 > config[CONF_BUFFER_SIZE]:
+        raise cv.Invalid(f"{CONF_BUFFER_SIZE} must hold at least two reads of {CONF_READ_SIZE}")
+    return config
+
+
+CONFIG_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.declare_id(SdAudioPlayer),
+            cv.GenerateID(sd_mmc_card.CONF_SD_MMC_CARD_ID): cv.use_id(sd_mmc_card.SdMmc),
+            cv.Required(CONF_SPEAKER): cv.use_id(speaker.Speaker),
+            cv.Optional(CONF_BUFFER_SIZE, default="64KB"): cv.All(
+                sd_mmc_card.validate_bytes, cv.int_range(min=8192, max=4 * 1024 * 1024)
+            ),
+            cv.Optional(CONF_READ_SIZE, default="16KB"): cv.All(
+                sd_mmc_card.validate_bytes, cv.int_range(min=512, max=65536)
+            ),
+            cv.Optional(CONF_ON_FINISHED): automation.validate_automation(
+                {
+                    cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(FinishedTrigger),
+                }
+            ),
+        }
+    ).extend(cv.COMPONENT_SCHEMA),
+    validate_sizes,
+)
+
+
+async def to_code(config):
+    var = cg.new_Pvariable(config[CONF_ID])
+    await cg.register_component(var, config)
+    sdmmc = await cg.get_variable(config[sd_mmc_card.CONF_SD_MMC_CARD_ID])
+    cg.add(var.set_sd_mmc_card(sdmmc))
+    spk = await cg.get_variable(config[CONF_SPEAKER])
+    cg.add(var.set_speaker(spk))
+    cg.add(var.set_buffer_size(config[CONF_BUFFER_SIZE]))
+    cg.add(var.set_read_size(config[CONF_READ_SIZE]))
+    for conf in config.get(CONF_ON_FINISHED, []):
+        trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
+        await automation.build_automation(trigger, [], conf)
+
+
+SD_AUDIO_PLAYER_ACTION_SCHEMA = cv.Schema({cv.GenerateID(): cv.use_id(SdAudioPlayer)})
+
+
+@automation.register_action(
+    "sd_audio_player.play",
+    SdAudioPlayerPlayAction,
+    SD_AUDIO_PLAYER_ACTION_SCHEMA.extend(
+        {
+            cv.Required(CONF_PATH): cv.templatable(cv.string_strict),
+        }
+    ),
+)
+async def sd_audio_player_play_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, parent)
+    path_ = await cg.templatable(config[CONF_PATH], args, cg.std_string)
+    cg.add(var.set_path(path_))
+    return var
+
+
+@automation.register_action(
+    "sd_audio_player.seek",
+    SdAudioPlayerSeekAction,
+    SD_AUDIO_PLAYER_ACTION_SCHEMA.extend(
+        {
+            cv.Required(CONF_POSITION): cv.templatable(cv.positive_time_period_milliseconds),
+        }
+    ),
+)
+async def sd_audio_player_seek_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, parent)
+    position_ = await cg.templatable(config[CONF_POSITION], args, cg.uint32)
+    cg.add(var.set_position(position_))
+    return var
+
+
+@automation.register_action("sd_audio_player.stop", SdAudioPlayerStopAction, SD_AUDIO_PLAYER_ACTION_SCHEMA)
+@automation.register_action("sd_audio_player.pause", SdAudioPlayerPauseAction, SD_AUDIO_PLAYER_ACTION_SCHEMA)
+@automation.register_action("sd_audio_player.resume", SdAudioPlayerResumeAction, SD_AUDIO_PLAYER_ACTION_SCHEMA)
+async def sd_audio_player_simple_action_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    return cg.new_Pvariable(action_id, template_arg, parent)
+
+
+@automation.register_condition(
+    "sd_audio_player.is_playing", SdAudioPlayerIsPlayingCondition, SD_AUDIO_PLAYER_ACTION_SCHEMA
+)
+async def sd_audio_player_is_playing_to_code(config, condition_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    return cg.new_Pvariable(condition_id, template_arg, parent)
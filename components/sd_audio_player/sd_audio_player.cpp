@@ -0,0 +1,221 @@
+#include "sd_audio_player.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "esphome/core/log.h"
+
+#ifdef USE_ESP32
+#include "esp_pthread.h"
+#endif
+
+namespace esphome {
+namespace sd_audio_player {
+
+static const char *TAG = "sd_audio_player";
+// bytes moved from the ring buffer to the speaker at once
+static constexpr size_t FEED_SIZE = 4096;
+// wait of the reader when the ring buffer is full
+static constexpr uint32_t READER_DELAY = 10;
+
+void SdAudioPlayer::setup() {
+  this->ring_buffer_ = RingBuffer::create(this->buffer_size_);
+  this->feed_buffer_.reset(new uint8_t[FEED_SIZE]);
+  if (this->ring_buffer_ == nullptr) {
+    ESP_LOGE(TAG, "Failed to allocate the ring buffer");
+    this->mark_failed();
+  }
+}
+
+void SdAudioPlayer::dump_config() {
+  ESP_LOGCONFIG(TAG, "SD Audio Player:");
+  ESP_LOGCONFIG(TAG, "  Buffer size: %s", sd_mmc_card::format_size(this->buffer_size_).c_str());
+  ESP_LOGCONFIG(TAG, "  Read size: %s", sd_mmc_card::format_size(this->read_size_).c_str());
+  if (this->is_failed())
+    ESP_LOGE(TAG, "  Failed to allocate the ring buffer");
+}
+
+void SdAudioPlayer::on_shutdown() { this->stop(); }
+
+void SdAudioPlayer::set_sd_mmc_card(sd_mmc_card::SdMmc *card) { this->sd_mmc_card_ = card; }
+
+void SdAudioPlayer::set_speaker(speaker::Speaker *speaker) { this->speaker_ = speaker; }
+
+void SdAudioPlayer::set_buffer_size(size_t size) { this->buffer_size_ = size; }
+
+void SdAudioPlayer::set_read_size(size_t size) { this->read_size_ = size; }
+
+bool SdAudioPlayer::play(std::string const &path) {
+  if (this->is_failed())
+    return false;
+  this->stop();
+  auto file = this->sd_mmc_card_->open_file(path, "rb");
+  if (file == nullptr) {
+    ESP_LOGE(TAG, "Failed to open %s", path.c_str());
+    return false;
+  }
+  WavInfo info;
+  if (!parse_wav(*file, this->sd_mmc_card_->file_size(path).value_or(0), info))
+    return false;
+  ESP_LOGD(TAG, "Playing %s: %u channels of %u bits at %u Hz, %u s", path.c_str(), info.channels,
+           info.bits_per_sample, info.sample_rate, info.duration_ms() / 1000);
+
+  this->file_ = std::move(file);
+  this->path_ = path;
+  this->info_ = info;
+  this->read_position_ = info.data_offset;
+  this->played_ = info.data_offset;
+  this->ring_buffer_->reset();
+  this->feed_length_ = 0;
+  this->feed_position_ = 0;
+  // the speaker has nothing buffered yet, it is not an underrun
+  this->starved_ = true;
+  this->end_of_file_ = false;
+  this->reading_ = true;
+#ifdef USE_ESP32
+  esp_pthread_cfg_t config = esp_pthread_get_default_config();
+  config.thread_name = "sd_audio";
+  config.stack_size = 4096;
+  config.prio = 5;
+  esp_pthread_set_cfg(&config);
+#endif
+  this->reader_ = std::thread(&SdAudioPlayer::read_task, this);
+#ifdef USE_ESP32
+  config = esp_pthread_get_default_config();
+  esp_pthread_set_cfg(&config);
+#endif
+
+  this->speaker_->set_audio_stream_info(audio::AudioStreamInfo(info.bits_per_sample, info.channels, info.sample_rate));
+  this->speaker_->start();
+  this->state_ = State::PLAYING;
+  this->high_freq_.start();
+  return true;
+}
+
+void SdAudioPlayer::stop() {
+  if (this->state_ == State::IDLE)
+    return;
+  this->speaker_->stop();
+  this->join_reader();
+  this->file_.reset();
+  this->state_ = State::IDLE;
+  this->high_freq_.stop();
+  ESP_LOGD(TAG, "Stopped %s", this->path_.c_str());
+}
+
+void SdAudioPlayer::pause() {
+  if (this->state_ != State::PLAYING)
+    return;
+  this->speaker_->set_pause_state(true);
+  this->state_ = State::PAUSED;
+  this->high_freq_.stop();
+}
+
+void SdAudioPlayer::resume() {
+  if (this->state_ != State::PAUSED)
+    return;
+  this->speaker_->set_pause_state(false);
+  this->state_ = State::PLAYING;
+  this->high_freq_.start();
+}
+
+void SdAudioPlayer::seek(uint32_t ms) {
+  if (this->state_ == State::IDLE)
+    return;
+  size_t offset = this->info_.offset_at(ms);
+  std::lock_guard<std::mutex> guard(this->file_lock_);
+  if (!this->file_->seek(offset)) {
+    ESP_LOGW(TAG, "Failed to seek %s to %u ms", this->path_.c_str(), ms);
+    return;
+  }
+  this->read_position_ = offset;
+  this->played_ = offset;
+  // the samples of the old position are dropped, the speaker still plays what it has buffered
+  this->ring_buffer_->reset();
+  this->feed_length_ = 0;
+  this->feed_position_ = 0;
+  this->starved_ = true;
+  this->end_of_file_ = false;
+}
+
+uint32_t SdAudioPlayer::get_position() const {
+  if (this->state_ == State::IDLE || this->info_.block_align == 0)
+    return 0;
+  uint64_t frames = (this->played_ - this->info_.data_offset) / this->info_.block_align;
+  return frames * 1000 / this->info_.sample_rate;
+}
+
+void SdAudioPlayer::loop() {
+  if (this->state_ != State::PLAYING)
+    return;
+
+  while (true) {
+    if (this->feed_position_ == this->feed_length_) {
+      this->feed_length_ = this->ring_buffer_->read(this->feed_buffer_.get(), FEED_SIZE, 0);
+      this->feed_position_ = 0;
+      if (this->feed_length_ == 0)
+        break;
+    }
+    const uint8_t *data = this->feed_buffer_.get() + this->feed_position_;
+    size_t n = this->speaker_->play(data, this->feed_length_ - this->feed_position_);
+    this->feed_position_ += n;
+    this->played_ += n;
+    // the speaker buffer is full
+    if (this->feed_position_ < this->feed_length_)
+      return;
+  }
+
+  if (this->end_of_file_ && this->ring_buffer_->available() == 0) {
+    this->finish();
+    return;
+  }
+  // nothing was ready while the speaker ran out of samples
+  bool starved = !this->speaker_->has_buffered_data();
+  if (starved && !this->starved_) {
+    this->underruns_++;
+    ESP_LOGW(TAG, "Buffer underrun playing %s", this->path_.c_str());
+  }
+  this->starved_ = starved;
+}
+
+void SdAudioPlayer::finish() {
+  this->speaker_->finish();
+  this->join_reader();
+  this->file_.reset();
+  this->state_ = State::IDLE;
+  this->high_freq_.stop();
+  ESP_LOGD(TAG, "Finished %s", this->path_.c_str());
+  this->finished_callback_.call();
+}
+
+void SdAudioPlayer::read_task() {
+  std::unique_ptr<uint8_t[]> buffer(new uint8_t[this->read_size_]);
+  size_t end = this->info_.data_offset + this->info_.data_size;
+  while (this->reading_) {
+    // only the reader writes to the ring buffer, the free space can only grow until the read
+    if (this->end_of_file_ || this->ring_buffer_->free() < this->read_size_) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(READER_DELAY));
+      continue;
+    }
+    std::lock_guard<std::mutex> guard(this->file_lock_);
+    size_t n = std::min(this->read_size_, end - this->read_position_);
+    size_t read = n > 0 ? this->file_->read(buffer.get(), n) : 0;
+    if (read < n)
+      ESP_LOGE(TAG, "Failed to read %s", this->path_.c_str());
+    if (read == 0) {
+      this->end_of_file_ = true;
+      continue;
+    }
+    this->ring_buffer_->write(buffer.get(), read);
+    this->read_position_ += read;
+  }
+}
+
+void SdAudioPlayer::join_reader() {
+  this->reading_ = false;
+  if (this->reader_.joinable())
+    this->reader_.join();
+}
+
+}  // namespace sd_audio_player
+}  // namespace esphome
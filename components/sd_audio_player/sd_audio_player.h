@@ -0,0 +1,157 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "esphome/core/component.h"
+#include "esphome/core/automation.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/ring_buffer.h"
+#include "esphome/components/speaker/speaker.h"
+#include "../sd_mmc_card/sd_mmc_card.h"
+#include "wav_file.h"
+
+namespace esphome {
+namespace sd_audio_player {
+
+/* Play wav files from the sd card on a speaker.
+ *
+ * A reader task fills a ring buffer with large reads of the file, the main loop moves the samples from the ring
+ * buffer to the speaker. Only the ring buffer and one read are held in memory whatever the length of the file,
+ * and a slow card read is absorbed by the ring buffer instead of starving the speaker.
+ */
+class SdAudioPlayer : public Component {
+ public:
+  enum class State : uint8_t { IDLE, PLAYING, PAUSED };
+
+  void setup() override;
+  void loop() override;
+  void dump_config() override;
+  void on_shutdown() override;
+  float get_setup_priority() const override { return setup_priority::LATE; }
+
+  void set_sd_mmc_card(sd_mmc_card::SdMmc *);
+  void set_speaker(speaker::Speaker *);
+  void set_buffer_size(size_t);
+  void set_read_size(size_t);
+
+  bool play(std::string const &path);
+  void stop();
+  void pause();
+  void resume();
+  /* Continue the playback from the given time in the file */
+  void seek(uint32_t ms);
+
+  State get_state() const { return this->state_; }
+  bool is_playing() const { return this->state_ == State::PLAYING; }
+  std::string const &get_path() const { return this->path_; }
+  WavInfo const &get_info() const { return this->info_; }
+  /* Time of the sample sent to the speaker in milliseconds */
+  uint32_t get_position() const;
+  /* Times the speaker was given nothing while playing because the ring buffer was empty */
+  uint32_t get_underruns() const { return this->underruns_; }
+  void add_on_finished_callback(std::function<void()> &&callback) { this->finished_callback_.add(std::move(callback)); }
+
+ protected:
+  void read_task();
+  void finish();
+  void join_reader();
+
+  sd_mmc_card::SdMmc *sd_mmc_card_;
+  speaker::Speaker *speaker_;
+  size_t buffer_size_{65536};
+  size_t read_size_{16384};
+  std::unique_ptr<RingBuffer> ring_buffer_;
+  std::unique_ptr<uint8_t[]> feed_buffer_;
+  size_t feed_length_{0};
+  size_t feed_position_{0};
+  std::unique_ptr<sd_mmc_card::FileHandle> file_;
+  std::string path_;
+  WavInfo info_;
+  State state_{State::IDLE};
+  // offset of the next sample sent to the speaker
+  size_t played_{0};
+  uint32_t underruns_{0};
+  HighFrequencyLoopRequester high_freq_;
+  CallbackManager<void()> finished_callback_;
+
+  std::thread reader_;
+  // held by the reader around each read, a seek then never mixes samples of the old and new position
+  std::mutex file_lock_;
+  size_t read_position_{0};
+  std::atomic<bool> reading_{false};
+  std::atomic<bool> end_of_file_{false};
+  bool starved_{false};
+};
+
+class FinishedTrigger : public Trigger<> {
+ public:
+  explicit FinishedTrigger(SdAudioPlayer *parent) {
+    parent->add_on_finished_callback([this]() { this->trigger(); });
+  }
+};
+
+template<typename... Ts> class SdAudioPlayerPlayAction : public Action<Ts...> {
+ public:
+  SdAudioPlayerPlayAction(SdAudioPlayer *parent) : parent_(parent) {}
+  TEMPLATABLE_VALUE(std::string, path)
+
+  void play(Ts... x) { this->parent_->play(this->path_.value(x...)); }
+
+ protected:
+  SdAudioPlayer *parent_;
+};
+
+template<typename... Ts> class SdAudioPlayerStopAction : public Action<Ts...> {
+ public:
+  SdAudioPlayerStopAction(SdAudioPlayer *parent) : parent_(parent) {}
+
+  void play(Ts... x) { this->parent_->stop(); }
+
+ protected:
+  SdAudioPlayer *parent_;
+};
+
+template<typename... Ts> class SdAudioPlayerPauseAction : public Action<Ts...> {
+ public:
+  SdAudioPlayerPauseAction(SdAudioPlayer *parent) : parent_(parent) {}
+
+  void play(Ts... x) { this->parent_->pause(); }
+
+ protected:
+  SdAudioPlayer *parent_;
+};
+
+template<typename... Ts> class SdAudioPlayerResumeAction : public Action<Ts...> {
+ public:
+  SdAudioPlayerResumeAction(SdAudioPlayer *parent) : parent_(parent) {}
+
+  void play(Ts... x) { this->parent_->resume(); }
+
+ protected:
+  SdAudioPlayer *parent_;
+};
+
+template<typename... Ts> class SdAudioPlayerSeekAction : public Action<Ts...> {
+ public:
+  SdAudioPlayerSeekAction(SdAudioPlayer *parent) : parent_(parent) {}
+  TEMPLATABLE_VALUE(uint32_t, position)
+
+  void play(Ts... x) { this->parent_->seek(this->position_.value(x...)); }
+
+ protected:
+  SdAudioPlayer *parent_;
+};
+
+template<typename... Ts> class SdAudioPlayerIsPlayingCondition : public Condition<Ts...> {
+ public:
+  SdAudioPlayerIsPlayingCondition(SdAudioPlayer *parent) : parent_(parent) {}
+
+  bool check(Ts... x) override { return this->parent_->is_playing(); }
+
+ protected:
+  SdAudioPlayer *parent_;
+};
+
+}  // namespace sd_audio_player
+}  // namespace esphome
@@ -0,0 +1,96 @@
+#include "wav_file.h"
+#include <algorithm>
+#include <cstring>
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace sd_audio_player {
+
+static const char *TAG = "sd_audio_player";
+
+static constexpr uint16_t FORMAT_PCM = 1;
+static constexpr uint16_t FORMAT_EXTENSIBLE = 0xFFFE;
+
+static uint16_t get_le16(const uint8_t *buffer) { return buffer[0] | (buffer[1] << 8); }
+
+static uint32_t get_le32(const uint8_t *buffer) {
+  return buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | (static_cast<uint32_t>(buffer[3]) << 24);
+}
+
+size_t WavInfo::offset_at(uint32_t ms) const {
+  uint64_t frame = static_cast<uint64_t>(ms) * this->sample_rate / 1000;
+  uint64_t offset = std::min<uint64_t>(frame * this->block_align, this->data_size);
+  // stay on a frame boundary, the channels would be swapped otherwise
+  return this->data_offset + offset - offset % this->block_align;
+}
+
+uint32_t WavInfo::duration_ms() const {
+  if (this->sample_rate == 0 || this->block_align == 0)
+    return 0;
+  return static_cast<uint64_t>(this->data_size / this->block_align) * 1000 / this->sample_rate;
+}
+
+bool parse_wav(sd_mmc_card::FileHandle &file, size_t file_size, WavInfo &info) {
+  uint8_t header[12];
+  if (file.read(header, sizeof(header)) != sizeof(header) || memcmp(header, "RIFF", 4) != 0 ||
+      memcmp(header + 8, "WAVE", 4) != 0) {
+    ESP_LOGE(TAG, "Not a wav file");
+    return false;
+  }
+
+  bool has_format = false;
+  size_t position = sizeof(header);
+  while (position + 8 <= file_size) {
+    uint8_t chunk[8];
+    if (!file.seek(position) || file.read(chunk, sizeof(chunk)) != sizeof(chunk))
+      break;
+    uint32_t size = get_le32(chunk + 4);
+    position += sizeof(chunk);
+
+    if (memcmp(chunk, "fmt ", 4) == 0) {
+      uint8_t format[40];
+      size_t n = std::min<size_t>(size, sizeof(format));
+      if (n < 16 || file.read(format, n) != n)
+        break;
+      uint16_t tag = get_le16(format);
+      // the sub format of an extensible header starts with the format tag
+      if (tag == FORMAT_EXTENSIBLE && n >= 26)
+        tag = get_le16(format + 24);
+      if (tag != FORMAT_PCM) {
+        ESP_LOGE(TAG, "Unsupported wav format %u, only PCM is supported", tag);
+        return false;
+      }
+      info.channels = get_le16(format + 2);
+      info.sample_rate = get_le32(format + 4);
+      info.block_align = get_le16(format + 12);
+      info.bits_per_sample = get_le16(format + 14);
+      if (info.channels == 0 || info.channels > 2 || info.bits_per_sample % 8 != 0 || info.bits_per_sample == 0 ||
+          info.bits_per_sample > 32 || info.block_align != info.channels * info.bits_per_sample / 8 ||
+          info.sample_rate == 0) {
+        ESP_LOGE(TAG, "Unsupported wav format: %u channels of %u bits at %u Hz", info.channels, info.bits_per_sample,
+                 info.sample_rate);
+        return false;
+      }
+      has_format = true;
+    } else if (memcmp(chunk, "data", 4) == 0) {
+      if (!has_format)
+        break;
+      info.data_offset = position;
+      info.data_size = std::min<size_t>(size, file_size - position);
+      info.data_size -= info.data_size % info.block_align;
+      return true;
+    }
+    // a chunk past the end of the file, the position would wrap around and the walk never end
+    if (size > file_size - position)
+      break;
+    // chunks are padded to an even size
+    position += size;
+    position += size & 1;
+  }
+
+  ESP_LOGE(TAG, "Invalid wav file");
+  return false;
+}
+
+}  // namespace sd_audio_player
+}  // namespace esphome
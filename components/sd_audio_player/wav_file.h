@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "../sd_mmc_card/sd_mmc_card.h"
+
+namespace esphome {
+namespace sd_audio_player {
+
+/* Format and position of the samples of a wav file */
+struct WavInfo {
+  uint32_t sample_rate{0};
+  uint8_t channels{0};
+  uint8_t bits_per_sample{0};
+  /* bytes of one sample of every channel */
+  uint16_t block_align{0};
+  size_t data_offset{0};
+  size_t data_size{0};
+
+  /* Byte offset of the frame played at the given time */
+  size_t offset_at(uint32_t ms) const;
+  uint32_t duration_ms() const;
+};
+
+/* Read the chunks of a RIFF/WAVE file up to the data chunk, only PCM samples are supported.
+ * A data chunk larger than the file, left by a recording that was not closed, is cut to the file size.
+ */
+bool parse_wav(sd_mmc_card::FileHandle &file, size_t file_size, WavInfo &info);
+
+}  // namespace sd_audio_player
+}  // namespace esphome
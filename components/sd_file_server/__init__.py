@@ -13,6 +13,17 @@ CONF_ROOT_PATH = "root_path"
 CONF_ENABLE_DELETION = "enable_deletion"
 CONF_ENABLE_DOWNLOAD = "enable_download"
 CONF_ENABLE_UPLOAD = "enable_upload"
+CONF_COMPRESSION = "compression"
+CONF_LEVEL = "level"
+CONF_MIN_SIZE = "min_size"
+CONF_TRANSFERS = "transfers"
+CONF_MAX_DOWNLOADS = "max_downloads"
+CONF_MAX_UPLOADS = "max_uploads"
+CONF_BUFFER_BUDGET = "buffer_budget"
+CONF_READ_SIZE = "read_size"
+CONF_READ_AHEAD = "read_ahead"
+CONF_RETRY_AFTER = "retry_after"
+CONF_SD_FILE_SERVER_ID = "sd_file_server_id"
 
 AUTO_LOAD = ["web_server_base"]
 DEPENDENCIES = ["sd_mmc_card"]
@@ -34,6 +45,20 @@ CONFIG_SCHEMA = cv.All(
             cv.Optional(CONF_ENABLE_DELETION, default=False): cv.boolean,
             cv.Optional(CONF_ENABLE_DOWNLOAD, default=False): cv.boolean,
             cv.Optional(CONF_ENABLE_UPLOAD, default=False): cv.boolean,
+            cv.Optional(CONF_COMPRESSION): cv.Schema({
+                cv.Optional(CONF_LEVEL, default=6): cv.int_range(min=1, max=9),
+                cv.Optional(CONF_MIN_SIZE, default=1024): cv.positive_int,
+            }),
+            cv.Optional(CONF_TRANSFERS, default={}): cv.Schema({
+                cv.Optional(CONF_MAX_DOWNLOADS, default=2): cv.int_range(min=1, max=16),
+                cv.Optional(CONF_MAX_UPLOADS, default=1): cv.int_range(min=1, max=16),
+                cv.Optional(CONF_BUFFER_BUDGET, default="64KB"): sd_mmc_card.validate_bytes,
+                cv.Optional(CONF_READ_SIZE): cv.All(
+                    sd_mmc_card.validate_bytes, cv.int_range(min=4096, max=65536)
+                ),
+                cv.Optional(CONF_READ_AHEAD, default=1): cv.int_range(min=0, max=2),
+                cv.Optional(CONF_RETRY_AFTER, default="5s"): cv.positive_time_period_seconds,
+            }),
         }
     ).extend(cv.COMPONENT_SCHEMA),
 )
@@ -51,5 +76,16 @@ async def to_code(config):
     cg.add(var.set_deletion_enabled(config[CONF_ENABLE_DELETION]))
     cg.add(var.set_download_enabled(config[CONF_ENABLE_DOWNLOAD]))
     cg.add(var.set_upload_enabled(config[CONF_ENABLE_UPLOAD]))
+    if CONF_COMPRESSION in config:
+        cg.add(var.set_compression_level(config[CONF_COMPRESSION][CONF_LEVEL]))
+        cg.add(var.set_compression_min_size(config[CONF_COMPRESSION][CONF_MIN_SIZE]))
+    transfers = config[CONF_TRANSFERS]
+    cg.add(var.set_max_downloads(transfers[CONF_MAX_DOWNLOADS]))
+    cg.add(var.set_max_uploads(transfers[CONF_MAX_UPLOADS]))
+    cg.add(var.set_buffer_budget(transfers[CONF_BUFFER_BUDGET]))
+    if CONF_READ_SIZE in transfers:
+        cg.add(var.set_read_size(transfers[CONF_READ_SIZE]))
+    cg.add(var.set_read_ahead(transfers[CONF_READ_AHEAD]))
+    cg.add(var.set_retry_after(transfers[CONF_RETRY_AFTER].total_seconds))
     
     cg.add_define("USE_SD_CARD_WEBSERVER")
@@ -0,0 +1,365 @@
+#include "archive.h"
+#include <algorithm>
+#include <cstring>
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace sd_file_server {
+
+static const char *TAG = "sd_file_server.archive";
+
+static constexpr size_t TAR_BLOCK_SIZE = 512;
+static constexpr size_t TAR_NAME_SIZE = 100;
+static constexpr size_t TAR_PREFIX_SIZE = 155;
+// 11 octal digits, larger sizes are written in base-256
+static constexpr uint64_t TAR_MAX_OCTAL_SIZE = 1ULL << 33;
+static constexpr size_t ZIP_MAX_ENTRIES = 0xFFFF;
+// sizes and offsets from this value on are in the zip64 fields
+static constexpr uint32_t ZIP64_LIMIT = 0xFFFFFFFF;
+static constexpr uint16_t ZIP64_EXTRA_ID = 0x0001;
+// 1980-01-01 00:00, used when the file has no valid timestamp
+static constexpr uint32_t ZIP_DOS_EPOCH = ((1 << 5) | 1) << 16;
+static constexpr uint16_t ZIP_FLAG_DATA_DESCRIPTOR = 1 << 3;
+static constexpr uint16_t ZIP_FLAG_UTF8 = 1 << 11;
+static constexpr uint16_t ZIP_VERSION = 20;
+static constexpr uint16_t ZIP64_VERSION = 45;
+
+static void write_octal(char *field, size_t width, uint64_t value) {
+  snprintf(field, width, "%0*llo", static_cast<int>(width - 1), static_cast<unsigned long long>(value));
+}
+
+static void write_tar_size(char *field, uint64_t size) {
+  if (size < TAR_MAX_OCTAL_SIZE) {
+    write_octal(field, 12, size);
+    return;
+  }
+  // gnu base-256: the high bit of the first byte set, the size big endian in the others
+  field[0] = static_cast<char>(0x80);
+  for (size_t i = 11; i > 0; i--) {
+    field[i] = static_cast<char>(size & 0xFF);
+    size >>= 8;
+  }
+}
+
+// msdos date in the high word, time in the low word
+static uint32_t to_dos_time(time_t mtime) {
+  struct tm tm;
+  if (mtime == 0 || localtime_r(&mtime, &tm) == nullptr || tm.tm_year < 80)
+    return ZIP_DOS_EPOCH;
+  uint32_t date = ((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday;
+  uint32_t time = (tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2);
+  return (date << 16) | time;
+}
+
+ArchiveSource::ArchiveSource(sd_mmc_card::SdMmc *card, std::string const &root,
+                             std::vector<sd_mmc_card::FileInfo> entries, ArchiveFormat format)
+    : card_(card), root_(root), entries_(std::move(entries)), format_(format) {
+  if (this->format_ == ArchiveFormat::ZIP && this->entries_.size() > ZIP_MAX_ENTRIES) {
+    ESP_LOGW(TAG, "Too many entries for a zip archive, only the first %u are included", ZIP_MAX_ENTRIES);
+    this->entries_.erase(this->entries_.begin() + ZIP_MAX_ENTRIES, this->entries_.end());
+  }
+}
+
+size_t ArchiveSource::read(uint8_t *buffer, size_t len) {
+  size_t written = 0;
+  while (written < len) {
+    if (this->pending_pos_ < this->pending_.size()) {
+      size_t n = std::min(len - written, this->pending_.size() - this->pending_pos_);
+      memcpy(buffer + written, this->pending_.data() + this->pending_pos_, n);
+      this->pending_pos_ += n;
+      this->offset_ += n;
+      written += n;
+      if (this->pending_pos_ == this->pending_.size()) {
+        this->pending_.clear();
+        this->pending_pos_ = 0;
+      }
+      continue;
+    }
+    switch (this->state_) {
+      case State::ENTRY:
+        this->start_entry();
+        break;
+      case State::DATA: {
+        size_t n = this->read_data(buffer + written, len - written);
+        if (n == 0)
+          this->end_entry();
+        this->offset_ += n;
+        written += n;
+        break;
+      }
+      case State::CENTRAL_DIRECTORY:
+        this->write_central_directory();
+        break;
+      case State::DONE:
+        return written;
+    }
+  }
+  return written;
+}
+
+void ArchiveSource::start_entry() {
+  if (this->index_ >= this->entries_.size()) {
+    if (this->format_ == ArchiveFormat::TAR) {
+      // end of archive marker
+      this->write_padding(2 * TAR_BLOCK_SIZE);
+      this->state_ = State::DONE;
+    } else {
+      this->central_offset_ = this->offset_;
+      this->state_ = State::CENTRAL_DIRECTORY;
+    }
+    return;
+  }
+
+  auto const &entry = this->entries_[this->index_];
+  std::string name = this->entry_name(entry);
+  if (name.empty()) {
+    this->index_++;
+    return;
+  }
+
+  if (entry.is_directory) {
+    if (this->format_ == ArchiveFormat::TAR) {
+      this->write_tar_header(name, 0, true, entry.mtime);
+    } else {
+      this->records_.push_back(ZipRecord{name + "/", 0, 0, this->offset_, true, to_dos_time(entry.mtime), false});
+      this->write_zip_local_header(this->records_.back());
+    }
+    this->index_++;
+    return;
+  }
+
+  this->file_ = this->card_->open_file(entry.path, "rb");
+  if (this->file_ == nullptr) {
+    ESP_LOGW(TAG, "Skipping %s, failed to open file", entry.path.c_str());
+    this->index_++;
+    return;
+  }
+  this->file_expected_ = entry.size;
+  this->file_read_ = 0;
+  this->file_crc_ = 0;
+  if (this->format_ == ArchiveFormat::TAR) {
+    this->write_tar_header(name, entry.size, false, entry.mtime);
+  } else {
+    this->records_.push_back(
+        ZipRecord{name, 0, 0, this->offset_, false, to_dos_time(entry.mtime), entry.size >= ZIP64_LIMIT});
+    this->write_zip_local_header(this->records_.back());
+  }
+  this->state_ = State::DATA;
+}
+
+size_t ArchiveSource::read_data(uint8_t *buffer, size_t len) {
+  if (this->format_ == ArchiveFormat::ZIP) {
+    // a file grown past 4 GB since it was listed is cut, its entry has no room for the size
+    if (!this->records_.back().zip64)
+      len = std::min<uint64_t>(len, ZIP64_LIMIT - 1 - this->file_read_);
+    size_t n = this->file_->read(buffer, len);
+    this->file_crc_ = sd_mmc_card::crc32(this->file_crc_, buffer, n);
+    this->file_read_ += n;
+    return n;
+  }
+
+  // the tar header already announced the size, stick to it even if the file changed
+  uint64_t remaining = this->file_expected_ - this->file_read_;
+  size_t n = this->file_->read(buffer, std::min<uint64_t>(len, remaining));
+  if (n == 0 && remaining > 0) {
+    n = std::min<uint64_t>(len, remaining);
+    memset(buffer, 0, n);
+  }
+  this->file_read_ += n;
+  return n;
+}
+
+void ArchiveSource::end_entry() {
+  this->file_.reset();
+  if (this->format_ == ArchiveFormat::TAR) {
+    this->write_padding((TAR_BLOCK_SIZE - this->file_read_ % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE);
+  } else {
+    ZipRecord &record = this->records_.back();
+    record.crc = this->file_crc_;
+    record.size = this->file_read_;
+    this->put32(0x08074b50);
+    this->put32(record.crc);
+    if (record.zip64) {
+      this->put64(record.size);
+      this->put64(record.size);
+    } else {
+      this->put32(record.size);
+      this->put32(record.size);
+    }
+  }
+  this->index_++;
+  this->state_ = State::ENTRY;
+}
+
+void ArchiveSource::write_central_directory() {
+  if (this->central_index_ < this->records_.size()) {
+    this->write_zip_central_header(this->records_[this->central_index_++]);
+    return;
+  }
+  this->write_zip_end_of_central_directory();
+  this->state_ = State::DONE;
+}
+
+std::string ArchiveSource::entry_name(sd_mmc_card::FileInfo const &entry) const {
+  size_t start = 0;
+  if (entry.path.compare(0, this->root_.size(), this->root_) == 0)
+    start = this->root_.size();
+  while (start < entry.path.size() && entry.path[start] == '/')
+    start++;
+  return entry.path.substr(start);
+}
+
+void ArchiveSource::write_tar_header(std::string const &name, uint64_t size, bool is_directory, time_t mtime) {
+  std::string full = is_directory ? name + "/" : name;
+  char type = is_directory ? '5' : '0';
+  if (full.size() <= TAR_NAME_SIZE) {
+    this->write_tar_record(full, "", size, type, mtime);
+    return;
+  }
+
+  // ustar split: the prefix holds the leading directories
+  size_t pos = full.find('/', full.size() - TAR_NAME_SIZE - 1);
+  if (pos != std::string::npos && pos <= TAR_PREFIX_SIZE && pos + 1 < full.size()) {
+    this->write_tar_record(full.substr(pos + 1), full.substr(0, pos), size, type, mtime);
+    return;
+  }
+
+  // gnu long name extension
+  this->write_tar_record("././@LongLink", "", full.size() + 1, 'L', 0);
+  this->pending_.insert(this->pending_.end(), full.begin(), full.end());
+  this->pending_.push_back(0);
+  this->write_padding((TAR_BLOCK_SIZE - (full.size() + 1) % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE);
+  this->write_tar_record(full.substr(0, TAR_NAME_SIZE), "", size, type, mtime);
+}
+
+void ArchiveSource::write_tar_record(std::string const &name, std::string const &prefix, uint64_t size, char type,
+                                     time_t mtime) {
+  size_t start = this->pending_.size();
+  this->pending_.resize(start + TAR_BLOCK_SIZE, 0);
+  char *header = reinterpret_cast<char *>(this->pending_.data() + start);
+
+  memcpy(header, name.data(), std::min(name.size(), TAR_NAME_SIZE));
+  write_octal(header + 100, 8, type == '5' ? 0755 : 0644);
+  write_octal(header + 108, 8, 0);
+  write_octal(header + 116, 8, 0);
+  write_tar_size(header + 124, size);
+  write_octal(header + 136, 12, mtime > 0 ? mtime : 0);
+  memset(header + 148, ' ', 8);
+  header[156] = type;
+  memcpy(header + 257, "ustar", 6);
+  memcpy(header + 263, "00", 2);
+  memcpy(header + 345, prefix.data(), std::min(prefix.size(), TAR_PREFIX_SIZE));
+
+  uint32_t checksum = 0;
+  for (size_t i = 0; i < TAR_BLOCK_SIZE; i++)
+    checksum += static_cast<uint8_t>(header[i]);
+  write_octal(header + 148, 7, checksum);
+  header[155] = ' ';
+}
+
+void ArchiveSource::write_padding(size_t size) { this->pending_.resize(this->pending_.size() + size, 0); }
+
+void ArchiveSource::write_zip_local_header(ZipRecord const &record) {
+  this->put32(0x04034b50);
+  this->put16(record.zip64 ? ZIP64_VERSION : ZIP_VERSION);
+  this->put16(record.is_directory ? ZIP_FLAG_UTF8 : ZIP_FLAG_UTF8 | ZIP_FLAG_DATA_DESCRIPTOR);
+  this->put16(0);  // stored
+  this->put32(record.dos_time);
+  // crc and sizes follow the data in the data descriptor, 64 bits wide when the extra field is present
+  this->put32(0);
+  this->put32(record.zip64 ? ZIP64_LIMIT : 0);
+  this->put32(record.zip64 ? ZIP64_LIMIT : 0);
+  this->put16(record.name.size());
+  this->put16(record.zip64 ? 20 : 0);
+  this->pending_.insert(this->pending_.end(), record.name.begin(), record.name.end());
+  if (record.zip64) {
+    this->put16(ZIP64_EXTRA_ID);
+    this->put16(16);
+    this->put64(0);
+    this->put64(0);
+  }
+}
+
+void ArchiveSource::write_zip_central_header(ZipRecord const &record) {
+  // the extra field holds the values too large for their field, in this order
+  bool large_offset = record.offset >= ZIP64_LIMIT;
+  uint16_t extra = (record.zip64 ? 16 : 0) + (large_offset ? 8 : 0);
+  uint16_t version = extra > 0 ? ZIP64_VERSION : ZIP_VERSION;
+  this->put32(0x02014b50);
+  this->put16(version);
+  this->put16(version);
+  this->put16(record.is_directory ? ZIP_FLAG_UTF8 : ZIP_FLAG_UTF8 | ZIP_FLAG_DATA_DESCRIPTOR);
+  this->put16(0);
+  this->put32(record.dos_time);
+  this->put32(record.crc);
+  this->put32(record.zip64 ? ZIP64_LIMIT : record.size);
+  this->put32(record.zip64 ? ZIP64_LIMIT : record.size);
+  this->put16(record.name.size());
+  this->put16(extra > 0 ? extra + 4 : 0);
+  this->put16(0);  // comment
+  this->put16(0);  // disk number
+  this->put16(0);  // internal attributes
+  this->put32(record.is_directory ? 0x10 : 0);
+  this->put32(large_offset ? ZIP64_LIMIT : record.offset);
+  this->pending_.insert(this->pending_.end(), record.name.begin(), record.name.end());
+  if (extra > 0) {
+    this->put16(ZIP64_EXTRA_ID);
+    this->put16(extra);
+    if (record.zip64) {
+      this->put64(record.size);
+      this->put64(record.size);
+    }
+    if (large_offset)
+      this->put64(record.offset);
+  }
+}
+
+void ArchiveSource::write_zip_end_of_central_directory() {
+  // called once the central directory went out, the current offset is its end
+  uint64_t size = this->offset_ - this->central_offset_;
+  size_t count = this->records_.size();
+  if (this->central_offset_ >= ZIP64_LIMIT || size >= ZIP64_LIMIT || count >= ZIP_MAX_ENTRIES) {
+    uint64_t record_offset = this->offset_;
+    this->put32(0x06064b50);
+    this->put64(44);  // size of the rest of the record
+    this->put16(ZIP64_VERSION);
+    this->put16(ZIP64_VERSION);
+    this->put32(0);
+    this->put32(0);
+    this->put64(count);
+    this->put64(count);
+    this->put64(size);
+    this->put64(this->central_offset_);
+    // locator of the zip64 record
+    this->put32(0x07064b50);
+    this->put32(0);
+    this->put64(record_offset);
+    this->put32(1);
+  }
+  this->put32(0x06054b50);
+  this->put16(0);
+  this->put16(0);
+  this->put16(std::min<size_t>(count, ZIP_MAX_ENTRIES));
+  this->put16(std::min<size_t>(count, ZIP_MAX_ENTRIES));
+  this->put32(std::min<uint64_t>(size, ZIP64_LIMIT));
+  this->put32(std::min<uint64_t>(this->central_offset_, ZIP64_LIMIT));
+  this->put16(0);
+}
+
+void ArchiveSource::put16(uint16_t value) {
+  this->pending_.push_back(value & 0xFF);
+  this->pending_.push_back(value >> 8);
+}
+
+void ArchiveSource::put32(uint32_t value) {
+  this->put16(value & 0xFFFF);
+  this->put16(value >> 16);
+}
+
+void ArchiveSource::put64(uint64_t value) {
+  this->put32(value & 0xFFFFFFFF);
+  this->put32(value >> 32);
+}
+
+}  // namespace sd_file_server
+}  // namespace esphome
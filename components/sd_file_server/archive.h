@@ -0,0 +1,73 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "stream_response.h"
+#include "../sd_mmc_card/sd_mmc_card.h"
+
+namespace esphome {
+namespace sd_file_server {
+
+enum class ArchiveFormat { TAR, ZIP };
+
+/* Stream a list of files as an uncompressed tar or store-only zip archive, generated on the fly.
+ * Files and archives larger than 4 GB use the zip64 extensions and the base-256 sizes of GNU tar.
+ */
+class ArchiveSource : public StreamSource {
+ public:
+  ArchiveSource(sd_mmc_card::SdMmc *card, std::string const &root, std::vector<sd_mmc_card::FileInfo> entries,
+                ArchiveFormat format);
+  size_t read(uint8_t *buffer, size_t len) override;
+
+ protected:
+  enum class State { ENTRY, DATA, CENTRAL_DIRECTORY, DONE };
+
+  struct ZipRecord {
+    std::string name;
+    uint32_t crc;
+    uint64_t size;
+    uint64_t offset;
+    bool is_directory;
+    uint32_t dos_time;
+    // the sizes are in a zip64 extra field, decided from the size of the file before its data
+    bool zip64;
+  };
+
+  void start_entry();
+  size_t read_data(uint8_t *buffer, size_t len);
+  void end_entry();
+  void write_central_directory();
+  std::string entry_name(sd_mmc_card::FileInfo const &) const;
+
+  void write_tar_header(std::string const &name, uint64_t size, bool is_directory, time_t mtime);
+  void write_tar_record(std::string const &name, std::string const &prefix, uint64_t size, char type,
+                        time_t mtime);
+  void write_padding(size_t size);
+  void write_zip_local_header(ZipRecord const &record);
+  void write_zip_central_header(ZipRecord const &record);
+  void write_zip_end_of_central_directory();
+  void put16(uint16_t);
+  void put32(uint32_t);
+  void put64(uint64_t);
+
+  sd_mmc_card::SdMmc *card_;
+  std::string root_;
+  std::vector<sd_mmc_card::FileInfo> entries_;
+  ArchiveFormat format_;
+  State state_{State::ENTRY};
+  size_t index_{0};
+
+  std::unique_ptr<sd_mmc_card::FileHandle> file_;
+  uint64_t file_expected_{0};
+  uint64_t file_read_{0};
+  uint32_t file_crc_{0};
+
+  std::vector<uint8_t> pending_;
+  size_t pending_pos_{0};
+  uint64_t offset_{0};
+  std::vector<ZipRecord> records_;
+  size_t central_index_{0};
+  uint64_t central_offset_{0};
+};
+
+}  // namespace sd_file_server
+}  // namespace esphome
@@ -0,0 +1,250 @@
+#include "deflate.h"
+#include <algorithm>
+#include <cstring>
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+#include "../sd_mmc_card/sd_mmc_card.h"
+
+namespace esphome {
+namespace sd_file_server {
+
+static const char *TAG = "sd_file_server.gzip";
+
+static constexpr size_t MIN_MATCH = 3;
+static constexpr size_t MAX_MATCH = 258;
+static constexpr size_t MIN_LOOKAHEAD = MAX_MATCH + MIN_MATCH + 1;
+// compress until that much output is available before handing it to the caller
+static constexpr size_t OUTPUT_THRESHOLD = 1024;
+
+static constexpr uint16_t LENGTH_BASE[] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                           31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static constexpr uint8_t LENGTH_EXTRA[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                           2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static constexpr uint16_t DISTANCE_BASE[] = {1,   2,   3,   4,   5,   7,    9,    13,   17,   25,
+                                             33,  49,  65,  97,  129, 193,  257,  385,  513,  769,
+                                             1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static constexpr uint8_t DISTANCE_EXTRA[] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                             6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+struct LevelConfig {
+  uint16_t max_chain;
+  uint16_t nice_length;
+};
+
+static constexpr LevelConfig LEVELS[] = {{4, 8},     {6, 16},    {8, 32},    {16, 32},   {32, 64},
+                                         {64, 128},  {128, 128}, {256, 258}, {1024, 258}};
+
+GzipSource::GzipSource(std::shared_ptr<StreamSource> source, uint8_t level)
+    : source_(std::move(source)),
+      window_(new uint8_t[2 * WINDOW_SIZE]),
+      head_(new uint16_t[HASH_SIZE]),
+      prev_(new uint16_t[WINDOW_SIZE]) {
+  auto const &config = LEVELS[std::min<uint8_t>(std::max<uint8_t>(level, 1), 9) - 1];
+  this->max_chain_ = config.max_chain;
+  this->nice_length_ = config.nice_length;
+  std::fill_n(this->head_.get(), HASH_SIZE, NIL);
+  std::fill_n(this->prev_.get(), WINDOW_SIZE, NIL);
+  this->out_.reserve(OUTPUT_THRESHOLD + 64);
+
+  // gzip header: deflate, no flags, no mtime, unknown os
+  static constexpr uint8_t HEADER[] = {0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff};
+  this->out_.insert(this->out_.end(), HEADER, HEADER + sizeof(HEADER));
+  // a single non final block using the fixed huffman codes
+  this->put_bits(0, 1);
+  this->put_bits(1, 2);
+}
+
+GzipSource::~GzipSource() {
+  ESP_LOGV(TAG, "Compressed %u bytes to %u bytes, %u ms spent compressing", this->bytes_in_, this->bytes_out_,
+           this->compress_time_ / 1000);
+}
+
+size_t GzipSource::read(uint8_t *buffer, size_t len) {
+  size_t written = 0;
+  while (written < len) {
+    if (this->out_pos_ < this->out_.size()) {
+      size_t n = std::min(len - written, this->out_.size() - this->out_pos_);
+      memcpy(buffer + written, this->out_.data() + this->out_pos_, n);
+      this->out_pos_ += n;
+      written += n;
+      continue;
+    }
+    if (this->done_)
+      break;
+    this->out_.clear();
+    this->out_pos_ = 0;
+    this->compress();
+  }
+  this->bytes_out_ += written;
+  return written;
+}
+
+void GzipSource::fill() {
+  while (!this->eof_ && this->lookahead_ < MIN_LOOKAHEAD) {
+    if (this->strstart_ + this->lookahead_ >= 2 * WINDOW_SIZE)
+      this->slide();
+    uint8_t *destination = this->window_.get() + this->strstart_ + this->lookahead_;
+    size_t n = this->source_->read(destination, 2 * WINDOW_SIZE - this->strstart_ - this->lookahead_);
+    if (n == 0) {
+      this->eof_ = true;
+      break;
+    }
+    this->crc_ = sd_mmc_card::crc32(this->crc_, destination, n);
+    this->bytes_in_ += n;
+    this->lookahead_ += n;
+  }
+}
+
+void GzipSource::slide() {
+  memmove(this->window_.get(), this->window_.get() + WINDOW_SIZE, WINDOW_SIZE);
+  this->strstart_ -= WINDOW_SIZE;
+  auto rebase = [](uint16_t pos) -> uint16_t { return pos != NIL && pos >= WINDOW_SIZE ? pos - WINDOW_SIZE : NIL; };
+  for (size_t i = 0; i < HASH_SIZE; i++)
+    this->head_[i] = rebase(this->head_[i]);
+  for (size_t i = 0; i < WINDOW_SIZE; i++)
+    this->prev_[i] = rebase(this->prev_[i]);
+}
+
+void GzipSource::compress() {
+  uint32_t start = micros();
+  while (this->out_.size() < OUTPUT_THRESHOLD) {
+    if (this->lookahead_ < MIN_LOOKAHEAD)
+      this->fill();
+    if (this->lookahead_ == 0) {
+      this->finish();
+      break;
+    }
+
+    size_t length = 0;
+    size_t match_start = 0;
+    if (this->lookahead_ >= MIN_MATCH) {
+      uint16_t chain = this->insert_hash(this->strstart_);
+      if (chain != NIL) {
+        length = this->longest_match(this->strstart_, chain);
+        match_start = this->match_start_;
+      }
+    }
+
+    if (length >= MIN_MATCH) {
+      this->put_match(length, this->strstart_ - match_start);
+      for (size_t i = 1; i < length && this->lookahead_ - i >= MIN_MATCH; i++)
+        this->insert_hash(this->strstart_ + i);
+      this->strstart_ += length;
+      this->lookahead_ -= length;
+    } else {
+      this->put_literal(this->window_[this->strstart_]);
+      this->strstart_++;
+      this->lookahead_--;
+    }
+  }
+  this->compress_time_ += micros() - start;
+}
+
+void GzipSource::finish() {
+  // end the current block, then an empty final block
+  this->put_huffman(0, 7);
+  this->put_bits(1, 1);
+  this->put_bits(1, 2);
+  this->put_huffman(0, 7);
+  this->align();
+  for (uint32_t value : {this->crc_, this->bytes_in_}) {
+    for (int i = 0; i < 4; i++)
+      this->out_.push_back((value >> (8 * i)) & 0xFF);
+  }
+  this->done_ = true;
+}
+
+uint16_t GzipSource::insert_hash(size_t pos) {
+  const uint8_t *data = this->window_.get() + pos;
+  size_t hash = ((data[0] << 8) ^ (data[1] << 4) ^ data[2]) & (HASH_SIZE - 1);
+  uint16_t chain = this->head_[hash];
+  this->prev_[pos & (WINDOW_SIZE - 1)] = chain;
+  this->head_[hash] = pos;
+  return chain;
+}
+
+size_t GzipSource::longest_match(size_t pos, uint16_t chain) {
+  const uint8_t *current = this->window_.get() + pos;
+  size_t limit = std::min(MAX_MATCH, this->lookahead_);
+  size_t best = 0;
+  uint16_t candidate = chain;
+  for (uint16_t chains = this->max_chain_; candidate != NIL && chains > 0; chains--) {
+    // stale links from positions overwritten in prev_ are not monotonic
+    if (candidate >= pos || pos - candidate >= WINDOW_SIZE)
+      break;
+    const uint8_t *match = this->window_.get() + candidate;
+    if (match[best] == current[best]) {
+      size_t length = 0;
+      while (length < limit && match[length] == current[length])
+        length++;
+      if (length > best) {
+        best = length;
+        this->match_start_ = candidate;
+        if (length >= this->nice_length_ || length >= limit)
+          break;
+      }
+    }
+    uint16_t next = this->prev_[candidate & (WINDOW_SIZE - 1)];
+    if (next != NIL && next >= candidate)
+      break;
+    candidate = next;
+  }
+  return best;
+}
+
+void GzipSource::put_bits(uint32_t value, uint8_t count) {
+  this->bit_buffer_ |= value << this->bit_count_;
+  this->bit_count_ += count;
+  while (this->bit_count_ >= 8) {
+    this->out_.push_back(this->bit_buffer_ & 0xFF);
+    this->bit_buffer_ >>= 8;
+    this->bit_count_ -= 8;
+  }
+}
+
+void GzipSource::put_huffman(uint16_t code, uint8_t length) {
+  // huffman codes are packed starting with the most significant bit
+  uint16_t reversed = 0;
+  for (uint8_t i = 0; i < length; i++) {
+    reversed = (reversed << 1) | (code & 1);
+    code >>= 1;
+  }
+  this->put_bits(reversed, length);
+}
+
+void GzipSource::put_literal(uint8_t literal) {
+  if (literal < 144) {
+    this->put_huffman(0x30 + literal, 8);
+  } else {
+    this->put_huffman(0x190 + literal - 144, 9);
+  }
+}
+
+void GzipSource::put_match(size_t length, size_t distance) {
+  size_t code = sizeof(LENGTH_BASE) / sizeof(LENGTH_BASE[0]) - 1;
+  while (LENGTH_BASE[code] > length)
+    code--;
+  uint16_t symbol = 257 + code;
+  if (symbol < 280) {
+    this->put_huffman(symbol - 256, 7);
+  } else {
+    this->put_huffman(0xC0 + symbol - 280, 8);
+  }
+  this->put_bits(length - LENGTH_BASE[code], LENGTH_EXTRA[code]);
+
+  code = sizeof(DISTANCE_BASE) / sizeof(DISTANCE_BASE[0]) - 1;
+  while (DISTANCE_BASE[code] > distance)
+    code--;
+  this->put_huffman(code, 5);
+  this->put_bits(distance - DISTANCE_BASE[code], DISTANCE_EXTRA[code]);
+}
+
+void GzipSource::align() {
+  if (this->bit_count_ > 0)
+    this->out_.push_back(this->bit_buffer_ & 0xFF);
+  this->bit_buffer_ = 0;
+  this->bit_count_ = 0;
+}
+
+}  // namespace sd_file_server
+}  // namespace esphome
@@ -0,0 +1,68 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "stream_response.h"
+
+namespace esphome {
+namespace sd_file_server {
+
+/* Gzip compress another source on the fly.
+ *
+ * The encoder uses a small LZ77 window with the fixed deflate huffman codes so it only needs
+ * about 24KB of internal RAM whatever the size of the file.
+ */
+class GzipSource : public StreamSource {
+ public:
+  static constexpr size_t WINDOW_SIZE = 4096;
+
+  GzipSource(std::shared_ptr<StreamSource> source, uint8_t level);
+  ~GzipSource() override;
+  size_t read(uint8_t *buffer, size_t len) override;
+
+  uint32_t get_bytes_in() const { return this->bytes_in_; }
+  uint32_t get_bytes_out() const { return this->bytes_out_; }
+
+ protected:
+  static constexpr size_t HASH_SIZE = 4096;
+  static constexpr uint16_t NIL = 0xFFFF;
+
+  void fill();
+  void slide();
+  void compress();
+  void finish();
+  uint16_t insert_hash(size_t pos);
+  size_t longest_match(size_t pos, uint16_t chain);
+
+  void put_bits(uint32_t value, uint8_t count);
+  void put_huffman(uint16_t code, uint8_t length);
+  void put_literal(uint8_t literal);
+  void put_match(size_t length, size_t distance);
+  void align();
+
+  std::shared_ptr<StreamSource> source_;
+  uint16_t max_chain_;
+  uint16_t nice_length_;
+
+  std::unique_ptr<uint8_t[]> window_;
+  std::unique_ptr<uint16_t[]> head_;
+  std::unique_ptr<uint16_t[]> prev_;
+  size_t strstart_{0};
+  size_t lookahead_{0};
+  size_t match_start_{0};
+  bool eof_{false};
+  bool done_{false};
+
+  uint32_t bit_buffer_{0};
+  uint8_t bit_count_{0};
+  std::vector<uint8_t> out_;
+  size_t out_pos_{0};
+
+  uint32_t crc_{0};
+  uint32_t bytes_in_{0};
+  uint32_t bytes_out_{0};
+  uint32_t compress_time_{0};
+};
+
+}  // namespace sd_file_server
+}  // namespace esphome
@@ -0,0 +1,257 @@
+#include "downsample.h"
+#include <algorithm>
+#include <cstring>
+#include "esphome/core/helpers.h"
+
+namespace esphome {
+namespace sd_file_server {
+
+static const char *const AGGREGATE_NAMES[] = {"min", "max", "avg", "last"};
+
+uint8_t parse_aggregates(std::string const &list) {
+  uint8_t aggregates = 0;
+  size_t start = 0;
+  while (start <= list.size()) {
+    size_t end = list.find(',', start);
+    if (end == std::string::npos)
+      end = list.size();
+    std::string name = list.substr(start, end - start);
+    uint8_t found = 0;
+    for (uint8_t i = 0; i < 4; i++) {
+      if (name == AGGREGATE_NAMES[i])
+        found = 1 << i;
+    }
+    if (found == 0)
+      return 0;
+    aggregates |= found;
+    start = end + 1;
+  }
+  return aggregates;
+}
+
+/* Parse the time at the start of a line, false for a header or an invalid line */
+static bool parse_time(const char *line, uint32_t &time) {
+  char *end;
+  if (*line < '0' || *line > '9')
+    return false;
+  time = strtoul(line, &end, 10);
+  return *end == ',' || *end == '\0' || *end == '\r';
+}
+
+DownsampleSource::DownsampleSource(sd_mmc_card::SdMmc *card, std::vector<std::string> files, uint32_t from,
+                                   uint32_t to, uint32_t bucket, uint8_t aggregates)
+    : card_(card), files_(std::move(files)), from_(from), to_(to), bucket_(bucket), aggregates_(aggregates) {
+  this->input_.resize(STREAM_CHUNK_SIZE);
+}
+
+size_t DownsampleSource::read(uint8_t *buffer, size_t len) {
+  size_t written = 0;
+  while (written < len) {
+    if (this->pending_position_ >= this->pending_.size()) {
+      if (this->done_)
+        break;
+      this->pending_.clear();
+      this->pending_position_ = 0;
+      while (this->pending_.empty() && this->next_line(this->line_))
+        this->process(this->line_);
+      if (this->pending_.empty()) {
+        // the input is over, flush the last bucket
+        if (this->has_bucket_)
+          this->emit_bucket();
+        this->emit_header();
+        this->done_ = true;
+      }
+      continue;
+    }
+    size_t n = std::min(len - written, this->pending_.size() - this->pending_position_);
+    memcpy(buffer + written, this->pending_.data() + this->pending_position_, n);
+    this->pending_position_ += n;
+    written += n;
+  }
+  return written;
+}
+
+bool DownsampleSource::open_next_file() {
+  this->file_.reset();
+  this->input_size_ = 0;
+  this->input_position_ = 0;
+  while (this->file_index_ < this->files_.size()) {
+    std::string const &path = this->files_[this->file_index_++];
+    uint64_t size = this->card_->file_size(path).value_or(0);
+    this->file_ = this->card_->open_file(path, "rb");
+    if (this->file_ == nullptr)
+      continue;
+    if (this->names_.empty())
+      this->read_header();
+    // only the first file of the range can start before it
+    uint64_t start = this->from_ > 0 ? this->find_start(size) : 0;
+    this->file_->seek(start);
+    // a seek lands in the middle of a line
+    this->skip_line_ = start > 0;
+    return true;
+  }
+  return false;
+}
+
+void DownsampleSource::read_header() {
+  size_t n = this->file_->read(this->input_.data(), MAX_LINE_SIZE);
+  auto *end = static_cast<uint8_t *>(memchr(this->input_.data(), '\n', n));
+  if (end == nullptr)
+    return;
+  std::string line(reinterpret_cast<char *>(this->input_.data()), end - this->input_.data());
+  uint32_t time;
+  if (line.empty() || parse_time(line.c_str(), time))
+    return;
+  size_t start = line.find(',');
+  while (start != std::string::npos && this->names_.size() < MAX_COLUMNS) {
+    size_t next = line.find(',', start + 1);
+    std::string name = line.substr(start + 1, next == std::string::npos ? std::string::npos : next - start - 1);
+    if (!name.empty() && name.back() == '\r')
+      name.pop_back();
+    this->names_.push_back(name);
+    start = next;
+  }
+}
+
+uint64_t DownsampleSource::find_start(uint64_t size) {
+  // bisect on the time of the first full line after each probe, a probe that can not be parsed moves left
+  uint64_t low = 0;
+  uint64_t high = size;
+  while (high - low > STREAM_CHUNK_SIZE) {
+    uint64_t middle = low + (high - low) / 2;
+    this->file_->seek(middle);
+    size_t n = this->file_->read(this->input_.data(), 2 * MAX_LINE_SIZE);
+    auto *newline = static_cast<uint8_t *>(memchr(this->input_.data(), '\n', n));
+    uint32_t time;
+    if (newline == nullptr || newline + 1 >= this->input_.data() + n) {
+      high = middle;
+      continue;
+    }
+    std::string line(reinterpret_cast<char *>(newline + 1),
+                     std::min<size_t>(this->input_.data() + n - newline - 1, MAX_LINE_SIZE));
+    if (parse_time(line.c_str(), time) && time < this->from_) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+bool DownsampleSource::next_line(std::string &line) {
+  line.clear();
+  bool overflow = false;
+  while (true) {
+    if (this->input_position_ >= this->input_size_) {
+      this->input_size_ = this->file_ != nullptr ? this->file_->read(this->input_.data(), this->input_.size()) : 0;
+      this->input_position_ = 0;
+      if (this->input_size_ == 0) {
+        // a line without a final new line, lines do not span files
+        if (this->file_ != nullptr && !line.empty() && !overflow && !this->skip_line_) {
+          this->file_.reset();
+          return true;
+        }
+        if (!this->open_next_file())
+          return false;
+        line.clear();
+        overflow = false;
+        continue;
+      }
+    }
+    const uint8_t *start = this->input_.data() + this->input_position_;
+    size_t available = this->input_size_ - this->input_position_;
+    auto *newline = static_cast<const uint8_t *>(memchr(start, '\n', available));
+    size_t n = newline != nullptr ? newline - start : available;
+    if (line.size() + n > MAX_LINE_SIZE) {
+      overflow = true;
+    } else {
+      line.append(reinterpret_cast<const char *>(start), n);
+    }
+    this->input_position_ += newline != nullptr ? n + 1 : n;
+    if (newline == nullptr)
+      continue;
+    if (!overflow && !this->skip_line_)
+      return true;
+    line.clear();
+    overflow = false;
+    this->skip_line_ = false;
+  }
+}
+
+void DownsampleSource::process(std::string const &line) {
+  uint32_t time;
+  if (!parse_time(line.c_str(), time) || time < this->from_)
+    return;
+  if (time > this->to_) {
+    // the logs are sorted, nothing further can match
+    this->file_.reset();
+    this->file_index_ = this->files_.size();
+    this->input_size_ = 0;
+    return;
+  }
+
+  uint32_t start = time - time % this->bucket_;
+  if (this->has_bucket_ && start != this->bucket_start_)
+    this->emit_bucket();
+  if (!this->has_bucket_) {
+    this->has_bucket_ = true;
+    this->bucket_start_ = start;
+  }
+
+  // the number of columns is set by the header or by the first line
+  size_t limit = this->names_.empty() ? MAX_COLUMNS : this->names_.size();
+  if (this->columns_.empty()) {
+    size_t count = std::min<size_t>(std::count(line.begin(), line.end(), ','), limit);
+    this->columns_.resize(count, Column{0, 0, 0, 0, 0});
+  }
+  const char *field = strchr(line.c_str(), ',');
+  for (size_t i = 0; field != nullptr && i < this->columns_.size(); i++) {
+    char *end;
+    double value = strtod(field + 1, &end);
+    if (end != field + 1) {
+      Column &column = this->columns_[i];
+      column.min = column.count == 0 ? value : std::min(column.min, value);
+      column.max = column.count == 0 ? value : std::max(column.max, value);
+      column.sum += value;
+      column.last = value;
+      column.count++;
+    }
+    field = strchr(field + 1, ',');
+  }
+}
+
+void DownsampleSource::emit_header() {
+  if (this->header_sent_)
+    return;
+  this->header_sent_ = true;
+  std::string header = "time";
+  for (size_t i = 0; i < this->columns_.size(); i++) {
+    std::string name = i < this->names_.size() ? this->names_[i] : "value" + to_string(i + 1);
+    for (uint8_t aggregate = 0; aggregate < 4; aggregate++) {
+      if (this->aggregates_ & (1 << aggregate))
+        header += "," + name + "_" + AGGREGATE_NAMES[aggregate];
+    }
+  }
+  this->pending_ += header + "\n";
+}
+
+void DownsampleSource::emit_bucket() {
+  this->emit_header();
+  this->pending_ += to_string(this->bucket_start_);
+  for (auto &column : this->columns_) {
+    double values[] = {column.min, column.max, column.count > 0 ? column.sum / column.count : 0, column.last};
+    for (uint8_t aggregate = 0; aggregate < 4; aggregate++) {
+      if (!(this->aggregates_ & (1 << aggregate)))
+        continue;
+      this->pending_ += ',';
+      if (column.count > 0)
+        this->pending_ += str_sprintf("%g", values[aggregate]);
+    }
+    column = Column{0, 0, 0, 0, 0};
+  }
+  this->pending_ += '\n';
+  this->has_bucket_ = false;
+}
+
+}  // namespace sd_file_server
+}  // namespace esphome
@@ -0,0 +1,80 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include "stream_response.h"
+#include "../sd_mmc_card/sd_mmc_card.h"
+
+namespace esphome {
+namespace sd_file_server {
+
+enum Aggregate : uint8_t {
+  AGGREGATE_MIN = 1 << 0,
+  AGGREGATE_MAX = 1 << 1,
+  AGGREGATE_AVG = 1 << 2,
+  AGGREGATE_LAST = 1 << 3,
+};
+
+/* Parse a comma separated list of aggregate names, return 0 on an unknown name */
+uint8_t parse_aggregates(std::string const &list);
+
+/* Reduce csv logs to one row per time bucket in a single pass.
+ *
+ * The first column of each line is a unix time in seconds, the other columns are numbers. The files are read
+ * in order and must be sorted by time. The start of the range is found by bisecting the first file, a line
+ * after the end of the range ends the stream. Memory usage does not depend on the size of the logs.
+ */
+class DownsampleSource : public StreamSource {
+ public:
+  static constexpr size_t MAX_COLUMNS = 16;
+  static constexpr size_t MAX_LINE_SIZE = 512;
+
+  DownsampleSource(sd_mmc_card::SdMmc *card, std::vector<std::string> files, uint32_t from, uint32_t to,
+                   uint32_t bucket, uint8_t aggregates);
+  size_t read(uint8_t *buffer, size_t len) override;
+
+ protected:
+  struct Column {
+    double min;
+    double max;
+    double sum;
+    double last;
+    uint32_t count;
+  };
+
+  bool open_next_file();
+  bool next_line(std::string &line);
+  void read_header();
+  uint64_t find_start(uint64_t size);
+  void process(std::string const &line);
+  void emit_header();
+  void emit_bucket();
+
+  sd_mmc_card::SdMmc *card_;
+  std::vector<std::string> files_;
+  size_t file_index_{0};
+  std::unique_ptr<sd_mmc_card::FileHandle> file_;
+  uint32_t from_;
+  uint32_t to_;
+  uint32_t bucket_;
+  uint8_t aggregates_;
+
+  std::vector<uint8_t> input_;
+  size_t input_size_{0};
+  size_t input_position_{0};
+  bool skip_line_{false};
+  std::string line_;
+
+  std::vector<std::string> names_;
+  std::vector<Column> columns_;
+  bool has_bucket_{false};
+  uint32_t bucket_start_{0};
+
+  std::string pending_;
+  size_t pending_position_{0};
+  bool header_sent_{false};
+  bool done_{false};
+};
+
+}  // namespace sd_file_server
+}  // namespace esphome
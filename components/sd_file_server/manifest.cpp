@@ -0,0 +1,261 @@
+#include "manifest.h"
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace sd_file_server {
+
+static const char *TAG = "sd_file_server.manifest";
+
+const char *const HashCache::FILE_NAME = ".sdhash";
+
+// longest line of the sidecar: crc, size, time and a file name of at most 255 bytes
+static constexpr size_t MAX_LINE_SIZE = 320;
+
+static std::string parent_directory(std::string const &path) {
+  size_t slash = path.rfind('/');
+  if (slash == std::string::npos || slash == 0)
+    return "/";
+  return path.substr(0, slash);
+}
+
+static std::string file_name(std::string const &path) {
+  size_t slash = path.rfind('/');
+  return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+static std::string sidecar_path(std::string const &directory) {
+  if (!directory.empty() && directory.back() == '/')
+    return directory + HashCache::FILE_NAME;
+  return directory + "/" + HashCache::FILE_NAME;
+}
+
+// one file per line: crc, size, time, name
+static bool parse_line(const char *line, std::string &name, uint64_t &size, time_t &mtime, uint32_t &crc) {
+  unsigned long long line_size;
+  long long line_mtime;
+  int name_start = 0;
+  if (sscanf(line, "%" SCNx32 " %llu %lld %n", &crc, &line_size, &line_mtime, &name_start) != 3 || name_start == 0)
+    return false;
+  name = line + name_start;
+  while (!name.empty() && (name.back() == '\n' || name.back() == '\r'))
+    name.pop_back();
+  size = line_size;
+  mtime = static_cast<time_t>(line_mtime);
+  return !name.empty();
+}
+
+bool is_sidecar(std::string const &path) {
+  std::string name = file_name(path);
+  return name == HashCache::FILE_NAME ||
+         name.compare(0, strlen(sd_mmc_card::DirectoryIndex::FILE_NAME), sd_mmc_card::DirectoryIndex::FILE_NAME) == 0;
+}
+
+HashCache::HashCache(sd_mmc_card::SdMmc *card, std::string const &directory) : card_(card), directory_(directory) {
+  this->load();
+}
+
+void HashCache::load() {
+  FILE *file = fopen(sd_mmc_card::build_path(sidecar_path(this->directory_).c_str()).c_str(), "r");
+  if (file == nullptr)
+    return;
+  char line[MAX_LINE_SIZE];
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    std::string name;
+    uint64_t size;
+    time_t mtime;
+    uint32_t crc;
+    if (parse_line(line, name, size, mtime, crc))
+      this->records_[name] = Record{size, mtime, crc, false};
+  }
+  fclose(file);
+}
+
+bool HashCache::find(std::string const &name, uint64_t size, time_t mtime, uint32_t &crc) {
+  auto it = this->records_.find(name);
+  if (it == this->records_.end())
+    return false;
+  it->second.seen = true;
+  if (it->second.size != size || it->second.mtime != mtime)
+    return false;
+  crc = it->second.crc;
+  return true;
+}
+
+void HashCache::put(std::string const &name, uint64_t size, time_t mtime, uint32_t crc) {
+  this->records_[name] = Record{size, mtime, crc, true};
+  this->dirty_ = true;
+}
+
+bool HashCache::save(bool prune) {
+  if (prune) {
+    for (auto it = this->records_.begin(); it != this->records_.end();) {
+      if (it->second.seen) {
+        ++it;
+        continue;
+      }
+      it = this->records_.erase(it);
+      this->dirty_ = true;
+    }
+  }
+  if (!this->dirty_)
+    return true;
+  auto file = this->card_->open_file_atomic(sidecar_path(this->directory_).c_str());
+  if (file == nullptr)
+    return false;
+  bool ok = true;
+  for (auto const &it : this->records_) {
+    std::string line = str_sprintf("%08" PRIx32 " %llu %lld %s\n", it.second.crc,
+                                   static_cast<unsigned long long>(it.second.size),
+                                   static_cast<long long>(it.second.mtime), it.first.c_str());
+    ok = ok && file->write(reinterpret_cast<const uint8_t *>(line.data()), line.size()) == line.size();
+  }
+  if (!ok || !file->commit()) {
+    ESP_LOGW(TAG, "Failed to save the hashes of %s", this->directory_.c_str());
+    return false;
+  }
+  this->dirty_ = false;
+  return true;
+}
+
+bool hash_file(sd_mmc_card::SdMmc *card, std::string const &path, TransferScheduler::Ticket *ticket, size_t read_size,
+               uint32_t &crc) {
+  auto file = card->open_file(path, "rb");
+  std::unique_ptr<uint8_t[]> buffer(new (std::nothrow) uint8_t[read_size]);
+  if (file == nullptr || buffer == nullptr)
+    return false;
+  crc = 0;
+  size_t n;
+  do {
+    ticket->begin_turn();
+    n = file->read(buffer.get(), read_size);
+    ticket->end_turn();
+    crc = sd_mmc_card::crc32(crc, buffer.get(), n);
+  } while (n == read_size);
+  return true;
+}
+
+bool stored_hash(sd_mmc_card::SdMmc *card, sd_mmc_card::FileInfo const &info, uint32_t &crc) {
+  std::string directory = parent_directory(info.path);
+  std::string name = file_name(info.path);
+  // through the file cache, the etag of a plain download does not read the card once the sidecar is cached
+  auto cached = card->read_file_cached(sidecar_path(directory));
+  if (cached == nullptr)
+    return HashCache(card, directory).find(name, info.size, info.mtime, crc);
+  const char *data = reinterpret_cast<const char *>(cached->data());
+  size_t position = 0;
+  char line[MAX_LINE_SIZE];
+  while (position < cached->size()) {
+    const char *end = static_cast<const char *>(memchr(data + position, '\n', cached->size() - position));
+    size_t len = (end != nullptr ? end - data : cached->size()) - position;
+    if (len < sizeof(line)) {
+      memcpy(line, data + position, len);
+      line[len] = '\0';
+      std::string line_name;
+      uint64_t size;
+      time_t mtime;
+      uint32_t line_crc;
+      if (parse_line(line, line_name, size, mtime, line_crc) && line_name == name) {
+        // computed for another content of the file
+        if (size != info.size || mtime != info.mtime)
+          return false;
+        crc = line_crc;
+        return true;
+      }
+    }
+    position += len + 1;
+  }
+  return false;
+}
+
+bool cached_hash(sd_mmc_card::SdMmc *card, sd_mmc_card::FileInfo const &info, TransferScheduler::Ticket *ticket,
+                 size_t read_size, uint32_t &crc) {
+  return stored_hash(card, info, crc) || hash_file(card, info.path, ticket, read_size, crc);
+}
+
+ManifestSource::ManifestSource(sd_mmc_card::SdMmc *card, std::string const &root,
+                               std::vector<sd_mmc_card::FileInfo> entries,
+                               std::shared_ptr<TransferScheduler::Ticket> ticket, size_t read_size)
+    : card_(card), root_(root), ticket_(std::move(ticket)), read_size_(read_size) {
+  for (auto &entry : entries) {
+    if (!entry.is_directory && !is_sidecar(entry.path))
+      this->entries_.push_back(std::move(entry));
+  }
+  // the files of a directory next to each other, its sidecar is then loaded and saved once
+  std::sort(this->entries_.begin(), this->entries_.end(),
+            [](sd_mmc_card::FileInfo const &a, sd_mmc_card::FileInfo const &b) {
+              std::string a_directory = parent_directory(a.path), b_directory = parent_directory(b.path);
+              return a_directory != b_directory ? a_directory < b_directory : a.path < b.path;
+            });
+}
+
+ManifestSource::~ManifestSource() {
+  // an interrupted manifest did not see every file of the directory, nothing is pruned
+  if (this->cache_ != nullptr)
+    this->cache_->save(false);
+  ESP_LOGD(TAG, "Listed %u of %u files, %u hashed", this->index_, this->entries_.size(), this->hashed_);
+}
+
+size_t ManifestSource::read(uint8_t *buffer, size_t len) {
+  size_t written = 0;
+  while (written < len) {
+    if (this->pending_position_ >= this->pending_.size()) {
+      if (this->index_ >= this->entries_.size()) {
+        if (this->cache_ != nullptr) {
+          this->cache_->save(true);
+          this->cache_.reset();
+        }
+        break;
+      }
+      this->pending_.clear();
+      this->pending_position_ = 0;
+      while (this->pending_.size() < len && this->index_ < this->entries_.size())
+        this->format(this->entries_[this->index_++]);
+      continue;
+    }
+    size_t n = std::min(len - written, this->pending_.size() - this->pending_position_);
+    memcpy(buffer + written, this->pending_.data() + this->pending_position_, n);
+    this->pending_position_ += n;
+    written += n;
+  }
+  return written;
+}
+
+void ManifestSource::format(sd_mmc_card::FileInfo const &entry) {
+  std::string directory = parent_directory(entry.path);
+  if (this->cache_ == nullptr || this->cache_->get_directory() != directory) {
+    // every file of the previous directory was listed, the hashes of the removed files are dropped
+    if (this->cache_ != nullptr)
+      this->cache_->save(true);
+    this->cache_.reset(new HashCache(this->card_, directory));
+  }
+  std::string name = file_name(entry.path);
+  uint32_t crc;
+  if (!this->cache_->find(name, entry.size, entry.mtime, crc)) {
+    if (!hash_file(this->card_, entry.path, this->ticket_.get(), this->read_size_, crc)) {
+      ESP_LOGW(TAG, "Skipping %s, failed to read file", entry.path.c_str());
+      return;
+    }
+    this->cache_->put(name, entry.size, entry.mtime, crc);
+    this->hashed_++;
+  }
+
+  size_t start = 0;
+  if (entry.path.compare(0, this->root_.size(), this->root_) == 0)
+    start = this->root_.size();
+  while (start < entry.path.size() && entry.path[start] == '/')
+    start++;
+  this->pending_ += "{\"path\":";
+  append_json_string(this->pending_, entry.path.substr(start));
+  this->pending_ += str_sprintf(",\"size\":%llu,\"mtime\":%lld,\"crc32\":\"%08" PRIx32 "\"}\n",
+                                static_cast<unsigned long long>(entry.size), static_cast<long long>(entry.mtime), crc);
+}
+
+}  // namespace sd_file_server
+}  // namespace esphome
@@ -0,0 +1,92 @@
+#pragma once
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "stream_response.h"
+#include "transfer_scheduler.h"
+#include "../sd_mmc_card/sd_mmc_card.h"
+
+namespace esphome {
+namespace sd_file_server {
+
+/* Content hashes of the files of one directory.
+ *
+ * The hashes are kept in a sidecar in the directory itself, each keyed by the size and time of the file it was
+ * computed for. A file whose size or time changed is hashed again, the others are answered from the sidecar, so a
+ * manifest of an unchanged tree reads no file content.
+ */
+class HashCache {
+ public:
+  /* Name of the sidecar in the directory */
+  static const char *const FILE_NAME;
+
+  HashCache(sd_mmc_card::SdMmc *card, std::string const &directory);
+
+  std::string const &get_directory() const { return this->directory_; }
+  /* Hash of the file when it was computed for this size and time */
+  bool find(std::string const &name, uint64_t size, time_t mtime, uint32_t &crc);
+  void put(std::string const &name, uint64_t size, time_t mtime, uint32_t crc);
+  /* Write the sidecar when it changed, prune drops the files not looked up since the load */
+  bool save(bool prune);
+
+ protected:
+  struct Record {
+    uint64_t size;
+    time_t mtime;
+    uint32_t crc;
+    bool seen;
+  };
+
+  void load();
+
+  sd_mmc_card::SdMmc *card_;
+  std::string directory_;
+  std::map<std::string, Record> records_;
+  bool dirty_{false};
+};
+
+/* Crc32 of the content of a file, read in chunks of read_size bytes each in one turn of the ticket on the card */
+bool hash_file(sd_mmc_card::SdMmc *card, std::string const &path, TransferScheduler::Ticket *ticket, size_t read_size,
+               uint32_t &crc);
+
+/* Is the file a sidecar kept by the components next to the files, the hashes or the directory index? */
+bool is_sidecar(std::string const &path);
+
+/* Hash of a file from its sidecar only, false when it was never computed or the file changed since */
+bool stored_hash(sd_mmc_card::SdMmc *card, sd_mmc_card::FileInfo const &info, uint32_t &crc);
+
+/* Hash of a file, from its sidecar when the file did not change since it was computed, the sidecar is not written */
+bool cached_hash(sd_mmc_card::SdMmc *card, sd_mmc_card::FileInfo const &info, TransferScheduler::Ticket *ticket,
+                 size_t read_size, uint32_t &crc);
+
+/* Stream the path, size, time and content hash of every file of a tree, one json object per line.
+ *
+ * The files are listed by directory, each directory with the hashes of its sidecar, which is saved once its files
+ * are done.
+ */
+class ManifestSource : public StreamSource {
+ public:
+  ManifestSource(sd_mmc_card::SdMmc *card, std::string const &root, std::vector<sd_mmc_card::FileInfo> entries,
+                 std::shared_ptr<TransferScheduler::Ticket> ticket, size_t read_size);
+  ~ManifestSource() override;
+  size_t read(uint8_t *buffer, size_t len) override;
+
+ protected:
+  void format(sd_mmc_card::FileInfo const &entry);
+
+  sd_mmc_card::SdMmc *card_;
+  // removed from the paths of the manifest
+  std::string root_;
+  std::vector<sd_mmc_card::FileInfo> entries_;
+  std::shared_ptr<TransferScheduler::Ticket> ticket_;
+  size_t read_size_;
+  size_t index_{0};
+  std::unique_ptr<HashCache> cache_;
+  std::string pending_;
+  size_t pending_position_{0};
+  uint32_t hashed_{0};
+};
+
+}  // namespace sd_file_server
+}  // namespace esphome
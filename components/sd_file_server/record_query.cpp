@@ -0,0 +1,64 @@
+#include "record_query.h"
+#ifdef USE_SD_RECORDER
+#include <algorithm>
+#include <cstring>
+#include "esphome/core/helpers.h"
+
+namespace esphome {
+namespace sd_file_server {
+
+RecordQuerySource::RecordQuerySource(std::unique_ptr<sd_recorder::RecordReader> reader,
+                                     std::map<uint16_t, std::string> series, RecordFormat format)
+    : reader_(std::move(reader)), series_(std::move(series)), format_(format) {}
+
+size_t RecordQuerySource::read(uint8_t *buffer, size_t len) {
+  size_t written = 0;
+  while (written < len) {
+    if (this->pending_position_ >= this->pending_.size()) {
+      if (this->done_)
+        break;
+      this->pending_.clear();
+      this->pending_position_ = 0;
+      if (!this->started_) {
+        this->pending_ = this->format_ == RecordFormat::CSV ? "time,series,value\n" : "[";
+        this->started_ = true;
+      }
+      // format rows until a chunk is ready, the text of a row is never split across reads of the card
+      sd_recorder::Record record;
+      while (this->pending_.size() < len && this->reader_->next(record))
+        this->format(record);
+      if (this->pending_.size() < len) {
+        if (this->format_ == RecordFormat::JSON)
+          this->pending_ += "]";
+        this->done_ = true;
+      }
+      continue;
+    }
+    size_t n = std::min(len - written, this->pending_.size() - this->pending_position_);
+    memcpy(buffer + written, this->pending_.data() + this->pending_position_, n);
+    this->pending_position_ += n;
+    written += n;
+  }
+  return written;
+}
+
+void RecordQuerySource::format(sd_recorder::Record const &record) {
+  auto it = this->series_.find(record.series);
+  std::string name = it != this->series_.end() ? it->second : to_string(record.series);
+  // the names come from the configuration and may hold any character
+  if (this->format_ == RecordFormat::CSV) {
+    this->pending_ += str_sprintf("%u,", static_cast<unsigned>(record.time));
+    append_csv_field(this->pending_, name);
+    this->pending_ += str_sprintf(",%g\n", record.value);
+  } else {
+    this->pending_ += str_sprintf("%s{\"time\":%u,\"series\":", this->count_ > 0 ? "," : "",
+                                  static_cast<unsigned>(record.time));
+    append_json_string(this->pending_, name);
+    this->pending_ += str_sprintf(",\"value\":%g}", record.value);
+  }
+  this->count_++;
+}
+
+}  // namespace sd_file_server
+}  // namespace esphome
+#endif
@@ -0,0 +1,37 @@
+#pragma once
+#include "esphome/core/defines.h"
+#ifdef USE_SD_RECORDER
+#include <map>
+#include <memory>
+#include <string>
+#include "stream_response.h"
+#include "../sd_recorder/record_reader.h"
+
+namespace esphome {
+namespace sd_file_server {
+
+enum class RecordFormat { CSV, JSON };
+
+/* Format the records of a time range as csv or json while they are read */
+class RecordQuerySource : public StreamSource {
+ public:
+  RecordQuerySource(std::unique_ptr<sd_recorder::RecordReader> reader, std::map<uint16_t, std::string> series,
+                    RecordFormat format);
+  size_t read(uint8_t *buffer, size_t len) override;
+
+ protected:
+  void format(sd_recorder::Record const &record);
+
+  std::unique_ptr<sd_recorder::RecordReader> reader_;
+  std::map<uint16_t, std::string> series_;
+  RecordFormat format_;
+  std::string pending_;
+  size_t pending_position_{0};
+  size_t count_{0};
+  bool started_{false};
+  bool done_{false};
+};
+
+}  // namespace sd_file_server
+}  // namespace esphome
+#endif
@@ -1,17 +1,87 @@
 #include "sd_file_server.h"
-#include <map>
+#include <algorithm>
+#include <cinttypes>
+#include <iterator>
+#include "archive.h"
+#include "deflate.h"
+#include "downsample.h"
+#include "manifest.h"
+#include "record_query.h"
+#include "search.h"
 #include "esphome/core/log.h"
 #include "esphome/components/network/util.h"
 #include "esphome/core/helpers.h"
 
+#ifdef USE_ESP_IDF
+#include <esp_http_server.h>
+#endif
+
 namespace esphome {
 namespace sd_file_server {
 
 static const char *TAG = "sd_file_server";
+// bytes of the file sent when a viewer starts following it
+static constexpr size_t MAX_TAIL_BACKLOG = 4096;
+// allocation unit assumed when the file system does not report it
+static constexpr size_t DEFAULT_CLUSTER_SIZE = 32 * 1024;
+static constexpr size_t BODY_BUFFER_SIZE = 4096;
+// memory of a gzip encoder, counted in the buffer budget of a compressed download
+static constexpr size_t GZIP_MEMORY_SIZE = 26 * 1024;
+// added to the etag of a gzip compressed download
+static const char *const GZIP_ETAG_SUFFIX = "-gzip";
+static constexpr size_t DEFAULT_SEARCH_LIMIT = 100;
+static constexpr size_t MAX_SEARCH_LIMIT = 1000;
+// seconds a search may walk the card
+static constexpr uint32_t DEFAULT_SEARCH_TIMEOUT = 5;
+static constexpr uint32_t MAX_SEARCH_TIMEOUT = 30;
+
+static std::string request_arg(AsyncWebServerRequest *request, const char *name) {
+  if (!request->hasArg(name))
+    return "";
+  return std::string(request->arg(name).c_str());
+}
+
+static std::string request_header(AsyncWebServerRequest *request, const char *name) {
+#ifdef USE_ESP_IDF
+  auto header = request->get_header(name);
+  return header.has_value() ? header.value() : "";
+#else
+  if (!request->hasHeader(name))
+    return "";
+  return std::string(request->getHeader(name)->value().c_str());
+#endif
+}
 
 SDFileServer::SDFileServer(web_server_base::WebServerBase *base) : base_(base) {}
 
-void SDFileServer::setup() { this->base_->add_handler(this); }
+void SDFileServer::setup() {
+  this->base_->add_handler(this);
+  this->sd_mmc_card_->add_on_append_callback(
+      [this](const char *path, const uint8_t *data, size_t len) { this->tail_.on_append(path, data, len); });
+}
+
+void SDFileServer::loop() {
+  this->tail_.loop();
+  this->resumable_.loop();
+  this->scheduler_.expire(millis());
+#ifdef USE_SENSOR
+  this->update_sensors();
+#endif
+}
+
+#ifdef USE_SENSOR
+static void publish_changed(sensor::Sensor *sensor, float value) {
+  if (sensor != nullptr && (!sensor->has_state() || sensor->get_raw_state() != value))
+    sensor->publish_state(value);
+}
+
+void SDFileServer::update_sensors() {
+  publish_changed(this->active_downloads_sensor_, this->scheduler_.get_active(TransferScheduler::Kind::DOWNLOAD));
+  publish_changed(this->active_uploads_sensor_, this->scheduler_.get_active(TransferScheduler::Kind::UPLOAD));
+  publish_changed(this->queued_transfers_sensor_, this->scheduler_.get_queued());
+  publish_changed(this->rejected_transfers_sensor_, this->scheduler_.get_rejected());
+}
+#endif
 
 void SDFileServer::dump_config() {
   ESP_LOGCONFIG(TAG, "SD File Server:");
@@ -21,25 +91,46 @@ void SDFileServer::dump_config() {
   ESP_LOGCONFIG(TAG, "  Deletation Enabled: %s", TRUEFALSE(this->deletion_enabled_));
   ESP_LOGCONFIG(TAG, "  Download Enabled : %s", TRUEFALSE(this->download_enabled_));
   ESP_LOGCONFIG(TAG, "  Upload Enabled : %s", TRUEFALSE(this->upload_enabled_));
+  if (this->compression_level_ > 0) {
+    ESP_LOGCONFIG(TAG, "  Compression Level: %u", this->compression_level_);
+    ESP_LOGCONFIG(TAG, "  Compression Min Size: %u", this->compression_min_size_);
+  }
+  ESP_LOGCONFIG(TAG, "  Max Downloads: %u", this->scheduler_.get_max_downloads());
+  ESP_LOGCONFIG(TAG, "  Max Uploads: %u", this->scheduler_.get_max_uploads());
+  ESP_LOGCONFIG(TAG, "  Buffer Budget: %s", sd_mmc_card::format_size(this->scheduler_.get_buffer_budget()).c_str());
+  ESP_LOGCONFIG(TAG, "  Read Size: %s%s", sd_mmc_card::format_size(this->get_read_size()).c_str(),
+                this->read_size_ > 0 ? "" : " (card profile)");
+  ESP_LOGCONFIG(TAG, "  Read Ahead: %u chunks", this->read_ahead_);
 }
 
+// called for every request to the web server, the match allocates nothing
 bool SDFileServer::canHandle(AsyncWebServerRequest *request) const {
-  ESP_LOGD(TAG, "can handle %s %u", request->url().c_str(),
-           str_startswith(std::string(request->url().c_str()), this->build_prefix()));
-  return str_startswith(std::string(request->url().c_str()), this->build_prefix());
+  return this->matches_prefix(request->url().c_str());
 }
 
 void SDFileServer::handleRequest(AsyncWebServerRequest *request) {
-  ESP_LOGD(TAG, "%s", request->url().c_str());
-  if (str_startswith(std::string(request->url().c_str()), this->build_prefix())) {
+  ESP_LOGV(TAG, "%s", request->url().c_str());
+  if (this->matches_prefix(request->url().c_str())) {
     if (request->method() == HTTP_GET) {
       this->handle_get(request);
       return;
     }
+    if (request->method() == HTTP_DELETE && request->hasArg("upload")) {
+      this->handle_upload_status(request, this->request_path(request));
+      return;
+    }
     if (request->method() == HTTP_DELETE) {
       this->handle_delete(request);
       return;
     }
+    if (this->is_body_upload(request)) {
+      this->handle_body_upload(request);
+      return;
+    }
+    if (request->method() == HTTP_POST && request->hasArg("action")) {
+      this->handle_batch(request);
+      return;
+    }
   }
 }
 
@@ -49,8 +140,7 @@ void SDFileServer::handleUpload(AsyncWebServerRequest *request, const String &fi
     request->send(401, "application/json", "{ \"error\": \"file upload is disabled\" }");
     return;
   }
-  std::string extracted = this->extract_path_from_url(std::string(request->url().c_str()));
-  std::string path = this->build_absolute_path(extracted);
+  std::string path = this->request_path(request);
 
   if (index == 0 && !this->sd_mmc_card_->is_directory(path)) {
     auto response = request->beginResponse(401, "application/json", "{ \"error\": \"invalid upload folder\" }");
@@ -60,12 +150,42 @@ void SDFileServer::handleUpload(AsyncWebServerRequest *request, const String &fi
   }
   std::string file_name(filename.c_str());
   if (index == 0) {
+    if (this->upload_ != nullptr)
+      ESP_LOGW(TAG, "discarding unfinished upload of %s", this->upload_->get_path().c_str());
+    this->upload_.reset();
+    this->upload_ticket_.reset();
+    this->upload_ticket_ = this->scheduler_.admit(TransferScheduler::Kind::UPLOAD, 0);
+    if (this->upload_ticket_ == nullptr) {
+      this->send_busy(request);
+      return;
+    }
     ESP_LOGD(TAG, "uploading file %s to %s", file_name.c_str(), path.c_str());
-    this->sd_mmc_card_->write_file(Path::join(path, file_name).c_str(), data, len);
+    // the file is written under a temporary name, an interrupted upload never replaces an existing file
+    this->upload_ = this->sd_mmc_card_->open_file_atomic(Path::join(path, file_name).c_str());
+    this->upload_request_ = request;
+    if (this->upload_ == nullptr) {
+      this->upload_ticket_.reset();
+      request->send(500, "application/json", "{ \"error\": \"failed to create file\" }");
+      return;
+    }
+  }
+  if (this->upload_ == nullptr || this->upload_request_ != request)
+    return;
+  this->upload_ticket_->touch();
+  if (len > 0 && this->upload_->write(data, len) != len) {
+    this->upload_.reset();
+    this->upload_ticket_.reset();
+    request->send(500, "application/json", "{ \"error\": \"failed to write file\" }");
     return;
   }
-  this->sd_mmc_card_->append_file(Path::join(path, file_name).c_str(), data, len);
   if (final) {
+    bool ok = this->upload_->commit();
+    this->upload_.reset();
+    this->upload_ticket_.reset();
+    if (!ok) {
+      request->send(500, "application/json", "{ \"error\": \"failed to save file\" }");
+      return;
+    }
     auto response = request->beginResponse(201, "text/html", "upload success");
     response->addHeader("Connection", "close");
     request->send(response);
@@ -73,11 +193,192 @@ void SDFileServer::handleUpload(AsyncWebServerRequest *request, const String &fi
   }
 }
 
-void SDFileServer::set_url_prefix(std::string const &prefix) { this->url_prefix_ = prefix; }
+#ifndef USE_ESP_IDF
+void SDFileServer::handleBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+  if (!this->is_body_upload(request))
+    return;
+  if (index == 0)
+    this->begin_body(request, total);
+  if (this->body_request_ == request)
+    this->write_body(data, len);
+}
+#endif
+
+bool SDFileServer::is_body_upload(AsyncWebServerRequest *request) const {
+  if (request->method() == HTTP_PUT)
+    return true;
+  if (request->method() != HTTP_POST)
+    return false;
+  return request->hasArg("offset") || !request_header(request, "Content-Range").empty() ||
+         str_startswith(request_header(request, "Content-Type"), "application/octet-stream");
+}
+
+bool SDFileServer::is_resumable_upload(AsyncWebServerRequest *request) const {
+  return request->hasArg("offset") || !request_header(request, "Content-Range").empty();
+}
+
+void SDFileServer::handle_body_upload(AsyncWebServerRequest *request) {
+#ifdef USE_ESP_IDF
+  // the shim leaves a body that is not a form unread, it is received here in the request handler
+  httpd_req_t *req = *request;
+  this->begin_body(request, req->content_len);
+  std::unique_ptr<uint8_t[]> buffer(new uint8_t[BODY_BUFFER_SIZE]);
+  size_t remaining = req->content_len;
+  while (remaining > 0 && this->body_status_ == 0) {
+    int n = httpd_req_recv(req, reinterpret_cast<char *>(buffer.get()), std::min(remaining, BODY_BUFFER_SIZE));
+    if (n == HTTPD_SOCK_ERR_TIMEOUT)
+      continue;
+    if (n <= 0) {
+      this->fail_body(400, "connection lost");
+      break;
+    }
+    this->write_body(buffer.get(), n);
+    remaining -= n;
+  }
+#else
+  // an empty body does not go through handleBody
+  if (this->body_request_ != request)
+    this->begin_body(request, 0);
+#endif
+  this->end_body(request);
+}
+
+void SDFileServer::begin_body(AsyncWebServerRequest *request, size_t length) {
+  this->body_request_ = request;
+  this->body_status_ = 0;
+  this->body_path_ = this->request_path(request);
+  if (!this->upload_enabled_) {
+    this->fail_body(401, "file upload is disabled");
+    return;
+  }
+  // a new body means the previous one is over, even if its end was never received
+  this->body_ticket_.reset();
+  this->body_ticket_ = this->scheduler_.admit(TransferScheduler::Kind::UPLOAD, 0);
+  if (this->body_ticket_ == nullptr) {
+    this->fail_body(503, "too many transfers");
+    return;
+  }
+  if (this->sd_mmc_card_->is_directory(this->body_path_)) {
+    this->fail_body(400, "invalid upload path");
+    return;
+  }
+  if (!this->is_resumable_upload(request)) {
+    // the whole file in one request, the body is the content and its length the size of the file
+    size_t preallocate = request_arg(request, "preallocate") == "true" ? length : 0;
+    if (!this->resumable_.begin_raw(this->body_path_, preallocate)) {
+      this->fail_body(500, "failed to create file");
+      return;
+    }
+    this->body_total_ = length;
+    return;
+  }
+
+  size_t offset, total;
+  std::string range = request_header(request, "Content-Range");
+  if (!range.empty()) {
+    size_t last;
+    if (sscanf(range.c_str(), "bytes %zu-%zu/%zu", &offset, &last, &total) != 3 || last < offset ||
+        last - offset + 1 != length) {
+      this->fail_body(400, "invalid content range");
+      return;
+    }
+  } else {
+    offset = strtoul(request_arg(request, "offset").c_str(), nullptr, 10);
+    total = strtoul(request_arg(request, "total").c_str(), nullptr, 10);
+  }
+  if (total == 0) {
+    this->fail_body(400, "missing total size");
+    return;
+  }
+  if (length > this->max_chunk_size()) {
+    this->fail_body(413, "chunk too large");
+    return;
+  }
+  // a chunk must continue exactly where the content received so far ends
+  if (offset != this->resumable_.get_offset(this->body_path_)) {
+    this->fail_body(409, "offset mismatch");
+    return;
+  }
+  if (!this->resumable_.begin(this->body_path_)) {
+    this->fail_body(500, "failed to create file");
+    return;
+  }
+  this->body_total_ = total;
+}
+
+void SDFileServer::write_body(const uint8_t *data, size_t len) {
+  if (this->body_status_ != 0)
+    return;
+  this->body_ticket_->touch();
+  if (this->resumable_.write(data, len) != len)
+    this->fail_body(500, "failed to write file");
+}
+
+void SDFileServer::end_body(AsyncWebServerRequest *request) {
+  bool complete = false;
+  if (this->body_status_ == 0 && !this->resumable_.end(this->body_total_, complete))
+    this->fail_body(500, "failed to save file");
+  if (this->body_status_ != 0)
+    this->resumable_.abort();
+  size_t offset = complete ? this->body_total_ : this->resumable_.get_offset(this->body_path_);
+  this->body_request_ = nullptr;
+  this->body_ticket_.reset();
+
+  if (this->body_status_ == 503) {
+    this->send_busy(request);
+    return;
+  }
+  if (this->body_status_ != 0) {
+    request->send(this->body_status_, "application/json",
+                  str_sprintf("{ \"error\": \"%s\", \"offset\": %u }", this->body_error_.c_str(), offset).c_str());
+    return;
+  }
+  request->send(complete ? 201 : 200, "application/json",
+                str_sprintf("{ \"offset\": %u, \"complete\": %s }", offset, TRUEFALSE(complete)).c_str());
+}
+
+void SDFileServer::fail_body(int status, std::string const &error) {
+  if (this->body_status_ != 0)
+    return;
+  ESP_LOGW(TAG, "upload of %s failed: %s", this->body_path_.c_str(), error.c_str());
+  this->body_status_ = status;
+  this->body_error_ = error;
+}
+
+size_t SDFileServer::max_chunk_size() const {
+  // whole clusters, large enough for the sync after each chunk to be cheap
+  size_t cluster = this->sd_mmc_card_->get_cluster_size().value_or(DEFAULT_CLUSTER_SIZE);
+  size_t size = std::min<size_t>(std::max<size_t>(16 * cluster, 64 * 1024), 1024 * 1024);
+  return std::max(size - size % cluster, cluster);
+}
+
+void SDFileServer::handle_upload_status(AsyncWebServerRequest *request, std::string const &path) {
+  if (!this->upload_enabled_) {
+    request->send(401, "application/json", "{ \"error\": \"file upload is disabled\" }");
+    return;
+  }
+  if (request->method() == HTTP_DELETE) {
+    this->resumable_.cancel(path);
+    request->send(200, "application/json", "{ \"offset\": 0 }");
+    return;
+  }
+  request->send(200, "application/json",
+                str_sprintf("{ \"offset\": %u, \"max_chunk_size\": %u }", this->resumable_.get_offset(path),
+                            this->max_chunk_size())
+                    .c_str());
+}
+
+void SDFileServer::set_url_prefix(std::string const &prefix) {
+  this->url_prefix_ = prefix;
+  this->prefix_ = prefix.empty() || prefix[0] != '/' ? "/" + prefix : prefix;
+}
 
 void SDFileServer::set_root_path(std::string const &path) { this->root_path_ = path; }
 
-void SDFileServer::set_sd_mmc_card(sd_mmc_card::SdMmc *card) { this->sd_mmc_card_ = card; }
+void SDFileServer::set_sd_mmc_card(sd_mmc_card::SdMmc *card) {
+  this->sd_mmc_card_ = card;
+  this->resumable_.set_sd_mmc_card(card);
+}
 
 void SDFileServer::set_deletion_enabled(bool allow) { this->deletion_enabled_ = allow; }
 
@@ -85,15 +386,71 @@ void SDFileServer::set_download_enabled(bool allow) { this->download_enabled_ =
 
 void SDFileServer::set_upload_enabled(bool allow) { this->upload_enabled_ = allow; }
 
-void SDFileServer::handle_get(AsyncWebServerRequest *request) const {
-  std::string extracted = this->extract_path_from_url(std::string(request->url().c_str()));
-  std::string path = this->build_absolute_path(extracted);
+void SDFileServer::set_compression_level(uint8_t level) { this->compression_level_ = level; }
+
+void SDFileServer::set_compression_min_size(size_t size) { this->compression_min_size_ = size; }
+
+void SDFileServer::set_max_downloads(uint8_t max) { this->scheduler_.set_max_downloads(max); }
+
+void SDFileServer::set_max_uploads(uint8_t max) { this->scheduler_.set_max_uploads(max); }
+
+void SDFileServer::set_buffer_budget(size_t budget) { this->scheduler_.set_buffer_budget(budget); }
+
+void SDFileServer::set_read_size(size_t size) { this->read_size_ = size; }
+
+size_t SDFileServer::get_read_size() const {
+  return this->read_size_ > 0 ? this->read_size_ : this->sd_mmc_card_->get_profile().read_chunk_size;
+}
+
+void SDFileServer::set_read_ahead(uint8_t chunks) { this->read_ahead_ = chunks; }
+
+void SDFileServer::set_retry_after(uint32_t seconds) { this->retry_after_ = seconds; }
+
+void SDFileServer::handle_get(AsyncWebServerRequest *request) {
+  std::string path = this->request_path(request);
+
+  if (request->hasArg("downsample")) {
+    handle_downsample(request, path);
+    return;
+  }
+
+  if (request->hasArg("tail")) {
+    handle_tail(request, path);
+    return;
+  }
+
+  if (request->hasArg("upload")) {
+    handle_upload_status(request, path);
+    return;
+  }
+
+  if (request->hasArg("manifest")) {
+    handle_manifest(request, path);
+    return;
+  }
+
+  if (request->hasArg("search")) {
+    handle_search(request, path);
+    return;
+  }
 
   if (!this->sd_mmc_card_->is_directory(path)) {
     handle_download(request, path);
     return;
   }
 
+  if (request->hasArg("archive")) {
+    handle_archive(request, path);
+    return;
+  }
+
+#ifdef USE_SD_RECORDER
+  if (request->hasArg("records")) {
+    handle_records(request, path);
+    return;
+  }
+#endif
+
   handle_index(request, path);
 }
 
@@ -280,6 +637,12 @@ void SDFileServer::handle_index(AsyncWebServerRequest *request, std::string cons
   }
   response->print(F("</div>"));
 
+  if (this->download_enabled_)
+    response->print(F("<div class=\"header-actions\">"
+                      "<button onclick=\"window.location.href='?archive=zip&depth=255'\">Download as ZIP</button>"
+                      "<button onclick=\"window.location.href='?archive=tar&depth=255'\">Download as TAR</button>"
+                      "</div>"));
+
   if (this->upload_enabled_)
     response->print(F("<div class=\"upload-form\"><form method=\"POST\" enctype=\"multipart/form-data\">"
                       "<input type=\"file\" name=\"file\"><input type=\"submit\" value=\"upload\"></form></div>"));
@@ -291,7 +654,11 @@ void SDFileServer::handle_index(AsyncWebServerRequest *request, std::string cons
                     "<th>Actions</th>"
                     "</tr></thead><tbody>"));
 
-  auto entries = this->sd_mmc_card_->list_directory_file_info(path, 0);
+  auto entries = this->list_files(path, 0);
+  // directories first, date shards then read in order
+  std::sort(entries.begin(), entries.end(), [](sd_mmc_card::FileInfo const &a, sd_mmc_card::FileInfo const &b) {
+    return a.is_directory != b.is_directory ? a.is_directory : a.path < b.path;
+  });
   for (auto const &entry : entries)
     write_row(response, entry);
 
@@ -313,24 +680,437 @@ void SDFileServer::handle_index(AsyncWebServerRequest *request, std::string cons
   request->send(response);
 }
 
-void SDFileServer::handle_download(AsyncWebServerRequest *request, std::string const &path) const {
+std::vector<sd_mmc_card::FileInfo> SDFileServer::list_files(std::string const &path, uint8_t depth) const {
+  auto entries = this->sd_mmc_card_->list_directory_file_info(path, depth);
+  entries.erase(std::remove_if(entries.begin(), entries.end(),
+                               [](sd_mmc_card::FileInfo const &entry) { return is_sidecar(entry.path); }),
+                entries.end());
+  return entries;
+}
+
+void SDFileServer::handle_download(AsyncWebServerRequest *request, std::string const &path) {
+  if (!this->download_enabled_) {
+    request->send(401, "application/json", "{ \"error\": \"file download is disabled\" }");
+    return;
+  }
+
+  Headers headers;
+  if (!this->check_preconditions(request, path, headers))
+    return;
+
+  auto cached = this->sd_mmc_card_->read_file_cached(path);
+  if (cached != nullptr) {
+    this->send_cached_file(request, path, cached, headers);
+    return;
+  }
+
+  uint64_t size = this->sd_mmc_card_->file_size(path).value_or(0);
+  const char *mime_type = Path::mime_type(path);
+  bool compress = this->should_compress(request, mime_type, size);
+  size_t read_size = this->get_read_size();
+  auto ticket = this->admit_download(request, read_size * (this->read_ahead_ + 1), compress);
+  if (ticket == nullptr)
+    return;
+
+  std::shared_ptr<StreamSource> source;
+  if (this->read_ahead_ > 0) {
+    // the card reads the next chunks while the current one is sent
+    auto reader = std::make_shared<ReadAheadSource>(this->sd_mmc_card_, ticket, this->read_ahead_ + 1, read_size);
+    if (!reader->start(path)) {
+      request->send(401, "application/json", "{ \"error\": \"failed to read file\" }");
+      return;
+    }
+    source = reader;
+  } else {
+    auto file = this->sd_mmc_card_->open_file(path, "rb");
+    if (file == nullptr) {
+      request->send(401, "application/json", "{ \"error\": \"failed to read file\" }");
+      return;
+    }
+    source = this->schedule(std::make_shared<FileSource>(std::move(file)), ticket);
+  }
+  if (compress) {
+    source = std::make_shared<GzipSource>(source, this->compression_level_);
+    // another representation of the content, its etag tells it from the identity one
+    for (auto &header : headers) {
+      if (header.first == "ETag")
+        header.second.insert(header.second.size() - 1, GZIP_ETAG_SUFFIX);
+    }
+    headers.emplace_back("Content-Encoding", "gzip");
+    headers.emplace_back("Vary", "Accept-Encoding");
+  }
+  send_stream(request, 200, mime_type, source, headers);
+}
+
+// the header lists the etag, quoted or not, or is a wildcard
+static bool etag_matches(std::string const &header, std::string const &hash) {
+  return header == "*" || header.find(hash) != std::string::npos;
+}
+
+bool SDFileServer::check_preconditions(AsyncWebServerRequest *request, std::string const &path, Headers &headers) {
+  std::string if_match = request_header(request, "If-Match");
+  std::string if_none_match = request_header(request, "If-None-Match");
+  auto info = this->sd_mmc_card_->file_info(path);
+  if (!info.has_value()) {
+    if (if_match.empty())
+      return true;
+    request->send(412, "application/json", "{ \"error\": \"file not found\" }");
+    return false;
+  }
+
+  // the etag is the content hash
+  uint32_t crc;
+  if (if_match.empty() && if_none_match.empty()) {
+    // a plain download only sends a hash already in the sidecar, the file is never read for it
+    if (stored_hash(this->sd_mmc_card_, *info, crc))
+      headers.emplace_back("ETag", str_sprintf("\"%08" PRIx32 "\"", crc));
+    return true;
+  }
+  {
+    auto ticket = this->admit_download(request, this->get_read_size(), false);
+    if (ticket == nullptr)
+      return false;
+    if (!cached_hash(this->sd_mmc_card_, *info, ticket.get(), this->get_read_size(), crc)) {
+      request->send(500, "application/json", "{ \"error\": \"failed to read file\" }");
+      return false;
+    }
+  }
+  std::string hash = str_sprintf("%08" PRIx32, crc);
+  std::string etag = "\"" + hash + "\"";
+  int code = 0;
+  if (!if_match.empty() && !etag_matches(if_match, hash)) {
+    code = 412;
+  } else if (!if_none_match.empty() && etag_matches(if_none_match, hash)) {
+    code = 304;
+  }
+  if (code != 0) {
+    auto *response = code == 412 ? request->beginResponse(412, "application/json", "{ \"error\": \"file changed\" }")
+                                 : request->beginResponse(304, "text/plain", "");
+    response->addHeader("ETag", etag.c_str());
+    request->send(response);
+    return false;
+  }
+  headers.emplace_back("ETag", etag);
+  return true;
+}
+
+bool SDFileServer::should_compress(AsyncWebServerRequest *request, std::string_view mime_type, uint64_t size) const {
+  if (this->compression_level_ == 0 || size < this->compression_min_size_ || !Path::is_compressible(mime_type))
+    return false;
+  return request_header(request, "Accept-Encoding").find("gzip") != std::string::npos;
+}
+
+std::shared_ptr<TransferScheduler::Ticket> SDFileServer::admit_download(AsyncWebServerRequest *request,
+                                                                        size_t buffer_size, bool compressed) {
+  if (compressed)
+    buffer_size += GZIP_MEMORY_SIZE;
+  auto ticket = this->scheduler_.admit(TransferScheduler::Kind::DOWNLOAD, buffer_size);
+  if (ticket == nullptr)
+    this->send_busy(request);
+  return ticket;
+}
+
+std::shared_ptr<StreamSource> SDFileServer::schedule(std::shared_ptr<StreamSource> source,
+                                                     std::shared_ptr<TransferScheduler::Ticket> ticket) const {
+  return std::make_shared<ScheduledSource>(std::move(source), std::move(ticket), this->get_read_size());
+}
+
+void SDFileServer::send_busy(AsyncWebServerRequest *request) const {
+  // the header value must stay valid until the response is sent
+  std::string retry_after = to_string(this->retry_after_);
+  auto *response = request->beginResponse(503, "application/json", "{ \"error\": \"too many transfers\" }");
+  response->addHeader("Retry-After", retry_after.c_str());
+  request->send(response);
+}
+
+void SDFileServer::handle_archive(AsyncWebServerRequest *request, std::string const &path) {
+  if (!this->download_enabled_) {
+    request->send(401, "application/json", "{ \"error\": \"file download is disabled\" }");
+    return;
+  }
+
+  std::string format = request_arg(request, "archive");
+  ArchiveFormat archive_format;
+  if (format == "tar") {
+    archive_format = ArchiveFormat::TAR;
+  } else if (format == "zip") {
+    archive_format = ArchiveFormat::ZIP;
+  } else {
+    request->send(400, "application/json", "{ \"error\": \"unsupported archive format\" }");
+    return;
+  }
+  std::string depth_arg = request_arg(request, "depth");
+  uint8_t depth = depth_arg.empty() ? 0 : std::min(atoi(depth_arg.c_str()), 255);
+  auto ticket = this->admit_download(request, this->get_read_size(), false);
+  if (ticket == nullptr)
+    return;
+
+  std::string name = Path::file_name(path);
+  if (name.empty())
+    name = "sdcard";
+  name += "." + format;
+  ESP_LOGD(TAG, "streaming %s as %s", path.c_str(), name.c_str());
+
+  auto source =
+      std::make_shared<ArchiveSource>(this->sd_mmc_card_, path, this->list_files(path, depth), archive_format);
+  send_stream(request, 200, Path::mime_type(name), this->schedule(source, ticket),
+              {{"Content-Disposition", "attachment; filename=\"" + name + "\""}});
+}
+
+void SDFileServer::handle_manifest(AsyncWebServerRequest *request, std::string const &path) {
+  if (!this->download_enabled_) {
+    request->send(401, "application/json", "{ \"error\": \"file download is disabled\" }");
+    return;
+  }
+  if (!this->sd_mmc_card_->is_directory(path)) {
+    request->send(400, "application/json", "{ \"error\": \"manifest applies to a directory\" }");
+    return;
+  }
+
+  std::string depth_arg = request_arg(request, "depth");
+  uint8_t depth = depth_arg.empty() ? 255 : std::min(atoi(depth_arg.c_str()), 255);
+  bool compress = this->should_compress(request, "application/json", SIZE_MAX);
+  auto ticket = this->admit_download(request, this->get_read_size(), compress);
+  if (ticket == nullptr)
+    return;
+  ESP_LOGD(TAG, "listing the manifest of %s", path.c_str());
+
+  // the source takes the turns of the ticket on the card for the files it hashes
+  std::shared_ptr<StreamSource> source = std::make_shared<ManifestSource>(
+      this->sd_mmc_card_, path, this->list_files(path, depth), ticket, this->get_read_size());
+  if (compress) {
+    source = std::make_shared<GzipSource>(source, this->compression_level_);
+    send_stream(request, 200, "application/x-ndjson", source,
+                {{"Content-Encoding", "gzip"}, {"Vary", "Accept-Encoding"}});
+    return;
+  }
+  send_stream(request, 200, "application/x-ndjson", source);
+}
+
+void SDFileServer::handle_search(AsyncWebServerRequest *request, std::string const &path) {
+  if (!this->sd_mmc_card_->is_directory(path)) {
+    request->send(400, "application/json", "{ \"error\": \"search applies to a directory\" }");
+    return;
+  }
+
+  SearchFilter filter;
+  std::string pattern = request_arg(request, "search");
+  if (!pattern.empty())
+    filter.pattern = pattern;
+  for (auto &extension : Path::split_list(request_arg(request, "ext"))) {
+    if (extension.front() == '.')
+      extension.erase(0, 1);
+    filter.extensions.push_back(extension);
+  }
+  std::string min_size = request_arg(request, "min_size");
+  std::string max_size = request_arg(request, "max_size");
+  if (!min_size.empty())
+    filter.min_size = strtoull(min_size.c_str(), nullptr, 10);
+  if (!max_size.empty())
+    filter.max_size = strtoull(max_size.c_str(), nullptr, 10);
+  filter.from = strtoul(request_arg(request, "from").c_str(), nullptr, 10);
+  filter.to = strtoul(request_arg(request, "to").c_str(), nullptr, 10);
+  std::string type = request_arg(request, "type");
+  if (type == "directory") {
+    filter.type = SearchFilter::Type::DIRECTORY;
+  } else if (type == "any") {
+    filter.type = SearchFilter::Type::ANY;
+  } else if (!type.empty() && type != "file") {
+    request->send(400, "application/json", "{ \"error\": \"unsupported type\" }");
+    return;
+  }
+
+  std::string depth_arg = request_arg(request, "depth");
+  uint8_t depth = depth_arg.empty() ? 255 : std::min(atoi(depth_arg.c_str()), 255);
+  std::string limit_arg = request_arg(request, "limit");
+  size_t limit = limit_arg.empty() ? DEFAULT_SEARCH_LIMIT : strtoul(limit_arg.c_str(), nullptr, 10);
+  std::string timeout_arg = request_arg(request, "timeout");
+  uint32_t timeout = timeout_arg.empty() ? DEFAULT_SEARCH_TIMEOUT : strtoul(timeout_arg.c_str(), nullptr, 10);
+  limit = std::min(limit, MAX_SEARCH_LIMIT);
+  timeout = std::min(timeout, MAX_SEARCH_TIMEOUT);
+
+  bool compress = this->should_compress(request, "application/json", SIZE_MAX);
+  auto ticket = this->admit_download(request, this->get_read_size(), compress);
+  if (ticket == nullptr)
+    return;
+  ESP_LOGD(TAG, "searching %s for %s", path.c_str(), filter.pattern.c_str());
+
+  // the directories are read in turns with the downloads
+  std::shared_ptr<StreamSource> source = this->schedule(
+      std::make_shared<SearchSource>(this->sd_mmc_card_, path, depth, std::move(filter), limit, timeout * 1000),
+      ticket);
+  if (compress) {
+    source = std::make_shared<GzipSource>(source, this->compression_level_);
+    send_stream(request, 200, "application/json", source, {{"Content-Encoding", "gzip"}, {"Vary", "Accept-Encoding"}});
+    return;
+  }
+  send_stream(request, 200, "application/json", source);
+}
+
+void SDFileServer::handle_downsample(AsyncWebServerRequest *request, std::string const &path) {
+  if (!this->download_enabled_) {
+    request->send(401, "application/json", "{ \"error\": \"file download is disabled\" }");
+    return;
+  }
+
+  uint32_t bucket = strtoul(request_arg(request, "downsample").c_str(), nullptr, 10);
+  if (bucket == 0) {
+    request->send(400, "application/json", "{ \"error\": \"invalid bucket duration\" }");
+    return;
+  }
+  std::string aggregate_arg = request_arg(request, "aggregate");
+  uint8_t aggregates = parse_aggregates(aggregate_arg.empty() ? "min,max,avg,last" : aggregate_arg);
+  if (aggregates == 0) {
+    request->send(400, "application/json", "{ \"error\": \"unsupported aggregate\" }");
+    return;
+  }
+  std::string from_arg = request_arg(request, "from");
+  std::string to_arg = request_arg(request, "to");
+  uint32_t from = from_arg.empty() ? 0 : strtoul(from_arg.c_str(), nullptr, 10);
+  uint32_t to = to_arg.empty() ? UINT32_MAX : strtoul(to_arg.c_str(), nullptr, 10);
+  // the size is unknown, the result is worth compressing whenever compression is enabled
+  bool compress = this->should_compress(request, "text/csv", SIZE_MAX);
+  auto ticket = this->admit_download(request, this->get_read_size(), compress);
+  if (ticket == nullptr)
+    return;
+
+  std::vector<std::string> files;
+  if (this->sd_mmc_card_->is_directory(path)) {
+    // a rotated log set, oldest file first, the files last written before the range are not read
+    std::string pattern = request_arg(request, "pattern");
+    if (pattern.empty())
+      pattern = "*.csv";
+    // logs sharded in date directories are found with a depth
+    uint8_t depth = std::min<unsigned long>(strtoul(request_arg(request, "depth").c_str(), nullptr, 10), 4);
+    auto entries = this->list_files(path, depth);
+    std::sort(entries.begin(), entries.end(), [](sd_mmc_card::FileInfo const &a, sd_mmc_card::FileInfo const &b) {
+      return a.mtime != b.mtime ? a.mtime < b.mtime : a.path < b.path;
+    });
+    for (auto const &entry : entries) {
+      if (entry.is_directory || !sd_mmc_card::glob_match(pattern.c_str(), Path::file_name(entry.path).c_str()))
+        continue;
+      if (from > 0 && entry.mtime > 0 && entry.mtime < static_cast<time_t>(from))
+        continue;
+      files.push_back(entry.path);
+    }
+  } else {
+    std::string_view mime_type = Path::mime_type(path);
+    if (mime_type != "text/csv" && mime_type != "text/plain") {
+      request->send(400, "application/json", "{ \"error\": \"not a csv file\" }");
+      return;
+    }
+    files.push_back(path);
+  }
+  ESP_LOGD(TAG, "downsampling %u files of %s by %u s", files.size(), path.c_str(), bucket);
+
+  std::shared_ptr<StreamSource> source = this->schedule(
+      std::make_shared<DownsampleSource>(this->sd_mmc_card_, std::move(files), from, to, bucket, aggregates), ticket);
+  if (compress) {
+    source = std::make_shared<GzipSource>(source, this->compression_level_);
+    send_stream(request, 200, "text/csv", source, {{"Content-Encoding", "gzip"}, {"Vary", "Accept-Encoding"}});
+    return;
+  }
+  send_stream(request, 200, "text/csv", source);
+}
+
+void SDFileServer::handle_tail(AsyncWebServerRequest *request, std::string const &path) {
+  if (!this->download_enabled_) {
+    request->send(401, "application/json", "{ \"error\": \"file download is disabled\" }");
+    return;
+  }
+  if (this->sd_mmc_card_->is_directory(path)) {
+    request->send(400, "application/json", "{ \"error\": \"can not follow a directory\" }");
+    return;
+  }
+
+  std::string lines_arg = request_arg(request, "lines");
+  std::string bytes_arg = request_arg(request, "bytes");
+  size_t bytes = strtoul(bytes_arg.c_str(), nullptr, 10);
+  size_t lines = lines_arg.empty() ? (bytes_arg.empty() ? 10 : 0) : strtoul(lines_arg.c_str(), nullptr, 10);
+  std::string backlog;
+  if (lines > 0 || bytes > 0)
+    backlog = read_tail(this->sd_mmc_card_, path, lines, bytes, MAX_TAIL_BACKLOG);
+
+  if (!this->tail_.follow(request, path, backlog)) {
+    auto *response = request->beginResponse(503, "application/json", "{ \"error\": \"too many viewers\" }");
+    response->addHeader("Retry-After", "10");
+    request->send(response);
+  }
+}
+
+#ifdef USE_SD_RECORDER
+void SDFileServer::handle_records(AsyncWebServerRequest *request, std::string const &path) {
   if (!this->download_enabled_) {
     request->send(401, "application/json", "{ \"error\": \"file download is disabled\" }");
     return;
   }
 
-  auto file = this->sd_mmc_card_->read_file(path);
-  if (file.size() == 0) {
-    request->send(401, "application/json", "{ \"error\": \"failed to read file\" }");
+  std::string format = request_arg(request, "records");
+  RecordFormat record_format;
+  if (format == "csv" || format.empty()) {
+    record_format = RecordFormat::CSV;
+  } else if (format == "json") {
+    record_format = RecordFormat::JSON;
+  } else {
+    request->send(400, "application/json", "{ \"error\": \"unsupported record format\" }");
+    return;
+  }
+  std::string from_arg = request_arg(request, "from");
+  std::string to_arg = request_arg(request, "to");
+  uint32_t from = from_arg.empty() ? 0 : strtoul(from_arg.c_str(), nullptr, 10);
+  uint32_t to = to_arg.empty() ? UINT32_MAX : strtoul(to_arg.c_str(), nullptr, 10);
+  const char *mime_type = record_format == RecordFormat::CSV ? "text/csv" : "application/json";
+  // the size is unknown, a query is worth compressing whenever compression is enabled
+  bool compress = this->should_compress(request, mime_type, SIZE_MAX);
+  auto ticket = this->admit_download(request, this->get_read_size(), compress);
+  if (ticket == nullptr)
+    return;
+
+  std::string directory = sd_mmc_card::build_path(path.c_str());
+  auto names = sd_recorder::RecordReader::read_series(directory);
+  int32_t series = -1;
+  std::string series_arg = request_arg(request, "series");
+  if (!series_arg.empty()) {
+    auto it = std::find_if(names.begin(), names.end(), [&series_arg](std::pair<const uint16_t, std::string> const &e) {
+      return e.second == series_arg;
+    });
+    if (it == names.end()) {
+      request->send(404, "application/json", "{ \"error\": \"unknown series\" }");
+      return;
+    }
+    series = it->first;
+  }
+  ESP_LOGD(TAG, "querying %s from %u to %u", path.c_str(), from, to);
+
+  std::unique_ptr<sd_recorder::RecordReader> reader(new sd_recorder::RecordReader(directory, from, to, series));
+  std::shared_ptr<StreamSource> source =
+      this->schedule(std::make_shared<RecordQuerySource>(std::move(reader), std::move(names), record_format), ticket);
+  if (compress) {
+    source = std::make_shared<GzipSource>(source, this->compression_level_);
+    send_stream(request, 200, mime_type, source, {{"Content-Encoding", "gzip"}, {"Vary", "Accept-Encoding"}});
     return;
   }
+  send_stream(request, 200, mime_type, source);
+}
+#endif
+
+void SDFileServer::send_cached_file(AsyncWebServerRequest *request, std::string const &path,
+                                    std::shared_ptr<const sd_mmc_card::CachedFile> const &file,
+                                    Headers const &headers) const {
 #ifdef USE_ESP_IDF
-  auto *response = request->beginResponse(200, Path::mime_type(path).c_str(), file.data(), file.size());
+  // the response is sent synchronously, the cache entry outlive it
+  auto *response = request->beginResponse(200, Path::mime_type(path), file->data(), file->size());
 #else
-  auto *response = request->beginResponseStream(Path::mime_type(path).c_str(), file.size());
-  response->write(file.data(), file.size());
+  // keep the cache entry alive until the response has been fully sent
+  auto *response = request->beginResponse(Path::mime_type(path), file->size(),
+                                          [file](uint8_t *buffer, size_t max_len, size_t index) -> size_t {
+                                            size_t len = std::min(max_len, file->size() - index);
+                                            memcpy(buffer, file->data() + index, len);
+                                            return len;
+                                          });
 #endif
-
+  for (auto const &header : headers)
+    response->addHeader(header.first.c_str(), header.second.c_str());
   request->send(response);
 }
 
@@ -339,10 +1119,25 @@ void SDFileServer::handle_delete(AsyncWebServerRequest *request) {
     request->send(401, "application/json", "{ \"error\": \"file deletion is disabled\" }");
     return;
   }
-  std::string extracted = this->extract_path_from_url(std::string(request->url().c_str()));
-  std::string path = this->build_absolute_path(extracted);
+  std::string path = this->request_path(request);
   if (this->sd_mmc_card_->is_directory(path)) {
-    request->send(401, "application/json", "{ \"error\": \"cannot delete a directory\" }");
+    if (request_arg(request, "recursive") != "true") {
+      request->send(401, "application/json", "{ \"error\": \"cannot delete a directory\" }");
+      return;
+    }
+    if (path == this->root_path_) {
+      request->send(401, "application/json", "{ \"error\": \"cannot delete the root directory\" }");
+      return;
+    }
+    if (this->sd_mmc_card_->remove_directory_recursive(path.c_str())) {
+      request->send(204, "application/json", "{}");
+      return;
+    }
+    request->send(401, "application/json", "{ \"error\": \"failed to delete directory\" }");
+    return;
+  }
+  if (sd_mmc_card::is_internal_file(path.c_str())) {
+    request->send(401, "application/json", "{ \"error\": \"file is used by the card component\" }");
     return;
   }
   if (this->sd_mmc_card_->delete_file(path)) {
@@ -352,18 +1147,78 @@ void SDFileServer::handle_delete(AsyncWebServerRequest *request) {
   request->send(401, "application/json", "{ \"error\": \"failed to delete file\" }");
 }
 
-std::string SDFileServer::build_prefix() const {
-  if (this->url_prefix_.length() == 0 || this->url_prefix_.at(0) != '/')
-    return "/" + this->url_prefix_;
-  return this->url_prefix_;
+void SDFileServer::handle_batch(AsyncWebServerRequest *request) {
+  if (!this->deletion_enabled_) {
+    request->send(401, "application/json", "{ \"error\": \"file deletion is disabled\" }");
+    return;
+  }
+  std::string directory = this->request_path(request);
+  if (!Path::is_contained(directory) || !this->sd_mmc_card_->is_directory(directory)) {
+    request->send(400, "application/json", "{ \"error\": \"batch operations apply to a directory\" }");
+    return;
+  }
+
+  std::string action = request_arg(request, "action");
+  std::vector<std::string> names = Path::split_list(request_arg(request, "paths"));
+  // the files of the directory only, nothing outside of the root can be reached
+  if (!std::all_of(names.begin(), names.end(), [](std::string const &name) { return Path::is_name(name); })) {
+    request->send(400, "application/json", "{ \"error\": \"paths must be file names of the directory\" }");
+    return;
+  }
+  size_t count = 0;
+  const char *key = "deleted";
+  if (action == "delete") {
+    std::vector<std::string> paths;
+    paths.reserve(names.size());
+    for (auto const &name : names)
+      paths.push_back(Path::join(directory, name));
+    count = this->sd_mmc_card_->delete_files(paths);
+  } else if (action == "delete_matching") {
+    std::string pattern = request_arg(request, "pattern");
+    if (pattern.empty()) {
+      request->send(400, "application/json", "{ \"error\": \"missing pattern\" }");
+      return;
+    }
+    uint32_t older_than = strtoul(request_arg(request, "older_than").c_str(), nullptr, 10);
+    uint8_t depth = std::min<unsigned long>(strtoul(request_arg(request, "depth").c_str(), nullptr, 10), 255);
+    count = this->sd_mmc_card_->delete_files_matching(directory.c_str(), pattern.c_str(), older_than, depth);
+  } else if (action == "move") {
+    std::string destination = request_arg(request, "destination");
+    if (destination.empty()) {
+      request->send(400, "application/json", "{ \"error\": \"missing destination\" }");
+      return;
+    }
+    if (!Path::is_contained(destination)) {
+      request->send(400, "application/json", "{ \"error\": \"destination must be below the root path\" }");
+      return;
+    }
+    destination = this->build_absolute_path(destination);
+    std::vector<std::pair<std::string, std::string>> moves;
+    moves.reserve(names.size());
+    for (auto const &name : names)
+      moves.emplace_back(Path::join(directory, name), Path::join(destination, name));
+    count = this->sd_mmc_card_->move_files(moves);
+    key = "moved";
+  } else {
+    request->send(400, "application/json", "{ \"error\": \"unknown action\" }");
+    return;
+  }
+  ESP_LOGD(TAG, "batch %s in %s: %u files", action.c_str(), directory.c_str(), count);
+  std::string body = str_sprintf("{ \"%s\": %u }", key, count);
+  request->send(200, "application/json", body.c_str());
+}
+
+bool SDFileServer::matches_prefix(std::string_view url) const {
+  return url.substr(0, this->prefix_.size()) == this->prefix_;
 }
 
-std::string SDFileServer::extract_path_from_url(std::string const &url) const {
-  std::string prefix = this->build_prefix();
-  return url.substr(prefix.size(), url.size() - prefix.size());
+std::string_view SDFileServer::extract_path_from_url(std::string_view url) const {
+  if (url.size() < this->prefix_.size())
+    return {};
+  return url.substr(this->prefix_.size());
 }
 
-std::string SDFileServer::build_absolute_path(std::string relative_path) const {
+std::string SDFileServer::build_absolute_path(std::string_view relative_path) const {
   if (relative_path.size() == 0)
     return this->root_path_;
 
@@ -371,20 +1226,37 @@ std::string SDFileServer::build_absolute_path(std::string relative_path) const {
   return absolute;
 }
 
-std::string Path::file_name(std::string const &path) {
+std::string SDFileServer::request_path(AsyncWebServerRequest *request) const {
+  // the url is a temporary string with the idf web server, it is only viewed until the path is built
+  return this->build_absolute_path(this->extract_path_from_url(request->url().c_str()));
+}
+
+std::string Path::file_name(std::string_view path) {
   size_t pos = path.rfind(Path::separator);
-  if (pos != std::string::npos) {
-    return path.substr(pos + 1);
+  if (pos != std::string_view::npos) {
+    return std::string(path.substr(pos + 1));
   }
   return "";
 }
 
-bool Path::is_absolute(std::string const &path) { return path.size() && path[0] == separator; }
+bool Path::is_absolute(std::string_view path) { return path.size() && path[0] == separator; }
 
-bool Path::trailing_slash(std::string const &path) { return path.size() && path[path.length() - 1] == separator; }
+bool Path::is_name(std::string_view name) {
+  return !name.empty() && name != "." && name != ".." && name.find(separator) == std::string_view::npos;
+}
+
+bool Path::is_contained(std::string_view path) {
+  for (auto const &part : split_path(path)) {
+    if (part == "..")
+      return false;
+  }
+  return true;
+}
+
+bool Path::trailing_slash(std::string_view path) { return path.size() && path[path.length() - 1] == separator; }
 
-std::string Path::join(std::string const &first, std::string const &second) {
-  std::string result = first;
+std::string Path::join(std::string_view first, std::string_view second) {
+  std::string result(first);
   if (!trailing_slash(first) && !is_absolute(second)) {
     result.push_back(separator);
   }
@@ -395,71 +1267,128 @@ std::string Path::join(std::string const &first, std::string const &second) {
   return result;
 }
 
-std::string Path::remove_root_path(std::string path, std::string const &root) {
-  if (!str_startswith(path, root))
-    return path;
+std::string Path::remove_root_path(std::string_view path, std::string_view root) {
+  if (path.substr(0, root.size()) != root)
+    return std::string(path);
   if (path.size() == root.size() || path.size() < 2)
     return "/";
-  return path.erase(0, root.size());
+  return std::string(path.substr(root.size()));
 }
 
-std::vector<std::string> Path::split_path(std::string path) {
+std::vector<std::string> Path::split_path(std::string_view path) {
   std::vector<std::string> parts;
-  size_t pos = 0;
-  while ((pos = path.find('/')) != std::string::npos) {
-    std::string part = path.substr(0, pos);
-    if (!part.empty()) {
-      parts.push_back(part);
+  size_t start = 0;
+  size_t pos;
+  while ((pos = path.find(separator, start)) != std::string_view::npos) {
+    if (pos > start) {
+      parts.emplace_back(path.substr(start, pos - start));
     }
-    path.erase(0, pos + 1);
+    start = pos + 1;
   }
-  parts.push_back(path);
+  parts.emplace_back(path.substr(start));
   return parts;
 }
 
-std::string Path::extension(std::string const &file) {
+std::vector<std::string> Path::split_list(std::string const &list) {
+  std::vector<std::string> items;
+  size_t start = 0;
+  while (start <= list.size()) {
+    size_t end = list.find_first_of(",\n", start);
+    if (end == std::string::npos)
+      end = list.size();
+    std::string item = list.substr(start, end - start);
+    if (!item.empty() && item.back() == '\r')
+      item.pop_back();
+    if (!item.empty())
+      items.push_back(item);
+    start = end + 1;
+  }
+  return items;
+}
+
+std::string_view Path::extension(std::string_view file) {
   size_t pos = file.find_last_of('.');
-  if (pos == std::string::npos)
-    return "";
+  if (pos == std::string_view::npos)
+    return {};
   return file.substr(pos + 1);
 }
 
-std::string Path::file_type(std::string const &file) {
-  static const std::map<std::string, std::string> file_types = {
-      {"mp3", "Audio (MP3)"},   {"wav", "Audio (WAV)"}, {"png", "Image (PNG)"},   {"jpg", "Image (JPG)"},
-      {"jpeg", "Image (JPEG)"}, {"bmp", "Image (BMP)"}, {"txt", "Text (TXT)"},    {"log", "Text (LOG)"},
-      {"csv", "Text (CSV)"},    {"html", "Web (HTML)"}, {"css", "Web (CSS)"},     {"js", "Web (JS)"},
-      {"json", "Data (JSON)"},  {"xml", "Data (XML)"},  {"zip", "Archive (ZIP)"}, {"gz", "Archive (GZ)"},
-      {"tar", "Archive (TAR)"}, {"mp4", "Video (MP4)"}, {"avi", "Video (AVI)"},   {"webm", "Video (WEBM)"}};
+struct FileType {
+  std::string_view extension;
+  const char *mime_type;
+  const char *description;
+};
 
-  std::string ext = Path::extension(file);
+// sorted by extension for the binary search of find_file_type
+static constexpr FileType FILE_TYPES[] = {
+    {"avi", "video/x-msvideo", "Video (AVI)"},
+    {"bmp", "image/bmp", "Image (BMP)"},
+    {"css", "text/css", "Web (CSS)"},
+    {"csv", "text/csv", "Text (CSV)"},
+    {"gz", "application/gzip", "Archive (GZ)"},
+    {"html", "text/html", "Web (HTML)"},
+    {"jpeg", "image/jpeg", "Image (JPEG)"},
+    {"jpg", "image/jpeg", "Image (JPG)"},
+    {"js", "text/javascript", "Web (JS)"},
+    {"json", "application/json", "Data (JSON)"},
+    {"log", "text/plain", "Text (LOG)"},
+    {"mp3", "audio/mpeg", "Audio (MP3)"},
+    {"mp4", "video/mp4", "Video (MP4)"},
+    {"png", "image/png", "Image (PNG)"},
+    {"tar", "application/x-tar", "Archive (TAR)"},
+    {"txt", "text/plain", "Text (TXT)"},
+    {"wav", "audio/vnd.wav", "Audio (WAV)"},
+    {"webm", "video/webm", "Video (WEBM)"},
+    {"xml", "application/xml", "Data (XML)"},
+    {"zip", "application/zip", "Archive (ZIP)"},
+};
+// longest extension of the table, a longer one is unknown
+static constexpr size_t MAX_EXTENSION_SIZE = 4;
+
+static constexpr bool is_sorted(const FileType *types, size_t count) {
+  for (size_t i = 1; i < count; i++) {
+    if (!(types[i - 1].extension < types[i].extension))
+      return false;
+  }
+  return true;
+}
+static_assert(is_sorted(FILE_TYPES, std::size(FILE_TYPES)), "FILE_TYPES must be sorted by extension");
+
+static const FileType *find_file_type(std::string_view extension) {
+  if (extension.empty() || extension.size() > MAX_EXTENSION_SIZE)
+    return nullptr;
+  char lower[MAX_EXTENSION_SIZE];
+  for (size_t i = 0; i < extension.size(); i++)
+    lower[i] = std::tolower(static_cast<unsigned char>(extension[i]));
+  std::string_view key(lower, extension.size());
+  auto it = std::lower_bound(std::begin(FILE_TYPES), std::end(FILE_TYPES), key,
+                             [](FileType const &type, std::string_view key) { return type.extension < key; });
+  if (it == std::end(FILE_TYPES) || it->extension != key)
+    return nullptr;
+  return it;
+}
+
+std::string Path::file_type(std::string_view file) {
+  std::string_view ext = Path::extension(file);
   if (ext.empty())
     return "File";
 
-  std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
-  auto it = file_types.find(ext);
-  if (it != file_types.end())
-    return it->second;
-  return "File (" + ext + ")";
-}
-
-std::string Path::mime_type(std::string const &file) {
-  static const std::map<std::string, std::string> file_types = {
-      {"mp3", "audio/mpeg"},        {"wav", "audio/vnd.wav"},   {"png", "image/png"},       {"jpg", "image/jpeg"},
-      {"jpeg", "image/jpeg"},       {"bmp", "image/bmp"},       {"txt", "text/plain"},      {"log", "text/plain"},
-      {"csv", "text/csv"},          {"html", "text/html"},      {"css", "text/css"},        {"js", "text/javascript"},
-      {"json", "application/json"}, {"xml", "application/xml"}, {"zip", "application/zip"}, {"gz", "application/gzip"},
-      {"tar", "application/x-tar"}, {"mp4", "video/mp4"},       {"avi", "video/x-msvideo"}, {"webm", "video/webm"}};
-
-  std::string ext = Path::extension(file);
-  ESP_LOGD(TAG, "ext : %s", ext.c_str());
-  if (!ext.empty()) {
-    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
-    auto it = file_types.find(ext);
-    if (it != file_types.end())
-      return it->second;
-  }
-  return "application/octet-stream";
+  const FileType *type = find_file_type(ext);
+  if (type != nullptr)
+    return type->description;
+  std::string lower(ext);
+  std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return std::tolower(c); });
+  return "File (" + lower + ")";
+}
+
+const char *Path::mime_type(std::string_view file) {
+  const FileType *type = find_file_type(Path::extension(file));
+  return type != nullptr ? type->mime_type : "application/octet-stream";
+}
+
+bool Path::is_compressible(std::string_view mime_type) {
+  return mime_type.substr(0, 5) == "text/" || mime_type == "application/json" || mime_type == "application/xml" ||
+         mime_type == "image/bmp";
 }
 
 }  // namespace sd_file_server
@@ -1,7 +1,14 @@
 #pragma once
+#include <string_view>
 #include "esphome/core/component.h"
 #include "esphome/components/web_server_base/web_server_base.h"
 #include "../sd_mmc_card/sd_mmc_card.h"
+#include "tail.h"
+#include "transfer_scheduler.h"
+#include "upload.h"
+#ifdef USE_SENSOR
+#include "esphome/components/sensor/sensor.h"
+#endif
 
 namespace esphome {
 namespace sd_file_server {
@@ -10,11 +17,15 @@ class SDFileServer : public Component, public AsyncWebHandler {
  public:
   SDFileServer(web_server_base::WebServerBase *);
   void setup() override;
+  void loop() override;
   void dump_config() override;
   bool canHandle(AsyncWebServerRequest *request) const override;
   void handleRequest(AsyncWebServerRequest *request) override;
   void handleUpload(AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data, size_t len,
                     bool final) override;
+#ifndef USE_ESP_IDF
+  void handleBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) override;
+#endif
   bool isRequestHandlerTrivial() const override { return false; }
 
   void set_url_prefix(std::string const &);
@@ -23,51 +34,140 @@ class SDFileServer : public Component, public AsyncWebHandler {
   void set_deletion_enabled(bool);
   void set_download_enabled(bool);
   void set_upload_enabled(bool);
+  void set_compression_level(uint8_t);
+  void set_compression_min_size(size_t);
+  void set_max_downloads(uint8_t);
+  void set_max_uploads(uint8_t);
+  void set_buffer_budget(size_t);
+  void set_read_size(size_t);
+  void set_read_ahead(uint8_t);
+  size_t get_read_size() const;
+  void set_retry_after(uint32_t);
+#ifdef USE_SENSOR
+  SUB_SENSOR(active_downloads)
+  SUB_SENSOR(active_uploads)
+  SUB_SENSOR(queued_transfers)
+  SUB_SENSOR(rejected_transfers)
+#endif
 
  protected:
   web_server_base::WebServerBase *base_;
   sd_mmc_card::SdMmc *sd_mmc_card_;
 
   std::string url_prefix_;
+  /* url prefix with its leading slash, every request url is matched against it */
+  std::string prefix_{"/"};
   std::string root_path_;
   bool deletion_enabled_;
   bool download_enabled_;
   bool upload_enabled_;
-
-  std::string build_prefix() const;
-  std::string extract_path_from_url(std::string const &) const;
-  std::string build_absolute_path(std::string) const;
+  uint8_t compression_level_{0};
+  size_t compression_min_size_{0};
+  TransferScheduler scheduler_;
+  // bytes read from the card in one turn of a download, 0 for the read chunk size of the card profile
+  size_t read_size_{0};
+  // chunks of a file read ahead of the network, 0 to read only when the network asks for more
+  uint8_t read_ahead_{1};
+  // seconds a refused client is asked to wait
+  uint32_t retry_after_{5};
+  std::unique_ptr<sd_mmc_card::AtomicFile> upload_;
+  AsyncWebServerRequest *upload_request_{nullptr};
+  std::shared_ptr<TransferScheduler::Ticket> upload_ticket_;
+  TailHub tail_;
+  ResumableUpload resumable_;
+  /* state of the raw body upload being received */
+  AsyncWebServerRequest *body_request_{nullptr};
+  std::string body_path_;
+  int body_status_{0};
+  std::string body_error_;
+  size_t body_total_{0};
+  std::shared_ptr<TransferScheduler::Ticket> body_ticket_;
+
+  bool matches_prefix(std::string_view url) const;
+  std::string_view extract_path_from_url(std::string_view url) const;
+  std::string build_absolute_path(std::string_view) const;
+  /* Absolute path on the card of the file the request is about */
+  std::string request_path(AsyncWebServerRequest *) const;
+  /* Entries of a directory tree, without the sidecars of the components */
+  std::vector<sd_mmc_card::FileInfo> list_files(std::string const &path, uint8_t depth) const;
   void write_row(AsyncResponseStream *response, sd_mmc_card::FileInfo const &info) const;
   void handle_index(AsyncWebServerRequest *, std::string const &) const;
-  void handle_get(AsyncWebServerRequest *) const;
+  void handle_get(AsyncWebServerRequest *);
   void handle_delete(AsyncWebServerRequest *);
-  void handle_download(AsyncWebServerRequest *, std::string const &) const;
+  void handle_batch(AsyncWebServerRequest *);
+  void handle_download(AsyncWebServerRequest *, std::string const &);
+  /* Answer If-Match and If-None-Match with the content hash of the file, false when a response was sent */
+  bool check_preconditions(AsyncWebServerRequest *, std::string const &, Headers &headers);
+  void handle_manifest(AsyncWebServerRequest *, std::string const &);
+  void handle_search(AsyncWebServerRequest *, std::string const &);
+  void handle_archive(AsyncWebServerRequest *, std::string const &);
+  void handle_downsample(AsyncWebServerRequest *, std::string const &);
+  void handle_tail(AsyncWebServerRequest *, std::string const &);
+  void handle_upload_status(AsyncWebServerRequest *, std::string const &);
+  bool is_body_upload(AsyncWebServerRequest *) const;
+  bool is_resumable_upload(AsyncWebServerRequest *) const;
+  void handle_body_upload(AsyncWebServerRequest *);
+  void begin_body(AsyncWebServerRequest *, size_t length);
+  void write_body(const uint8_t *data, size_t len);
+  void end_body(AsyncWebServerRequest *);
+  void fail_body(int status, std::string const &error);
+  size_t max_chunk_size() const;
+#ifdef USE_SD_RECORDER
+  void handle_records(AsyncWebServerRequest *, std::string const &);
+#endif
+  bool should_compress(AsyncWebServerRequest *, std::string_view, uint64_t) const;
+  /* Take a download slot for buffers of buffer_size bytes, a refused request is answered with a 503 */
+  std::shared_ptr<TransferScheduler::Ticket> admit_download(AsyncWebServerRequest *, size_t buffer_size,
+                                                            bool compressed);
+  /* Read the card for the source in large chunks, in turn with the other downloads */
+  std::shared_ptr<StreamSource> schedule(std::shared_ptr<StreamSource>,
+                                         std::shared_ptr<TransferScheduler::Ticket> ticket) const;
+  void send_busy(AsyncWebServerRequest *) const;
+#ifdef USE_SENSOR
+  void update_sensors();
+#endif
+  void send_cached_file(AsyncWebServerRequest *, std::string const &,
+                        std::shared_ptr<const sd_mmc_card::CachedFile> const &, Headers const &headers = {}) const;
 };
 
 struct Path {
   static constexpr char separator = '/';
 
   /* Return the name of the file */
-  static std::string file_name(std::string const &);
+  static std::string file_name(std::string_view);
 
   /* Is the path an absolute path? */
-  static bool is_absolute(std::string const &);
+  static bool is_absolute(std::string_view);
+
+  /* Is it a single file name, without separator nor reference to a parent? */
+  static bool is_name(std::string_view);
+
+  /* Does the path stay below the directory it is joined to, having no parent reference? */
+  static bool is_contained(std::string_view);
 
   /* Does the path have a trailing slash? */
-  static bool trailing_slash(std::string const &);
+  static bool trailing_slash(std::string_view);
 
   /* Join two path */
-  static std::string join(std::string const &, std::string const &);
+  static std::string join(std::string_view, std::string_view);
+
+  static std::string remove_root_path(std::string_view path, std::string_view root);
+
+  static std::vector<std::string> split_path(std::string_view path);
 
-  static std::string remove_root_path(std::string path, std::string const &root);
+  /* Split a comma or new line separated list of paths */
+  static std::vector<std::string> split_list(std::string const &);
 
-  static std::vector<std::string> split_path(std::string path);
+  /* Extension of the file, a view into the given path */
+  static std::string_view extension(std::string_view);
 
-  static std::string extension(std::string const &);
+  static std::string file_type(std::string_view);
 
-  static std::string file_type(std::string const &);
+  /* Mime type of the file, a static string */
+  static const char *mime_type(std::string_view);
 
-  static std::string mime_type(std::string const &);
+  /* Is the mime type worth compressing? */
+  static bool is_compressible(std::string_view mime_type);
 };
 
 }  // namespace sd_file_server
@@ -0,0 +1,134 @@
+#include "search.h"
+#include "manifest.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace sd_file_server {
+
+static const char *TAG = "sd_file_server.search";
+
+static bool equals_ignore_case(std::string const &a, const char *b, size_t len) {
+  if (a.size() != len)
+    return false;
+  for (size_t i = 0; i < len; i++) {
+    if (tolower(static_cast<uint8_t>(a[i])) != tolower(static_cast<uint8_t>(b[i])))
+      return false;
+  }
+  return true;
+}
+
+bool SearchFilter::matches(sd_mmc_card::FileInfo const &info) const {
+  if ((this->type == Type::FILE && info.is_directory) || (this->type == Type::DIRECTORY && !info.is_directory))
+    return false;
+  // the cheap checks first, the name is only looked at for the entries in range
+  if (!info.is_directory && (info.size < this->min_size || info.size > this->max_size))
+    return false;
+  if ((this->from > 0 && info.mtime < this->from) || (this->to > 0 && info.mtime > this->to))
+    return false;
+  size_t slash = info.path.rfind('/');
+  const char *name = info.path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+  if (!this->extensions.empty()) {
+    const char *dot = strrchr(name, '.');
+    if (dot == nullptr)
+      return false;
+    size_t len = strlen(dot + 1);
+    if (std::none_of(this->extensions.begin(), this->extensions.end(),
+                     [dot, len](std::string const &extension) { return equals_ignore_case(extension, dot + 1, len); }))
+      return false;
+  }
+  return sd_mmc_card::glob_match(this->pattern.c_str(), name);
+}
+
+SearchSource::SearchSource(sd_mmc_card::SdMmc *card, std::string const &root, uint8_t depth, SearchFilter filter,
+                           size_t limit, uint32_t timeout)
+    : walker_(card, root, depth),
+      root_(root),
+      filter_(std::move(filter)),
+      limit_(limit),
+      timeout_(timeout),
+      start_(millis()) {}
+
+SearchSource::~SearchSource() {
+  ESP_LOGD(TAG, "Found %u matches in %u entries of %u directories in %u ms", this->matches_, this->scanned_,
+           this->walker_.get_directories(), millis() - this->start_);
+}
+
+size_t SearchSource::read(uint8_t *buffer, size_t len) {
+  size_t written = 0;
+  while (written < len) {
+    if (this->pending_position_ >= this->pending_.size()) {
+      if (this->done_)
+        break;
+      this->pending_.clear();
+      this->pending_position_ = 0;
+      this->search(len);
+      continue;
+    }
+    size_t n = std::min(len - written, this->pending_.size() - this->pending_position_);
+    memcpy(buffer + written, this->pending_.data() + this->pending_position_, n);
+    this->pending_position_ += n;
+    written += n;
+  }
+  return written;
+}
+
+void SearchSource::search(size_t len) {
+  if (!this->started_) {
+    this->pending_ = "{\"matches\":[";
+    this->started_ = true;
+  }
+  // walk until a chunk of results is ready, the walk or the search budget is over
+  const char *stopped = nullptr;
+  while (this->pending_.size() < len) {
+    if (this->matches_ >= this->limit_) {
+      stopped = "limit";
+      break;
+    }
+    if (millis() - this->start_ >= this->timeout_) {
+      stopped = "timeout";
+      break;
+    }
+    auto info = this->walker_.next();
+    if (!info.has_value()) {
+      stopped = "";
+      break;
+    }
+    if (is_sidecar(info->path))
+      continue;
+    this->scanned_++;
+    if (this->filter_.matches(*info))
+      this->format(*info);
+  }
+  if (stopped == nullptr)
+    return;
+  // complete only when the whole tree was walked
+  this->pending_ += str_sprintf("],\"scanned\":%u,\"complete\":%s", this->scanned_, *stopped ? "false" : "true");
+  if (*stopped)
+    this->pending_ += str_sprintf(",\"stopped\":\"%s\"", stopped);
+  this->pending_ += "}";
+  this->done_ = true;
+}
+
+void SearchSource::format(sd_mmc_card::FileInfo const &info) {
+  size_t start = 0;
+  if (info.path.compare(0, this->root_.size(), this->root_) == 0)
+    start = this->root_.size();
+  while (start < info.path.size() && info.path[start] == '/')
+    start++;
+  if (this->matches_ > 0)
+    this->pending_ += ",";
+  this->pending_ += "{\"path\":";
+  append_json_string(this->pending_, info.path.substr(start));
+  this->pending_ += str_sprintf(",\"size\":%llu,\"mtime\":%lld,\"is_directory\":%s}",
+                                static_cast<unsigned long long>(info.size), static_cast<long long>(info.mtime),
+                                info.is_directory ? "true" : "false");
+  this->matches_++;
+}
+
+}  // namespace sd_file_server
+}  // namespace esphome
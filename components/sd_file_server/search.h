@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+#include "stream_response.h"
+#include "../sd_mmc_card/sd_mmc_card.h"
+
+namespace esphome {
+namespace sd_file_server {
+
+/* Conditions an entry must meet to be found by a search */
+struct SearchFilter {
+  enum class Type : uint8_t { FILE, DIRECTORY, ANY };
+
+  /* Glob pattern matched against the name */
+  std::string pattern{"*"};
+  /* Extensions of the files, without the dot, any when empty */
+  std::vector<std::string> extensions;
+  uint64_t min_size{0};
+  uint64_t max_size{UINT64_MAX};
+  /* Range of modification times, unix time in seconds, included */
+  time_t from{0};
+  time_t to{0};
+  Type type{Type::FILE};
+
+  bool matches(sd_mmc_card::FileInfo const &info) const;
+};
+
+/* Walk a directory tree on the card and stream the entries matching a filter as json while they are found.
+ *
+ * The walk stops after limit matches or after timeout milliseconds, the end of the response tells whether the whole
+ * tree was searched. Only the directories being walked are held in memory.
+ */
+class SearchSource : public StreamSource {
+ public:
+  SearchSource(sd_mmc_card::SdMmc *card, std::string const &root, uint8_t depth, SearchFilter filter, size_t limit,
+               uint32_t timeout);
+  ~SearchSource() override;
+  size_t read(uint8_t *buffer, size_t len) override;
+
+ protected:
+  void search(size_t len);
+  void format(sd_mmc_card::FileInfo const &info);
+
+  sd_mmc_card::DirectoryWalker walker_;
+  // removed from the paths of the results
+  std::string root_;
+  SearchFilter filter_;
+  size_t limit_;
+  uint32_t timeout_;
+  uint32_t start_;
+  size_t matches_{0};
+  uint32_t scanned_{0};
+  std::string pending_;
+  size_t pending_position_{0};
+  bool started_{false};
+  bool done_{false};
+};
+
+}  // namespace sd_file_server
+}  // namespace esphome
@@ -0,0 +1,54 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.components import sensor
+from esphome.const import (
+    CONF_TYPE,
+    STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
+)
+from . import (
+    SDFileServer,
+    CONF_SD_FILE_SERVER_ID,
+)
+
+DEPENDENCIES = ["sd_file_server"]
+
+CONF_ACTIVE_DOWNLOADS = "active_downloads"
+CONF_ACTIVE_UPLOADS = "active_uploads"
+CONF_QUEUED_TRANSFERS = "queued_transfers"
+CONF_REJECTED_TRANSFERS = "rejected_transfers"
+
+GAUGE_CONFIG_SCHEMA = sensor.sensor_schema(
+    accuracy_decimals=0,
+    state_class=STATE_CLASS_MEASUREMENT,
+).extend(
+    {
+        cv.GenerateID(CONF_SD_FILE_SERVER_ID): cv.use_id(SDFileServer),
+    }
+)
+
+COUNTER_CONFIG_SCHEMA = sensor.sensor_schema(
+    accuracy_decimals=0,
+    state_class=STATE_CLASS_TOTAL_INCREASING,
+).extend(
+    {
+        cv.GenerateID(CONF_SD_FILE_SERVER_ID): cv.use_id(SDFileServer),
+    }
+)
+
+CONFIG_SCHEMA = cv.typed_schema(
+    {
+        CONF_ACTIVE_DOWNLOADS: GAUGE_CONFIG_SCHEMA,
+        CONF_ACTIVE_UPLOADS: GAUGE_CONFIG_SCHEMA,
+        CONF_QUEUED_TRANSFERS: GAUGE_CONFIG_SCHEMA,
+        CONF_REJECTED_TRANSFERS: COUNTER_CONFIG_SCHEMA,
+    },
+    lower=True,
+)
+
+
+async def to_code(config):
+    server = await cg.get_variable(config[CONF_SD_FILE_SERVER_ID])
+    var = await sensor.new_sensor(config)
+    func = getattr(server, f"set_{config[CONF_TYPE]}_sensor")
+    cg.add(func(var))
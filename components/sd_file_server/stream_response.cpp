@@ -0,0 +1,101 @@
+#include "stream_response.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+
+#ifdef USE_ESP_IDF
+#include <esp_http_server.h>
+#endif
+
+namespace esphome {
+namespace sd_file_server {
+
+static const char *TAG = "sd_file_server";
+
+FileSource::FileSource(std::unique_ptr<sd_mmc_card::FileHandle> file) : file_(std::move(file)), start_(millis()) {}
+
+FileSource::~FileSource() { ESP_LOGV(TAG, "Read %u bytes in %u ms", this->bytes_read_, millis() - this->start_); }
+
+size_t FileSource::read(uint8_t *buffer, size_t len) {
+  size_t n = this->file_->read(buffer, len);
+  this->bytes_read_ += n;
+  return n;
+}
+
+void append_json_string(std::string &out, std::string const &value) {
+  out += '"';
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<uint8_t>(c) < 0x20) {
+      out += str_sprintf("\\u%04x", c);
+    } else {
+      out += c;
+    }
+  }
+  out += '"';
+}
+
+void append_csv_field(std::string &out, std::string const &value) {
+  out += '"';
+  for (char c : value) {
+    if (c == '"')
+      out += '"';
+    out += c;
+  }
+  out += '"';
+}
+
+#ifdef USE_ESP_IDF
+static const char *status_string(int code) {
+  switch (code) {
+    case 200:
+      return "200 OK";
+    case 206:
+      return "206 Partial Content";
+    case 304:
+      return "304 Not Modified";
+    case 412:
+      return "412 Precondition Failed";
+    default:
+      return "500 Internal Server Error";
+  }
+}
+
+void send_stream(AsyncWebServerRequest *request, int code, const char *content_type,
+                 std::shared_ptr<StreamSource> source, Headers const &headers) {
+  httpd_req_t *req = *request;
+  httpd_resp_set_status(req, status_string(code));
+  httpd_resp_set_type(req, content_type);
+  // headers must stay valid until the response is sent
+  for (auto const &header : headers)
+    httpd_resp_set_hdr(req, header.first.c_str(), header.second.c_str());
+
+  std::unique_ptr<uint8_t[]> buffer(new uint8_t[STREAM_CHUNK_SIZE]);
+  size_t len;
+  while ((len = source->read(buffer.get(), STREAM_CHUNK_SIZE)) > 0) {
+    if (httpd_resp_send_chunk(req, reinterpret_cast<const char *>(buffer.get()), len) != ESP_OK) {
+      ESP_LOGW(TAG, "Connection closed while streaming");
+      return;
+    }
+  }
+  httpd_resp_send_chunk(req, nullptr, 0);
+}
+#else
+void send_stream(AsyncWebServerRequest *request, int code, const char *content_type,
+                 std::shared_ptr<StreamSource> source, Headers const &headers) {
+  // the source is kept alive by the filler until the response is destroyed
+  auto *response = request->beginChunkedResponse(
+      content_type, [source](uint8_t *buffer, size_t max_len, size_t index) -> size_t {
+        return source->read(buffer, max_len);
+      });
+  response->setCode(code);
+  for (auto const &header : headers)
+    response->addHeader(header.first.c_str(), header.second.c_str());
+  request->send(response);
+}
+#endif
+
+}  // namespace sd_file_server
+}  // namespace esphome
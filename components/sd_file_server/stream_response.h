@@ -0,0 +1,48 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "esphome/components/web_server_base/web_server_base.h"
+#include "../sd_mmc_card/sd_mmc_card.h"
+
+namespace esphome {
+namespace sd_file_server {
+
+/* Size of the buffer used to send a streamed response */
+static constexpr size_t STREAM_CHUNK_SIZE = 4096;
+
+/* Produce a response body chunk by chunk */
+class StreamSource {
+ public:
+  virtual ~StreamSource() = default;
+  /* Fill at most len bytes of the buffer, return the number of bytes written, 0 once the stream is over */
+  virtual size_t read(uint8_t *buffer, size_t len) = 0;
+};
+
+/* Read the content of an open file */
+class FileSource : public StreamSource {
+ public:
+  explicit FileSource(std::unique_ptr<sd_mmc_card::FileHandle> file);
+  ~FileSource() override;
+  size_t read(uint8_t *buffer, size_t len) override;
+
+ protected:
+  std::unique_ptr<sd_mmc_card::FileHandle> file_;
+  uint32_t start_;
+  uint32_t bytes_read_{0};
+};
+
+using Headers = std::vector<std::pair<std::string, std::string>>;
+
+/* Append the value as a quoted json string */
+void append_json_string(std::string &out, std::string const &value);
+/* Append the value as a quoted csv field, the quotes it contains are doubled */
+void append_csv_field(std::string &out, std::string const &value);
+
+/* Send a chunked response with a body produced by the source, memory usage is bounded by STREAM_CHUNK_SIZE */
+void send_stream(AsyncWebServerRequest *request, int code, const char *content_type,
+                 std::shared_ptr<StreamSource> source, Headers const &headers = {});
+
+}  // namespace sd_file_server
+}  // namespace esphome
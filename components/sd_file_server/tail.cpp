@@ -0,0 +1,301 @@
+#include "tail.h"
+#include <algorithm>
+#include <cstring>
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+
+#ifdef USE_ESP_IDF
+#include <sys/socket.h>
+#endif
+
+namespace esphome {
+namespace sd_file_server {
+
+static const char *TAG = "sd_file_server";
+static const char *const KEEPALIVE_EVENT = ": keepalive\n\n";
+
+std::string format_event(const uint8_t *data, size_t len) {
+  const char *text = reinterpret_cast<const char *>(data);
+  // the final new line of the data does not start an empty line
+  if (len > 0 && text[len - 1] == '\n')
+    len--;
+  std::string event;
+  event.reserve(len + 16);
+  size_t start = 0;
+  while (start <= len) {
+    const char *end = static_cast<const char *>(memchr(text + start, '\n', len - start));
+    size_t line_end = end != nullptr ? end - text : len;
+    size_t line_len = line_end - start;
+    if (line_len > 0 && text[line_end - 1] == '\r')
+      line_len--;
+    event += "data: ";
+    event.append(text + start, line_len);
+    event += '\n';
+    start = line_end + 1;
+  }
+  event += '\n';
+  return event;
+}
+
+std::string read_tail(sd_mmc_card::SdMmc *card, std::string const &path, size_t lines, size_t bytes,
+                      size_t max_size) {
+  uint64_t size = card->file_size(path).value_or(0);
+  auto file = card->open_file(path, "rb");
+  if (file == nullptr)
+    return "";
+  uint64_t start = size - std::min<uint64_t>(size, lines > 0 ? max_size : std::min(bytes, max_size));
+  if (lines > 0) {
+    // scan backward block by block until enough lines are found
+    uint8_t block[512];
+    uint64_t position = size;
+    size_t found = 0;
+    bool skip_last = true;
+    while (position > start && found < lines) {
+      size_t n = std::min<uint64_t>(sizeof(block), position - start);
+      position -= n;
+      file->seek(position);
+      if (file->read(block, n) != n)
+        break;
+      for (size_t i = n; i-- > 0;) {
+        if (block[i] != '\n')
+          continue;
+        // the new line ending the file does not start a line
+        if (skip_last && position + i == size - 1)
+          continue;
+        if (++found == lines) {
+          start = position + i + 1;
+          break;
+        }
+      }
+      skip_last = false;
+    }
+  }
+  std::string content(size - start, '\0');
+  file->seek(start);
+  content.resize(file->read(reinterpret_cast<uint8_t *>(&content[0]), content.size()));
+  return content;
+}
+
+TailViewer::TailViewer(std::string const &path) : path_(path) {}
+
+void TailViewer::push(std::shared_ptr<const std::string> const &event) {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  if (this->pending_ + event->size() > MAX_PENDING) {
+    this->dropped_++;
+    return;
+  }
+  if (this->dropped_ > 0) {
+    auto notice = std::make_shared<const std::string>(str_sprintf("event: dropped\ndata: %u\n\n", this->dropped_));
+    this->pending_ += notice->size();
+    this->events_.push_back(notice);
+    this->dropped_ = 0;
+  }
+  this->pending_ += event->size();
+  this->events_.push_back(event);
+}
+
+size_t TailViewer::read(uint8_t *buffer, size_t len) {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  size_t written = 0;
+  while (written < len && !this->events_.empty()) {
+    auto const &event = this->events_.front();
+    size_t n = std::min(len - written, event->size() - this->position_);
+    memcpy(buffer + written, event->data() + this->position_, n);
+    this->position_ += n;
+    written += n;
+    if (this->position_ == event->size()) {
+      this->pending_ -= event->size();
+      this->events_.pop_front();
+      this->position_ = 0;
+    }
+  }
+  return written;
+}
+
+void TailViewer::close() {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  this->closed_ = true;
+  this->events_.clear();
+  this->pending_ = 0;
+}
+
+bool TailViewer::is_closed() {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  return this->closed_;
+}
+
+bool TailViewer::has_pending() {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  if (this->closed_)
+    return false;
+#ifdef USE_ESP_IDF
+  if (this->sent_ < this->chunk_.size())
+    return true;
+#endif
+  return !this->events_.empty();
+}
+
+#ifdef USE_ESP_IDF
+void TailViewer::set_socket(httpd_handle_t handle, int fd, void *context) {
+  this->handle_ = handle;
+  this->fd_ = fd;
+  this->context_ = context;
+}
+
+bool TailViewer::send() {
+  this->queued_ = false;
+  // closed by the server since the send was queued, or the socket now belongs to another connection
+  if (this->is_closed() || httpd_sess_get_ctx(this->handle_, this->fd_) != this->context_)
+    return false;
+  while (true) {
+    if (this->sent_ == this->chunk_.size()) {
+      // the response was started with chunked encoding, each write is a chunk
+      this->chunk_.resize(CHUNK_SIZE);
+      size_t len = this->read(reinterpret_cast<uint8_t *>(&this->chunk_[0]), CHUNK_SIZE);
+      this->chunk_.resize(len);
+      this->sent_ = 0;
+      if (len == 0)
+        return true;
+      this->chunk_.insert(0, str_sprintf("%X\r\n", static_cast<unsigned>(len)));
+      this->chunk_ += "\r\n";
+    }
+    int n = httpd_socket_send(this->handle_, this->fd_, this->chunk_.data() + this->sent_,
+                              this->chunk_.size() - this->sent_, MSG_DONTWAIT);
+    // the socket buffer is full, the rest of the chunk waits for the next send
+    if (n == HTTPD_SOCK_ERR_TIMEOUT)
+      return true;
+    if (n <= 0) {
+      this->close();
+      httpd_sess_trigger_close(this->handle_, this->fd_);
+      return false;
+    }
+    this->sent_ += n;
+  }
+}
+
+static void send_work(void *context) {
+  auto *viewer = static_cast<std::shared_ptr<TailViewer> *>(context);
+  if (!(*viewer)->send())
+    ESP_LOGD(TAG, "Stopped following %s", (*viewer)->get_path().c_str());
+  delete viewer;
+}
+
+void TailViewer::queue_send() {
+  if (this->queued_.exchange(true))
+    return;
+  auto *viewer = new std::shared_ptr<TailViewer>(this->shared_from_this());
+  if (httpd_queue_work(this->handle_, send_work, viewer) != ESP_OK) {
+    this->queued_ = false;
+    delete viewer;
+  }
+}
+
+static void free_viewer(void *context) {
+  // called by the server task once the session is closed, no send of this viewer can run at the same time
+  auto *viewer = static_cast<std::shared_ptr<TailViewer> *>(context);
+  (*viewer)->close();
+  delete viewer;
+}
+#endif
+
+void TailHub::on_append(const char *path, const uint8_t *data, size_t len) {
+  std::string file(path);
+  {
+    std::lock_guard<std::mutex> guard(this->lock_);
+    bool followed =
+        std::any_of(this->viewers_.begin(), this->viewers_.end(), [&file](std::weak_ptr<TailViewer> const &v) {
+          auto viewer = v.lock();
+          return viewer != nullptr && viewer->get_path() == file;
+        });
+    if (!followed)
+      return;
+  }
+  this->broadcast(&file, std::make_shared<const std::string>(format_event(data, len)));
+}
+
+void TailHub::broadcast(std::string const *path, std::shared_ptr<const std::string> const &event) {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  for (auto const &it : this->viewers_) {
+    auto viewer = it.lock();
+    if (viewer != nullptr && (path == nullptr || viewer->get_path() == *path))
+      viewer->push(event);
+  }
+}
+
+bool TailHub::follow(AsyncWebServerRequest *request, std::string const &path, std::string const &backlog) {
+  if (this->size() >= MAX_VIEWERS)
+    return false;
+  auto viewer = std::make_shared<TailViewer>(path);
+  if (!backlog.empty())
+    viewer->push(std::make_shared<const std::string>(
+        format_event(reinterpret_cast<const uint8_t *>(backlog.data()), backlog.size())));
+
+#ifdef USE_ESP_IDF
+  httpd_req_t *req = *request;
+  httpd_resp_set_status(req, "200 OK");
+  httpd_resp_set_type(req, "text/event-stream");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  httpd_resp_set_hdr(req, "Connection", "keep-alive");
+  // start the chunked response, the events are then written to the socket from the main loop
+  if (httpd_resp_send_chunk(req, KEEPALIVE_EVENT, strlen(KEEPALIVE_EVENT)) != ESP_OK)
+    return true;
+  req->sess_ctx = new std::shared_ptr<TailViewer>(viewer);
+  req->free_ctx = free_viewer;
+  viewer->set_socket(req->handle, httpd_req_to_sockfd(req), req->sess_ctx);
+#else
+  // the filler owns the viewer, it is released with the response when the client disconnects
+  auto *response = request->beginChunkedResponse(
+      "text/event-stream", [viewer](uint8_t *buffer, size_t max_len, size_t index) -> size_t {
+        size_t n = viewer->read(buffer, max_len);
+        return n > 0 ? n : RESPONSE_TRY_AGAIN;
+      });
+  response->addHeader("Cache-Control", "no-cache");
+  request->send(response);
+#endif
+
+  std::lock_guard<std::mutex> guard(this->lock_);
+  this->viewers_.push_back(viewer);
+  ESP_LOGD(TAG, "Following %s, %u viewers", path.c_str(), this->viewers_.size());
+  return true;
+}
+
+void TailHub::loop() {
+  if (this->size() == 0)
+    return;
+  if (millis() - this->last_keepalive_ > KEEPALIVE_INTERVAL) {
+    this->last_keepalive_ = millis();
+    this->broadcast(nullptr, std::make_shared<const std::string>(KEEPALIVE_EVENT));
+  }
+
+#ifdef USE_ESP_IDF
+  std::vector<std::shared_ptr<TailViewer>> viewers;
+  {
+    std::lock_guard<std::mutex> guard(this->lock_);
+    for (auto const &it : this->viewers_) {
+      auto viewer = it.lock();
+      if (viewer != nullptr)
+        viewers.push_back(viewer);
+    }
+  }
+  // the sends run on the server task, a slow client never holds the main loop
+  for (auto const &viewer : viewers) {
+    if (viewer->has_pending())
+      viewer->queue_send();
+  }
+#endif
+}
+
+size_t TailHub::size() {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  this->viewers_.erase(std::remove_if(this->viewers_.begin(), this->viewers_.end(),
+                                      [](std::weak_ptr<TailViewer> const &v) {
+                                        auto viewer = v.lock();
+                                        return viewer == nullptr || viewer->is_closed();
+                                      }),
+                       this->viewers_.end());
+  return this->viewers_.size();
+}
+
+}  // namespace sd_file_server
+}  // namespace esphome
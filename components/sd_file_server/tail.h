@@ -0,0 +1,98 @@
+#pragma once
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "esphome/components/web_server_base/web_server_base.h"
+#include "../sd_mmc_card/sd_mmc_card.h"
+
+#ifdef USE_ESP_IDF
+#include <esp_http_server.h>
+#endif
+
+namespace esphome {
+namespace sd_file_server {
+
+/* Format data as a server sent event, one data field per line */
+std::string format_event(const uint8_t *data, size_t len);
+
+/* Read the end of a file, the last lines when lines > 0 otherwise the last bytes, at most max_size bytes */
+std::string read_tail(sd_mmc_card::SdMmc *card, std::string const &path, size_t lines, size_t bytes,
+                      size_t max_size);
+
+/* Connection following a file, the events are queued until the connection can take them */
+class TailViewer : public std::enable_shared_from_this<TailViewer> {
+ public:
+  static constexpr size_t MAX_PENDING = 16 * 1024;
+  static constexpr size_t CHUNK_SIZE = 1024;
+
+  explicit TailViewer(std::string const &path);
+  std::string const &get_path() const { return this->path_; }
+  /* Queue an event, the same event is shared by every viewer of the file */
+  void push(std::shared_ptr<const std::string> const &event);
+  /* Copy at most len bytes of the queued events, return 0 when nothing is queued */
+  size_t read(uint8_t *buffer, size_t len);
+  void close();
+  bool is_closed();
+  /* Are there events or part of a chunk still to send? */
+  bool has_pending();
+
+#ifdef USE_ESP_IDF
+  /* Send as much of the queued events as the socket takes without waiting, false once the connection is gone.
+   * Runs on the http server task, which also closes the connection: the session can not go away during a send.
+   */
+  bool send();
+  void set_socket(httpd_handle_t handle, int fd, void *context);
+  /* Queue a send on the http server task unless one is already queued */
+  void queue_send();
+#endif
+
+ protected:
+  std::string path_;
+  std::mutex lock_;
+  std::deque<std::shared_ptr<const std::string>> events_;
+  size_t position_{0};
+  size_t pending_{0};
+  uint32_t dropped_{0};
+  bool closed_{false};
+#ifdef USE_ESP_IDF
+  httpd_handle_t handle_{nullptr};
+  int fd_{-1};
+  // session context of the connection, a socket number reused by another connection does not match it
+  void *context_{nullptr};
+  // chunk being sent and how much of it the socket took
+  std::string chunk_;
+  size_t sent_{0};
+  std::atomic<bool> queued_{false};
+#endif
+};
+
+/* Dispatch the data appended to the files to the connections following them.
+ *
+ * Each append is formatted once and the event is shared by all the viewers of the file, the file itself is
+ * never read again. A viewer too slow to keep up loses events and is told how many.
+ */
+class TailHub {
+ public:
+  static constexpr size_t MAX_VIEWERS = 4;
+  static constexpr uint32_t KEEPALIVE_INTERVAL = 15000;
+
+  void on_append(const char *path, const uint8_t *data, size_t len);
+  /* Start an event stream following the file, backlog is sent first. false when there are too many viewers */
+  bool follow(AsyncWebServerRequest *request, std::string const &path, std::string const &backlog);
+  /* Queue the keepalives and the sends of the pending events, drop the closed connections */
+  void loop();
+  size_t size();
+
+ protected:
+  void broadcast(std::string const *path, std::shared_ptr<const std::string> const &event);
+
+  std::mutex lock_;
+  std::vector<std::weak_ptr<TailViewer>> viewers_;
+  uint32_t last_keepalive_{0};
+};
+
+}  // namespace sd_file_server
+}  // namespace esphome
@@ -0,0 +1,136 @@
+#include "transfer_scheduler.h"
+#include <algorithm>
+#include <cstring>
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace sd_file_server {
+
+static const char *TAG = "sd_file_server.transfers";
+
+TransferScheduler::Ticket::Ticket(TransferScheduler *scheduler, Kind kind, size_t buffer_size)
+    : scheduler_(scheduler), kind_(kind), buffer_size_(buffer_size), active_at_(millis()) {}
+
+TransferScheduler::Ticket::~Ticket() { this->scheduler_->release(this); }
+
+void TransferScheduler::Ticket::touch() { this->active_at_ = millis(); }
+
+std::shared_ptr<TransferScheduler::Ticket> TransferScheduler::admit(Kind kind, size_t buffer_size) {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  uint8_t &active = this->active_[static_cast<uint8_t>(kind)];
+  uint8_t max = kind == Kind::DOWNLOAD ? this->max_downloads_ : this->max_uploads_;
+  // a transfer larger than the whole budget still runs alone
+  if (active >= max || (this->buffer_used_ > 0 && this->buffer_used_ + buffer_size > this->buffer_budget_)) {
+    this->rejected_++;
+    ESP_LOGD(TAG, "Refused %s, %u downloads and %u uploads active, %u bytes of buffers used",
+             kind == Kind::DOWNLOAD ? "a download" : "an upload", this->active_[0], this->active_[1],
+             this->buffer_used_);
+    return nullptr;
+  }
+  active++;
+  this->buffer_used_ += buffer_size;
+  auto ticket = std::make_shared<Ticket>(this, kind, buffer_size);
+  if (kind == Kind::UPLOAD)
+    this->uploads_.push_back(ticket.get());
+  return ticket;
+}
+
+void TransferScheduler::release(Ticket *ticket) {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  if (ticket->kind_ == Kind::UPLOAD)
+    this->uploads_.erase(std::remove(this->uploads_.begin(), this->uploads_.end(), ticket), this->uploads_.end());
+  if (ticket->expired_)
+    return;
+  this->active_[static_cast<uint8_t>(ticket->kind_)]--;
+  this->buffer_used_ -= ticket->buffer_size_;
+}
+
+void TransferScheduler::expire(uint32_t now) {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  for (auto *ticket : this->uploads_) {
+    if (ticket->expired_ || now - ticket->active_at_ < UPLOAD_TIMEOUT)
+      continue;
+    ESP_LOGW(TAG, "Upload without data for %u s, releasing its slot", UPLOAD_TIMEOUT / 1000);
+    ticket->expired_ = true;
+    this->active_[static_cast<uint8_t>(Kind::UPLOAD)]--;
+    this->buffer_used_ -= ticket->buffer_size_;
+  }
+}
+
+void TransferScheduler::begin_turn() {
+  std::unique_lock<std::mutex> lock(this->lock_);
+  uint32_t turn = this->next_turn_++;
+  this->turn_.wait(lock, [this, turn] { return this->serving_ == turn; });
+}
+
+void TransferScheduler::end_turn() {
+  {
+    std::lock_guard<std::mutex> guard(this->lock_);
+    this->serving_++;
+  }
+  this->turn_.notify_all();
+}
+
+uint8_t TransferScheduler::get_active(Kind kind) const {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  return this->active_[static_cast<uint8_t>(kind)];
+}
+
+uint32_t TransferScheduler::get_queued() const {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  // the turn being served is not waiting
+  uint32_t taken = this->next_turn_ - this->serving_;
+  return taken > 0 ? taken - 1 : 0;
+}
+
+uint32_t TransferScheduler::get_rejected() const {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  return this->rejected_;
+}
+
+ScheduledSource::ScheduledSource(std::shared_ptr<StreamSource> source,
+                                 std::shared_ptr<TransferScheduler::Ticket> ticket, size_t read_size)
+    : source_(std::move(source)), ticket_(std::move(ticket)), read_size_(read_size), buffer_(new uint8_t[read_size]) {}
+
+size_t ScheduledSource::read(uint8_t *buffer, size_t len) {
+  if (this->position_ == this->length_) {
+    if (this->eof_)
+      return 0;
+    this->fill();
+  }
+  size_t n = std::min(len, this->length_ - this->position_);
+  memcpy(buffer, this->buffer_.get() + this->position_, n);
+  this->position_ += n;
+  return n;
+}
+
+void ScheduledSource::fill() {
+  size_t length = 0;
+  this->ticket_->begin_turn();
+  while (length < this->read_size_) {
+    size_t n = this->source_->read(this->buffer_.get() + length, this->read_size_ - length);
+    if (n == 0) {
+      this->eof_ = true;
+      break;
+    }
+    length += n;
+  }
+  this->ticket_->end_turn();
+  this->length_ = length;
+  this->position_ = 0;
+}
+
+ReadAheadSource::ReadAheadSource(sd_mmc_card::SdMmc *card, std::shared_ptr<TransferScheduler::Ticket> ticket,
+                                 uint8_t buffer_count, size_t buffer_size)
+    : ticket_(std::move(ticket)), reader_(card, this->ticket_.get(), buffer_count, buffer_size) {}
+
+size_t ReadAheadSource::Reader::read_chunk(uint8_t *buffer, size_t len) {
+  this->ticket_->begin_turn();
+  size_t n = ReadAhead::read_chunk(buffer, len);
+  this->ticket_->end_turn();
+  return n;
+}
+
+}  // namespace sd_file_server
+}  // namespace esphome
@@ -0,0 +1,140 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "stream_response.h"
+#include "../sd_mmc_card/read_ahead.h"
+
+namespace esphome {
+namespace sd_file_server {
+
+/* Admission and fair card access of the concurrent transfers.
+ *
+ * Each download or upload takes a ticket before it starts. A transfer over the limit of its kind, or whose buffers
+ * do not fit in what is left of the budget, is refused and answered with a 503 instead of running the device out of
+ * memory.
+ *
+ * The downloads read the card in large chunks through a ScheduledSource. The reads take turns in the order they
+ * asked for the card, so each transfer gets one large sequential read per round instead of every stream seeking the
+ * card for each network chunk.
+ */
+class TransferScheduler {
+ public:
+  enum class Kind : uint8_t { DOWNLOAD, UPLOAD };
+
+  /* Time without data after which an upload is considered abandoned and its slot released */
+  static constexpr uint32_t UPLOAD_TIMEOUT = 30000;
+
+  /* Slot of an admitted transfer, released with the last reference to it */
+  class Ticket {
+   public:
+    Ticket(TransferScheduler *scheduler, Kind kind, size_t buffer_size);
+    ~Ticket();
+    Ticket(Ticket const &) = delete;
+    Ticket &operator=(Ticket const &) = delete;
+
+    Kind get_kind() const { return this->kind_; }
+    /* Data was received for the upload */
+    void touch();
+    /* Wait for the turn of the transfer on the card */
+    void begin_turn() { this->scheduler_->begin_turn(); }
+    void end_turn() { this->scheduler_->end_turn(); }
+
+   protected:
+    friend class TransferScheduler;
+
+    TransferScheduler *scheduler_;
+    Kind kind_;
+    size_t buffer_size_;
+    std::atomic<uint32_t> active_at_;
+    // the slot was released because the upload was abandoned
+    bool expired_{false};
+  };
+
+  void set_max_downloads(uint8_t max) { this->max_downloads_ = max; }
+  void set_max_uploads(uint8_t max) { this->max_uploads_ = max; }
+  void set_buffer_budget(size_t budget) { this->buffer_budget_ = budget; }
+  uint8_t get_max_downloads() const { return this->max_downloads_; }
+  uint8_t get_max_uploads() const { return this->max_uploads_; }
+  size_t get_buffer_budget() const { return this->buffer_budget_; }
+
+  /* Take a slot for a transfer holding buffer_size bytes, nullptr when saturated */
+  std::shared_ptr<Ticket> admit(Kind kind, size_t buffer_size);
+  /* Release the slots of the uploads without data for UPLOAD_TIMEOUT */
+  void expire(uint32_t now);
+
+  uint8_t get_active(Kind kind) const;
+  /* Transfers waiting for their turn on the card */
+  uint32_t get_queued() const;
+  uint32_t get_rejected() const;
+
+ protected:
+  void begin_turn();
+  void end_turn();
+  void release(Ticket *ticket);
+
+  mutable std::mutex lock_;
+  std::condition_variable turn_;
+  uint8_t max_downloads_{2};
+  uint8_t max_uploads_{1};
+  size_t buffer_budget_{65536};
+  uint8_t active_[2]{0, 0};
+  size_t buffer_used_{0};
+  std::vector<Ticket *> uploads_;
+  // tickets of the card turns, the turns are served in the order they were taken
+  uint32_t next_turn_{0};
+  uint32_t serving_{0};
+  uint32_t rejected_{0};
+};
+
+/* Read another source in chunks of read_size bytes, each chunk in one turn of the transfer on the card */
+class ScheduledSource : public StreamSource {
+ public:
+  ScheduledSource(std::shared_ptr<StreamSource> source, std::shared_ptr<TransferScheduler::Ticket> ticket,
+                  size_t read_size);
+  size_t read(uint8_t *buffer, size_t len) override;
+
+ protected:
+  void fill();
+
+  std::shared_ptr<StreamSource> source_;
+  std::shared_ptr<TransferScheduler::Ticket> ticket_;
+  size_t read_size_;
+  std::unique_ptr<uint8_t[]> buffer_;
+  size_t length_{0};
+  size_t position_{0};
+  bool eof_{false};
+};
+
+/* Read a file ahead of the network on a task, each card read in one turn of the transfer */
+class ReadAheadSource : public StreamSource {
+ public:
+  ReadAheadSource(sd_mmc_card::SdMmc *card, std::shared_ptr<TransferScheduler::Ticket> ticket, uint8_t buffer_count,
+                  size_t buffer_size);
+  bool start(std::string const &path) { return this->reader_.start(path.c_str()); }
+  size_t read(uint8_t *buffer, size_t len) override { return this->reader_.read(buffer, len); }
+
+ protected:
+  class Reader : public sd_mmc_card::ReadAhead {
+   public:
+    Reader(sd_mmc_card::SdMmc *card, TransferScheduler::Ticket *ticket, uint8_t buffer_count, size_t buffer_size)
+        : ReadAhead(card, buffer_count, buffer_size), ticket_(ticket) {}
+    ~Reader() override { this->stop(); }
+
+   protected:
+    size_t read_chunk(uint8_t *buffer, size_t len) override;
+
+    TransferScheduler::Ticket *ticket_;
+  };
+
+  // outlives the reader, whose task takes the turns of the ticket
+  std::shared_ptr<TransferScheduler::Ticket> ticket_;
+  Reader reader_;
+};
+
+}  // namespace sd_file_server
+}  // namespace esphome
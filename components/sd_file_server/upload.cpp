@@ -0,0 +1,159 @@
+#include "upload.h"
+#include <algorithm>
+#include <cstring>
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace sd_file_server {
+
+static const char *TAG = "sd_file_server";
+
+size_t ResumableUpload::get_offset(std::string const &path) {
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
+  if (this->file_ != nullptr && this->file_->get_path() == path)
+    return this->file_->size() + this->buffered_;
+  return this->card_->get_partial_size(path.c_str());
+}
+
+bool ResumableUpload::begin(std::string const &path) {
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
+  this->last_activity_ = millis();
+  if (this->file_ != nullptr && this->file_->get_path() == path && !this->raw_)
+    return true;
+  this->close();
+  this->file_ = this->card_->resume_file_atomic(path.c_str());
+  if (this->file_ == nullptr)
+    return false;
+  ESP_LOGD(TAG, "resuming upload of %s at %u", path.c_str(), this->file_->size());
+  return true;
+}
+
+bool ResumableUpload::begin_raw(std::string const &path, size_t preallocate) {
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
+  this->last_activity_ = millis();
+  this->close();
+  this->file_ = this->card_->open_file_atomic(path.c_str(), preallocate);
+  if (this->file_ == nullptr)
+    return false;
+  this->raw_ = true;
+  ESP_LOGD(TAG, "receiving %s", path.c_str());
+  return true;
+}
+
+size_t ResumableUpload::write(const uint8_t *data, size_t len) {
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
+  if (this->file_ == nullptr)
+    return 0;
+  this->last_activity_ = millis();
+  if (this->buffer_ == nullptr) {
+    this->write_size_ = this->card_->get_profile().write_buffer_size;
+    this->buffer_.reset(new uint8_t[this->write_size_]);
+  }
+
+  size_t written = 0;
+  while (written < len) {
+    // bytes up to the next aligned offset, a resumed upload may not start on one
+    size_t block = this->write_size_ - this->file_->size() % this->write_size_;
+    size_t n = len - written;
+    if (this->buffered_ == 0 && n >= block) {
+      // nothing is waiting, whole blocks are written straight from the input
+      n = block + (n - block) / this->write_size_ * this->write_size_;
+      if (this->file_->write(data + written, n) != n)
+        return written;
+      written += n;
+      continue;
+    }
+    n = std::min(n, block - this->buffered_);
+    memcpy(this->buffer_.get() + this->buffered_, data + written, n);
+    this->buffered_ += n;
+    written += n;
+    if (this->buffered_ == block && !this->flush())
+      return written - n;
+  }
+  return written;
+}
+
+bool ResumableUpload::flush() {
+  if (this->buffered_ == 0)
+    return true;
+  size_t n = this->buffered_;
+  this->buffered_ = 0;
+  return this->file_->write(this->buffer_.get(), n) == n;
+}
+
+bool ResumableUpload::end(size_t total, bool &complete) {
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
+  complete = false;
+  if (this->file_ == nullptr)
+    return false;
+  if (!this->flush()) {
+    this->abort();
+    return false;
+  }
+  size_t size = this->file_->size();
+  if (size < total && !this->raw_)
+    return this->file_->sync();
+  if (size != total) {
+    ESP_LOGE(TAG, "%s does not match its announced size", this->file_->get_path().c_str());
+    this->file_.reset();
+    this->close();
+    return false;
+  }
+  bool ok = this->file_->commit();
+  ESP_LOGD(TAG, "upload of %s %s", this->file_->get_path().c_str(), ok ? "complete" : "failed");
+  this->file_.reset();
+  this->close();
+  complete = ok;
+  return ok;
+}
+
+void ResumableUpload::abort() {
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
+  this->buffered_ = 0;
+  if (this->raw_)
+    this->file_.reset();
+  this->close();
+}
+
+void ResumableUpload::close() {
+  if (this->file_ != nullptr) {
+    if (this->raw_) {
+      ESP_LOGD(TAG, "dropping unfinished upload of %s", this->file_->get_path().c_str());
+    } else {
+      ESP_LOGD(TAG, "suspending upload of %s", this->file_->get_path().c_str());
+      // the buffered data is not lost when the chunk is not finished
+      this->flush();
+      this->file_->suspend();
+    }
+  }
+  this->file_.reset();
+  this->buffer_.reset();
+  this->buffered_ = 0;
+  this->raw_ = false;
+}
+
+void ResumableUpload::cancel(std::string const &path) {
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
+  if (this->file_ != nullptr && this->file_->get_path() == path) {
+    this->buffered_ = 0;
+    this->file_.reset();
+    this->close();
+    return;
+  }
+  auto file = this->card_->resume_file_atomic(path.c_str());
+  if (file != nullptr)
+    file->discard();
+}
+
+void ResumableUpload::loop() {
+  // a chunk being written is not idle, the main loop does not wait for it
+  std::unique_lock<std::recursive_mutex> guard(this->lock_, std::try_to_lock);
+  if (!guard.owns_lock() || this->file_ == nullptr || millis() - this->last_activity_ < IDLE_TIMEOUT)
+    return;
+  ESP_LOGD(TAG, "closing idle upload of %s", this->file_->get_path().c_str());
+  this->close();
+}
+
+}  // namespace sd_file_server
+}  // namespace esphome
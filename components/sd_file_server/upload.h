@@ -0,0 +1,64 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <string>
+#include "../sd_mmc_card/sd_mmc_card.h"
+
+namespace esphome {
+namespace sd_file_server {
+
+/* Upload of a file sent in chunks, possibly over several connections.
+ *
+ * The content is written to <path>.sdtmp and synced after each chunk, so the received size survives a lost
+ * connection or a reboot and is the offset of the next chunk. The file stays open between the chunks of a
+ * session and is moved over the target once the total size is received.
+ *
+ * A raw upload sends the whole file in one request, it is not resumable and the temporary file is dropped when
+ * the request fails. The content can be preallocated in one contiguous region when its size is known.
+ *
+ * The received data is gathered in blocks of the write buffer size of the card profile, aligned on the start of
+ * the file, the card then sees a few large writes on sector boundaries instead of one small write per received
+ * network packet.
+ *
+ * The chunks are received on the http server task while the idle timeout is checked from the main loop, every
+ * public method holds the lock of the session.
+ */
+class ResumableUpload {
+ public:
+  /* The file is closed after this time without chunk, the content is kept */
+  static constexpr uint32_t IDLE_TIMEOUT = 30000;
+
+  void set_sd_mmc_card(sd_mmc_card::SdMmc *card) { this->card_ = card; }
+
+  /* Offset the next chunk of the file must start at */
+  size_t get_offset(std::string const &path);
+  /* Start a chunk, false when the file can not be opened */
+  bool begin(std::string const &path);
+  /* Start a raw upload replacing any unfinished one, preallocate is the expected size or 0 */
+  bool begin_raw(std::string const &path, size_t preallocate);
+  size_t write(const uint8_t *data, size_t len);
+  /* Sync the chunk and move the file over the target once total bytes are received */
+  bool end(size_t total, bool &complete);
+  /* Drop the content received so far */
+  void cancel(std::string const &path);
+  /* Drop the content of a failed raw upload, a chunk of a resumable upload is kept */
+  void abort();
+  void loop();
+
+ protected:
+  bool flush();
+  void close();
+
+  sd_mmc_card::SdMmc *card_{nullptr};
+  std::unique_ptr<sd_mmc_card::AtomicFile> file_;
+  std::unique_ptr<uint8_t[]> buffer_;
+  // block size of the writes, kept while the buffer is allocated
+  size_t write_size_{0};
+  size_t buffered_{0};
+  bool raw_{false};
+  uint32_t last_activity_{0};
+  std::recursive_mutex lock_;
+};
+
+}  // namespace sd_file_server
+}  // namespace esphome
@@ -0,0 +1,99 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome import automation
+from esphome.const import (
+    CONF_ID,
+    CONF_KEY,
+    CONF_PATH,
+    CONF_VALUE,
+)
+from .. import sd_mmc_card
+
+CONF_COMPACTION = "compaction"
+CONF_MIN_SIZE = "min_size"
+CONF_STALE_RATIO = "stale_ratio"
+
+DEPENDENCIES = ["sd_mmc_card"]
+
+sd_kv_store_ns = cg.esphome_ns.namespace("sd_kv_store")
+SdKvStore = sd_kv_store_ns.class_("SdKvStore", cg.Component)
+
+SdKvStorePutAction = sd_kv_store_ns.class_("SdKvStorePutAction", automation.Action)
+SdKvStoreDeleteAction = sd_kv_store_ns.class_("SdKvStoreDeleteAction", automation.Action)
+SdKvStoreCompactAction = sd_kv_store_ns.class_("SdKvStoreCompactAction", automation.Action)
+SdKvStoreHasKeyCondition = sd_kv_store_ns.class_("SdKvStoreHasKeyCondition", automation.Condition)
+
+CONFIG_SCHEMA = cv.All(
+    cv.require_esphome_version(2025,7,0),
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.declare_id(SdKvStore),
+            cv.GenerateID(sd_mmc_card.CONF_SD_MMC_CARD_ID): cv.use_id(sd_mmc_card.SdMmc),
+            cv.Optional(CONF_PATH, default="/kv/store.log"): cv.string_strict,
+            cv.Optional(CONF_COMPACTION, default={}): cv.Schema({
+                cv.Optional(CONF_MIN_SIZE, default=65536): sd_mmc_card.validate_bytes,
+                cv.Optional(CONF_STALE_RATIO, default="50%"): cv.percentage_int,
+            }),
+        }
+    ).extend(cv.COMPONENT_SCHEMA),
+)
+
+async def to_code(config):
+    var = cg.new_Pvariable(config[CONF_ID])
+    await cg.register_component(var, config)
+    sdmmc = await cg.get_variable(config[sd_mmc_card.CONF_SD_MMC_CARD_ID])
+    cg.add(var.set_sd_mmc_card(sdmmc))
+    cg.add(var.set_path(config[CONF_PATH]))
+    cg.add(var.set_compaction(config[CONF_COMPACTION][CONF_MIN_SIZE], config[CONF_COMPACTION][CONF_STALE_RATIO]))
+
+
+SD_KV_STORE_KEY_SCHEMA = cv.Schema(
+    {
+        cv.GenerateID(): cv.use_id(SdKvStore),
+        cv.Required(CONF_KEY): cv.templatable(cv.string_strict),
+    }
+)
+
+SD_KV_STORE_PUT_SCHEMA = SD_KV_STORE_KEY_SCHEMA.extend(
+    {
+        cv.Required(CONF_VALUE): cv.templatable(cv.string),
+    }
+)
+
+@automation.register_action("sd_kv_store.put", SdKvStorePutAction, SD_KV_STORE_PUT_SCHEMA)
+async def sd_kv_store_put_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, parent)
+    key_ = await cg.templatable(config[CONF_KEY], args, cg.std_string)
+    value_ = await cg.templatable(config[CONF_VALUE], args, cg.std_string)
+    cg.add(var.set_key(key_))
+    cg.add(var.set_value(value_))
+    return var
+
+
+@automation.register_action("sd_kv_store.delete", SdKvStoreDeleteAction, SD_KV_STORE_KEY_SCHEMA)
+async def sd_kv_store_delete_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, parent)
+    key_ = await cg.templatable(config[CONF_KEY], args, cg.std_string)
+    cg.add(var.set_key(key_))
+    return var
+
+
+@automation.register_action(
+    "sd_kv_store.compact",
+    SdKvStoreCompactAction,
+    cv.Schema({cv.GenerateID(): cv.use_id(SdKvStore)}),
+)
+async def sd_kv_store_compact_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    return cg.new_Pvariable(action_id, template_arg, parent)
+
+
+@automation.register_condition("sd_kv_store.has_key", SdKvStoreHasKeyCondition, SD_KV_STORE_KEY_SCHEMA)
+async def sd_kv_store_has_key_to_code(config, condition_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(condition_id, template_arg, parent)
+    key_ = await cg.templatable(config[CONF_KEY], args, cg.std_string)
+    cg.add(var.set_key(key_))
+    return var
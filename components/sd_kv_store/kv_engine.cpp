@@ -0,0 +1,301 @@
+#include "kv_engine.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+namespace esphome {
+namespace sd_kv_store {
+
+// "SDKV", version 1
+static constexpr uint8_t FILE_HEADER[8] = {'S', 'D', 'K', 'V', 1, 0, 0, 0};
+static constexpr size_t FILE_HEADER_SIZE = sizeof(FILE_HEADER);
+
+// record: marker, type, key size, 0, value size (le32), crc32 of the rest of the record (le32), key, value
+static constexpr size_t RECORD_HEADER_SIZE = 12;
+static constexpr uint8_t RECORD_MARKER = 0xA5;
+static constexpr uint8_t RECORD_PUT = 1;
+static constexpr uint8_t RECORD_DELETE = 2;
+
+static const char *const TEMP_SUFFIX = ".tmp";
+static const char *const NEW_SUFFIX = ".new";
+
+static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t len) {
+  crc = ~crc;
+  while (len--) {
+    crc ^= *data++;
+    for (int i = 0; i < 8; i++)
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+static void put_le32(uint8_t *buffer, uint32_t value) {
+  for (int i = 0; i < 4; i++)
+    buffer[i] = (value >> (8 * i)) & 0xFF;
+}
+
+static uint32_t get_le32(const uint8_t *buffer) {
+  return buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | (static_cast<uint32_t>(buffer[3]) << 24);
+}
+
+static uint32_t record_size(size_t key_size, size_t value_size) {
+  return RECORD_HEADER_SIZE + key_size + value_size;
+}
+
+static bool exists(std::string const &path) { return access(path.c_str(), F_OK) == 0; }
+
+KvEngine::~KvEngine() { this->close(); }
+
+bool KvEngine::open(std::string const &path) {
+  this->close();
+  this->path_ = path;
+  this->index_.clear();
+  this->log_size_ = 0;
+  this->live_size_ = 0;
+  this->discarded_size_ = 0;
+
+  // finish a compaction interrupted by a power loss, the .new log is complete
+  std::string new_path = path + NEW_SUFFIX;
+  if (exists(new_path)) {
+    ::remove(path.c_str());
+    if (rename(new_path.c_str(), path.c_str()) != 0)
+      return false;
+  }
+  ::remove((path + TEMP_SUFFIX).c_str());
+
+  this->file_ = fopen(path.c_str(), "r+b");
+  if (this->file_ == nullptr)
+    return errno == ENOENT && this->create();
+  return this->replay();
+}
+
+void KvEngine::close() {
+  if (this->file_ == nullptr)
+    return;
+  fclose(this->file_);
+  this->file_ = nullptr;
+}
+
+bool KvEngine::create() {
+  this->file_ = fopen(this->path_.c_str(), "w+b");
+  if (this->file_ == nullptr)
+    return false;
+  if (fwrite(FILE_HEADER, 1, FILE_HEADER_SIZE, this->file_) != FILE_HEADER_SIZE || fflush(this->file_) != 0) {
+    this->close();
+    return false;
+  }
+  this->log_size_ = FILE_HEADER_SIZE;
+  return true;
+}
+
+bool KvEngine::replay() {
+  uint8_t header[FILE_HEADER_SIZE];
+  size_t n = fread(header, 1, FILE_HEADER_SIZE, this->file_);
+  if (n == 0) {
+    // the power was lost while creating the log
+    this->close();
+    return this->create();
+  }
+  if (n != FILE_HEADER_SIZE || memcmp(header, FILE_HEADER, FILE_HEADER_SIZE) != 0) {
+    this->close();
+    return false;
+  }
+
+  uint32_t position = FILE_HEADER_SIZE;
+  uint8_t buffer[256];
+  while (true) {
+    uint8_t record[RECORD_HEADER_SIZE];
+    n = fread(record, 1, RECORD_HEADER_SIZE, this->file_);
+    if (n == 0)
+      break;
+    if (n != RECORD_HEADER_SIZE || record[0] != RECORD_MARKER || record[3] != 0 ||
+        (record[1] != RECORD_PUT && record[1] != RECORD_DELETE))
+      break;
+    uint8_t type = record[1];
+    size_t key_size = record[2];
+    uint32_t value_size = get_le32(record + 4);
+    if (value_size > MAX_VALUE_SIZE)
+      break;
+
+    std::string key(key_size, '\0');
+    if (fread(&key[0], 1, key_size, this->file_) != key_size)
+      break;
+    uint32_t crc = crc32(0, record + 1, 7);
+    crc = crc32(crc, reinterpret_cast<const uint8_t *>(key.data()), key_size);
+    size_t remaining = value_size;
+    while (remaining > 0) {
+      size_t chunk = std::min(remaining, sizeof(buffer));
+      if (fread(buffer, 1, chunk, this->file_) != chunk)
+        break;
+      crc = crc32(crc, buffer, chunk);
+      remaining -= chunk;
+    }
+    if (remaining > 0 || crc != get_le32(record + 8))
+      break;
+
+    this->forget(key);
+    if (type == RECORD_PUT) {
+      this->index_[key] = Entry{position, value_size};
+      this->live_size_ += record_size(key_size, value_size);
+    }
+    position += record_size(key_size, value_size);
+  }
+
+  // drop the torn record left by a power loss, the next append starts from the last valid one
+  fseek(this->file_, 0, SEEK_END);
+  long end = ftell(this->file_);
+  if (end > static_cast<long>(position)) {
+    this->discarded_size_ = end - position;
+    fflush(this->file_);
+    if (ftruncate(fileno(this->file_), position) != 0) {
+      this->close();
+      return false;
+    }
+  }
+  this->log_size_ = position;
+  return true;
+}
+
+bool KvEngine::get(std::string const &key, std::string &value) {
+  auto it = this->index_.find(key);
+  if (it == this->index_.end())
+    return false;
+  value.resize(it->second.value_size);
+  return this->read_at(it->second.offset + RECORD_HEADER_SIZE + key.size(), reinterpret_cast<uint8_t *>(&value[0]),
+                       it->second.value_size);
+}
+
+bool KvEngine::put(std::string const &key, const uint8_t *data, size_t len) {
+  return this->append(RECORD_PUT, key, data, len);
+}
+
+bool KvEngine::put(std::string const &key, std::string const &value) {
+  return this->put(key, reinterpret_cast<const uint8_t *>(value.data()), value.size());
+}
+
+bool KvEngine::remove(std::string const &key) {
+  if (!this->contains(key))
+    return true;
+  return this->append(RECORD_DELETE, key, nullptr, 0);
+}
+
+std::vector<std::string> KvEngine::keys() const {
+  std::vector<std::string> keys;
+  keys.reserve(this->index_.size());
+  for (auto const &it : this->index_)
+    keys.push_back(it.first);
+  return keys;
+}
+
+void KvEngine::set_compaction(uint32_t min_size, uint8_t ratio) {
+  this->compaction_min_size_ = min_size;
+  this->compaction_ratio_ = ratio;
+}
+
+bool KvEngine::needs_compaction() const {
+  if (this->log_size_ < this->compaction_min_size_)
+    return false;
+  uint64_t stale = this->log_size_ - FILE_HEADER_SIZE - this->live_size_;
+  return stale * 100 > static_cast<uint64_t>(this->compaction_ratio_) * this->log_size_;
+}
+
+bool KvEngine::compact() {
+  if (this->file_ == nullptr)
+    return false;
+  std::string temp_path = this->path_ + TEMP_SUFFIX;
+  std::string new_path = this->path_ + NEW_SUFFIX;
+  FILE *out = fopen(temp_path.c_str(), "wb");
+  if (out == nullptr)
+    return false;
+
+  bool ok = fwrite(FILE_HEADER, 1, FILE_HEADER_SIZE, out) == FILE_HEADER_SIZE;
+  std::unordered_map<std::string, Entry> index;
+  uint32_t position = FILE_HEADER_SIZE;
+  std::vector<uint8_t> value;
+  for (auto it = this->index_.begin(); ok && it != this->index_.end(); ++it) {
+    value.resize(it->second.value_size);
+    ok = this->read_at(it->second.offset + RECORD_HEADER_SIZE + it->first.size(), value.data(), value.size()) &&
+         this->write_record(out, RECORD_PUT, it->first, value.data(), value.size());
+    index[it->first] = Entry{position, it->second.value_size};
+    position += record_size(it->first.size(), it->second.value_size);
+  }
+  // the old log is deleted next, the new one must be on the card first
+  ok = ok && fflush(out) == 0 && fsync(fileno(out)) == 0;
+  ok = fclose(out) == 0 && ok;
+  if (!ok) {
+    ::remove(temp_path.c_str());
+    return false;
+  }
+
+  // fat can not rename over an existing file, open() finishes the replacement if it is interrupted
+  this->close();
+  ::remove(new_path.c_str());
+  if (rename(temp_path.c_str(), new_path.c_str()) != 0 || ::remove(this->path_.c_str()) != 0 ||
+      rename(new_path.c_str(), this->path_.c_str()) != 0) {
+    this->open(this->path_);
+    return false;
+  }
+
+  this->file_ = fopen(this->path_.c_str(), "r+b");
+  if (this->file_ == nullptr)
+    return false;
+  this->index_ = std::move(index);
+  this->log_size_ = position;
+  this->live_size_ = position - FILE_HEADER_SIZE;
+  return true;
+}
+
+bool KvEngine::append(uint8_t type, std::string const &key, const uint8_t *data, size_t len) {
+  if (this->file_ == nullptr || key.empty() || key.size() > MAX_KEY_SIZE || len > MAX_VALUE_SIZE)
+    return false;
+  if (fseek(this->file_, this->log_size_, SEEK_SET) != 0)
+    return false;
+  bool ok = this->write_record(this->file_, type, key, data, len) && fflush(this->file_) == 0;
+  if (ok && this->sync_writes_)
+    ok = fsync(fileno(this->file_)) == 0;
+  if (!ok) {
+    // do not leave a partial record before the next one
+    fflush(this->file_);
+    ftruncate(fileno(this->file_), this->log_size_);
+    return false;
+  }
+
+  uint32_t offset = this->log_size_;
+  this->log_size_ += record_size(key.size(), len);
+  this->forget(key);
+  if (type == RECORD_PUT) {
+    this->index_[key] = Entry{offset, static_cast<uint32_t>(len)};
+    this->live_size_ += record_size(key.size(), len);
+  }
+  return true;
+}
+
+bool KvEngine::read_at(uint32_t offset, uint8_t *buffer, size_t len) {
+  if (this->file_ == nullptr || fseek(this->file_, offset, SEEK_SET) != 0)
+    return false;
+  return fread(buffer, 1, len, this->file_) == len;
+}
+
+bool KvEngine::write_record(FILE *file, uint8_t type, std::string const &key, const uint8_t *data, size_t len) {
+  uint8_t header[RECORD_HEADER_SIZE] = {RECORD_MARKER, type, static_cast<uint8_t>(key.size()), 0};
+  put_le32(header + 4, len);
+  uint32_t crc = crc32(0, header + 1, 7);
+  crc = crc32(crc, reinterpret_cast<const uint8_t *>(key.data()), key.size());
+  crc = crc32(crc, data, len);
+  put_le32(header + 8, crc);
+  return fwrite(header, 1, RECORD_HEADER_SIZE, file) == RECORD_HEADER_SIZE &&
+         fwrite(key.data(), 1, key.size(), file) == key.size() && (len == 0 || fwrite(data, 1, len, file) == len);
+}
+
+void KvEngine::forget(std::string const &key) {
+  auto it = this->index_.find(key);
+  if (it == this->index_.end())
+    return;
+  this->live_size_ -= record_size(key.size(), it->second.value_size);
+  this->index_.erase(it);
+}
+
+}  // namespace sd_kv_store
+}  // namespace esphome
@@ -0,0 +1,79 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace esphome {
+namespace sd_kv_store {
+
+/* Key value store backed by an append only log file.
+ *
+ * Every put or remove appends a record to the log, the in memory index only keeps the position of the
+ * latest value of each key. Opening the store replays the log and drops a record torn by a power loss.
+ * compact() rewrites the live records to a new log, which then replaces the old one.
+ *
+ * The engine only uses stdio and posix calls so it can be tested on a host.
+ */
+class KvEngine {
+ public:
+  static constexpr size_t MAX_KEY_SIZE = 255;
+  static constexpr size_t MAX_VALUE_SIZE = 65535;
+
+  KvEngine() = default;
+  ~KvEngine();
+  KvEngine(KvEngine const &) = delete;
+  KvEngine &operator=(KvEngine const &) = delete;
+
+  /* Open the log at the given absolute path, creating it if needed, and rebuild the index */
+  bool open(std::string const &path);
+  void close();
+  bool is_open() const { return this->file_ != nullptr; }
+
+  bool get(std::string const &key, std::string &value);
+  bool put(std::string const &key, const uint8_t *data, size_t len);
+  bool put(std::string const &key, std::string const &value);
+  bool remove(std::string const &key);
+  bool contains(std::string const &key) const { return this->index_.count(key) > 0; }
+  std::vector<std::string> keys() const;
+  size_t size() const { return this->index_.size(); }
+
+  /* fsync the log after every record */
+  void set_sync_writes(bool sync) { this->sync_writes_ = sync; }
+  /* Compact once the log is larger than min_size and more than ratio percent of it is stale */
+  void set_compaction(uint32_t min_size, uint8_t ratio);
+  bool needs_compaction() const;
+  bool compact();
+
+  uint32_t get_log_size() const { return this->log_size_; }
+  uint32_t get_live_size() const { return this->live_size_; }
+  /* Bytes dropped at the end of the log when it was opened */
+  uint32_t get_discarded_size() const { return this->discarded_size_; }
+
+ protected:
+  struct Entry {
+    uint32_t offset;
+    uint32_t value_size;
+  };
+
+  bool create();
+  bool replay();
+  bool append(uint8_t type, std::string const &key, const uint8_t *data, size_t len);
+  bool read_at(uint32_t offset, uint8_t *buffer, size_t len);
+  bool write_record(FILE *file, uint8_t type, std::string const &key, const uint8_t *data, size_t len);
+  void forget(std::string const &key);
+
+  std::string path_;
+  FILE *file_{nullptr};
+  std::unordered_map<std::string, Entry> index_;
+  uint32_t log_size_{0};
+  uint32_t live_size_{0};
+  uint32_t discarded_size_{0};
+  uint32_t compaction_min_size_{65536};
+  uint8_t compaction_ratio_{50};
+  bool sync_writes_{false};
+};
+
+}  // namespace sd_kv_store
+}  // namespace esphome
@@ -0,0 +1,121 @@
+#include "sd_kv_store.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace sd_kv_store {
+
+static const char *TAG = "sd_kv_store";
+
+void SdKvStore::setup() {
+  if (this->sd_mmc_card_->is_failed()) {
+    this->mark_failed();
+    return;
+  }
+  size_t pos = this->path_.rfind('/');
+  if (pos != std::string::npos && pos > 0) {
+    std::string directory = this->path_.substr(0, pos);
+    if (!this->sd_mmc_card_->is_directory(directory))
+      this->sd_mmc_card_->create_directory(directory.c_str());
+  }
+
+  // a put is only durable once the file size is written to the fat, sync every record unless disabled
+  this->engine_.set_sync_writes(this->sd_mmc_card_->get_sync_policy() != sd_mmc_card::SyncPolicy::NEVER);
+  uint32_t start = millis();
+  // opening creates the log, drops a torn record or finishes an interrupted compaction
+  this->invalidate_log();
+  bool ok = this->engine_.open(sd_mmc_card::build_path(this->path_.c_str()));
+  this->invalidate_log();
+  if (!ok) {
+    ESP_LOGE(TAG, "Failed to open %s", this->path_.c_str());
+    this->mark_failed();
+    return;
+  }
+  if (this->engine_.get_discarded_size() > 0)
+    ESP_LOGW(TAG, "Dropped %u bytes of an interrupted write", this->engine_.get_discarded_size());
+  ESP_LOGD(TAG, "Loaded %u keys in %u ms", this->engine_.size(), millis() - start);
+  this->schedule_compaction();
+}
+
+void SdKvStore::dump_config() {
+  ESP_LOGCONFIG(TAG, "SD Key Value Store:");
+  ESP_LOGCONFIG(TAG, "  Path: %s", this->path_.c_str());
+  ESP_LOGCONFIG(TAG, "  Keys: %u", this->engine_.size());
+  ESP_LOGCONFIG(TAG, "  Log size: %s", sd_mmc_card::format_size(this->engine_.get_log_size()).c_str());
+  ESP_LOGCONFIG(TAG, "  Live size: %s", sd_mmc_card::format_size(this->engine_.get_live_size()).c_str());
+  if (this->is_failed())
+    ESP_LOGE(TAG, "  Failed to open the store");
+}
+
+void SdKvStore::set_sd_mmc_card(sd_mmc_card::SdMmc *card) { this->sd_mmc_card_ = card; }
+
+void SdKvStore::set_path(std::string const &path) { this->path_ = path; }
+
+void SdKvStore::set_compaction(uint32_t min_size, uint8_t ratio) { this->engine_.set_compaction(min_size, ratio); }
+
+optional<std::string> SdKvStore::get(std::string const &key) {
+  std::string value;
+  if (!this->engine_.get(key, value))
+    return {};
+  return value;
+}
+
+bool SdKvStore::put(std::string const &key, std::string const &value) {
+  return this->put(key, reinterpret_cast<const uint8_t *>(value.data()), value.size());
+}
+
+bool SdKvStore::put(std::string const &key, const uint8_t *data, size_t len) {
+  this->invalidate_log();
+  bool ok = this->engine_.put(key, data, len);
+  this->invalidate_log();
+  if (!ok) {
+    ESP_LOGE(TAG, "Failed to store %s", key.c_str());
+    return false;
+  }
+  this->schedule_compaction();
+  return true;
+}
+
+bool SdKvStore::remove(std::string const &key) {
+  this->invalidate_log();
+  bool ok = this->engine_.remove(key);
+  this->invalidate_log();
+  if (!ok) {
+    ESP_LOGE(TAG, "Failed to delete %s", key.c_str());
+    return false;
+  }
+  this->schedule_compaction();
+  return true;
+}
+
+bool SdKvStore::contains(std::string const &key) const { return this->engine_.contains(key); }
+
+std::vector<std::string> SdKvStore::keys() const { return this->engine_.keys(); }
+
+bool SdKvStore::compact() {
+  uint32_t start = millis();
+  uint32_t before = this->engine_.get_log_size();
+  this->invalidate_log();
+  bool ok = this->engine_.compact();
+  this->invalidate_log();
+  if (!ok) {
+    ESP_LOGE(TAG, "Failed to compact %s", this->path_.c_str());
+    return false;
+  }
+  ESP_LOGD(TAG, "Compacted %u bytes to %u bytes in %u ms", before, this->engine_.get_log_size(), millis() - start);
+  return true;
+}
+
+void SdKvStore::invalidate_log() {
+  // before the write for the index log, again once it is done for the cached content
+  this->sd_mmc_card_->get_cache().invalidate(this->path_);
+}
+
+void SdKvStore::schedule_compaction() {
+  // compact from the main loop rather than in the middle of the caller's automation
+  if (this->engine_.needs_compaction())
+    this->defer("compact", [this]() { this->compact(); });
+}
+
+}  // namespace sd_kv_store
+}  // namespace esphome
@@ -0,0 +1,102 @@
+#pragma once
+#include <cstring>
+#include <type_traits>
+#include "esphome/core/component.h"
+#include "esphome/core/automation.h"
+#include "esphome/core/optional.h"
+#include "../sd_mmc_card/sd_mmc_card.h"
+#include "kv_engine.h"
+
+namespace esphome {
+namespace sd_kv_store {
+
+class SdKvStore : public Component {
+ public:
+  void setup() override;
+  void dump_config() override;
+
+  void set_sd_mmc_card(sd_mmc_card::SdMmc *);
+  void set_path(std::string const &);
+  void set_compaction(uint32_t min_size, uint8_t ratio);
+
+  optional<std::string> get(std::string const &key);
+  bool put(std::string const &key, std::string const &value);
+  bool put(std::string const &key, const uint8_t *data, size_t len);
+  bool remove(std::string const &key);
+  bool contains(std::string const &key) const;
+  std::vector<std::string> keys() const;
+  bool compact();
+  KvEngine &get_engine() { return this->engine_; }
+
+  /* Store a trivially copyable value as its raw bytes */
+  template<typename T> bool put_value(std::string const &key, T const &value) {
+    static_assert(std::is_trivially_copyable<T>::value, "value must be trivially copyable");
+    return this->put(key, reinterpret_cast<const uint8_t *>(&value), sizeof(T));
+  }
+
+  template<typename T> optional<T> get_value(std::string const &key) {
+    static_assert(std::is_trivially_copyable<T>::value, "value must be trivially copyable");
+    auto raw = this->get(key);
+    if (!raw.has_value() || raw->size() != sizeof(T))
+      return {};
+    T value;
+    memcpy(&value, raw->data(), sizeof(T));
+    return value;
+  }
+
+ protected:
+  void schedule_compaction();
+  /* The engine writes the log with stdio, tell the file cache and the directory index of the card about it */
+  void invalidate_log();
+
+  sd_mmc_card::SdMmc *sd_mmc_card_;
+  std::string path_;
+  KvEngine engine_;
+};
+
+template<typename... Ts> class SdKvStorePutAction : public Action<Ts...> {
+ public:
+  SdKvStorePutAction(SdKvStore *parent) : parent_(parent) {}
+  TEMPLATABLE_VALUE(std::string, key)
+  TEMPLATABLE_VALUE(std::string, value)
+
+  void play(Ts... x) { this->parent_->put(this->key_.value(x...), this->value_.value(x...)); }
+
+ protected:
+  SdKvStore *parent_;
+};
+
+template<typename... Ts> class SdKvStoreDeleteAction : public Action<Ts...> {
+ public:
+  SdKvStoreDeleteAction(SdKvStore *parent) : parent_(parent) {}
+  TEMPLATABLE_VALUE(std::string, key)
+
+  void play(Ts... x) { this->parent_->remove(this->key_.value(x...)); }
+
+ protected:
+  SdKvStore *parent_;
+};
+
+template<typename... Ts> class SdKvStoreCompactAction : public Action<Ts...> {
+ public:
+  SdKvStoreCompactAction(SdKvStore *parent) : parent_(parent) {}
+
+  void play(Ts... x) { this->parent_->compact(); }
+
+ protected:
+  SdKvStore *parent_;
+};
+
+template<typename... Ts> class SdKvStoreHasKeyCondition : public Condition<Ts...> {
+ public:
+  SdKvStoreHasKeyCondition(SdKvStore *parent) : parent_(parent) {}
+  TEMPLATABLE_VALUE(std::string, key)
+
+  bool check(Ts... x) override { return this->parent_->contains(this->key_.value(x...)); }
+
+ protected:
+  SdKvStore *parent_;
+};
+
+}  // namespace sd_kv_store
+}  // namespace esphome
@@ -1,3 +1,5 @@
+import re
+
 import esphome.codegen as cg
 import esphome.config_validation as cv
 from esphome import automation, pins
@@ -9,6 +11,7 @@ from esphome.const import (
     CONF_OUTPUT,
     CONF_PULLUP,
     CONF_PULLDOWN,
+    CONF_INTERVAL,
 )
 from esphome.core import CORE
 from esphome.components.esp32 import get_esp32_variant
@@ -27,16 +30,53 @@ CONF_DATA2_PIN = "data2_pin"
 CONF_DATA3_PIN = "data3_pin"
 CONF_MODE_1BIT = "mode_1bit"
 CONF_POWER_CTRL_PIN = "power_ctrl_pin"
+CONF_CACHE = "cache"
+CONF_CAPACITY = "capacity"
+CONF_MAX_FILE_SIZE = "max_file_size"
+CONF_RETENTION = "retention"
+CONF_DIRECTORIES = "directories"
+CONF_PATTERN = "pattern"
+CONF_DEPTH = "depth"
+CONF_MAX_AGE = "max_age"
+CONF_MAX_SIZE = "max_size"
+CONF_MIN_FREE_SPACE = "min_free_space"
+CONF_TIME_SLICE = "time_slice"
+CONF_FSYNC = "fsync"
+CONF_ATOMIC = "atomic"
+CONF_SIZE = "size"
+CONF_INDEXED_DIRECTORIES = "indexed_directories"
+CONF_SHARD = "shard"
+CONF_PARENTS = "parents"
+CONF_DISCARD = "discard"
 
 sd_mmc_card_component_ns = cg.esphome_ns.namespace("sd_mmc_card")
 SdMmc = sd_mmc_card_component_ns.class_("SdMmc", cg.Component)
+SyncPolicy = sd_mmc_card_component_ns.enum("SyncPolicy", is_class=True)
+ShardLevel = sd_mmc_card_component_ns.enum("ShardLevel", is_class=True)
+SYNC_POLICIES = {
+    "never": SyncPolicy.NEVER,
+    "atomic": SyncPolicy.ATOMIC,
+    "always": SyncPolicy.ALWAYS,
+}
+
+SHARD_LEVELS = {
+    "none": ShardLevel.NONE,
+    "year": ShardLevel.YEAR,
+    "month": ShardLevel.MONTH,
+    "day": ShardLevel.DAY,
+    "hour": ShardLevel.HOUR,
+}
 
 # Action
 SdMmcWriteFileAction = sd_mmc_card_component_ns.class_("SdMmcWriteFileAction", automation.Action)
 SdMmcAppendFileAction = sd_mmc_card_component_ns.class_("SdMmcAppendFileAction", automation.Action)
+SdMmcPreallocateFileAction = sd_mmc_card_component_ns.class_("SdMmcPreallocateFileAction", automation.Action)
+SdMmcCloseFileAction = sd_mmc_card_component_ns.class_("SdMmcCloseFileAction", automation.Action)
 SdMmcCreateDirectoryAction = sd_mmc_card_component_ns.class_("SdMmcCreateDirectoryAction", automation.Action)
 SdMmcRemoveDirectoryAction = sd_mmc_card_component_ns.class_("SdMmcRemoveDirectoryAction", automation.Action)
 SdMmcDeleteFileAction = sd_mmc_card_component_ns.class_("SdMmcDeleteFileAction", automation.Action)
+SdMmcBenchmarkAction = sd_mmc_card_component_ns.class_("SdMmcBenchmarkAction", automation.Action)
+SdMmcDiscardFreeSpaceAction = sd_mmc_card_component_ns.class_("SdMmcDiscardFreeSpaceAction", automation.Action)
 
 def validate_raw_data(value):
     if isinstance(value, str):
@@ -47,6 +87,58 @@ def validate_raw_data(value):
         "data must either be a string wrapped in quotes or a list of bytes"
     )
 
+BYTE_UNITS = {"B": 1, "KB": 1024, "MB": 1024**2, "GB": 1024**3, "TB": 1024**4}
+
+def validate_bytes(value):
+    if isinstance(value, int):
+        return cv.positive_int(value)
+    match = re.match(r"^\s*(\d+(?:\.\d+)?)\s*([KMGT]?B)?\s*$", str(value), re.IGNORECASE)
+    if match is None:
+        raise cv.Invalid(f"invalid size '{value}', expected a number of bytes like 512MB or 2GB")
+    unit = (match.group(2) or "B").upper()
+    return int(float(match.group(1)) * BYTE_UNITS[unit])
+
+RETENTION_DIRECTORY_SCHEMA = cv.Schema(
+    {
+        cv.Required(CONF_PATH): cv.string_strict,
+        cv.Optional(CONF_PATTERN, default=""): cv.string,
+        cv.Optional(CONF_DEPTH, default=0): cv.int_range(min=0, max=8),
+        cv.Optional(CONF_MAX_AGE): cv.positive_time_period_seconds,
+        cv.Optional(CONF_MAX_SIZE): validate_bytes,
+    }
+)
+
+def validate_directory_path(value):
+    value = cv.string_strict(value)
+    if not value.startswith("/"):
+        raise cv.Invalid(f"directory '{value}' must be an absolute path on the card")
+    return value.rstrip("/")
+
+def validate_retention(config):
+    if CONF_MIN_FREE_SPACE in config:
+        return config
+    for directory in config[CONF_DIRECTORIES]:
+        if CONF_MAX_AGE not in directory and CONF_MAX_SIZE not in directory:
+            raise cv.Invalid(
+                f"directory {directory[CONF_PATH]} needs max_age or max_size when min_free_space is not set"
+            )
+    return config
+
+RETENTION_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.Required(CONF_DIRECTORIES): cv.All(cv.ensure_list(RETENTION_DIRECTORY_SCHEMA), cv.Length(min=1)),
+            cv.Optional(CONF_MIN_FREE_SPACE): validate_bytes,
+            cv.Optional(CONF_INTERVAL, default="10min"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_TIME_SLICE, default="10ms"): cv.All(
+                cv.positive_time_period_milliseconds,
+                cv.Range(min=cv.TimePeriod(milliseconds=1), max=cv.TimePeriod(milliseconds=25)),
+            ),
+        }
+    ),
+    validate_retention,
+)
+
 CONFIG_SCHEMA = cv.All(
     cv.require_esphome_version(2025,7,0),
     cv.Schema(
@@ -64,6 +156,14 @@ CONFIG_SCHEMA = cv.All(
                 CONF_PULLUP: False,
                 CONF_PULLDOWN: False,
             }),
+            cv.Optional(CONF_CACHE): cv.Schema({
+                cv.Optional(CONF_CAPACITY, default=65536): cv.positive_int,
+                cv.Optional(CONF_MAX_FILE_SIZE, default=8192): cv.positive_int,
+            }),
+            cv.Optional(CONF_RETENTION): RETENTION_SCHEMA,
+            cv.Optional(CONF_INDEXED_DIRECTORIES): cv.All(cv.ensure_list(validate_directory_path), cv.Length(min=1)),
+            cv.Optional(CONF_FSYNC, default="atomic"): cv.enum(SYNC_POLICIES, lower=True),
+            cv.Optional(CONF_DISCARD, default=False): cv.boolean,
         }
     ).extend(cv.COMPONENT_SCHEMA)
 )
@@ -73,6 +173,8 @@ async def to_code(config):
     await cg.register_component(var, config)
 
     cg.add(var.set_mode_1bit(config[CONF_MODE_1BIT]))
+    cg.add(var.set_sync_policy(config[CONF_FSYNC]))
+    cg.add(var.set_discard(config[CONF_DISCARD]))
 
     cg.add(var.set_clk_pin(config[CONF_CLK_PIN]))
     cg.add(var.set_cmd_pin(config[CONF_CMD_PIN]))
@@ -87,6 +189,29 @@ async def to_code(config):
         power_ctrl = await cg.gpio_pin_expression(config[CONF_POWER_CTRL_PIN])
         cg.add(var.set_power_ctrl_pin(power_ctrl))
 
+    if (CONF_CACHE in config):
+        cg.add(var.set_cache_capacity(config[CONF_CACHE][CONF_CAPACITY]))
+        cg.add(var.set_cache_max_file_size(config[CONF_CACHE][CONF_MAX_FILE_SIZE]))
+
+    if (CONF_RETENTION in config):
+        retention = config[CONF_RETENTION]
+        for directory in retention[CONF_DIRECTORIES]:
+            max_age = directory[CONF_MAX_AGE].total_seconds if CONF_MAX_AGE in directory else 0
+            cg.add(var.add_retention_rule(
+                directory[CONF_PATH],
+                directory[CONF_PATTERN],
+                directory[CONF_DEPTH],
+                max_age,
+                directory.get(CONF_MAX_SIZE, 0),
+            ))
+        if (CONF_MIN_FREE_SPACE in retention):
+            cg.add(var.set_retention_min_free_space(retention[CONF_MIN_FREE_SPACE]))
+        cg.add(var.set_retention_interval(retention[CONF_INTERVAL].total_milliseconds))
+        cg.add(var.set_retention_time_slice(retention[CONF_TIME_SLICE].total_milliseconds))
+
+    for directory in config.get(CONF_INDEXED_DIRECTORIES, []):
+        cg.add(var.add_indexed_directory(directory))
+
     if CORE.using_arduino:
         if CORE.is_esp32:
             cg.add_library("FS", None)
@@ -116,11 +241,18 @@ SD_MMC_WRITE_FILE_ACTION_SCHEMA = cv.Schema(
         cv.GenerateID(): cv.use_id(SdMmc),
         cv.Required(CONF_PATH): cv.templatable(cv.string_strict),
         cv.Required(CONF_DATA): cv.templatable(validate_raw_data),
+        cv.Optional(CONF_SHARD, default="none"): cv.enum(SHARD_LEVELS, lower=True),
     }
 ).extend(SD_MMC_PATH_ACTION_SCHEMA)
 
 @automation.register_action(
-    "sd_mmc_card.write_file", SdMmcWriteFileAction, SD_MMC_WRITE_FILE_ACTION_SCHEMA
+    "sd_mmc_card.write_file",
+    SdMmcWriteFileAction,
+    SD_MMC_WRITE_FILE_ACTION_SCHEMA.extend(
+        {
+            cv.Optional(CONF_ATOMIC, default=False): cv.boolean,
+        }
+    ),
 )
 async def sd_mmc_write_file_to_code(config, action_id, template_arg, args):
     parent = await cg.get_variable(config[CONF_ID])
@@ -129,6 +261,8 @@ async def sd_mmc_write_file_to_code(config, action_id, template_arg, args):
     data_ = await cg.templatable(config[CONF_DATA], args, cg.std_vector.template(cg.uint8))
     cg.add(var.set_path(path_))
     cg.add(var.set_data(data_))
+    cg.add(var.set_atomic(config[CONF_ATOMIC]))
+    cg.add(var.set_shard(config[CONF_SHARD]))
     return var
 
 
@@ -142,17 +276,55 @@ async def sd_mmc_append_file_to_code(config, action_id, template_arg, args):
     data_ = await cg.templatable(config[CONF_DATA], args, cg.std_vector.template(cg.uint8))
     cg.add(var.set_path(path_))
     cg.add(var.set_data(data_))
+    cg.add(var.set_shard(config[CONF_SHARD]))
     return var
 
 
 @automation.register_action(
-    "sd_mmc_card.create_directory", SdMmcCreateDirectoryAction, SD_MMC_PATH_ACTION_SCHEMA
+    "sd_mmc_card.preallocate_file",
+    SdMmcPreallocateFileAction,
+    SD_MMC_PATH_ACTION_SCHEMA.extend(
+        {
+            cv.Required(CONF_SIZE): cv.templatable(validate_bytes),
+        }
+    ),
+)
+async def sd_mmc_preallocate_file_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, parent)
+    path_ = await cg.templatable(config[CONF_PATH], args, cg.std_string)
+    size_ = await cg.templatable(config[CONF_SIZE], args, cg.size_t)
+    cg.add(var.set_path(path_))
+    cg.add(var.set_size(size_))
+    return var
+
+
+@automation.register_action(
+    "sd_mmc_card.close_file", SdMmcCloseFileAction, SD_MMC_PATH_ACTION_SCHEMA
+)
+async def sd_mmc_close_file_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, parent)
+    path_ = await cg.templatable(config[CONF_PATH], args, cg.std_string)
+    cg.add(var.set_path(path_))
+    return var
+
+
+@automation.register_action(
+    "sd_mmc_card.create_directory",
+    SdMmcCreateDirectoryAction,
+    SD_MMC_PATH_ACTION_SCHEMA.extend(
+        {
+            cv.Optional(CONF_PARENTS, default=False): cv.boolean,
+        }
+    ),
 )
 async def sd_mmc_create_directory_to_code(config, action_id, template_arg, args):
     parent = await cg.get_variable(config[CONF_ID])
     var = cg.new_Pvariable(action_id, template_arg, parent)
     path_ = await cg.templatable(config[CONF_PATH], args, cg.std_string)
     cg.add(var.set_path(path_))
+    cg.add(var.set_parents(config[CONF_PARENTS]))
     return var
 
 
@@ -176,3 +348,35 @@ async def sd_mmc_delete_file_to_code(config, action_id, template_arg, args):
     path_ = await cg.templatable(config[CONF_PATH], args, cg.std_string)
     cg.add(var.set_path(path_))
     return var
+
+
+@automation.register_action(
+    "sd_mmc_card.benchmark",
+    SdMmcBenchmarkAction,
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.use_id(SdMmc),
+            cv.Optional(CONF_SIZE, default="1MB"): cv.templatable(validate_bytes),
+        }
+    ),
+)
+async def sd_mmc_benchmark_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, parent)
+    size_ = await cg.templatable(config[CONF_SIZE], args, cg.size_t)
+    cg.add(var.set_size(size_))
+    return var
+
+
+@automation.register_action(
+    "sd_mmc_card.discard_free_space",
+    SdMmcDiscardFreeSpaceAction,
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.use_id(SdMmc),
+        }
+    ),
+)
+async def sd_mmc_discard_free_space_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    return cg.new_Pvariable(action_id, template_arg, parent)
@@ -0,0 +1,281 @@
+#include "benchmark.h"
+#include "sd_mmc_card.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <unistd.h>
+
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+
+#ifdef USE_ESP32
+#include "esp_pthread.h"
+#endif
+
+namespace esphome {
+namespace sd_mmc_card {
+
+static const char *TAG = "sd_mmc_card.benchmark";
+static const char *const SCRATCH_DIRECTORY = "/.sdbench";
+// a long write is synced about once per this time of writing, in milliseconds
+static constexpr uint32_t FLUSH_INTERVAL = 1000;
+static constexpr uint32_t MIN_FLUSH_THRESHOLD = 65536;
+static constexpr uint32_t MAX_FLUSH_THRESHOLD = 4 * 1024 * 1024;
+
+constexpr uint32_t BenchmarkResult::BLOCK_SIZES[];
+
+uint32_t BenchmarkResult::best_sequential_write() const {
+  return *std::max_element(this->sequential_write, this->sequential_write + BLOCK_SIZE_COUNT);
+}
+
+uint32_t BenchmarkResult::best_sequential_read() const {
+  return *std::max_element(this->sequential_read, this->sequential_read + BLOCK_SIZE_COUNT);
+}
+
+static uint32_t rate(uint64_t count, uint32_t elapsed) {
+  return std::min<uint64_t>(count * 1000000 / std::max<uint32_t>(elapsed, 1), UINT32_MAX);
+}
+
+// smallest block size whose speed is within the tuning threshold of the best one
+static uint32_t smallest_fast_block(const uint32_t *speeds) {
+  uint32_t best = *std::max_element(speeds, speeds + BenchmarkResult::BLOCK_SIZE_COUNT);
+  uint64_t threshold = static_cast<uint64_t>(best) * CardBenchmark::TUNING_THRESHOLD;
+  for (size_t i = 0; i < BenchmarkResult::BLOCK_SIZE_COUNT; i++) {
+    if (best > 0 && static_cast<uint64_t>(speeds[i]) * 100 >= threshold)
+      return BenchmarkResult::BLOCK_SIZES[i];
+  }
+  return CardProfile().write_buffer_size;
+}
+
+CardBenchmark::CardBenchmark(std::unique_ptr<BenchmarkTarget> target, size_t file_size, uint32_t random_count,
+                             uint32_t file_count)
+    : target_(std::move(target)), random_count_(random_count), file_count_(file_count) {
+  uint32_t largest = BenchmarkResult::BLOCK_SIZES[BenchmarkResult::BLOCK_SIZE_COUNT - 1];
+  // whole blocks of the largest size, each block size then writes the same file
+  this->file_size_ = std::max<size_t>((file_size + largest - 1) / largest * largest, largest);
+}
+
+CardBenchmark::~CardBenchmark() {
+  if (this->task_.joinable())
+    this->task_.join();
+}
+
+bool CardBenchmark::run() {
+  this->result_ = BenchmarkResult();
+  this->seed_ = 1;
+  uint32_t largest = BenchmarkResult::BLOCK_SIZES[BenchmarkResult::BLOCK_SIZE_COUNT - 1];
+  this->buffer_.reset(new (std::nothrow) uint8_t[largest]);
+  if (this->buffer_ == nullptr) {
+    ESP_LOGE(TAG, "Failed to allocate a buffer of %u bytes", largest);
+    return false;
+  }
+  // not a repeated pattern, nothing on the way can shortcut the data
+  for (uint32_t i = 0; i < largest; i++)
+    this->buffer_[i] = static_cast<uint8_t>(i * 2654435761u >> 24);
+
+  bool ok = true;
+  for (size_t i = 0; ok && i < BenchmarkResult::BLOCK_SIZE_COUNT; i++) {
+    uint32_t block_size = BenchmarkResult::BLOCK_SIZES[i];
+    ok = this->sequential_write(block_size, this->result_.sequential_write[i]) &&
+         this->sequential_read(block_size, this->result_.sequential_read[i]);
+    if (ok) {
+      ESP_LOGD(TAG, "%u byte blocks: write %s/s, read %s/s", block_size,
+               format_size(this->result_.sequential_write[i]).c_str(),
+               format_size(this->result_.sequential_read[i]).c_str());
+    }
+  }
+  ok = ok && this->random_access(false, this->result_.random_read) &&
+       this->random_access(true, this->result_.random_write);
+  if (ok) {
+    ESP_LOGD(TAG, "Random %u byte blocks: %u reads/s, %u writes/s", RANDOM_BLOCK_SIZE, this->result_.random_read,
+             this->result_.random_write);
+  }
+  // the transfer results stay valid when the small files can not be created
+  if (ok && !this->file_operations(this->result_.file_operations))
+    ESP_LOGW(TAG, "File creation test failed");
+  this->target_->clean();
+  this->buffer_.reset();
+  return ok;
+}
+
+void CardBenchmark::start() {
+  this->done_ = false;
+#ifdef USE_ESP32
+  esp_pthread_cfg_t config = esp_pthread_get_default_config();
+  config.thread_name = "sd_bench";
+  config.stack_size = 4096;
+  config.prio = 1;
+  esp_pthread_set_cfg(&config);
+#endif
+  this->task_ = std::thread([this] {
+    this->success_ = this->run();
+    this->done_ = true;
+  });
+#ifdef USE_ESP32
+  config = esp_pthread_get_default_config();
+  esp_pthread_set_cfg(&config);
+#endif
+}
+
+bool CardBenchmark::join() {
+  if (this->task_.joinable())
+    this->task_.join();
+  return this->success_;
+}
+
+CardProfile CardBenchmark::tune(BenchmarkResult const &result) {
+  CardProfile profile;
+  profile.write_buffer_size = smallest_fast_block(result.sequential_write);
+  profile.read_chunk_size = smallest_fast_block(result.sequential_read);
+  // about FLUSH_INTERVAL of writing at the best speed, in whole buffers
+  uint64_t flush = static_cast<uint64_t>(result.best_sequential_write()) * FLUSH_INTERVAL / 1000;
+  flush = std::min<uint64_t>(flush / profile.write_buffer_size * profile.write_buffer_size, MAX_FLUSH_THRESHOLD);
+  profile.flush_threshold = std::max<uint64_t>(flush, MIN_FLUSH_THRESHOLD);
+  profile.tuned = true;
+  return profile;
+}
+
+bool CardBenchmark::sequential_write(uint32_t block_size, uint32_t &speed) {
+  if (!this->target_->open(true))
+    return false;
+  uint32_t start = this->target_->now();
+  for (size_t written = 0; written < this->file_size_; written += block_size) {
+    if (this->target_->write(this->buffer_.get(), block_size) != block_size) {
+      this->target_->close();
+      ESP_LOGE(TAG, "Failed to write the scratch file");
+      return false;
+    }
+  }
+  if (!this->target_->close())
+    return false;
+  speed = rate(this->file_size_, this->target_->now() - start);
+  return true;
+}
+
+bool CardBenchmark::sequential_read(uint32_t block_size, uint32_t &speed) {
+  if (!this->target_->open(false))
+    return false;
+  uint32_t start = this->target_->now();
+  for (size_t read = 0; read < this->file_size_; read += block_size) {
+    if (this->target_->read(this->buffer_.get(), block_size) != block_size) {
+      this->target_->close();
+      ESP_LOGE(TAG, "Failed to read the scratch file");
+      return false;
+    }
+  }
+  this->target_->close();
+  speed = rate(this->file_size_, this->target_->now() - start);
+  return true;
+}
+
+bool CardBenchmark::random_access(bool write, uint32_t &ops) {
+  if (!this->target_->open(false))
+    return false;
+  uint32_t start = this->target_->now();
+  for (uint32_t i = 0; i < this->random_count_; i++) {
+    bool ok = this->target_->seek(this->next_offset()) &&
+              (write ? this->target_->write(this->buffer_.get(), RANDOM_BLOCK_SIZE)
+                     : this->target_->read(this->buffer_.get(), RANDOM_BLOCK_SIZE)) == RANDOM_BLOCK_SIZE;
+    if (!ok) {
+      this->target_->close();
+      ESP_LOGE(TAG, "Failed to %s at a random offset", write ? "write" : "read");
+      return false;
+    }
+  }
+  if (!this->target_->close())
+    return false;
+  ops = rate(this->random_count_, this->target_->now() - start);
+  return true;
+}
+
+bool CardBenchmark::file_operations(uint32_t &ops) {
+  uint32_t start = this->target_->now();
+  bool ok = true;
+  for (uint32_t i = 0; ok && i < this->file_count_; i++)
+    ok = this->target_->create_file(i);
+  for (uint32_t i = 0; ok && i < this->file_count_; i++)
+    ok = this->target_->delete_file(i);
+  if (!ok) {
+    // the files left by the failed step
+    for (uint32_t i = 0; i < this->file_count_; i++)
+      this->target_->delete_file(i);
+    return false;
+  }
+  ops = rate(this->file_count_ * 2, this->target_->now() - start);
+  return true;
+}
+
+size_t CardBenchmark::next_offset() {
+  // xorshift, the same offsets on every run
+  this->seed_ ^= this->seed_ << 13;
+  this->seed_ ^= this->seed_ >> 17;
+  this->seed_ ^= this->seed_ << 5;
+  return this->seed_ % (this->file_size_ / RANDOM_BLOCK_SIZE) * RANDOM_BLOCK_SIZE;
+}
+
+// the scratch files are used through stdio without buffering, each block reaches the card driver as it is
+class CardTarget : public BenchmarkTarget {
+ public:
+  explicit CardTarget(SdMmc *card) : card_(card) {
+    this->directory_ = build_path(SCRATCH_DIRECTORY);
+    this->path_ = this->directory_ + "/scratch";
+  }
+  ~CardTarget() override { this->close(); }
+
+  bool open(bool truncate) override {
+    this->close();
+    bool exists = !truncate || this->card_->is_directory(SCRATCH_DIRECTORY);
+    if (!exists && !this->card_->create_directory(SCRATCH_DIRECTORY))
+      return false;
+    this->file_ = fopen(this->path_.c_str(), truncate ? "wb" : "r+b");
+    if (this->file_ == nullptr) {
+      ESP_LOGE(TAG, "Failed to open the scratch file: %s", strerror(errno));
+      return false;
+    }
+    setvbuf(this->file_, nullptr, _IONBF, 0);
+    return true;
+  }
+  size_t write(const uint8_t *buffer, size_t len) override { return fwrite(buffer, 1, len, this->file_); }
+  size_t read(uint8_t *buffer, size_t len) override { return fread(buffer, 1, len, this->file_); }
+  bool seek(size_t offset) override { return fseek(this->file_, offset, SEEK_SET) == 0; }
+  bool close() override {
+    if (this->file_ == nullptr)
+      return true;
+    bool ok = fflush(this->file_) == 0 && fsync(fileno(this->file_)) == 0;
+    ok = fclose(this->file_) == 0 && ok;
+    this->file_ = nullptr;
+    return ok;
+  }
+  bool create_file(uint32_t index) override {
+    FILE *file = fopen(this->file_path(index).c_str(), "wb");
+    if (file == nullptr)
+      return false;
+    bool ok = fsync(fileno(file)) == 0;
+    return fclose(file) == 0 && ok;
+  }
+  bool delete_file(uint32_t index) override { return unlink(this->file_path(index).c_str()) == 0; }
+  void clean() override {
+    this->close();
+    unlink(this->path_.c_str());
+    this->card_->remove_directory(SCRATCH_DIRECTORY);
+  }
+  uint32_t now() override { return micros(); }
+
+ protected:
+  std::string file_path(uint32_t index) const { return this->directory_ + "/" + to_string(index); }
+
+  SdMmc *card_;
+  std::string directory_;
+  std::string path_;
+  FILE *file_{nullptr};
+};
+
+std::unique_ptr<BenchmarkTarget> make_card_target(SdMmc *card) {
+  return std::unique_ptr<BenchmarkTarget>(new CardTarget(card));
+}
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
@@ -0,0 +1,117 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+namespace esphome {
+namespace sd_mmc_card {
+
+class SdMmc;
+
+/* Transfer settings tuned for the card, the defaults are used until a benchmark ran on it */
+struct CardProfile {
+  /* Buffer of the sequential writers, the smallest write reaching most of the card write speed */
+  uint32_t write_buffer_size{16384};
+  /* Bytes a long sequential write gathers before syncing the file, 0 to only sync when it is closed */
+  uint32_t flush_threshold{0};
+  /* Size of the sequential reads, the smallest read reaching most of the card read speed */
+  uint32_t read_chunk_size{16384};
+  bool tuned{false};
+};
+
+/* Speeds measured by a benchmark, 0 for the tests that did not run */
+struct BenchmarkResult {
+  static constexpr size_t BLOCK_SIZE_COUNT = 5;
+  static constexpr uint32_t BLOCK_SIZES[BLOCK_SIZE_COUNT] = {4096, 8192, 16384, 32768, 65536};
+
+  /* Bytes per second for each block size */
+  uint32_t sequential_write[BLOCK_SIZE_COUNT]{};
+  uint32_t sequential_read[BLOCK_SIZE_COUNT]{};
+  /* 4 KB operations per second at random offsets */
+  uint32_t random_write{0};
+  uint32_t random_read{0};
+  /* Files created then deleted per second */
+  uint32_t file_operations{0};
+
+  uint32_t best_sequential_write() const;
+  uint32_t best_sequential_read() const;
+};
+
+/* Storage a benchmark runs against: the card, or a simulated device when the measurements are checked on a host */
+class BenchmarkTarget {
+ public:
+  virtual ~BenchmarkTarget() = default;
+  /* Open the scratch file, emptied when truncate is set */
+  virtual bool open(bool truncate) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t len) = 0;
+  virtual size_t read(uint8_t *buffer, size_t len) = 0;
+  virtual bool seek(size_t offset) = 0;
+  /* Write everything to the device and close the scratch file */
+  virtual bool close() = 0;
+  /* Create an empty small file, or delete it */
+  virtual bool create_file(uint32_t index) = 0;
+  virtual bool delete_file(uint32_t index) = 0;
+  /* Remove the scratch file and its directory */
+  virtual void clean() = 0;
+  /* Monotonic time in microseconds */
+  virtual uint32_t now() = 0;
+};
+
+/* Card performance self-test.
+ *
+ * A scratch file of file_size bytes is written then read sequentially at each block size, then read and written
+ * in 4 KB blocks at random offsets, followed by the creation and deletion of file_count small files. Every test
+ * includes the time to sync its data to the card, the speeds are what a writer gets in practice.
+ *
+ * The profile keeps the smallest block size reaching 90% of the best speed, larger buffers cost memory for nothing
+ * on the card, and syncs the long writes about once per second of writing, at most every 4 MB.
+ */
+class CardBenchmark {
+ public:
+  static constexpr uint32_t RANDOM_BLOCK_SIZE = 4096;
+  /* Share of the best speed a block size must reach to be chosen, in percent */
+  static constexpr uint32_t TUNING_THRESHOLD = 90;
+
+  CardBenchmark(std::unique_ptr<BenchmarkTarget> target, size_t file_size, uint32_t random_count = 256,
+                uint32_t file_count = 32);
+  ~CardBenchmark();
+  CardBenchmark(CardBenchmark const &) = delete;
+  CardBenchmark &operator=(CardBenchmark const &) = delete;
+
+  /* Run every test, false when the scratch file could not be written or read */
+  bool run();
+  /* Run on a task, is_done() turns true when it finished */
+  void start();
+  bool is_done() const { return this->done_; }
+  /* Wait for the task, return the result of run() */
+  bool join();
+
+  BenchmarkResult const &get_result() const { return this->result_; }
+  static CardProfile tune(BenchmarkResult const &result);
+
+ protected:
+  bool sequential_write(uint32_t block_size, uint32_t &speed);
+  bool sequential_read(uint32_t block_size, uint32_t &speed);
+  bool random_access(bool write, uint32_t &ops);
+  bool file_operations(uint32_t &ops);
+  // offset of the next random block, a fixed sequence for the runs to be comparable
+  size_t next_offset();
+
+  std::unique_ptr<BenchmarkTarget> target_;
+  size_t file_size_;
+  uint32_t random_count_;
+  uint32_t file_count_;
+  std::unique_ptr<uint8_t[]> buffer_;
+  uint32_t seed_{1};
+  BenchmarkResult result_;
+  bool success_{false};
+  std::atomic<bool> done_{false};
+  std::thread task_;
+};
+
+/* Scratch files of a benchmark on the card */
+std::unique_ptr<BenchmarkTarget> make_card_target(SdMmc *card);
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
@@ -0,0 +1,785 @@
+#include "directory_index.h"
+#include "sd_mmc_card.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_set>
+
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+
+#ifdef USE_ESP_IDF
+#include "ff.h"
+#endif
+
+namespace esphome {
+namespace sd_mmc_card {
+
+static const char *TAG = "sd_mmc_card.index";
+
+const char *const DirectoryIndex::FILE_NAME = ".sdindex";
+
+// "SDIX", version 2, the logs of version 1 with 32 bit sizes fail the check and are rebuilt
+static constexpr uint8_t FILE_HEADER[8] = {'S', 'D', 'I', 'X', 2, 0, 0, 0};
+static constexpr size_t FILE_HEADER_SIZE = sizeof(FILE_HEADER);
+
+// record: marker, type, name size, flags, size (le64), mtime (le32), crc32 of the rest of the record (le32), name
+static constexpr size_t RECORD_HEADER_SIZE = 20;
+static constexpr uint8_t RECORD_MARKER = 0xA5;
+static constexpr uint8_t RECORD_PUT = 1;
+static constexpr uint8_t RECORD_DELETE = 2;
+// the entry is about to change, the card answers for it until a put or a delete follows
+static constexpr uint8_t RECORD_SUSPECT = 3;
+// the records before it hold a complete scan of the directory
+static constexpr uint8_t RECORD_VERIFIED = 4;
+
+static constexpr uint8_t FLAG_DIRECTORY = 1;
+// found by the current scan
+static constexpr uint8_t FLAG_SEEN = 2;
+
+static constexpr size_t MIN_CAPACITY = 64;
+static constexpr size_t MIN_NAMES_CAPACITY = 1024;
+static const char *const TEMP_SUFFIX = ".tmp";
+
+struct DirectoryIndex::Replay {
+  // the names announced as changing and not settled by a later record
+  std::unordered_set<std::string> suspects;
+  uint32_t start;
+  bool failed{false};
+};
+
+struct DirectoryIndex::Scan {
+#ifdef USE_ESP_IDF
+  FF_DIR dir;
+#else
+  DIR *dir{nullptr};
+#endif
+  bool failed{false};
+};
+
+static void put_le32(uint8_t *buffer, uint32_t value) {
+  for (int i = 0; i < 4; i++)
+    buffer[i] = (value >> (8 * i)) & 0xFF;
+}
+
+static uint32_t get_le32(const uint8_t *buffer) {
+  return buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | (static_cast<uint32_t>(buffer[3]) << 24);
+}
+
+static void put_le64(uint8_t *buffer, uint64_t value) {
+  put_le32(buffer, value & UINT32_MAX);
+  put_le32(buffer + 4, value >> 32);
+}
+
+static uint64_t get_le64(const uint8_t *buffer) {
+  return get_le32(buffer) | (static_cast<uint64_t>(get_le32(buffer + 4)) << 32);
+}
+
+static uint32_t hash_name(const char *name) {
+  // fnv-1a, 0 marks a free slot
+  uint32_t hash = 2166136261u;
+  for (; *name != '\0'; name++)
+    hash = (hash ^ static_cast<uint8_t>(*name)) * 16777619u;
+  return hash == 0 ? 1 : hash;
+}
+
+static bool ends_with(const char *name, size_t len, const char *suffix) {
+  size_t suffix_len = strlen(suffix);
+  return len >= suffix_len && strcmp(name + len - suffix_len, suffix) == 0;
+}
+
+// the log and its temporary file, and the temporary files of atomic writes are not indexed, their changes are not
+// reported. Only the names given by the component are left out, any other file is indexed whatever its extension.
+bool DirectoryIndex::is_indexed(const char *name, size_t len) {
+  if (len == 0 || (name[0] == '.' && (len == 1 || (len == 2 && name[1] == '.'))))
+    return false;
+  if (strncmp(name, DirectoryIndex::FILE_NAME, strlen(DirectoryIndex::FILE_NAME)) == 0)
+    return false;
+  return !ends_with(name, len, AtomicFile::TEMP_SUFFIX) && !ends_with(name, len, AtomicFile::NEW_SUFFIX);
+}
+
+DirectoryIndex::DirectoryIndex(std::string const &path) : path_(path) {}
+
+DirectoryIndex::~DirectoryIndex() {
+  this->close();
+  this->clear();
+}
+
+std::string DirectoryIndex::entry_path(const char *name) const { return this->path_ + "/" + name; }
+
+void DirectoryIndex::load() {
+  this->close();
+  this->clear();
+  this->phase_ = Phase::LOAD;
+}
+
+void DirectoryIndex::invalidate_all() {
+  if (this->phase_ != Phase::LOAD)
+    ESP_LOGD(TAG, "Index of %s invalidated", this->path_.c_str());
+  this->load();
+}
+
+void DirectoryIndex::step(uint32_t time_slice) {
+  uint32_t start = millis();
+  switch (this->phase_) {
+    case Phase::LOAD:
+      this->open_log();
+      break;
+    case Phase::REPLAY:
+      while (millis() - start < time_slice) {
+        if (!this->replay_record()) {
+          this->finish_replay();
+          break;
+        }
+      }
+      break;
+    case Phase::SCAN:
+      while (millis() - start < time_slice) {
+        if (!this->scan_entry()) {
+          this->finish_scan();
+          break;
+        }
+      }
+      break;
+    case Phase::READY:
+      if (this->log_size_ > COMPACTION_MIN_SIZE && this->log_size_ > 2 * this->live_size())
+        this->compact();
+      break;
+    case Phase::DISABLED:
+      return;
+  }
+  if (this->phase_ == Phase::SCAN || this->phase_ == Phase::READY)
+    this->resolve(start, time_slice);
+  this->flush(false);
+}
+
+void DirectoryIndex::open_log() {
+  this->trusted_ = false;
+  this->overflow_ = false;
+  this->corrections_ = 0;
+  if (!this->open_scan()) {
+    ESP_LOGW(TAG, "Failed to open %s, it is not indexed", this->path_.c_str());
+    this->phase_ = Phase::DISABLED;
+    return;
+  }
+
+  this->log_ = fopen(build_path(this->entry_path(FILE_NAME).c_str()).c_str(), "r+b");
+  uint8_t header[FILE_HEADER_SIZE];
+  if (this->log_ != nullptr && fread(header, 1, FILE_HEADER_SIZE, this->log_) == FILE_HEADER_SIZE &&
+      memcmp(header, FILE_HEADER, FILE_HEADER_SIZE) == 0) {
+    this->replay_.reset(new Replay());
+    this->replay_->start = millis();
+    this->log_size_ = FILE_HEADER_SIZE;
+    this->phase_ = Phase::REPLAY;
+    return;
+  }
+  if (this->log_ != nullptr)
+    ESP_LOGW(TAG, "Index of %s is damaged, rebuilding it", this->path_.c_str());
+  this->start_scan();
+}
+
+bool DirectoryIndex::replay_record() {
+  uint8_t record[RECORD_HEADER_SIZE];
+  if (fread(record, 1, RECORD_HEADER_SIZE, this->log_) != RECORD_HEADER_SIZE || record[0] != RECORD_MARKER ||
+      record[1] < RECORD_PUT || record[1] > RECORD_VERIFIED)
+    return false;
+  char name[UINT8_MAX + 1];
+  size_t len = record[2];
+  if (fread(name, 1, len, this->log_) != len)
+    return false;
+  uint32_t crc = crc32(0, record + 1, 15);
+  crc = crc32(crc, reinterpret_cast<const uint8_t *>(name), len);
+  if (crc != get_le32(record + 16))
+    return false;
+  name[len] = '\0';
+  // log_size_ is the end of the last valid record until the replay is done
+  this->log_size_ += RECORD_HEADER_SIZE + len;
+
+  if (record[1] == RECORD_VERIFIED) {
+    this->trusted_ = true;
+    return true;
+  }
+  auto &suspects = this->replay_->suspects;
+  if (record[1] == RECORD_SUSPECT) {
+    suspects.emplace(name);
+    return true;
+  }
+  suspects.erase(name);
+  if (record[1] == RECORD_PUT) {
+    Entry entry{get_le64(record + 4), get_le32(record + 12), (record[3] & FLAG_DIRECTORY) != 0};
+    if (!this->put(name, entry)) {
+      this->replay_->failed = true;
+      return false;
+    }
+  } else {
+    this->remove(name);
+  }
+  return true;
+}
+
+void DirectoryIndex::finish_replay() {
+  if (this->phase_ != Phase::REPLAY)
+    return;
+  std::unique_ptr<Replay> replay = std::move(this->replay_);
+  size_t position = this->log_size_;
+  bool failed = replay->failed;
+  if (!failed) {
+    // drop the torn record left by a power loss, the next append starts from the last valid one
+    fseek(this->log_, 0, SEEK_END);
+    long end = ftell(this->log_);
+    if (end > static_cast<long>(position)) {
+      ESP_LOGW(TAG, "Dropped %ld bytes at the end of the index of %s", end - static_cast<long>(position),
+               this->path_.c_str());
+      fflush(this->log_);
+      failed = ftruncate(fileno(this->log_), position) != 0;
+    }
+    fseek(this->log_, position, SEEK_SET);
+  }
+  if (failed || !this->trusted_) {
+    if (failed)
+      ESP_LOGW(TAG, "Index of %s is damaged, rebuilding it", this->path_.c_str());
+    this->start_scan();
+    return;
+  }
+  // the changes announced before a power loss are looked up again
+  for (auto const &suspect : replay->suspects) {
+    if (!this->is_pending(suspect.c_str()))
+      this->add_pending(suspect);
+  }
+  ESP_LOGD(TAG, "Loaded index of %s: %u entries in %u ms, verifying it", this->path_.c_str(), this->count_,
+           millis() - replay->start);
+  this->phase_ = Phase::SCAN;
+}
+
+void DirectoryIndex::start_scan() {
+  // an index from an interrupted rebuild is incomplete, it is started again
+  this->clear();
+  this->trusted_ = false;
+  if (!this->create_log()) {
+    this->disable("failed to create the log");
+    return;
+  }
+  ESP_LOGD(TAG, "Building index of %s", this->path_.c_str());
+  this->phase_ = Phase::SCAN;
+}
+
+bool DirectoryIndex::create_log() {
+  if (this->log_ != nullptr)
+    fclose(this->log_);
+  this->log_ = fopen(build_path(this->entry_path(FILE_NAME).c_str()).c_str(), "w+b");
+  if (this->log_ == nullptr)
+    return false;
+  if (fwrite(FILE_HEADER, 1, FILE_HEADER_SIZE, this->log_) != FILE_HEADER_SIZE) {
+    this->close();
+    return false;
+  }
+  this->log_size_ = FILE_HEADER_SIZE;
+  this->dirty_ = true;
+  return true;
+}
+
+bool DirectoryIndex::compact() {
+  std::string log_path = build_path(this->entry_path(FILE_NAME).c_str());
+  std::string temp_path = log_path + TEMP_SUFFIX;
+  FILE *out = fopen(temp_path.c_str(), "wb");
+  if (out == nullptr)
+    return false;
+
+  uint32_t start = millis();
+  size_t size = FILE_HEADER_SIZE;
+  bool ok = fwrite(FILE_HEADER, 1, FILE_HEADER_SIZE, out) == FILE_HEADER_SIZE;
+  for (size_t i = 0; ok && i < this->capacity_; i++) {
+    Slot const &slot = this->slots_[i];
+    if (slot.hash == 0 || slot.name == DELETED)
+      continue;
+    Entry entry{slot.size, slot.mtime, (slot.flags & FLAG_DIRECTORY) != 0};
+    ok = this->write_record(out, RECORD_PUT, this->names_ + slot.name, entry, size);
+  }
+  ok = ok && this->write_record(out, RECORD_VERIFIED, "", Entry{}, size);
+  for (auto const &pending : this->pending_)
+    ok = ok && this->write_record(out, RECORD_SUSPECT, pending.name.c_str(), Entry{}, size);
+  // the old log is deleted next, the new one must be on the card first
+  ok = ok && fflush(out) == 0 && fsync(fileno(out)) == 0;
+  ok = fclose(out) == 0 && ok;
+  if (!ok) {
+    ::remove(temp_path.c_str());
+    return false;
+  }
+
+  // fat can not rename over an existing file, a power loss in between leaves no log and the index is rebuilt
+  fclose(this->log_);
+  this->log_ = nullptr;
+  if (::remove(log_path.c_str()) != 0 || rename(temp_path.c_str(), log_path.c_str()) != 0 ||
+      (this->log_ = fopen(log_path.c_str(), "r+b")) == nullptr || fseek(this->log_, size, SEEK_SET) != 0) {
+    this->disable("failed to replace the log");
+    return false;
+  }
+  ESP_LOGD(TAG, "Compacted index of %s from %u to %u bytes in %u ms", this->path_.c_str(), this->log_size_, size,
+           millis() - start);
+  this->log_size_ = size;
+  this->dirty_ = false;
+  return true;
+}
+
+bool DirectoryIndex::write_record(FILE *file, uint8_t type, const char *name, Entry const &entry, size_t &size) {
+  size_t len = strlen(name);
+  uint8_t header[RECORD_HEADER_SIZE] = {RECORD_MARKER, type, static_cast<uint8_t>(len),
+                                        static_cast<uint8_t>(entry.is_directory ? FLAG_DIRECTORY : 0)};
+  put_le64(header + 4, entry.size);
+  put_le32(header + 12, entry.mtime);
+  uint32_t crc = crc32(0, header + 1, 15);
+  crc = crc32(crc, reinterpret_cast<const uint8_t *>(name), len);
+  put_le32(header + 16, crc);
+  if (fwrite(header, 1, RECORD_HEADER_SIZE, file) != RECORD_HEADER_SIZE || fwrite(name, 1, len, file) != len)
+    return false;
+  size += RECORD_HEADER_SIZE + len;
+  return true;
+}
+
+bool DirectoryIndex::append(uint8_t type, const char *name, Entry const &entry) {
+  if (this->log_ == nullptr)
+    return false;
+  if (!this->write_record(this->log_, type, name, entry, this->log_size_)) {
+    this->disable("failed to write the log");
+    return false;
+  }
+  this->dirty_ = true;
+  return true;
+}
+
+void DirectoryIndex::flush(bool sync) {
+  if (this->log_ == nullptr || !this->dirty_)
+    return;
+  this->dirty_ = false;
+  if (fflush(this->log_) != 0 || (sync && fsync(fileno(this->log_)) != 0))
+    this->disable("failed to write the log");
+}
+
+void DirectoryIndex::close() {
+  this->replay_.reset();
+  this->close_scan();
+  if (this->log_ == nullptr)
+    return;
+  fclose(this->log_);
+  this->log_ = nullptr;
+  this->dirty_ = false;
+}
+
+void DirectoryIndex::disable(const char *reason) {
+  ESP_LOGW(TAG, "Index of %s disabled: %s", this->path_.c_str(), reason);
+  this->close();
+  this->clear();
+  this->trusted_ = false;
+  this->phase_ = Phase::DISABLED;
+  // without a log the next mount rebuilds the index instead of trusting a log that missed a change
+  ::remove(build_path(this->entry_path(FILE_NAME).c_str()).c_str());
+}
+
+bool DirectoryIndex::open_scan() {
+  this->scan_.reset(new Scan());
+#ifdef USE_ESP_IDF
+  // FatFs reads the size and time along with the name, the vfs would need a stat per entry
+  if (f_opendir(&this->scan_->dir, fat_path(this->path_.empty() ? "/" : this->path_.c_str()).c_str()) != FR_OK) {
+    this->scan_.reset();
+    return false;
+  }
+#else
+  this->scan_->dir = opendir(build_path(this->path_.c_str()).c_str());
+  if (this->scan_->dir == nullptr) {
+    this->scan_.reset();
+    return false;
+  }
+#endif
+  return true;
+}
+
+void DirectoryIndex::close_scan() {
+  if (this->scan_ == nullptr)
+    return;
+#ifdef USE_ESP_IDF
+  f_closedir(&this->scan_->dir);
+#else
+  closedir(this->scan_->dir);
+#endif
+  this->scan_.reset();
+}
+
+bool DirectoryIndex::scan_entry() {
+  Entry entry;
+#ifdef USE_ESP_IDF
+  FILINFO info;
+  if (f_readdir(&this->scan_->dir, &info) != FR_OK) {
+    this->scan_->failed = true;
+    return false;
+  }
+  if (info.fname[0] == '\0')
+    return false;
+  const char *name = info.fname;
+#else
+  errno = 0;
+  struct dirent *dirent = readdir(this->scan_->dir);
+  if (dirent == nullptr) {
+    this->scan_->failed = errno != 0;
+    return false;
+  }
+  const char *name = dirent->d_name;
+#endif
+  size_t len = strlen(name);
+  if (len > UINT8_MAX) {
+    // the log can not hold the name, listings go to the card
+    this->overflow_ = true;
+    return true;
+  }
+  if (!is_indexed(name, len))
+    return true;
+  // a pending name is looked up when it settles
+  if (this->is_pending(name))
+    return true;
+#ifdef USE_ESP_IDF
+  entry.size = info.fsize;
+  entry.mtime = fat_time(info.fdate, info.ftime);
+  entry.is_directory = (info.fattrib & AM_DIR) != 0;
+#else
+  int error;
+  // removed since it was read
+  if (!this->stat_entry(name, entry, error))
+    return true;
+#endif
+  int32_t index = this->find_slot(name, hash_name(name));
+  if (index >= 0) {
+    Slot &slot = this->slots_[index];
+    if (slot.size == entry.size && slot.mtime == entry.mtime &&
+        ((slot.flags & FLAG_DIRECTORY) != 0) == entry.is_directory) {
+      slot.flags |= FLAG_SEEN;
+      return true;
+    }
+  }
+  if (this->trusted_) {
+    ESP_LOGV(TAG, "Index of %s corrected: %s", this->path_.c_str(), name);
+    this->corrections_++;
+  }
+  if (!this->put(name, entry, FLAG_SEEN)) {
+    this->disable("out of memory");
+    return false;
+  }
+  return this->append(RECORD_PUT, name, entry);
+}
+
+void DirectoryIndex::finish_scan() {
+  if (this->phase_ != Phase::SCAN)
+    return;
+  bool failed = this->scan_->failed;
+  this->close_scan();
+  if (failed) {
+    this->disable("failed to read the directory");
+    return;
+  }
+  // the entries the scan did not find were removed behind the index
+  for (size_t i = 0; i < this->capacity_; i++) {
+    Slot &slot = this->slots_[i];
+    if (slot.hash == 0 || slot.name == DELETED)
+      continue;
+    const char *name = this->names_ + slot.name;
+    if ((slot.flags & FLAG_SEEN) == 0 && !this->is_pending(name)) {
+      ESP_LOGV(TAG, "Index of %s corrected: %s removed", this->path_.c_str(), name);
+      this->corrections_++;
+      if (!this->append(RECORD_DELETE, name, Entry{}))
+        return;
+      this->remove(name);
+    }
+    slot.flags &= ~FLAG_SEEN;
+  }
+  if (!this->trusted_ && !this->append(RECORD_VERIFIED, "", Entry{}))
+    return;
+  this->trusted_ = true;
+  this->phase_ = Phase::READY;
+  this->flush(this->sync_);
+  ESP_LOGI(TAG, "Index of %s ready: %u entries, %u corrected", this->path_.c_str(), this->count_,
+           this->corrections_);
+}
+
+void DirectoryIndex::invalidate(std::string const &name) {
+  if (this->phase_ == Phase::DISABLED)
+    return;
+  if (name.size() > UINT8_MAX) {
+    this->overflow_ = true;
+    return;
+  }
+  if (!is_indexed(name.c_str(), name.size()))
+    return;
+  for (auto &pending : this->pending_) {
+    if (pending.name == name) {
+      pending.since = millis();
+      return;
+    }
+  }
+  this->add_pending(name);
+  // the log must know about the change before it happens, a power loss in between would leave a wrong entry.
+  // While loading the log is still being read, the scan that follows verifies the entry anyway.
+  if (this->phase_ != Phase::LOAD && this->phase_ != Phase::REPLAY &&
+      this->append(RECORD_SUSPECT, name.c_str(), Entry{}))
+    this->flush(this->sync_);
+}
+
+void DirectoryIndex::resolve(uint32_t start, uint32_t time_slice) {
+  uint32_t now = millis();
+  for (size_t i = 0; i < this->pending_.size() && millis() - start < time_slice;) {
+    Pending &pending = this->pending_[i];
+    // still being written
+    if (now - pending.since < RESOLVE_DELAY) {
+      i++;
+      continue;
+    }
+    Entry entry;
+    int error;
+    const char *name = pending.name.c_str();
+    if (this->stat_entry(name, entry, error)) {
+      if (!this->put(name, entry, this->phase_ == Phase::SCAN ? FLAG_SEEN : 0)) {
+        this->disable("out of memory");
+        return;
+      }
+      if (!this->append(RECORD_PUT, name, entry))
+        return;
+    } else if (error == ENOENT) {
+      this->remove(name);
+      if (!this->append(RECORD_DELETE, name, entry))
+        return;
+    } else {
+      ESP_LOGW(TAG, "Failed to stat %s/%s: %s", this->path_.c_str(), name, strerror(error));
+      pending.since = now;
+      i++;
+      continue;
+    }
+    this->pending_.erase(this->pending_.begin() + i);
+  }
+}
+
+bool DirectoryIndex::stat_entry(const char *name, Entry &entry, int &error) const {
+#ifdef USE_ESP_IDF
+  // the size in the vfs stat is 32 bits
+  FILINFO info;
+  FRESULT res = f_stat(fat_path(this->entry_path(name).c_str()).c_str(), &info);
+  if (res != FR_OK) {
+    error = res == FR_NO_FILE || res == FR_NO_PATH ? ENOENT : EIO;
+    return false;
+  }
+  entry.size = info.fsize;
+  entry.mtime = fat_time(info.fdate, info.ftime);
+  entry.is_directory = (info.fattrib & AM_DIR) != 0;
+  return true;
+#else
+  struct stat info;
+  if (stat(build_path(this->entry_path(name).c_str()).c_str(), &info) != 0) {
+    error = errno;
+    return false;
+  }
+  entry.size = info.st_size;
+  entry.mtime = info.st_mtime;
+  entry.is_directory = S_ISDIR(info.st_mode);
+  return true;
+#endif
+}
+
+DirectoryIndex::Lookup DirectoryIndex::find(const char *name, Entry &entry) const {
+  size_t len = strlen(name);
+  if (!this->is_ready() || len > UINT8_MAX || !is_indexed(name, len) || this->is_pending(name))
+    return Lookup::UNKNOWN;
+  int32_t index = this->find_slot(name, hash_name(name));
+  if (index < 0)
+    return Lookup::MISSING;
+  Slot const &slot = this->slots_[index];
+  entry = Entry{slot.size, slot.mtime, (slot.flags & FLAG_DIRECTORY) != 0};
+  return Lookup::FOUND;
+}
+
+bool DirectoryIndex::for_each(std::function<void(const char *, Entry const &)> const &callback) const {
+  if (!this->is_ready() || this->overflow_)
+    return false;
+  for (size_t i = 0; i < this->capacity_; i++) {
+    Slot const &slot = this->slots_[i];
+    if (slot.hash == 0 || slot.name == DELETED)
+      continue;
+    const char *name = this->names_ + slot.name;
+    if (!this->is_pending(name))
+      callback(name, Entry{slot.size, slot.mtime, (slot.flags & FLAG_DIRECTORY) != 0});
+  }
+  // the changed entries come from the card
+  for (auto const &pending : this->pending_) {
+    Entry entry;
+    int error;
+    if (this->stat_entry(pending.name.c_str(), entry, error))
+      callback(pending.name.c_str(), entry);
+  }
+  return true;
+}
+
+size_t DirectoryIndex::live_size() const {
+  return FILE_HEADER_SIZE + (this->count_ + 1) * RECORD_HEADER_SIZE + this->live_names_;
+}
+
+bool DirectoryIndex::put(const char *name, Entry const &entry, uint8_t flags) {
+  uint32_t hash = hash_name(name);
+  int32_t index = this->find_slot(name, hash);
+  if (index < 0) {
+    size_t len = strlen(name);
+    uint32_t offset;
+    if (!this->reserve(this->count_ + 1) || !this->add_name(name, len, offset))
+      return false;
+    size_t mask = this->capacity_ - 1;
+    index = hash & mask;
+    while (this->slots_[index].hash != 0 && this->slots_[index].name != DELETED)
+      index = (index + 1) & mask;
+    if (this->slots_[index].hash == 0)
+      this->used_++;
+    this->slots_[index].hash = hash;
+    this->slots_[index].name = offset;
+    this->count_++;
+    this->live_names_ += len;
+  }
+  Slot &slot = this->slots_[index];
+  slot.size = entry.size;
+  slot.mtime = entry.mtime;
+  slot.flags = (entry.is_directory ? FLAG_DIRECTORY : 0) | flags;
+  return true;
+}
+
+bool DirectoryIndex::remove(const char *name) {
+  int32_t index = this->find_slot(name, hash_name(name));
+  if (index < 0)
+    return false;
+  // the slot stays used so the probes of the entries after it still reach them
+  this->slots_[index].name = DELETED;
+  this->count_--;
+  this->live_names_ -= strlen(name);
+  return true;
+}
+
+int32_t DirectoryIndex::find_slot(const char *name, uint32_t hash) const {
+  if (this->capacity_ == 0)
+    return -1;
+  size_t mask = this->capacity_ - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    Slot const &slot = this->slots_[i];
+    if (slot.hash == 0)
+      return -1;
+    if (slot.hash == hash && slot.name != DELETED && strcmp(this->names_ + slot.name, name) == 0)
+      return i;
+  }
+}
+
+bool DirectoryIndex::reserve(size_t count) {
+  // at most 3/4 of the slots used, removed entries included
+  if ((this->used_ + 1) * 4 <= this->capacity_ * 3)
+    return true;
+  size_t capacity = MIN_CAPACITY;
+  while (capacity * 3 < count * 8)
+    capacity *= 2;
+  return this->rehash(capacity);
+}
+
+bool DirectoryIndex::rehash(size_t capacity) {
+  RAMAllocator<Slot> slot_allocator;
+  RAMAllocator<char> name_allocator;
+  Slot *slots = slot_allocator.allocate(capacity);
+  // the names of the removed entries are dropped
+  size_t names_capacity = std::max(2 * (this->live_names_ + this->count_), MIN_NAMES_CAPACITY);
+  char *names = name_allocator.allocate(names_capacity);
+  if (slots == nullptr || names == nullptr) {
+    if (slots != nullptr)
+      slot_allocator.deallocate(slots, capacity);
+    if (names != nullptr)
+      name_allocator.deallocate(names, names_capacity);
+    ESP_LOGE(TAG, "Failed to allocate %u entries for the index of %s", capacity, this->path_.c_str());
+    return false;
+  }
+  memset(slots, 0, capacity * sizeof(Slot));
+
+  size_t names_size = 0;
+  size_t mask = capacity - 1;
+  for (size_t i = 0; i < this->capacity_; i++) {
+    Slot const &slot = this->slots_[i];
+    if (slot.hash == 0 || slot.name == DELETED)
+      continue;
+    size_t index = slot.hash & mask;
+    while (slots[index].hash != 0)
+      index = (index + 1) & mask;
+    slots[index] = slot;
+    size_t len = strlen(this->names_ + slot.name) + 1;
+    memcpy(names + names_size, this->names_ + slot.name, len);
+    slots[index].name = names_size;
+    names_size += len;
+  }
+
+  size_t count = this->count_;
+  size_t live_names = this->live_names_;
+  this->clear();
+  this->slots_ = slots;
+  this->capacity_ = capacity;
+  this->used_ = count;
+  this->count_ = count;
+  this->live_names_ = live_names;
+  this->names_ = names;
+  this->names_size_ = names_size;
+  this->names_capacity_ = names_capacity;
+  return true;
+}
+
+bool DirectoryIndex::add_name(const char *name, size_t len, uint32_t &offset) {
+  if (this->names_size_ + len + 1 > this->names_capacity_) {
+    RAMAllocator<char> allocator;
+    size_t capacity = std::max(2 * this->names_capacity_, this->names_size_ + len + 1);
+    char *names = allocator.allocate(capacity);
+    if (names == nullptr) {
+      ESP_LOGE(TAG, "Failed to allocate %u bytes of names for the index of %s", capacity, this->path_.c_str());
+      return false;
+    }
+    if (this->names_ != nullptr) {
+      memcpy(names, this->names_, this->names_size_);
+      allocator.deallocate(this->names_, this->names_capacity_);
+    }
+    this->names_ = names;
+    this->names_capacity_ = capacity;
+  }
+  offset = this->names_size_;
+  memcpy(this->names_ + offset, name, len + 1);
+  this->names_size_ += len + 1;
+  return true;
+}
+
+void DirectoryIndex::clear() {
+  if (this->slots_ != nullptr) {
+    RAMAllocator<Slot> allocator;
+    allocator.deallocate(this->slots_, this->capacity_);
+  }
+  if (this->names_ != nullptr) {
+    RAMAllocator<char> allocator;
+    allocator.deallocate(this->names_, this->names_capacity_);
+  }
+  this->slots_ = nullptr;
+  this->capacity_ = 0;
+  this->used_ = 0;
+  this->count_ = 0;
+  this->live_names_ = 0;
+  this->names_ = nullptr;
+  this->names_size_ = 0;
+  this->names_capacity_ = 0;
+}
+
+bool DirectoryIndex::is_pending(const char *name) const {
+  for (auto const &pending : this->pending_) {
+    if (pending.name == name)
+      return true;
+  }
+  return false;
+}
+
+void DirectoryIndex::add_pending(std::string const &name) { this->pending_.push_back(Pending{name, millis()}); }
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
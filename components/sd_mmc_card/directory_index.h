@@ -0,0 +1,158 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace esphome {
+namespace sd_mmc_card {
+
+/* Index of the entries of one large directory.
+ *
+ * FAT keeps a directory as an unsorted list of entries, every lookup, size or listing reads it from the start.
+ * The index keeps the name, size, time and type of each entry in a hash table, in PSRAM when available, and
+ * persists it in a sidecar log in the directory itself so it is loaded at mount without a full scan.
+ *
+ * The card tells the index about each change through the file cache invalidation. The changed name is marked
+ * suspect in the log before the change, then looked up on the card once it has been left alone for a while.
+ * A suspect name is answered by the card, never by the index, so a power loss between the change and the
+ * lookup can not leave a wrong entry behind.
+ *
+ * The log is replayed in time slices, then the directory is scanned once in time slices to catch changes made
+ * outside of this device: a verified index answers during the scan, a new or damaged one is rebuilt by the scan
+ * before answering.
+ */
+class DirectoryIndex {
+ public:
+  enum class Lookup : uint8_t { UNKNOWN, FOUND, MISSING };
+
+  struct Entry {
+    uint64_t size;
+    uint32_t mtime;
+    bool is_directory;
+  };
+
+  /* Name of the sidecar log in the indexed directory */
+  static const char *const FILE_NAME;
+  /* Time without change before a suspect name is looked up on the card */
+  static constexpr uint32_t RESOLVE_DELAY = 1000;
+  /* Smallest log compacted, a larger log is compacted when it is more than half stale */
+  static constexpr uint32_t COMPACTION_MIN_SIZE = 65536;
+
+  /* False for . and .., the log and its temporary file and the temporary files of atomic writes */
+  static bool is_indexed(const char *name, size_t len);
+
+  explicit DirectoryIndex(std::string const &path);
+  ~DirectoryIndex();
+  DirectoryIndex(DirectoryIndex const &) = delete;
+  DirectoryIndex &operator=(DirectoryIndex const &) = delete;
+
+  std::string const &get_path() const { return this->path_; }
+  /* Sync the suspect records to the card before the change they announce */
+  void set_sync(bool sync) { this->sync_ = sync; }
+  /* The index answers lookups */
+  bool is_ready() const {
+    return this->trusted_ && this->phase_ != Phase::LOAD && this->phase_ != Phase::REPLAY &&
+           this->phase_ != Phase::DISABLED;
+  }
+  size_t size() const { return this->count_; }
+  uint32_t get_corrections() const { return this->corrections_; }
+
+  /* Load the log on the next step, then verify or rebuild it */
+  void load();
+  /* Work for at most time_slice milliseconds */
+  void step(uint32_t time_slice);
+  /* The entry is about to change */
+  void invalidate(std::string const &name);
+  /* Forget everything and rebuild, e.g. after the directory itself was removed or created */
+  void invalidate_all();
+  Lookup find(const char *name, Entry &entry) const;
+  /* Call back with every entry, false when the index can not answer */
+  bool for_each(std::function<void(const char *, Entry const &)> const &callback) const;
+  /* Write the pending records and close the log */
+  void close();
+
+ protected:
+  enum class Phase : uint8_t { LOAD, REPLAY, SCAN, READY, DISABLED };
+
+  struct Slot {
+    // 0 for a free slot
+    uint32_t hash;
+    // offset of the name in names_, DELETED for a removed entry
+    uint32_t name;
+    uint64_t size;
+    uint32_t mtime;
+    uint8_t flags;
+  };
+
+  struct Pending {
+    std::string name;
+    uint32_t since;
+  };
+
+  static constexpr uint32_t DELETED = UINT32_MAX;
+
+  struct Replay;
+  struct Scan;
+
+  std::string entry_path(const char *name) const;
+  void open_log();
+  bool replay_record();
+  void finish_replay();
+  void start_scan();
+  bool create_log();
+  bool compact();
+  bool write_record(FILE *file, uint8_t type, const char *name, Entry const &entry, size_t &size);
+  bool append(uint8_t type, const char *name, Entry const &entry);
+  void flush(bool sync);
+  void disable(const char *reason);
+  bool open_scan();
+  bool scan_entry();
+  void close_scan();
+  void finish_scan();
+  void resolve(uint32_t start, uint32_t time_slice);
+  bool stat_entry(const char *name, Entry &entry, int &error) const;
+  size_t live_size() const;
+
+  bool put(const char *name, Entry const &entry, uint8_t flags = 0);
+  bool remove(const char *name);
+  int32_t find_slot(const char *name, uint32_t hash) const;
+  bool reserve(size_t count);
+  bool rehash(size_t capacity);
+  bool add_name(const char *name, size_t len, uint32_t &offset);
+  void clear();
+  bool is_pending(const char *name) const;
+  void add_pending(std::string const &name);
+
+  std::string path_;
+  Phase phase_{Phase::DISABLED};
+  bool sync_{true};
+  // the log holds a complete scan of the directory
+  bool trusted_{false};
+
+  Slot *slots_{nullptr};
+  size_t capacity_{0};
+  // live and removed slots, a probe ends at a free one
+  size_t used_{0};
+  size_t count_{0};
+  char *names_{nullptr};
+  size_t names_size_{0};
+  size_t names_capacity_{0};
+  // bytes of the names of the live entries
+  size_t live_names_{0};
+  // a name too long for the log was found, listings go to the card
+  bool overflow_{false};
+
+  std::vector<Pending> pending_;
+  FILE *log_{nullptr};
+  size_t log_size_{0};
+  bool dirty_{false};
+  std::unique_ptr<Replay> replay_;
+  std::unique_ptr<Scan> scan_;
+  uint32_t corrections_{0};
+};
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
@@ -0,0 +1,203 @@
+#include "discard.h"
+
+#ifdef USE_ESP_IDF
+#include "sd_mmc_card.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+#include "esphome/core/log.h"
+#include "diskio_sdmmc.h"
+#include "esp_idf_version.h"
+#include "esp_pthread.h"
+
+namespace esphome {
+namespace sd_mmc_card {
+
+static const char *TAG = "sd_mmc_card.discard";
+// claims the region being discarded, left only by a power loss during a batch
+static const char *const CLAIM_FILE = ".sddiscard";
+// pause between two batches and between two looks at the freed clusters, in milliseconds
+static constexpr uint32_t BATCH_DELAY = 20;
+static constexpr uint32_t POLL_INTERVAL = 5000;
+
+DiscardTask::~DiscardTask() { this->stop(); }
+
+bool DiscardTask::start(SdMmc *card) {
+  if (this->is_running())
+    return true;
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 2, 0)
+  this->card_ = card;
+  this->sdmmc_ = card->card_;
+  BYTE drive = ff_diskio_get_pdrv_card(this->sdmmc_);
+  if (drive == 0xFF) {
+    ESP_LOGW(TAG, "The card is not mounted, nothing is discarded");
+    return false;
+  }
+  snprintf(this->drive_path_, sizeof(this->drive_path_), "%u:", drive);
+  snprintf(this->claim_path_, sizeof(this->claim_path_), "%u:/%s", drive, CLAIM_FILE);
+  DWORD free;
+  // also makes the free cluster count of the volume valid, it is then kept up to date by FatFs
+  if (f_getfree(this->drive_path_, &free, &this->fs_) != FR_OK) {
+    ESP_LOGW(TAG, "Failed to read the allocation of the card, nothing is discarded");
+    return false;
+  }
+  if (this->fs_->fs_type == FS_FAT12) {
+    ESP_LOGW(TAG, "FAT12 volumes are not discarded");
+    return false;
+  }
+  this->erase_arg_ = sdmmc_can_discard(this->sdmmc_) == ESP_OK ? SDMMC_DISCARD_ARG : SDMMC_ERASE_ARG;
+  f_unlink(this->claim_path_);
+  this->last_free_ = this->fs_->free_clst;
+  this->stop_ = false;
+
+  esp_pthread_cfg_t config = esp_pthread_get_default_config();
+  config.thread_name = "sd_discard";
+  config.stack_size = 4096;
+  config.prio = 1;
+  esp_pthread_set_cfg(&config);
+  this->task_ = std::thread([this] { this->run(); });
+  config = esp_pthread_get_default_config();
+  esp_pthread_set_cfg(&config);
+  return true;
+#else
+  // f_expand, which claims the free regions, is only built from ESP-IDF 5.2
+  ESP_LOGW(TAG, "Discarding the free space needs ESP-IDF 5.2 or later");
+  return false;
+#endif
+}
+
+void DiscardTask::stop() {
+  if (this->task_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(this->mutex_);
+      this->stop_ = true;
+    }
+    this->wake_.notify_all();
+    this->task_.join();
+  }
+}
+
+void DiscardTask::discard_all() {
+  if (!this->is_running())
+    return;
+  this->discard_all_ = true;
+  this->wake_.notify_all();
+}
+
+const char *DiscardTask::get_mode() const { return this->erase_arg_ == SDMMC_DISCARD_ARG ? "discard" : "erase"; }
+
+void DiscardTask::run() {
+  std::unique_lock<std::mutex> lock(this->mutex_);
+  while (!this->stop_) {
+    bool busy = (this->pending_ > 0 || this->discard_all_) && !this->paused_;
+    uint32_t delay = busy ? BATCH_DELAY : POLL_INTERVAL;
+    this->wake_.wait_for(lock, std::chrono::milliseconds(delay));
+    if (this->stop_)
+      break;
+    lock.unlock();
+    // the free clusters once, the claims then go around the whole volume
+    if (this->discard_all_.exchange(false))
+      this->pending_ = this->fs_->free_clst;
+    if (this->track_freed_)
+      this->track_freed();
+    if (this->pending_ > 0 && !this->paused_)
+      this->batch();
+    lock.lock();
+  }
+}
+
+void DiscardTask::track_freed() {
+  // a word written by FatFs under its own lock, an outdated value is corrected on the next look
+  DWORD free = this->fs_->free_clst;
+  if (free > this->fs_->n_fatent - 2)
+    return;
+  if (free > this->last_free_)
+    this->pending_ += free - this->last_free_;
+  this->last_free_ = free;
+}
+
+void DiscardTask::batch() {
+  uint32_t cluster_size = this->fs_->csize * FF_SS_SDCARD;
+  uint32_t batch_clusters = std::max<uint32_t>(BATCH_SIZE / cluster_size, 1);
+  uint32_t min_clusters = std::max<uint32_t>(MIN_REGION_SIZE / cluster_size, 1);
+  // there is never more to discard than the free space
+  uint32_t pending = std::min<uint32_t>(this->pending_, this->fs_->free_clst);
+  if (this->claim_clusters_ == 0)
+    this->claim_clusters_ = batch_clusters;
+  uint32_t count = std::min(this->claim_clusters_, pending);
+
+  if (count >= min_clusters) {
+    uint32_t start;
+    FRESULT res;
+    {
+      // only while the card is not used through the component, the batch runs later otherwise
+      std::unique_lock<std::recursive_mutex> guard(this->card_->lock_, std::try_to_lock);
+      if (!guard.owns_lock())
+        return;
+      res = this->claim_region(count, start);
+    }
+    if (res == FR_OK) {
+      if (this->discard_region(start, count))
+        this->sectors_discarded_ += static_cast<uint64_t>(count) * this->fs_->csize;
+      pending -= count;
+      this->claim_clusters_ = batch_clusters;
+    } else if (res == FR_DENIED && count > min_clusters) {
+      // no free region that large, the same clusters are claimed by smaller regions
+      this->claim_clusters_ = std::max(count / 2, min_clusters);
+    } else {
+      if (res == FR_DENIED)
+        ESP_LOGD(TAG, "No free region of %s left", format_size(MIN_REGION_SIZE).c_str());
+      pending = 0;
+    }
+  } else {
+    // what is left is smaller than a region worth discarding
+    pending = 0;
+  }
+  this->pending_ = pending;
+  if (pending == 0)
+    ESP_LOGD(TAG, "Free space discarded, %s in total", format_size(this->sectors_discarded_ * FF_SS_SDCARD).c_str());
+}
+
+FRESULT DiscardTask::claim_region(uint32_t count, uint32_t &start) {
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 2, 0)
+  FIL file;
+  FRESULT res = f_open(&file, this->claim_path_, FA_CREATE_ALWAYS | FA_WRITE);
+  if (res != FR_OK) {
+    ESP_LOGW(TAG, "Failed to create %s: %d", CLAIM_FILE, res);
+    return res;
+  }
+  // FatFs looks for the free region from its allocation hint and moves the hint past it
+  res = f_expand(&file, static_cast<FSIZE_t>(count) * this->fs_->csize * FF_SS_SDCARD, 1);
+  start = file.obj.sclust;
+  FRESULT closed = f_close(&file);
+  if (res == FR_OK)
+    res = closed;
+  if (res != FR_OK) {
+    f_unlink(this->claim_path_);
+    if (res != FR_DENIED)
+      ESP_LOGW(TAG, "Failed to claim %u free clusters: %d", count, res);
+  }
+  return res;
+#else
+  return FR_NOT_ENABLED;
+#endif
+}
+
+bool DiscardTask::discard_region(uint32_t start, uint32_t count) {
+  // the region belongs to the claim file, no write can be given any of its clusters until it is deleted
+  LBA_t sector = this->fs_->database + static_cast<LBA_t>(start - 2) * this->fs_->csize;
+  esp_err_t err =
+      sdmmc_erase_sectors(this->sdmmc_, sector, static_cast<size_t>(count) * this->fs_->csize, this->erase_arg_);
+  if (err != ESP_OK)
+    ESP_LOGW(TAG, "Failed to %s %u sectors: %s", this->get_mode(), count * this->fs_->csize, esp_err_to_name(err));
+  std::lock_guard<std::recursive_mutex> guard(this->card_->lock_);
+  f_unlink(this->claim_path_);
+  return err == ESP_OK;
+}
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
+
+#endif
@@ -0,0 +1,86 @@
+#pragma once
+#include "esphome/core/defines.h"
+
+#ifdef USE_ESP_IDF
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include "ff.h"
+#include "sdmmc_cmd.h"
+
+namespace esphome {
+namespace sd_mmc_card {
+
+class SdMmc;
+
+/* Discard of the free space of the card, its controller then no longer copies the stale data of those blocks when
+ * it reorganizes its flash.
+ *
+ * The clusters freed by deletes and truncates are counted from the free cluster count of the file system, the same
+ * amount of free space is then discarded by a low priority task in batches, while the card is not used through the
+ * component. A region is never erased while it is free: it is first claimed by a temporary file so no concurrent
+ * write can be given its clusters, erased without holding the card, then released. FatFs chooses the region from its
+ * own allocation hint, which moves past each claim, so the batches go through the free space of the volume in turn.
+ * A claim is halved when no free region is large enough, the free space left in regions smaller than the smallest
+ * claim is not discarded.
+ */
+class DiscardTask {
+ public:
+  /* Largest region claimed and discarded at once in bytes */
+  static constexpr uint32_t BATCH_SIZE = 4 * 1024 * 1024;
+  /* Free regions smaller than this are left, discarding them writes about as much as it saves */
+  static constexpr uint32_t MIN_REGION_SIZE = 64 * 1024;
+
+  ~DiscardTask();
+  /* Start the task on the mounted card, false when the card or its file system can not be discarded */
+  bool start(SdMmc *card);
+  void stop();
+  bool is_running() const { return this->task_.joinable(); }
+  /* Count the clusters freed from now on and discard as much free space */
+  void set_track_freed(bool track) { this->track_freed_ = track; }
+  /* Discard every free cluster of the card once */
+  void discard_all();
+  /* No batch runs while paused, a measurement of the card is not disturbed */
+  void set_paused(bool paused) { this->paused_ = paused; }
+  uint64_t get_sectors_discarded() const { return this->sectors_discarded_; }
+  /* Discard or erase, as supported by the card */
+  const char *get_mode() const;
+
+ protected:
+  void run();
+  /* Add the clusters freed since the last look to the pending ones */
+  void track_freed();
+  void batch();
+  /* Claim a free region of count clusters, with the card held for as short as possible */
+  FRESULT claim_region(uint32_t count, uint32_t &start);
+  /* Discard a claimed region and release it, false when the card failed */
+  bool discard_region(uint32_t start, uint32_t count);
+
+  SdMmc *card_{nullptr};
+  sdmmc_card_t *sdmmc_{nullptr};
+  FATFS *fs_{nullptr};
+  // FatFs paths of the drive of the card and of the temporary file on it
+  char drive_path_[8];
+  char claim_path_[16];
+  sdmmc_erase_arg_t erase_arg_{SDMMC_ERASE_ARG};
+  uint32_t last_free_{0};
+  // clusters of the next claim, 0 for a whole batch
+  uint32_t claim_clusters_{0};
+  // free clusters still to discard
+  uint32_t pending_{0};
+  std::atomic<uint64_t> sectors_discarded_{0};
+  std::atomic<bool> track_freed_{false};
+  std::atomic<bool> paused_{false};
+  std::atomic<bool> discard_all_{false};
+  bool stop_{false};
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::thread task_;
+};
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
+
+#endif
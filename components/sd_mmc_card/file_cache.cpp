@@ -0,0 +1,117 @@
+#include "file_cache.h"
+
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace sd_mmc_card {
+
+static const char *TAG = "sd_mmc_card.cache";
+
+CachedFile::CachedFile(uint8_t *data, size_t size) : data_(data), size_(size) {}
+
+CachedFile::~CachedFile() {
+  RAMAllocator<uint8_t> allocator;
+  allocator.deallocate(this->data_, this->size_);
+}
+
+std::shared_ptr<CachedFile> CachedFile::create(size_t size) {
+  RAMAllocator<uint8_t> allocator;
+  uint8_t *data = allocator.allocate(size);
+  if (data == nullptr) {
+    ESP_LOGW(TAG, "Failed to allocate %u bytes", size);
+    return nullptr;
+  }
+  return std::make_shared<CachedFile>(data, size);
+}
+
+bool FileCache::accepts(size_t size) const {
+  return this->is_enabled() && size > 0 && size <= this->max_file_size_ && size <= this->capacity_;
+}
+
+std::shared_ptr<const CachedFile> FileCache::get(std::string const &path) {
+  if (!this->is_enabled())
+    return nullptr;
+  LockGuard guard(this->lock_);
+  auto it = this->entries_.find(path);
+  if (it == this->entries_.end()) {
+    this->misses_++;
+    return nullptr;
+  }
+  this->hits_++;
+  this->lru_.splice(this->lru_.begin(), this->lru_, it->second);
+  return it->second->file;
+}
+
+void FileCache::put(std::string const &path, std::shared_ptr<const CachedFile> file, uint32_t generation) {
+  if (file == nullptr || !this->accepts(file->size()))
+    return;
+  LockGuard guard(this->lock_);
+  if (generation != this->generation_) {
+    ESP_LOGV(TAG, "Dropping stale entry: %s", path.c_str());
+    return;
+  }
+  auto it = this->entries_.find(path);
+  if (it != this->entries_.end())
+    this->erase(it->second);
+  this->evict(file->size());
+  this->used_ += file->size();
+  this->lru_.push_front(Entry{path, std::move(file)});
+  this->entries_[path] = this->lru_.begin();
+}
+
+uint32_t FileCache::generation() {
+  LockGuard guard(this->lock_);
+  return this->generation_;
+}
+
+void FileCache::invalidate(std::string const &path) {
+  this->invalidate_callback_.call(path, false);
+  if (!this->is_enabled())
+    return;
+  LockGuard guard(this->lock_);
+  this->generation_++;
+  auto it = this->entries_.find(path);
+  if (it != this->entries_.end())
+    this->erase(it->second);
+}
+
+void FileCache::invalidate_prefix(std::string const &directory) {
+  this->invalidate_callback_.call(directory, true);
+  if (!this->is_enabled())
+    return;
+  std::string prefix = directory;
+  if (prefix.empty() || prefix.back() != '/')
+    prefix.push_back('/');
+  LockGuard guard(this->lock_);
+  this->generation_++;
+  for (auto it = this->lru_.begin(); it != this->lru_.end();) {
+    auto next = std::next(it);
+    if (it->path.compare(0, prefix.size(), prefix) == 0)
+      this->erase(it);
+    it = next;
+  }
+}
+
+void FileCache::clear() {
+  LockGuard guard(this->lock_);
+  this->generation_++;
+  this->entries_.clear();
+  this->lru_.clear();
+  this->used_ = 0;
+}
+
+void FileCache::erase(std::list<Entry>::iterator it) {
+  this->used_ -= it->file->size();
+  this->entries_.erase(it->path);
+  this->lru_.erase(it);
+}
+
+void FileCache::evict(size_t required) {
+  while (!this->lru_.empty() && this->used_ + required > this->capacity_) {
+    ESP_LOGV(TAG, "Evicting: %s", this->lru_.back().path.c_str());
+    this->erase(std::prev(this->lru_.end()));
+  }
+}
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
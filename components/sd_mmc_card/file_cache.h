@@ -0,0 +1,85 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include "esphome/core/helpers.h"
+
+namespace esphome {
+namespace sd_mmc_card {
+
+/* Immutable copy of a file content owned by the cache, allocated in PSRAM when available */
+class CachedFile {
+ public:
+  CachedFile(uint8_t *data, size_t size);
+  ~CachedFile();
+  CachedFile(CachedFile const &) = delete;
+  CachedFile &operator=(CachedFile const &) = delete;
+
+  static std::shared_ptr<CachedFile> create(size_t size);
+
+  const uint8_t *data() const { return this->data_; }
+  uint8_t *data() { return this->data_; }
+  size_t size() const { return this->size_; }
+
+ protected:
+  uint8_t *data_;
+  size_t size_;
+};
+
+/* LRU cache of small file contents, keyed by path */
+class FileCache {
+ public:
+  void set_capacity(size_t capacity) { this->capacity_ = capacity; }
+  void set_max_file_size(size_t size) { this->max_file_size_ = size; }
+  size_t get_capacity() const { return this->capacity_; }
+  size_t get_max_file_size() const { return this->max_file_size_; }
+  size_t get_used() const { return this->used_; }
+  uint32_t get_hits() const { return this->hits_; }
+  uint32_t get_misses() const { return this->misses_; }
+
+  bool is_enabled() const { return this->capacity_ > 0; }
+  /* Can a file of the given size be cached? */
+  bool accepts(size_t size) const;
+
+  /* Lookup an entry, count a hit or a miss */
+  std::shared_ptr<const CachedFile> get(std::string const &path);
+  /* Insert an entry loaded while the cache was at the given generation, dropped if invalidated meanwhile */
+  void put(std::string const &path, std::shared_ptr<const CachedFile> file, uint32_t generation);
+  /* Current generation, incremented on every invalidation */
+  uint32_t generation();
+
+  void invalidate(std::string const &path);
+  /* Invalidate every entry under the given directory */
+  void invalidate_prefix(std::string const &directory);
+  void clear();
+  /* Called before every change of a path, even when the cache is disabled, with true for a whole directory */
+  void add_on_invalidate_callback(std::function<void(std::string const &, bool)> &&callback) {
+    this->invalidate_callback_.add(std::move(callback));
+  }
+
+ protected:
+  struct Entry {
+    std::string path;
+    std::shared_ptr<const CachedFile> file;
+  };
+
+  void erase(std::list<Entry>::iterator it);
+  void evict(size_t required);
+
+  size_t capacity_{0};
+  size_t max_file_size_{0};
+  size_t used_{0};
+  uint32_t hits_{0};
+  uint32_t misses_{0};
+  uint32_t generation_{0};
+  std::list<Entry> lru_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> entries_;
+  Mutex lock_;
+  CallbackManager<void(std::string const &, bool)> invalidate_callback_;
+};
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
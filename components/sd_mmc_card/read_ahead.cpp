@@ -0,0 +1,171 @@
+#include "read_ahead.h"
+#include "sd_mmc_card.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+#ifdef USE_ESP32
+#include "esp_pthread.h"
+#endif
+
+namespace esphome {
+namespace sd_mmc_card {
+
+static const char *TAG = "sd_mmc_card.read_ahead";
+// first chunk of a file, small for the first bytes to be sent early
+static constexpr size_t INITIAL_CHUNK_SIZE = 4096;
+
+ReadAhead::ReadAhead(SdMmc *card, uint8_t buffer_count, size_t buffer_size)
+    : card_(card), buffers_(std::max<uint8_t>(buffer_count, 2), Buffer{nullptr, 0}) {
+  if (buffer_size == 0)
+    buffer_size = card->get_profile().read_chunk_size;
+  this->buffer_size_ = std::max((buffer_size + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE, SECTOR_SIZE);
+  this->chunk_size_ = std::min(INITIAL_CHUNK_SIZE, this->buffer_size_);
+}
+
+ReadAhead::~ReadAhead() { this->stop(); }
+
+bool ReadAhead::start(const char *path) {
+  this->stop();
+  for (auto &buffer : this->buffers_) {
+    buffer.data = allocate_dma_buffer(this->buffer_size_);
+    buffer.length = 0;
+    if (buffer.data == nullptr) {
+      ESP_LOGE(TAG, "Failed to allocate %u buffers of %u bytes", this->buffers_.size(), this->buffer_size_);
+      this->release_buffers();
+      return false;
+    }
+  }
+  this->file_ = this->card_->open_file(path, "rb");
+  if (this->file_ == nullptr) {
+    this->release_buffers();
+    return false;
+  }
+
+  this->current_ = 0;
+  this->filled_ = 0;
+  this->position_ = 0;
+  this->drain_start_ = 0;
+  this->rate_ = 0;
+  this->chunk_size_ = std::min(INITIAL_CHUNK_SIZE, this->buffer_size_);
+  this->stopping_ = false;
+  this->end_ = false;
+  this->bytes_read_ = 0;
+  this->stalls_ = 0;
+  this->start_time_ = millis();
+  this->running_ = true;
+#ifdef USE_ESP32
+  esp_pthread_cfg_t config = esp_pthread_get_default_config();
+  config.thread_name = "sd_read";
+  config.stack_size = 4096;
+  config.prio = 5;
+  esp_pthread_set_cfg(&config);
+#endif
+  this->task_ = std::thread(&ReadAhead::run, this);
+#ifdef USE_ESP32
+  config = esp_pthread_get_default_config();
+  esp_pthread_set_cfg(&config);
+#endif
+  return true;
+}
+
+size_t ReadAhead::read(uint8_t *buffer, size_t len) {
+  std::unique_lock<std::mutex> lock(this->lock_);
+  if (!this->running_)
+    return 0;
+  if (this->filled_ == 0) {
+    if (this->end_)
+      return 0;
+    this->stalls_++;
+    this->filled_cond_.wait(lock, [this] { return this->filled_ > 0 || this->end_; });
+    if (this->filled_ == 0)
+      return 0;
+    // the wait for the card is not part of the drain rate
+    this->drain_start_ = micros();
+  }
+  if (this->drain_start_ == 0)
+    this->drain_start_ = micros();
+  Buffer &current = this->buffers_[this->current_];
+  // the task only fills the buffers after the current one
+  lock.unlock();
+  size_t n = std::min(len, current.length - this->position_);
+  memcpy(buffer, current.data + this->position_, n);
+  this->position_ += n;
+  if (this->position_ < current.length)
+    return n;
+
+  lock.lock();
+  uint32_t now = micros();
+  this->adapt(current.length, now - this->drain_start_);
+  this->drain_start_ = now;
+  this->position_ = 0;
+  this->current_ = (this->current_ + 1) % this->buffers_.size();
+  this->filled_--;
+  this->freed_.notify_one();
+  return n;
+}
+
+void ReadAhead::adapt(size_t length, uint32_t elapsed) {
+  uint64_t rate = static_cast<uint64_t>(length) * 1000000 / std::max<uint32_t>(elapsed, 1);
+  rate = std::min<uint64_t>(rate, UINT32_MAX);
+  this->rate_ = this->rate_ == 0 ? rate : (static_cast<uint64_t>(this->rate_) * 3 + rate) / 4;
+  size_t chunk = static_cast<uint64_t>(this->rate_) * TARGET_CHUNK_TIME / 1000 / SECTOR_SIZE * SECTOR_SIZE;
+  this->chunk_size_ = std::max(std::min(chunk, this->buffer_size_), SECTOR_SIZE);
+}
+
+void ReadAhead::stop() {
+  {
+    std::lock_guard<std::mutex> guard(this->lock_);
+    if (!this->running_)
+      return;
+    this->stopping_ = true;
+    this->freed_.notify_one();
+  }
+  this->task_.join();
+  this->file_.reset();
+  this->release_buffers();
+  this->running_ = false;
+  ESP_LOGV(TAG, "Read %llu bytes in %u ms, %u stalls, last chunk of %u bytes", this->bytes_read_,
+           millis() - this->start_time_, this->stalls_, this->chunk_size_);
+}
+
+size_t ReadAhead::read_chunk(uint8_t *buffer, size_t len) { return this->file_->read(buffer, len); }
+
+void ReadAhead::run() {
+  std::unique_lock<std::mutex> lock(this->lock_);
+  while (!this->end_) {
+    this->freed_.wait(lock, [this] { return this->filled_ < this->buffers_.size() || this->stopping_; });
+    if (this->stopping_)
+      return;
+    // the consumer moves to the next buffer meanwhile, this one stays after the filled ones
+    Buffer &buffer = this->buffers_[(this->current_ + this->filled_) % this->buffers_.size()];
+    size_t chunk = this->chunk_size_;
+    lock.unlock();
+    size_t n = this->read_chunk(buffer.data, chunk);
+    lock.lock();
+
+    buffer.length = n;
+    this->bytes_read_ += n;
+    if (n > 0)
+      this->filled_++;
+    // a short read is the end of the file or a read error, the consumer gets what was read
+    if (n < chunk)
+      this->end_ = true;
+    this->filled_cond_.notify_one();
+  }
+}
+
+void ReadAhead::release_buffers() {
+  for (auto &buffer : this->buffers_) {
+    if (buffer.data != nullptr)
+      free_dma_buffer(buffer.data);
+    buffer.data = nullptr;
+    buffer.length = 0;
+  }
+}
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
@@ -0,0 +1,93 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace esphome {
+namespace sd_mmc_card {
+
+class SdMmc;
+class FileHandle;
+
+/* Reader for files consumed at the pace of a slower sink, like a download sent to a network connection.
+ *
+ * A dedicated task reads the next chunks of the file into a small pool of buffers while the consumer drains the
+ * current one, the card and the sink then work at the same time instead of each waiting for the other.
+ *
+ * The chunk size follows the rate the consumer drains the buffers: a chunk holds about TARGET_CHUNK_TIME of
+ * consumption, between one sector and the buffer size. A fast consumer gets large reads, the most the card can
+ * deliver, and a slow one small reads that start early and keep the card free for others.
+ *
+ * Without a buffer size the buffers hold one read chunk of the card profile.
+ *
+ * A subclass overriding read_chunk must stop the task in its own destructor.
+ */
+class ReadAhead {
+ public:
+  static constexpr size_t SECTOR_SIZE = 512;
+  /* Time of consumption a chunk is sized for, in milliseconds */
+  static constexpr uint32_t TARGET_CHUNK_TIME = 50;
+
+  ReadAhead(SdMmc *card, uint8_t buffer_count = 2, size_t buffer_size = 0);
+  virtual ~ReadAhead();
+  ReadAhead(ReadAhead const &) = delete;
+  ReadAhead &operator=(ReadAhead const &) = delete;
+
+  /* Open the file and start the reader task */
+  bool start(const char *path);
+  /* Copy at most len bytes of the file, wait for the task when nothing was read ahead, 0 at the end of the file */
+  size_t read(uint8_t *buffer, size_t len);
+  /* Stop the task and close the file */
+  void stop();
+  bool is_running() const { return this->running_; }
+
+  size_t get_buffer_size() const { return this->buffer_size_; }
+  /* Size of the next read from the card */
+  size_t get_chunk_size() const { return this->chunk_size_; }
+  uint64_t get_bytes_read() const { return this->bytes_read_; }
+  /* Reads that found nothing read ahead and waited for the card */
+  uint32_t get_stalls() const { return this->stalls_; }
+
+ protected:
+  struct Buffer {
+    uint8_t *data;
+    size_t length;
+  };
+
+  /* Read one chunk from the card, called by the task */
+  virtual size_t read_chunk(uint8_t *buffer, size_t len);
+  void run();
+  void adapt(size_t length, uint32_t elapsed);
+  void release_buffers();
+
+  SdMmc *card_;
+  std::unique_ptr<FileHandle> file_;
+  std::vector<Buffer> buffers_;
+  size_t buffer_size_;
+  // buffer drained by the consumer, the filled ones after it wait in order
+  uint8_t current_{0};
+  uint8_t filled_{0};
+  size_t position_{0};
+  // the consumer started to drain the current buffer, 0 before its first byte
+  uint32_t drain_start_{0};
+  // drain rate of the consumer in bytes per second, 0 until a buffer was drained
+  uint32_t rate_{0};
+  size_t chunk_size_;
+  bool running_{false};
+  bool stopping_{false};
+  bool end_{false};
+  std::mutex lock_;
+  std::condition_variable filled_cond_;
+  std::condition_variable freed_;
+  std::thread task_;
+
+  uint64_t bytes_read_{0};
+  uint32_t stalls_{0};
+  uint32_t start_time_{0};
+};
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
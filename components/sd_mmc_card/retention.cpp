@@ -0,0 +1,242 @@
+#include "retention.h"
+#include "sd_mmc_card.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <unistd.h>
+
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace sd_mmc_card {
+
+static const char *TAG = "sd_mmc_card.retention";
+// 2020-01-01, any earlier time means the clock has not been set yet
+static constexpr time_t VALID_TIME = 1577836800;
+
+static bool is_dot_entry(const char *name) {
+  return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+void RetentionScheduler::request_run() { this->next_run_ = millis(); }
+
+bool RetentionScheduler::step(SdMmc *card) {
+  if (this->phase_ == Phase::IDLE) {
+    if (static_cast<int32_t>(millis() - this->next_run_) < 0)
+      return false;
+    this->start(card);
+  }
+
+  uint32_t start = millis();
+  do {
+    switch (this->phase_) {
+      case Phase::SCAN:
+        this->scan_entry(card);
+        break;
+      case Phase::TRIM_DIRECTORY:
+        this->trim_directory(card);
+        break;
+      case Phase::TRIM_FREE_SPACE:
+        this->trim_free_space(card);
+        break;
+      case Phase::IDLE:
+        break;
+    }
+  } while (this->phase_ != Phase::IDLE && millis() - start < this->time_slice_);
+
+  return this->phase_ == Phase::IDLE && this->pass_deleted_ > 0;
+}
+
+void RetentionScheduler::start(SdMmc *card) {
+  this->now_ = ::time(nullptr);
+  if (this->now_ < VALID_TIME)
+    this->now_ = 0;
+  // the free space is only read once, each deletion then adds the size of the file
+  this->free_space_ = UINT64_MAX;
+  if (this->min_free_space_ > 0) {
+    auto free_space = card->get_free_space();
+    if (free_space.has_value()) {
+      this->free_space_ = *free_space;
+    } else {
+      ESP_LOGW(TAG, "Failed to read the free space, ignoring the watermark");
+    }
+  }
+  this->pool_.clear();
+  this->pool_truncated_ = false;
+  this->rerun_ = false;
+  this->pass_deleted_ = 0;
+  this->rule_index_ = 0;
+  this->begin_rule();
+}
+
+void RetentionScheduler::begin_rule() {
+  this->directory_size_ = 0;
+  this->candidates_.clear();
+  this->truncated_ = false;
+  this->phase_ = Phase::SCAN;
+  if (!this->open_directory(this->rules_[this->rule_index_].path))
+    this->next_rule();
+}
+
+void RetentionScheduler::next_rule() {
+  if (++this->rule_index_ < this->rules_.size()) {
+    this->begin_rule();
+    return;
+  }
+  std::sort(this->pool_.begin(), this->pool_.end(),
+            [](Candidate const &a, Candidate const &b) { return a.mtime < b.mtime; });
+  this->trim_position_ = 0;
+  this->phase_ = Phase::TRIM_FREE_SPACE;
+}
+
+void RetentionScheduler::scan_entry(SdMmc *card) {
+  auto const &rule = this->rules_[this->rule_index_];
+  if (this->directories_.empty()) {
+    std::sort(this->candidates_.begin(), this->candidates_.end(),
+              [](Candidate const &a, Candidate const &b) { return a.mtime < b.mtime; });
+    this->trim_position_ = 0;
+    this->phase_ = Phase::TRIM_DIRECTORY;
+    return;
+  }
+
+  struct dirent *entry = readdir(this->directories_.back());
+  if (entry == nullptr) {
+    closedir(this->directories_.back());
+    this->directories_.pop_back();
+    this->directory_paths_.pop_back();
+    return;
+  }
+  // the index logs and the temporary files of atomic writes are open while in use
+  if (is_dot_entry(entry->d_name) || is_internal_file(entry->d_name))
+    return;
+
+  std::string const &directory = this->directory_paths_.back();
+  std::string path = directory.back() == '/' ? directory + entry->d_name : directory + "/" + entry->d_name;
+  if (entry->d_type == DT_DIR) {
+    if (this->directories_.size() <= rule.depth)
+      this->open_directory(path);
+    return;
+  }
+  if (!rule.pattern.empty() && !glob_match(rule.pattern.c_str(), entry->d_name))
+    return;
+
+  // the size in the vfs stat is 32 bits, the card reads it from FatFs or the directory index
+  auto info = card->file_info(path);
+  if (!info.has_value())
+    return;
+  if (rule.max_age > 0 && this->now_ > 0 && info->mtime + static_cast<time_t>(rule.max_age) < this->now_) {
+    this->remove(card, path, info->size);
+    return;
+  }
+  this->directory_size_ += info->size;
+  if (rule.max_size > 0 || this->min_free_space_ > 0)
+    this->add_candidate(path, info->mtime, info->size);
+}
+
+void RetentionScheduler::add_candidate(std::string const &path, time_t mtime, uint64_t size) {
+  // max heap on the modification time, the newest candidate is dropped first
+  auto newer = [](Candidate const &a, Candidate const &b) { return a.mtime < b.mtime; };
+  if (this->candidates_.size() >= MAX_CANDIDATES) {
+    this->truncated_ = true;
+    if (mtime >= this->candidates_.front().mtime)
+      return;
+    std::pop_heap(this->candidates_.begin(), this->candidates_.end(), newer);
+    this->candidates_.pop_back();
+  }
+  this->candidates_.push_back(Candidate{path, mtime, size});
+  std::push_heap(this->candidates_.begin(), this->candidates_.end(), newer);
+}
+
+void RetentionScheduler::trim_directory(SdMmc *card) {
+  auto const &rule = this->rules_[this->rule_index_];
+  if (rule.max_size > 0 && this->directory_size_ > rule.max_size) {
+    if (this->trim_position_ < this->candidates_.size()) {
+      auto const &candidate = this->candidates_[this->trim_position_++];
+      if (this->remove(card, candidate.path, candidate.size))
+        this->directory_size_ -= std::min<uint64_t>(candidate.size, this->directory_size_);
+      return;
+    }
+    // more files than candidates, the next pass will see the following ones
+    if (this->truncated_)
+      this->rerun_ = true;
+  }
+
+  // the remaining candidates are kept for the free space watermark
+  if (this->min_free_space_ > 0) {
+    this->pool_.insert(this->pool_.end(), std::make_move_iterator(this->candidates_.begin() + this->trim_position_),
+                       std::make_move_iterator(this->candidates_.end()));
+    this->pool_truncated_ |= this->truncated_;
+  }
+  this->candidates_.clear();
+  this->next_rule();
+}
+
+void RetentionScheduler::trim_free_space(SdMmc *card) {
+  if (this->free_space_ < this->min_free_space_) {
+    if (this->trim_position_ < this->pool_.size()) {
+      auto const &candidate = this->pool_[this->trim_position_++];
+      this->remove(card, candidate.path, candidate.size);
+      return;
+    }
+    if (this->pool_truncated_) {
+      this->rerun_ = true;
+    } else {
+      ESP_LOGW(TAG, "Free space still below %s, no file left to delete", format_size(this->min_free_space_).c_str());
+    }
+  }
+  this->finish();
+}
+
+void RetentionScheduler::finish() {
+  this->close_directories();
+  this->pool_.clear();
+  this->pool_.shrink_to_fit();
+  this->candidates_.shrink_to_fit();
+  this->phase_ = Phase::IDLE;
+  // start again right away only while files are still being deleted
+  bool again = this->rerun_ && this->pass_deleted_ > 0;
+  this->next_run_ = millis() + (again ? 0 : this->interval_);
+  if (this->pass_deleted_ > 0) {
+    ESP_LOGI(TAG, "Deleted %u files, %s reclaimed in total", this->pass_deleted_,
+             format_size(this->bytes_reclaimed_).c_str());
+  }
+}
+
+bool RetentionScheduler::open_directory(std::string const &path) {
+  DIR *dir = opendir(build_path(path.c_str()).c_str());
+  if (!dir) {
+    ESP_LOGW(TAG, "Failed to open directory %s: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+  this->directories_.push_back(dir);
+  this->directory_paths_.push_back(path);
+  return true;
+}
+
+void RetentionScheduler::close_directories() {
+  for (DIR *dir : this->directories_)
+    closedir(dir);
+  this->directories_.clear();
+  this->directory_paths_.clear();
+}
+
+bool RetentionScheduler::remove(SdMmc *card, std::string const &path, uint64_t size) {
+  card->get_cache().invalidate(path);
+  if (unlink(build_path(path.c_str()).c_str()) != 0) {
+    ESP_LOGW(TAG, "Failed to delete %s: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+  ESP_LOGD(TAG, "Deleted %s", path.c_str());
+  if (this->free_space_ != UINT64_MAX)
+    this->free_space_ += size;
+  this->bytes_reclaimed_ += size;
+  this->files_deleted_++;
+  this->pass_deleted_++;
+  return true;
+}
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
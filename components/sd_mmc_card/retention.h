@@ -0,0 +1,100 @@
+#pragma once
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <dirent.h>
+
+namespace esphome {
+namespace sd_mmc_card {
+
+class SdMmc;
+
+/* Files of a watched directory to clean up */
+struct RetentionRule {
+  std::string path;
+  std::string pattern;
+  uint8_t depth{0};
+  /* Delete files older than this number of seconds, 0 to disable */
+  uint32_t max_age{0};
+  /* Delete the oldest files while the directory is larger than this number of bytes, 0 to disable */
+  uint64_t max_size{0};
+};
+
+/* Delete old files of the watched directories.
+ *
+ * A pass walks the directories one entry at a time from the component loop, deleting expired files
+ * and keeping the oldest files as candidates, then deletes candidates oldest first until every
+ * directory is under its size limit and the card free space is above the watermark.
+ * The free space is read once per pass and then updated with the size of each deleted file.
+ */
+class RetentionScheduler {
+ public:
+  /* Oldest files remembered per directory during a pass */
+  static constexpr size_t MAX_CANDIDATES = 32;
+
+  void add_rule(RetentionRule const &rule) { this->rules_.push_back(rule); }
+  void set_min_free_space(uint64_t size) { this->min_free_space_ = size; }
+  void set_interval(uint32_t interval) { this->interval_ = interval; }
+  void set_time_slice(uint32_t time_slice) { this->time_slice_ = time_slice; }
+  std::vector<RetentionRule> const &get_rules() const { return this->rules_; }
+  uint64_t get_min_free_space() const { return this->min_free_space_; }
+  uint32_t get_interval() const { return this->interval_; }
+  uint32_t get_time_slice() const { return this->time_slice_; }
+  uint64_t get_bytes_reclaimed() const { return this->bytes_reclaimed_; }
+  uint32_t get_files_deleted() const { return this->files_deleted_; }
+  bool is_enabled() const { return !this->rules_.empty(); }
+
+  /* Start a pass on the next loop, e.g. after a failed write */
+  void request_run();
+  /* Run the current pass for at most one time slice, return true when a pass that deleted files just ended */
+  bool step(SdMmc *card);
+
+ protected:
+  struct Candidate {
+    std::string path;
+    time_t mtime;
+    uint64_t size;
+  };
+
+  enum class Phase { IDLE, SCAN, TRIM_DIRECTORY, TRIM_FREE_SPACE };
+
+  void start(SdMmc *card);
+  void scan_entry(SdMmc *card);
+  void add_candidate(std::string const &path, time_t mtime, uint64_t size);
+  void trim_directory(SdMmc *card);
+  void trim_free_space(SdMmc *card);
+  void begin_rule();
+  void next_rule();
+  void finish();
+  bool open_directory(std::string const &path);
+  void close_directories();
+  bool remove(SdMmc *card, std::string const &path, uint64_t size);
+
+  std::vector<RetentionRule> rules_;
+  uint64_t min_free_space_{0};
+  uint32_t interval_{600000};
+  uint32_t time_slice_{10};
+
+  Phase phase_{Phase::IDLE};
+  uint32_t next_run_{0};
+  size_t rule_index_{0};
+  time_t now_{0};
+  uint64_t free_space_{0};
+  uint64_t directory_size_{0};
+  std::vector<DIR *> directories_;
+  std::vector<std::string> directory_paths_;
+  std::vector<Candidate> candidates_;
+  std::vector<Candidate> pool_;
+  size_t trim_position_{0};
+  bool truncated_{false};
+  bool pool_truncated_{false};
+  bool rerun_{false};
+  uint32_t pass_deleted_{0};
+
+  uint64_t bytes_reclaimed_{0};
+  uint32_t files_deleted_{0};
+};
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
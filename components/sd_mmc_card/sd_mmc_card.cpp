@@ -1,20 +1,90 @@
 #include "sd_mmc_card.h"
 
 #include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "math.h"
 #include "esphome/core/log.h"
+#include "esp_rom_crc.h"
+
+#ifdef USE_ESP32
+#include "esp_heap_caps.h"
+#endif
 
 namespace esphome {
 namespace sd_mmc_card {
 
 static const char *TAG = "sd_mmc_card";
+// 2020-01-01, any earlier time means the clock has not been set yet
+static constexpr time_t VALID_TIME = 1577836800;
+// work done on the directory indexes per loop in milliseconds
+static constexpr uint32_t INDEX_TIME_SLICE = 10;
+// directories remembered by create_directories, the current shards of a few files
+static constexpr size_t MAX_KNOWN_DIRECTORIES = 8;
+// cache line size, the dma engine needs word aligned buffers
+static constexpr size_t DMA_BUFFER_ALIGNMENT = 32;
+// transfer settings tuned by the benchmark, kept on the card they were measured on
+static const char *const PROFILE_PATH = "/.sdprofile";
+static const char *const PROFILE_FORMAT = "write_buffer_size=%u\nflush_threshold=%u\nread_chunk_size=%u\n";
+
+static bool is_dot_entry(const char *name) {
+  return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+// names of the component only, a file of the user ending in .tmp or .new is never taken for one of them
+const char *const AtomicFile::TEMP_SUFFIX = ".sdtmp";
+const char *const AtomicFile::NEW_SUFFIX = ".sdnew";
+
+static std::string join_path(std::string const &directory, const char *name) {
+  if (!directory.empty() && directory.back() == '/')
+    return directory + name;
+  return directory + "/" + name;
+}
 
 #ifdef USE_SENSOR
 FileSizeSensor::FileSizeSensor(sensor::Sensor *sensor, std::string const &path) : sensor(sensor), path(path) {}
 #endif
 
-void SdMmc::loop() {}
+void SdMmc::loop() {
+  if (this->is_failed())
+    return;
+  if (this->benchmark_ != nullptr && this->benchmark_->is_done())
+    this->finish_benchmark();
+  if (!this->indexes_.empty()) {
+    std::lock_guard<std::recursive_mutex> guard(this->index_lock_);
+    for (auto &index : this->indexes_)
+      index->step(INDEX_TIME_SLICE);
+  }
+  if (!this->retention_.is_enabled())
+    return;
+  if (this->retention_.step(this)) {
+    this->update_sensors();
+#ifdef USE_SENSOR
+    if (this->bytes_reclaimed_sensor_ != nullptr)
+      this->bytes_reclaimed_sensor_->publish_state(this->retention_.get_bytes_reclaimed());
+#endif
+  }
+}
+
+void SdMmc::on_shutdown() {
+#ifdef USE_ESP_IDF
+  // a region claimed by a batch is released before the card is left
+  this->discard_task_.stop();
+#endif
+  // cut the preallocated files still being written, their unused end would otherwise be kept
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
+  for (auto &it : this->preallocated_files_)
+    it.second->close();
+  this->preallocated_files_.clear();
+  std::lock_guard<std::recursive_mutex> index_guard(this->index_lock_);
+  for (auto &index : this->indexes_)
+    index->close();
+}
 
 void SdMmc::dump_config() {
   ESP_LOGCONFIG(TAG, "SD MMC Component");
@@ -32,10 +102,22 @@ void SdMmc::dump_config() {
     LOG_PIN("  Power Ctrl Pin: ", this->power_ctrl_pin_);
   }
 
+  if (!this->file_system_.empty())
+    ESP_LOGCONFIG(TAG, "  File system: %s", this->file_system_.c_str());
+
 #ifdef USE_SENSOR
   LOG_SENSOR("  ", "Used space", this->used_space_sensor_);
   LOG_SENSOR("  ", "Total space", this->total_space_sensor_);
   LOG_SENSOR("  ", "Free space", this->free_space_sensor_);
+  LOG_SENSOR("  ", "Cache hits", this->cache_hits_sensor_);
+  LOG_SENSOR("  ", "Cache misses", this->cache_misses_sensor_);
+  LOG_SENSOR("  ", "Bytes reclaimed", this->bytes_reclaimed_sensor_);
+  LOG_SENSOR("  ", "Sequential write speed", this->sequential_write_speed_sensor_);
+  LOG_SENSOR("  ", "Sequential read speed", this->sequential_read_speed_sensor_);
+  LOG_SENSOR("  ", "Random write rate", this->random_write_rate_sensor_);
+  LOG_SENSOR("  ", "Random read rate", this->random_read_rate_sensor_);
+  LOG_SENSOR("  ", "File operation rate", this->file_operation_rate_sensor_);
+  LOG_SENSOR("  ", "Sectors discarded", this->sectors_discarded_sensor_);
   for (auto &sensor : this->file_size_sensors_) {
     if (sensor.sensor != nullptr)
       LOG_SENSOR("  ", "File size", sensor.sensor);
@@ -44,6 +126,37 @@ void SdMmc::dump_config() {
 #ifdef USE_TEXT_SENSOR
   LOG_TEXT_SENSOR("  ", "SD Card Type", this->sd_card_type_text_sensor_);
 #endif
+  if (this->cache_.is_enabled()) {
+    ESP_LOGCONFIG(TAG, "  Cache capacity: %s", format_size(this->cache_.get_capacity()).c_str());
+    ESP_LOGCONFIG(TAG, "  Cache max file size: %s", format_size(this->cache_.get_max_file_size()).c_str());
+  }
+  if (this->retention_.is_enabled()) {
+    ESP_LOGCONFIG(TAG, "  Retention:");
+    for (auto const &rule : this->retention_.get_rules()) {
+      ESP_LOGCONFIG(TAG, "    Directory: %s (pattern: %s, depth: %u)", rule.path.c_str(),
+                    rule.pattern.empty() ? "*" : rule.pattern.c_str(), rule.depth);
+      if (rule.max_age > 0)
+        ESP_LOGCONFIG(TAG, "      Max age: %us", rule.max_age);
+      if (rule.max_size > 0)
+        ESP_LOGCONFIG(TAG, "      Max size: %s", format_size(rule.max_size).c_str());
+    }
+    if (this->retention_.get_min_free_space() > 0)
+      ESP_LOGCONFIG(TAG, "    Min free space: %s", format_size(this->retention_.get_min_free_space()).c_str());
+    ESP_LOGCONFIG(TAG, "    Interval: %ums, time slice: %ums", this->retention_.get_interval(),
+                  this->retention_.get_time_slice());
+  }
+  for (auto const &index : this->indexes_)
+    ESP_LOGCONFIG(TAG, "  Indexed directory: %s", index->get_path().c_str());
+  ESP_LOGCONFIG(TAG, "  Profile: %s, write buffer %s, flush every %s, read chunk %s",
+                this->profile_.tuned ? "tuned" : "default", format_size(this->profile_.write_buffer_size).c_str(),
+                this->profile_.flush_threshold > 0 ? format_size(this->profile_.flush_threshold).c_str() : "close",
+                format_size(this->profile_.read_chunk_size).c_str());
+#ifdef USE_ESP_IDF
+  if (this->discard_) {
+    ESP_LOGCONFIG(TAG, "  Discard freed space: %s",
+                  this->discard_task_.is_running() ? this->discard_task_.get_mode() : "not supported");
+  }
+#endif
 
   if (this->is_failed()) {
     ESP_LOGE(TAG, "Setup failed : %s", SdMmc::error_code_to_string(this->init_error_).c_str());
@@ -58,7 +171,287 @@ void SdMmc::write_file(const char *path, const uint8_t *buffer, size_t len) {
 
 void SdMmc::append_file(const char *path, const uint8_t *buffer, size_t len) {
   ESP_LOGV(TAG, "Appending to file: %s", path);
-  this->write_file(path, buffer, len, "a");
+  bool ok;
+  {
+    std::lock_guard<std::recursive_mutex> guard(this->lock_);
+    auto it = this->preallocated_files_.find(path);
+    if (it != this->preallocated_files_.end()) {
+      // the handle passes the data written to the append callbacks
+      if (it->second->write(buffer, len) != len)
+        ESP_LOGE(TAG, "Failed to write to file");
+      // also done by the handle, a failed write may still have changed the file
+      this->cache_.invalidate(path);
+      return;
+    }
+    ok = this->write_file(path, buffer, len, "a");
+  }
+  if (ok)
+    this->append_callback_.call(path, buffer, len);
+}
+
+void SdMmc::on_file_changed(std::string const &path) { this->cache_.invalidate(path); }
+
+void SdMmc::on_file_written(std::string const &path, const uint8_t *buffer, size_t len) {
+  this->append_callback_.call(path.c_str(), buffer, len);
+}
+
+void SdMmc::add_on_append_callback(std::function<void(const char *, const uint8_t *, size_t)> &&callback) {
+  this->append_callback_.add(std::move(callback));
+}
+
+bool SdMmc::write_file_atomic(const char *path, const uint8_t *buffer, size_t len) {
+  ESP_LOGV(TAG, "Writing atomically to file: %s", path);
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
+  auto file = this->open_file_atomic(path);
+  if (file == nullptr)
+    return false;
+  if (file->write(buffer, len) != len) {
+    ESP_LOGE(TAG, "Failed to write to file");
+    if (this->retention_.is_enabled())
+      this->retention_.request_run();
+    return false;
+  }
+  bool ok = file->commit();
+  this->update_sensors();
+  return ok;
+}
+
+std::unique_ptr<AtomicFile> SdMmc::open_file_atomic(const char *path, size_t preallocate) {
+  std::string temp_path = build_path(path) + AtomicFile::TEMP_SUFFIX;
+  FILE *file = nullptr;
+  bool preallocated = false;
+  if (preallocate > 0) {
+    unlink(temp_path.c_str());
+    preallocated = this->preallocate_file((std::string(path) + AtomicFile::TEMP_SUFFIX).c_str(), preallocate);
+    // the allocated content is overwritten from the start
+    if (preallocated)
+      file = fopen(temp_path.c_str(), "r+b");
+  }
+  if (file == nullptr) {
+    preallocated = false;
+    file = fopen(temp_path.c_str(), "wb");
+  }
+  if (file == nullptr) {
+    ESP_LOGE(TAG, "Failed to open file for writing: %s", strerror(errno));
+    return nullptr;
+  }
+  auto handle = std::unique_ptr<FileHandle>(new FileHandle(file, this->sync_policy_ == SyncPolicy::ALWAYS));
+  return std::unique_ptr<AtomicFile>(new AtomicFile(&this->cache_, path, std::move(handle),
+                                                    this->sync_policy_ != SyncPolicy::NEVER, preallocated));
+}
+
+std::unique_ptr<PreallocatedFile> SdMmc::open_file_preallocated(const char *path, size_t size) {
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
+  this->cache_.invalidate(path);
+  std::string absolut_path = build_path(path);
+  unlink(absolut_path.c_str());
+  bool preallocated = size > 0 && this->preallocate_file(path, size);
+  if (size > 0 && !preallocated)
+    ESP_LOGW(TAG, "Preallocation of %s not available, the file grows while written", path);
+  // the allocated content is overwritten from the start
+  FILE *file = fopen(absolut_path.c_str(), preallocated ? "r+b" : "wb");
+  if (file == nullptr) {
+    ESP_LOGE(TAG, "Failed to open file for writing: %s", strerror(errno));
+    return nullptr;
+  }
+  auto handle =
+      std::unique_ptr<FileHandle>(new FileHandle(file, this->sync_policy_ == SyncPolicy::ALWAYS, this, path));
+  return std::unique_ptr<PreallocatedFile>(
+      new PreallocatedFile(&this->cache_, path, std::move(handle), preallocated ? size : 0));
+}
+
+bool SdMmc::open_preallocated(const char *path, size_t size) {
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
+  this->close_preallocated(path);
+  auto file = this->open_file_preallocated(path, size);
+  if (file == nullptr)
+    return false;
+  this->preallocated_files_[path] = std::move(file);
+  this->update_sensors();
+  return true;
+}
+
+bool SdMmc::close_preallocated(const char *path) {
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
+  auto it = this->preallocated_files_.find(path);
+  if (it == this->preallocated_files_.end())
+    return false;
+  bool ok = it->second->close();
+  this->preallocated_files_.erase(it);
+  this->update_sensors();
+  return ok;
+}
+
+std::unique_ptr<AtomicFile> SdMmc::resume_file_atomic(const char *path) {
+  std::string temp_path = build_path(path) + AtomicFile::TEMP_SUFFIX;
+  FILE *file = fopen(temp_path.c_str(), "r+b");
+  if (file == nullptr)
+    file = fopen(temp_path.c_str(), "w+b");
+  if (file == nullptr || fseek(file, 0, SEEK_END) != 0) {
+    ESP_LOGE(TAG, "Failed to open file for writing: %s", strerror(errno));
+    if (file != nullptr)
+      fclose(file);
+    return nullptr;
+  }
+  auto handle = std::unique_ptr<FileHandle>(new FileHandle(file, this->sync_policy_ == SyncPolicy::ALWAYS));
+  return std::unique_ptr<AtomicFile>(
+      new AtomicFile(&this->cache_, path, std::move(handle), this->sync_policy_ != SyncPolicy::NEVER));
+}
+
+size_t SdMmc::get_partial_size(const char *path) {
+  struct stat info;
+  if (stat((build_path(path) + AtomicFile::TEMP_SUFFIX).c_str(), &info) != 0)
+    return 0;
+  return info.st_size;
+}
+
+bool SdMmc::recover_file(const char *path) {
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
+  std::string absolut_path = build_path(path);
+  std::string new_path = absolut_path + AtomicFile::NEW_SUFFIX;
+  struct stat info;
+  if (stat(new_path.c_str(), &info) != 0)
+    return false;
+  // the .sdnew file is complete, the power was lost before it replaced the target
+  unlink(absolut_path.c_str());
+  if (rename(new_path.c_str(), absolut_path.c_str()) != 0) {
+    ESP_LOGE(TAG, "Failed to recover %s: %s", path, strerror(errno));
+    return false;
+  }
+  this->cache_.invalidate(path);
+  ESP_LOGW(TAG, "Recovered interrupted write of %s", path);
+  return true;
+}
+
+size_t SdMmc::delete_files(std::vector<std::string> const &paths) {
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
+  size_t deleted = 0;
+  for (auto const &path : paths) {
+    if (is_internal_file(path.c_str())) {
+      ESP_LOGW(TAG, "Not deleting %s, it is used by the card component", path.c_str());
+      continue;
+    }
+    this->cache_.invalidate(path);
+    if (unlink(build_path(path.c_str()).c_str()) == 0) {
+      deleted++;
+    } else {
+      ESP_LOGW(TAG, "Failed to delete %s: %s", path.c_str(), strerror(errno));
+    }
+  }
+  this->update_sensors();
+  return deleted;
+}
+
+size_t SdMmc::move_files(std::vector<std::pair<std::string, std::string>> const &moves) {
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
+  size_t moved = 0;
+  for (auto const &move : moves) {
+    this->cache_.invalidate(move.first);
+    this->cache_.invalidate(move.second);
+    if (rename(build_path(move.first.c_str()).c_str(), build_path(move.second.c_str()).c_str()) == 0) {
+      moved++;
+    } else {
+      ESP_LOGW(TAG, "Failed to move %s to %s: %s", move.first.c_str(), move.second.c_str(), strerror(errno));
+    }
+  }
+  this->update_sensors();
+  return moved;
+}
+
+size_t SdMmc::delete_files_matching(const char *directory, const char *pattern, uint32_t older_than,
+                                    uint8_t depth) {
+  time_t limit = 0;
+  if (older_than > 0) {
+    time_t now = ::time(nullptr);
+    if (now < VALID_TIME) {
+      ESP_LOGE(TAG, "Time is not set, cannot select files by age");
+      return 0;
+    }
+    limit = now - older_than;
+  }
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
+  size_t deleted = this->delete_files_matching_rec(directory, pattern, limit, depth);
+  this->update_sensors();
+  return deleted;
+}
+
+size_t SdMmc::delete_files_matching_rec(std::string const &directory, const char *pattern, time_t limit,
+                                        uint8_t depth) {
+  DIR *dir = opendir(build_path(directory.c_str()).c_str());
+  if (!dir) {
+    ESP_LOGE(TAG, "Failed to open directory: %s", strerror(errno));
+    return 0;
+  }
+  size_t deleted = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    if (is_dot_entry(entry->d_name))
+      continue;
+    std::string path = join_path(directory, entry->d_name);
+    if (entry->d_type == DT_DIR) {
+      if (depth)
+        deleted += this->delete_files_matching_rec(path, pattern, limit, depth - 1);
+      continue;
+    }
+    if (pattern != nullptr && *pattern != '\0' && !glob_match(pattern, entry->d_name))
+      continue;
+    // "*" matches the index logs, unlinking an open file corrupts the file system
+    if (is_internal_file(entry->d_name))
+      continue;
+    std::string absolut_path = build_path(path.c_str());
+    if (limit > 0) {
+      struct stat info;
+      if (stat(absolut_path.c_str(), &info) < 0 || info.st_mtime > limit)
+        continue;
+    }
+    this->cache_.invalidate(path);
+    if (unlink(absolut_path.c_str()) == 0) {
+      deleted++;
+    } else {
+      ESP_LOGW(TAG, "Failed to delete %s: %s", path.c_str(), strerror(errno));
+    }
+  }
+  closedir(dir);
+  return deleted;
+}
+
+bool SdMmc::remove_directory_recursive(const char *path) {
+  ESP_LOGV(TAG, "Remove directory recursively: %s", path);
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
+  this->cache_.invalidate_prefix(path);
+  bool ok = this->remove_directory_rec(path);
+  this->update_sensors();
+  return ok;
+}
+
+bool SdMmc::remove_directory_rec(std::string const &path) {
+  std::string absolut_path = build_path(path.c_str());
+  DIR *dir = opendir(absolut_path.c_str());
+  if (!dir) {
+    ESP_LOGE(TAG, "Failed to open directory: %s", strerror(errno));
+    return false;
+  }
+  bool ok = true;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    if (is_dot_entry(entry->d_name))
+      continue;
+    std::string child = join_path(path, entry->d_name);
+    if (entry->d_type == DT_DIR) {
+      ok &= this->remove_directory_rec(child);
+      continue;
+    }
+    if (unlink(build_path(child.c_str()).c_str()) != 0) {
+      ESP_LOGW(TAG, "Failed to delete %s: %s", child.c_str(), strerror(errno));
+      ok = false;
+    }
+  }
+  closedir(dir);
+  if (rmdir(absolut_path.c_str()) != 0) {
+    ESP_LOGE(TAG, "Failed to remove directory: %s", strerror(errno));
+    return false;
+  }
+  return ok;
 }
 
 std::vector<std::string> SdMmc::list_directory(const char *path, uint8_t depth) {
@@ -73,8 +466,11 @@ std::vector<std::string> SdMmc::list_directory(std::string path, uint8_t depth)
 }
 
 std::vector<FileInfo> SdMmc::list_directory_file_info(const char *path, uint8_t depth) {
+  ESP_LOGV(TAG, "Listing directory file info: %s", path);
   std::vector<FileInfo> list;
-  list_directory_file_info_rec(path, depth, list);
+  DirectoryWalker walker(this, path, depth);
+  while (auto info = walker.next())
+    list.push_back(std::move(*info));
   return list;
 }
 
@@ -82,7 +478,161 @@ std::vector<FileInfo> SdMmc::list_directory_file_info(std::string path, uint8_t
   return this->list_directory_file_info(path.c_str(), depth);
 }
 
-size_t SdMmc::file_size(std::string const &path) { return this->file_size(path.c_str()); }
+void SdMmc::track_changes() {
+  this->cache_.add_on_invalidate_callback(
+      [this](std::string const &path, bool directory) { this->on_invalidate(path, directory); });
+  for (auto &index : this->indexes_) {
+    index->set_sync(this->sync_policy_ != SyncPolicy::NEVER);
+    index->load();
+  }
+}
+
+void SdMmc::on_invalidate(std::string const &path, bool directory) {
+  std::lock_guard<std::recursive_mutex> guard(this->index_lock_);
+  // a remembered directory or one of its parents was removed or moved
+  this->known_directories_.erase(std::remove_if(this->known_directories_.begin(), this->known_directories_.end(),
+                                                [&path](std::string const &known) {
+                                                  return str_startswith(known, path) &&
+                                                         (known.size() == path.size() || known[path.size()] == '/');
+                                                }),
+                                 this->known_directories_.end());
+  for (auto &index : this->indexes_) {
+    std::string const &indexed = index->get_path();
+    // the indexed directory itself was created, removed or moved
+    if (str_startswith(indexed, path) && (indexed.size() == path.size() || indexed[path.size()] == '/')) {
+      index->invalidate_all();
+      continue;
+    }
+    if (directory)
+      continue;
+    size_t slash = path.rfind('/');
+    if (slash == indexed.size() && path.compare(0, slash, indexed) == 0)
+      index->invalidate(path.substr(slash + 1));
+  }
+}
+
+bool SdMmc::create_directories(const char *path) {
+  std::string directory(path);
+  while (directory.size() > 1 && directory.back() == '/')
+    directory.pop_back();
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
+  if (this->is_known_directory(directory))
+    return true;
+
+  // walk up to the first existing directory, then create the missing ones down from it
+  std::vector<size_t> missing;
+  size_t end = directory.size();
+  while (end > 0) {
+    std::string current = directory.substr(0, end);
+    struct stat info;
+    if (this->is_known_directory(current) || stat(build_path(current.c_str()).c_str(), &info) == 0)
+      break;
+    missing.push_back(end);
+    end = directory.rfind('/', end - 1);
+    if (end == std::string::npos)
+      break;
+  }
+  for (auto it = missing.rbegin(); it != missing.rend(); ++it) {
+    if (!this->create_directory(directory.substr(0, *it).c_str()))
+      return false;
+  }
+
+  std::lock_guard<std::recursive_mutex> index_guard(this->index_lock_);
+  if (this->known_directories_.size() >= MAX_KNOWN_DIRECTORIES)
+    this->known_directories_.erase(this->known_directories_.begin());
+  this->known_directories_.push_back(directory);
+  return true;
+}
+
+bool SdMmc::is_known_directory(std::string const &path) {
+  std::lock_guard<std::recursive_mutex> guard(this->index_lock_);
+  for (auto const &known : this->known_directories_) {
+    // a parent of a known directory exists too
+    if (str_startswith(known, path) && (known.size() == path.size() || known[path.size()] == '/'))
+      return true;
+  }
+  return false;
+}
+
+std::string SdMmc::shard_path(const char *path, ShardLevel level) {
+  static const char *const FORMATS[] = {"", "%Y", "%Y/%m", "%Y/%m/%d", "%Y/%m/%d/%H"};
+  if (level == ShardLevel::NONE)
+    return path;
+  time_t now = ::time(nullptr);
+  if (now < VALID_TIME) {
+    ESP_LOGW(TAG, "Time not set, %s is not sharded", path);
+    return path;
+  }
+  struct tm local;
+  localtime_r(&now, &local);
+  char shard[16];
+  strftime(shard, sizeof(shard), FORMATS[static_cast<uint8_t>(level)], &local);
+  const char *name = strrchr(path, '/');
+  if (name == nullptr)
+    return std::string("/") + shard + "/" + path;
+  return std::string(path, name - path) + "/" + shard + name;
+}
+
+bool SdMmc::shard(std::string &path, ShardLevel level) {
+  if (level == ShardLevel::NONE)
+    return true;
+  path = this->shard_path(path.c_str(), level);
+  size_t slash = path.rfind('/');
+  if (slash == 0 || slash == std::string::npos)
+    return true;
+  if (!this->create_directories(path.substr(0, slash).c_str())) {
+    ESP_LOGE(TAG, "Failed to create the directory of %s", path.c_str());
+    return false;
+  }
+  return true;
+}
+
+DirectoryIndex *SdMmc::find_index(std::string const &directory) {
+  for (auto &index : this->indexes_) {
+    if (index->get_path() == directory)
+      return index.get();
+  }
+  return nullptr;
+}
+
+DirectoryIndex::Lookup SdMmc::lookup_index(const char *path, DirectoryIndex::Entry &entry) {
+  if (this->indexes_.empty())
+    return DirectoryIndex::Lookup::UNKNOWN;
+  const char *slash = strrchr(path, '/');
+  if (slash == nullptr)
+    return DirectoryIndex::Lookup::UNKNOWN;
+  std::lock_guard<std::recursive_mutex> guard(this->index_lock_);
+  DirectoryIndex *index = this->find_index(std::string(path, slash - path));
+  if (index == nullptr)
+    return DirectoryIndex::Lookup::UNKNOWN;
+  return index->find(slash + 1, entry);
+}
+
+bool SdMmc::list_index(const char *path, std::vector<FileInfo> &list) {
+  if (this->indexes_.empty())
+    return false;
+  std::string directory(path);
+  if (!directory.empty() && directory.back() == '/')
+    directory.pop_back();
+  std::lock_guard<std::recursive_mutex> guard(this->index_lock_);
+  DirectoryIndex *index = this->find_index(directory);
+  if (index == nullptr)
+    return false;
+  return index->for_each([&](const char *name, DirectoryIndex::Entry const &entry) {
+    list.emplace_back(directory + "/" + name, entry.size, entry.is_directory, entry.mtime);
+  });
+}
+
+optional<FileInfo> SdMmc::file_info(std::string const &path) { return this->file_info(path.c_str()); }
+
+optional<uint64_t> SdMmc::file_size(const char *path) {
+  auto info = this->file_info(path);
+  if (!info.has_value())
+    return {};
+  return info->size;
+}
+
+optional<uint64_t> SdMmc::file_size(std::string const &path) { return this->file_size(path.c_str()); }
 
 bool SdMmc::is_directory(std::string const &path) { return this->is_directory(path.c_str()); }
 
@@ -90,6 +640,125 @@ bool SdMmc::delete_file(std::string const &path) { return this->delete_file(path
 
 std::vector<uint8_t> SdMmc::read_file(std::string const &path) { return this->read_file(path.c_str()); }
 
+std::unique_ptr<FileHandle> SdMmc::open_file(std::string const &path, const char *mode) {
+  return this->open_file(path.c_str(), mode);
+}
+
+std::shared_ptr<const CachedFile> SdMmc::read_file_cached(char const *path) {
+  if (!this->cache_.is_enabled())
+    return nullptr;
+  auto cached = this->cache_.get(path);
+  if (cached != nullptr)
+    return cached;
+
+  // a write_file can not run between the size and the content, the writes through handles change the generation
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
+  uint32_t generation = this->cache_.generation();
+  auto size = this->file_size(path);
+  // compared before the narrowing, a file of several GB is not a small one
+  if (!size.has_value() || *size > this->cache_.get_max_file_size() || !this->cache_.accepts(*size))
+    return nullptr;
+  auto file = CachedFile::create(*size);
+  if (file == nullptr || !this->read_file_content(path, file->data(), *size))
+    return nullptr;
+  this->cache_.put(path, file, generation);
+  return file;
+}
+
+std::shared_ptr<const CachedFile> SdMmc::read_file_cached(std::string const &path) {
+  return this->read_file_cached(path.c_str());
+}
+
+void SdMmc::update_cache_sensors() {
+#ifdef USE_SENSOR
+  if (this->cache_hits_sensor_ != nullptr)
+    this->cache_hits_sensor_->publish_state(this->cache_.get_hits());
+  if (this->cache_misses_sensor_ != nullptr)
+    this->cache_misses_sensor_->publish_state(this->cache_.get_misses());
+#endif
+}
+
+void SdMmc::update_discard_sensor() {
+#ifdef USE_SENSOR
+  if (this->sectors_discarded_sensor_ != nullptr)
+    this->sectors_discarded_sensor_->publish_state(this->get_sectors_discarded());
+#endif
+}
+
+bool SdMmc::start_benchmark(size_t size) {
+  if (this->benchmark_ != nullptr) {
+    ESP_LOGW(TAG, "A benchmark is already running");
+    return false;
+  }
+  ESP_LOGI(TAG, "Benchmark started with a scratch file of %s", format_size(size).c_str());
+  this->benchmark_.reset(new CardBenchmark(make_card_target(this), size));
+#ifdef USE_ESP_IDF
+  this->discard_task_.set_paused(true);
+#endif
+  this->benchmark_->start();
+  return true;
+}
+
+void SdMmc::finish_benchmark() {
+  bool success = this->benchmark_->join();
+  BenchmarkResult result = this->benchmark_->get_result();
+  this->benchmark_.reset();
+#ifdef USE_ESP_IDF
+  this->discard_task_.set_paused(false);
+#endif
+  if (!success) {
+    ESP_LOGE(TAG, "Benchmark failed, the profile is unchanged");
+    return;
+  }
+  this->profile_ = CardBenchmark::tune(result);
+  ESP_LOGI(TAG, "Benchmark done: write %s/s, read %s/s, %u random writes/s, %u random reads/s, %u file operations/s",
+           format_size(result.best_sequential_write()).c_str(), format_size(result.best_sequential_read()).c_str(),
+           result.random_write, result.random_read, result.file_operations);
+  ESP_LOGI(TAG, "Tuned profile: write buffer %s, flush every %s, read chunk %s",
+           format_size(this->profile_.write_buffer_size).c_str(), format_size(this->profile_.flush_threshold).c_str(),
+           format_size(this->profile_.read_chunk_size).c_str());
+  char content[96];
+  int len = snprintf(content, sizeof(content), PROFILE_FORMAT, this->profile_.write_buffer_size,
+                     this->profile_.flush_threshold, this->profile_.read_chunk_size);
+  this->write_file_atomic(PROFILE_PATH, reinterpret_cast<const uint8_t *>(content), len);
+#ifdef USE_SENSOR
+  if (this->sequential_write_speed_sensor_ != nullptr)
+    this->sequential_write_speed_sensor_->publish_state(result.best_sequential_write());
+  if (this->sequential_read_speed_sensor_ != nullptr)
+    this->sequential_read_speed_sensor_->publish_state(result.best_sequential_read());
+  if (this->random_write_rate_sensor_ != nullptr)
+    this->random_write_rate_sensor_->publish_state(result.random_write);
+  if (this->random_read_rate_sensor_ != nullptr)
+    this->random_read_rate_sensor_->publish_state(result.random_read);
+  if (this->file_operation_rate_sensor_ != nullptr)
+    this->file_operation_rate_sensor_->publish_state(result.file_operations);
+#endif
+}
+
+void SdMmc::load_profile() {
+  struct stat info;
+  if (stat(build_path(PROFILE_PATH).c_str(), &info) != 0)
+    return;
+  std::vector<uint8_t> content = this->read_file(PROFILE_PATH);
+  content.push_back('\0');
+  unsigned write_buffer_size, flush_threshold, read_chunk_size;
+  bool valid = sscanf(reinterpret_cast<const char *>(content.data()), PROFILE_FORMAT, &write_buffer_size,
+                      &flush_threshold, &read_chunk_size) == 3;
+  // sizes out of the measured ones come from an edited or damaged file
+  uint32_t smallest = BenchmarkResult::BLOCK_SIZES[0];
+  uint32_t largest = BenchmarkResult::BLOCK_SIZES[BenchmarkResult::BLOCK_SIZE_COUNT - 1];
+  for (unsigned size : {write_buffer_size, read_chunk_size})
+    valid = valid && size >= smallest && size <= largest && size % smallest == 0;
+  if (!valid) {
+    ESP_LOGW(TAG, "Ignoring the invalid profile %s", PROFILE_PATH);
+    return;
+  }
+  this->profile_.write_buffer_size = write_buffer_size;
+  this->profile_.flush_threshold = flush_threshold;
+  this->profile_.read_chunk_size = read_chunk_size;
+  this->profile_.tuned = true;
+}
+
 #ifdef USE_SENSOR
 void SdMmc::add_file_size_sensor(sensor::Sensor *sensor, std::string const &path) {
   this->file_size_sensors_.emplace_back(sensor, path);
@@ -112,6 +781,30 @@ void SdMmc::set_mode_1bit(bool b) { this->mode_1bit_ = b; }
 
 void SdMmc::set_power_ctrl_pin(GPIOPin *pin) { this->power_ctrl_pin_ = pin; }
 
+void SdMmc::set_sync_policy(SyncPolicy policy) { this->sync_policy_ = policy; }
+
+void SdMmc::set_cache_capacity(size_t capacity) { this->cache_.set_capacity(capacity); }
+
+void SdMmc::set_cache_max_file_size(size_t size) { this->cache_.set_max_file_size(size); }
+
+void SdMmc::add_retention_rule(std::string const &path, std::string const &pattern, uint8_t depth, uint32_t max_age,
+                               uint64_t max_size) {
+  this->retention_.add_rule(RetentionRule{path, pattern, depth, max_age, max_size});
+}
+
+void SdMmc::set_retention_min_free_space(uint64_t size) { this->retention_.set_min_free_space(size); }
+
+void SdMmc::set_retention_interval(uint32_t interval) { this->retention_.set_interval(interval); }
+
+void SdMmc::set_retention_time_slice(uint32_t time_slice) { this->retention_.set_time_slice(time_slice); }
+
+void SdMmc::add_indexed_directory(std::string const &path) {
+  std::string directory = path;
+  if (!directory.empty() && directory.back() == '/')
+    directory.pop_back();
+  this->indexes_.emplace_back(new DirectoryIndex(directory));
+}
+
 std::string SdMmc::error_code_to_string(SdMmc::ErrorCode code) {
   switch (code) {
     case ErrorCode::ERR_PIN_SETUP:
@@ -147,7 +840,7 @@ std::string memory_unit_to_string(MemoryUnits unit) {
   return "unknown";
 }
 
-MemoryUnits memory_unit_from_size(size_t size) {
+MemoryUnits memory_unit_from_size(uint64_t size) {
   short unit = MemoryUnits::Byte;
   double s = static_cast<double>(size);
   while (s >= 1024 && unit < MemoryUnits::PetaByte) {
@@ -157,15 +850,300 @@ MemoryUnits memory_unit_from_size(size_t size) {
   return static_cast<MemoryUnits>(unit);
 }
 
-std::string format_size(size_t size) {
+std::string format_size(uint64_t size) {
   MemoryUnits unit = memory_unit_from_size(size);
   char buffer[32];
   snprintf(buffer, sizeof(buffer), "%.2f %s", convertBytes(size, unit), memory_unit_to_string(unit).c_str());
   return std::string(buffer);
 }
 
-FileInfo::FileInfo(std::string const &path, size_t size, bool is_directory)
-    : path(path), size(size), is_directory(is_directory) {}
+uint32_t crc32(uint32_t crc, const uint8_t *data, size_t len) { return esp_rom_crc32_le(crc, data, len); }
+
+uint8_t *allocate_dma_buffer(size_t size) {
+#ifdef USE_ESP32
+  // the card driver copies a buffer that is not dma capable one sector at a time
+  return static_cast<uint8_t *>(heap_caps_aligned_alloc(DMA_BUFFER_ALIGNMENT, size, MALLOC_CAP_DMA));
+#else
+  return static_cast<uint8_t *>(aligned_alloc(DMA_BUFFER_ALIGNMENT, size));
+#endif
+}
+
+void free_dma_buffer(uint8_t *buffer) {
+#ifdef USE_ESP32
+  heap_caps_free(buffer);
+#else
+  free(buffer);
+#endif
+}
+
+bool is_internal_file(const char *path) {
+  const char *name = strrchr(path, '/');
+  name = name == nullptr ? path : name + 1;
+  return !DirectoryIndex::is_indexed(name, strlen(name));
+}
+
+bool glob_match(const char *pattern, const char *name) {
+  const char *star = nullptr;
+  const char *backtrack = nullptr;
+  while (*name != '\0') {
+    if (*pattern == '*') {
+      star = pattern++;
+      backtrack = name;
+    } else if (*pattern == '?' || *pattern == *name) {
+      pattern++;
+      name++;
+    } else if (star != nullptr) {
+      pattern = star + 1;
+      name = ++backtrack;
+    } else {
+      return false;
+    }
+  }
+  while (*pattern == '*')
+    pattern++;
+  return *pattern == '\0';
+}
+
+FileHandle::FileHandle(FILE *file, bool sync_on_write, SdMmc *card, std::string path)
+    : file_(file), sync_on_write_(sync_on_write), card_(card), path_(std::move(path)) {}
+
+FileHandle::~FileHandle() { this->close(); }
+
+size_t FileHandle::read(uint8_t *buffer, size_t len) {
+  if (this->file_ == nullptr)
+    return 0;
+  return fread(buffer, 1, len, this->file_);
+}
+
+size_t FileHandle::write(const uint8_t *buffer, size_t len) {
+  if (this->file_ == nullptr)
+    return 0;
+  size_t written = fwrite(buffer, 1, len, this->file_);
+  if (this->sync_on_write_)
+    this->sync();
+  if (written > 0) {
+    this->changed();
+    if (this->card_ != nullptr)
+      this->card_->on_file_written(this->path_, buffer, written);
+  }
+  return written;
+}
+
+bool FileHandle::seek(uint64_t offset) {
+  // an offset off_t can not hold is not reachable through the vfs
+  if (this->file_ == nullptr || static_cast<uint64_t>(static_cast<off_t>(offset)) != offset)
+    return false;
+  return fseeko(this->file_, static_cast<off_t>(offset), SEEK_SET) == 0;
+}
+
+uint64_t FileHandle::position() {
+  if (this->file_ == nullptr)
+    return 0;
+  off_t position = ftello(this->file_);
+  return position < 0 ? 0 : static_cast<uint64_t>(position);
+}
+
+bool FileHandle::sync() {
+  if (this->file_ == nullptr)
+    return false;
+  return fflush(this->file_) == 0 && fsync(fileno(this->file_)) == 0;
+}
+
+bool FileHandle::truncate() {
+  if (this->file_ == nullptr || fflush(this->file_) != 0)
+    return false;
+  bool ok = ftruncate(fileno(this->file_), ftello(this->file_)) == 0;
+  this->written_ = true;
+  if (this->card_ != nullptr)
+    this->card_->on_file_changed(this->path_);
+  return ok;
+}
+
+bool FileHandle::close() {
+  if (this->file_ == nullptr)
+    return true;
+  bool ok = fclose(this->file_) == 0;
+  this->file_ = nullptr;
+  // the buffered end of the content only reached the file now
+  if (this->written_ && this->card_ != nullptr)
+    this->card_->on_file_changed(this->path_);
+  return ok;
+}
+
+void FileHandle::changed() {
+  // on the first write and again on close once the content is complete, not on each write of a stream
+  if (this->written_)
+    return;
+  this->written_ = true;
+  if (this->card_ != nullptr)
+    this->card_->on_file_changed(this->path_);
+}
+
+AtomicFile::AtomicFile(FileCache *cache, std::string const &path, std::unique_ptr<FileHandle> file, bool sync,
+                       bool truncate)
+    : cache_(cache), path_(path), file_(std::move(file)), sync_(sync), truncate_(truncate) {}
+
+AtomicFile::~AtomicFile() { this->discard(); }
+
+size_t AtomicFile::write(const uint8_t *buffer, size_t len) {
+  if (this->file_ == nullptr)
+    return 0;
+  return this->file_->write(buffer, len);
+}
+
+size_t AtomicFile::size() {
+  if (this->file_ == nullptr)
+    return 0;
+  // the uploads writing atomically announce their size as a size_t
+  return static_cast<size_t>(this->file_->position());
+}
+
+bool AtomicFile::sync() {
+  if (this->file_ == nullptr)
+    return false;
+  return !this->sync_ || this->file_->sync();
+}
+
+bool AtomicFile::commit() {
+  if (this->file_ == nullptr)
+    return false;
+  if (this->truncate_ && !this->file_->truncate()) {
+    ESP_LOGE(TAG, "Failed to truncate %s: %s", this->path_.c_str(), strerror(errno));
+    this->discard();
+    return false;
+  }
+  if (this->sync_ && !this->file_->sync()) {
+    ESP_LOGE(TAG, "Failed to sync %s: %s", this->path_.c_str(), strerror(errno));
+    this->discard();
+    return false;
+  }
+  if (!this->file_->close()) {
+    ESP_LOGE(TAG, "Failed to close %s: %s", this->path_.c_str(), strerror(errno));
+    this->discard();
+    return false;
+  }
+  this->file_ = nullptr;
+
+  // fat can not rename over an existing file, the complete content is first renamed to .sdnew
+  // so that an interrupted replacement can be finished by recover_file
+  std::string target = build_path(this->path_.c_str());
+  std::string temp_path = target + AtomicFile::TEMP_SUFFIX;
+  std::string new_path = target + AtomicFile::NEW_SUFFIX;
+  unlink(new_path.c_str());
+  if (rename(temp_path.c_str(), new_path.c_str()) != 0) {
+    ESP_LOGE(TAG, "Failed to rename %s: %s", temp_path.c_str(), strerror(errno));
+    unlink(temp_path.c_str());
+    return false;
+  }
+  this->cache_->invalidate(this->path_);
+  if (unlink(target.c_str()) != 0 && errno != ENOENT) {
+    ESP_LOGE(TAG, "Failed to replace %s: %s", this->path_.c_str(), strerror(errno));
+    return false;
+  }
+  if (rename(new_path.c_str(), target.c_str()) != 0) {
+    ESP_LOGE(TAG, "Failed to rename %s: %s", new_path.c_str(), strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+void AtomicFile::discard() {
+  if (this->file_ == nullptr)
+    return;
+  this->file_->close();
+  this->file_ = nullptr;
+  unlink((build_path(this->path_.c_str()) + AtomicFile::TEMP_SUFFIX).c_str());
+}
+
+PreallocatedFile::PreallocatedFile(FileCache *cache, std::string const &path, std::unique_ptr<FileHandle> file,
+                                   size_t capacity)
+    : cache_(cache), path_(path), file_(std::move(file)), capacity_(capacity) {}
+
+PreallocatedFile::~PreallocatedFile() { this->close(); }
+
+size_t PreallocatedFile::write(const uint8_t *buffer, size_t len) {
+  if (this->file_ == nullptr)
+    return 0;
+  size_t written = this->file_->write(buffer, len);
+  this->length_ += written;
+  return written;
+}
+
+bool PreallocatedFile::sync() { return this->file_ != nullptr && this->file_->sync(); }
+
+bool PreallocatedFile::close() {
+  if (this->file_ == nullptr)
+    return true;
+  bool ok = this->length_ >= this->capacity_ || this->file_->truncate();
+  if (!ok)
+    ESP_LOGE(TAG, "Failed to truncate %s: %s", this->path_.c_str(), strerror(errno));
+  ok = this->file_->close() && ok;
+  this->file_ = nullptr;
+  this->cache_->invalidate(this->path_);
+  return ok;
+}
+
+bool AtomicFile::suspend() {
+  if (this->file_ == nullptr)
+    return false;
+  bool ok = this->sync();
+  ok = this->file_->close() && ok;
+  this->file_ = nullptr;
+  return ok;
+}
+
+DirectoryWalker::DirectoryWalker(SdMmc *card, std::string const &path, uint8_t depth) : card_(card) {
+  this->enter(path, depth);
+}
+
+DirectoryWalker::~DirectoryWalker() {
+  while (!this->levels_.empty())
+    this->leave();
+}
+
+optional<FileInfo> DirectoryWalker::next() {
+  while (!this->levels_.empty()) {
+    Level &level = this->levels_.back();
+    optional<FileInfo> info;
+    if (level.handle != nullptr) {
+      info = this->read_level(level);
+    } else if (level.position < level.entries.size()) {
+      info = optional<FileInfo>(std::move(level.entries[level.position++]));
+    }
+    if (!info.has_value()) {
+      this->leave();
+      continue;
+    }
+    if (info->is_directory && level.depth > 0)
+      this->enter(info->path, level.depth - 1);
+    return info;
+  }
+  return {};
+}
+
+void DirectoryWalker::enter(std::string const &path, uint8_t depth) {
+  Level level{path, depth, {}, 0, nullptr};
+  if (!level.path.empty() && level.path.back() == '/' && level.path.size() > 1)
+    level.path.pop_back();
+  // an indexed directory is read from memory, each level of the others keeps one directory open on the card
+  if (!this->card_->list_index(level.path.c_str(), level.entries) && !this->open_level(level)) {
+    ESP_LOGE(TAG, "Failed to open directory: %s", level.path.c_str());
+    return;
+  }
+  this->directories_++;
+  this->levels_.push_back(std::move(level));
+}
+
+void DirectoryWalker::leave() {
+  this->close_level(this->levels_.back());
+  this->levels_.pop_back();
+}
+
+FileInfo::FileInfo(std::string const &path, uint64_t size, bool is_directory)
+    : path(path), size(size), is_directory(is_directory), mtime(0) {}
+
+FileInfo::FileInfo(std::string const &path, uint64_t size, bool is_directory, time_t mtime)
+    : path(path), size(size), is_directory(is_directory), mtime(mtime) {}
 
 }  // namespace sd_mmc_card
 }  // namespace esphome
\ No newline at end of file
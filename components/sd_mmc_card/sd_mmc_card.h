@@ -1,8 +1,15 @@
 #pragma once
+#include <cstdio>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
 #include "esphome/core/gpio.h"
 #include "esphome/core/defines.h"
 #include "esphome/core/component.h"
 #include "esphome/core/automation.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/optional.h"
 #ifdef USE_SENSOR
 #include "esphome/components/sensor/sensor.h"
 #endif
@@ -14,6 +21,12 @@
 #include "sdmmc_cmd.h"
 #endif
 
+#include "benchmark.h"
+#include "directory_index.h"
+#include "discard.h"
+#include "file_cache.h"
+#include "retention.h"
+
 namespace esphome {
 namespace sd_mmc_card {
 
@@ -31,17 +44,196 @@ struct FileSizeSensor {
 
 struct FileInfo {
   std::string path;
-  size_t size;
+  // exFAT files can be larger than 4 GB
+  uint64_t size;
   bool is_directory;
+  time_t mtime;
+
+  FileInfo(std::string const &, uint64_t, bool);
+  FileInfo(std::string const &, uint64_t, bool, time_t);
+};
+
+/* When to flush written data to the card with fsync */
+enum class SyncPolicy : uint8_t {
+  /* only when the file is closed */
+  NEVER,
+  /* before an atomic write replaces its target */
+  ATOMIC,
+  /* after every write */
+  ALWAYS,
+};
+
+/* Date directories inserted before the file name of a sharded path */
+enum class ShardLevel : uint8_t {
+  NONE,
+  /* <directory>/YYYY/<name> */
+  YEAR,
+  /* <directory>/YYYY/MM/<name> */
+  MONTH,
+  /* <directory>/YYYY/MM/DD/<name> */
+  DAY,
+  /* <directory>/YYYY/MM/DD/HH/<name> */
+  HOUR,
+};
+
+class SdMmc;
+
+/* Handle on an open file, the file is closed when the handle is destroyed.
+ * A handle given the card and the path of its file tells the card each time the file changed, the cached content and
+ * the index entry of the file are then dropped.
+ */
+class FileHandle {
+ public:
+  explicit FileHandle(FILE *file, bool sync_on_write = false, SdMmc *card = nullptr, std::string path = {});
+  ~FileHandle();
+  FileHandle(FileHandle const &) = delete;
+  FileHandle &operator=(FileHandle const &) = delete;
+
+  size_t read(uint8_t *buffer, size_t len);
+  size_t write(const uint8_t *buffer, size_t len);
+  /* Offsets are 64 bits, exFAT files can be larger than 4 GB */
+  bool seek(uint64_t offset);
+  uint64_t position();
+  /* Flush the written data to the card */
+  bool sync();
+  /* Cut the file at the current position */
+  bool truncate();
+  bool close();
+
+ protected:
+  void changed();
+
+  FILE *file_;
+  bool sync_on_write_;
+  SdMmc *card_;
+  std::string path_;
+  bool written_{false};
+};
+
+/* File written under a temporary name then moved over the target by commit().
+ * The target keeps its previous content until the new one is complete, an uncommitted file is discarded.
+ */
+class AtomicFile {
+ public:
+  /* Suffixes of the files of an atomic write: the incomplete content, the complete content not yet moved */
+  static const char *const TEMP_SUFFIX;
+  static const char *const NEW_SUFFIX;
+
+  AtomicFile(FileCache *cache, std::string const &path, std::unique_ptr<FileHandle> file, bool sync,
+             bool truncate = false);
+  ~AtomicFile();
+  AtomicFile(AtomicFile const &) = delete;
+  AtomicFile &operator=(AtomicFile const &) = delete;
+
+  size_t write(const uint8_t *buffer, size_t len);
+  /* Bytes written so far */
+  size_t size();
+  /* Make the content written so far durable, unless the sync policy is never */
+  bool sync();
+  /* Replace the target with the written content */
+  bool commit();
+  /* Drop the written content, the target is left untouched */
+  void discard();
+  /* Close the file keeping the written content, resume_file_atomic continues it */
+  bool suspend();
+  std::string const &get_path() const { return this->path_; }
 
-  FileInfo(std::string const &, size_t, bool);
+ protected:
+  FileCache *cache_;
+  std::string path_;
+  std::unique_ptr<FileHandle> file_;
+  bool sync_;
+  // the file was preallocated, the unused end is cut on commit
+  bool truncate_;
+};
+
+/* File allocated in one contiguous region up front then written sequentially.
+ * Writes never search for a free cluster, their latency stays steady while recording a stream. The file keeps
+ * its allocated size until close() cuts it to the written length, writing past the capacity grows it as usual.
+ */
+class PreallocatedFile {
+ public:
+  PreallocatedFile(FileCache *cache, std::string const &path, std::unique_ptr<FileHandle> file, size_t capacity);
+  ~PreallocatedFile();
+  PreallocatedFile(PreallocatedFile const &) = delete;
+  PreallocatedFile &operator=(PreallocatedFile const &) = delete;
+
+  size_t write(const uint8_t *buffer, size_t len);
+  bool sync();
+  /* Cut the file to the written length and close it */
+  bool close();
+  /* Bytes written so far, a recording on exFAT can grow past 4 GB */
+  uint64_t length() const { return this->length_; }
+  /* Allocated size, 0 when the preallocation is not supported */
+  size_t capacity() const { return this->capacity_; }
+  std::string const &get_path() const { return this->path_; }
+
+ protected:
+  FileCache *cache_;
+  std::string path_;
+  std::unique_ptr<FileHandle> file_;
+  size_t capacity_;
+  uint64_t length_{0};
+};
+
+/* Depth first walk of a directory tree, one entry at a time.
+ * Only the directories being walked are open, a tree of any size is walked without holding its listing in memory.
+ * A directory is returned before its content, an indexed directory is read from its index.
+ */
+class DirectoryWalker {
+ public:
+  DirectoryWalker(SdMmc *card, std::string const &path, uint8_t depth);
+  ~DirectoryWalker();
+  DirectoryWalker(DirectoryWalker const &) = delete;
+  DirectoryWalker &operator=(DirectoryWalker const &) = delete;
+
+  /* Next entry of the tree, nothing once every entry was returned */
+  optional<FileInfo> next();
+  /* Directories entered so far */
+  uint32_t get_directories() const { return this->directories_; }
+
+ protected:
+  // open directory of the framework
+  struct Handle;
+
+  struct Level {
+    std::string path;
+    // levels of sub directories still to walk below this one
+    uint8_t depth;
+    // entries of an indexed directory, nothing is open on the card then
+    std::vector<FileInfo> entries;
+    size_t position;
+    Handle *handle;
+  };
+
+  void enter(std::string const &path, uint8_t depth);
+  void leave();
+  bool open_level(Level &level);
+  optional<FileInfo> read_level(Level &level);
+  void close_level(Level &level);
+
+  SdMmc *card_;
+  std::vector<Level> levels_;
+  uint32_t directories_{0};
 };
 
 class SdMmc : public Component {
+  friend class DirectoryWalker;
+  friend class DiscardTask;
+
 #ifdef USE_SENSOR
   SUB_SENSOR(used_space)
   SUB_SENSOR(total_space)
   SUB_SENSOR(free_space)
+  SUB_SENSOR(cache_hits)
+  SUB_SENSOR(cache_misses)
+  SUB_SENSOR(bytes_reclaimed)
+  SUB_SENSOR(sequential_write_speed)
+  SUB_SENSOR(sequential_read_speed)
+  SUB_SENSOR(random_write_rate)
+  SUB_SENSOR(random_read_rate)
+  SUB_SENSOR(file_operation_rate)
+  SUB_SENSOR(sectors_discarded)
 #endif
 #ifdef USE_TEXT_SENSOR
   SUB_TEXT_SENSOR(sd_card_type)
@@ -55,23 +247,85 @@ class SdMmc : public Component {
   void setup() override;
   void loop() override;
   void dump_config() override;
-  void write_file(const char *path, const uint8_t *buffer, size_t len, const char *mode);
+  void on_shutdown() override;
+  bool write_file(const char *path, const uint8_t *buffer, size_t len, const char *mode);
   void write_file(const char *path, const uint8_t *buffer, size_t len);
   void append_file(const char *path, const uint8_t *buffer, size_t len);
+  /* Drop the cached content and the index entry of a file changed through an open handle */
+  void on_file_changed(std::string const &path);
+  /* Pass the data written through an open handle to the append callbacks */
+  void on_file_written(std::string const &path, const uint8_t *buffer, size_t len);
+  /* Called with the path and the data after each successful append_file and each write through a writable handle,
+   * stream writers included. Can be called from the task of a stream writer.
+   */
+  void add_on_append_callback(std::function<void(const char *, const uint8_t *, size_t)> &&callback);
+  /* Write the whole file to a temporary file then rename it over the target */
+  bool write_file_atomic(const char *path, const uint8_t *buffer, size_t len);
+  /* Start an atomic write, the target is only replaced when the returned file is committed.
+   * With a preallocate size the temporary file is first allocated in one contiguous region when supported.
+   */
+  std::unique_ptr<AtomicFile> open_file_atomic(const char *path, size_t preallocate = 0);
+  /* Continue an unfinished atomic write, the content written so far is kept */
+  std::unique_ptr<AtomicFile> resume_file_atomic(const char *path);
+  /* Size of the content written so far by an unfinished atomic write, 0 if there is none */
+  size_t get_partial_size(const char *path);
+  /* Finish an atomic write interrupted by a power loss, return true when the file was restored */
+  bool recover_file(const char *path);
   bool delete_file(const char *path);
   bool delete_file(std::string const &path);
+  /* Create a file of size bytes allocated in one contiguous region, false when it is not supported */
+  bool preallocate_file(const char *path, size_t size);
+  /* Create a preallocated file of size bytes and open it for a sequential write, it grows as usual when the
+   * preallocation is not supported
+   */
+  std::unique_ptr<PreallocatedFile> open_file_preallocated(const char *path, size_t size);
+  /* Keep a preallocated file open, append_file to its path writes into it until close_preallocated */
+  bool open_preallocated(const char *path, size_t size);
+  bool close_preallocated(const char *path);
   bool create_directory(const char *path);
+  /* Create a directory and its missing parents, the last directories created are remembered and not checked
+   * again
+   */
+  bool create_directories(const char *path);
+  /* Insert the date directories of the current local time before the file name, the path is unchanged while
+   * the time is not set
+   */
+  std::string shard_path(const char *path, ShardLevel level);
+  /* Replace the path with its sharded path and create its directory, false if the directory can not be created */
+  bool shard(std::string &path, ShardLevel level);
   bool remove_directory(const char *path);
+  /* Delete the given files, return the number of files deleted */
+  size_t delete_files(std::vector<std::string> const &paths);
+  /* Rename each (source, destination) pair, return the number of files moved */
+  size_t move_files(std::vector<std::pair<std::string, std::string>> const &moves);
+  /* Delete files matching a glob pattern and older than the given age in seconds (0 to ignore age) */
+  size_t delete_files_matching(const char *directory, const char *pattern, uint32_t older_than, uint8_t depth);
+  /* Remove a directory and all its content */
+  bool remove_directory_recursive(const char *path);
   std::vector<uint8_t> read_file(char const *path);
   std::vector<uint8_t> read_file(std::string const &path);
+  std::unique_ptr<FileHandle> open_file(const char *path, const char *mode);
+  std::unique_ptr<FileHandle> open_file(std::string const &path, const char *mode);
+  std::shared_ptr<const CachedFile> read_file_cached(char const *path);
+  std::shared_ptr<const CachedFile> read_file_cached(std::string const &path);
   bool is_directory(const char *path);
   bool is_directory(std::string const &path);
   std::vector<std::string> list_directory(const char *path, uint8_t depth);
   std::vector<std::string> list_directory(std::string path, uint8_t depth);
   std::vector<FileInfo> list_directory_file_info(const char *path, uint8_t depth);
   std::vector<FileInfo> list_directory_file_info(std::string path, uint8_t depth);
-  size_t file_size(const char *path);
-  size_t file_size(std::string const &path);
+  /* Size, time and type of a file or directory, nothing when it does not exist */
+  optional<FileInfo> file_info(const char *path);
+  optional<FileInfo> file_info(std::string const &path);
+  /* Size of a file in bytes, nothing when it does not exist */
+  optional<uint64_t> file_size(const char *path);
+  optional<uint64_t> file_size(std::string const &path);
+  /* Free space on the card in bytes, scans the FAT on large cards */
+  optional<uint64_t> get_free_space();
+  /* Allocation unit of the file system in bytes */
+  optional<uint32_t> get_cluster_size();
+  /* FAT12, FAT16, FAT32 or exFAT, empty when the framework does not tell */
+  std::string const &get_file_system() const { return this->file_system_; }
 #ifdef USE_SENSOR
   void add_file_size_sensor(sensor::Sensor *, std::string const &path);
 #endif
@@ -84,6 +338,32 @@ class SdMmc : public Component {
   void set_data3_pin(uint8_t);
   void set_mode_1bit(bool);
   void set_power_ctrl_pin(GPIOPin *);
+  void set_sync_policy(SyncPolicy);
+  SyncPolicy get_sync_policy() const { return this->sync_policy_; }
+  void set_cache_capacity(size_t);
+  void set_cache_max_file_size(size_t);
+  FileCache &get_cache() { return this->cache_; }
+  void add_retention_rule(std::string const &path, std::string const &pattern, uint8_t depth, uint32_t max_age,
+                          uint64_t max_size);
+  void set_retention_min_free_space(uint64_t);
+  void set_retention_interval(uint32_t);
+  void set_retention_time_slice(uint32_t);
+  RetentionScheduler &get_retention() { return this->retention_; }
+  /* Keep an index of the entries of a large directory for its lookups and listings */
+  void add_indexed_directory(std::string const &path);
+  /* Measure the card on a task with a scratch file of size bytes, the benchmark sensors and the profile are
+   * updated when it finishes. False when a benchmark is already running.
+   */
+  bool start_benchmark(size_t size);
+  bool is_benchmark_running() const { return this->benchmark_ != nullptr; }
+  /* Transfer settings tuned by the last benchmark of the card, saved on the card itself */
+  CardProfile const &get_profile() const { return this->profile_; }
+  /* Discard the clusters freed by deletes and truncates in the background, ESP-IDF 5.2 or later only */
+  void set_discard(bool discard) { this->discard_ = discard; }
+  /* Discard the whole free space of the card in the background, false when the card can not be discarded */
+  bool discard_free_space();
+  /* Sectors discarded since the card was mounted */
+  uint64_t get_sectors_discarded() const;
 
  protected:
   ErrorCode init_error_;
@@ -95,21 +375,50 @@ class SdMmc : public Component {
   uint8_t data3_pin_;
   bool mode_1bit_;
   GPIOPin *power_ctrl_pin_{nullptr};
+  SyncPolicy sync_policy_{SyncPolicy::ATOMIC};
+  FileCache cache_;
+  RetentionScheduler retention_;
+  CallbackManager<void(const char *, const uint8_t *, size_t)> append_callback_;
+  std::map<std::string, std::unique_ptr<PreallocatedFile>> preallocated_files_;
+  std::recursive_mutex lock_;
+  // the indexes and the known directories only, a write through a handle never waits for a card operation
+  std::recursive_mutex index_lock_;
+  std::vector<std::unique_ptr<DirectoryIndex>> indexes_;
+  // directories recently created or found by create_directories, the most recent last
+  std::vector<std::string> known_directories_;
+  CardProfile profile_;
+  std::string file_system_;
+  std::unique_ptr<CardBenchmark> benchmark_;
+  bool discard_{false};
 
 #ifdef USE_ESP_IDF
   sdmmc_card_t *card_;
+  DiscardTask discard_task_;
 #endif
 #ifdef USE_SENSOR
   std::vector<FileSizeSensor> file_size_sensors_{};
 #endif
   void update_sensors();
+  void update_cache_sensors();
+  void update_discard_sensor();
+  bool read_file_content(char const *path, uint8_t *buffer, size_t len);
 #ifdef USE_ESP32_FRAMEWORK_ARDUINO
   std::string sd_card_type_to_string(int) const;
 #endif
 #ifdef USE_ESP_IDF
   std::string sd_card_type() const;
 #endif
-  std::vector<FileInfo> &list_directory_file_info_rec(const char *path, uint8_t depth, std::vector<FileInfo> &list);
+  size_t delete_files_matching_rec(std::string const &directory, const char *pattern, time_t limit, uint8_t depth);
+  bool remove_directory_rec(std::string const &path);
+  void track_changes();
+  void on_invalidate(std::string const &path, bool directory);
+  void load_profile();
+  void finish_benchmark();
+  bool is_known_directory(std::string const &path);
+  DirectoryIndex *find_index(std::string const &directory);
+  DirectoryIndex::Lookup lookup_index(const char *path, DirectoryIndex::Entry &entry);
+  /* List a directory from its index, false when it has none or the index is not ready */
+  bool list_index(const char *path, std::vector<FileInfo> &list);
   static std::string error_code_to_string(ErrorCode);
 };
 
@@ -118,15 +427,25 @@ template<typename... Ts> class SdMmcWriteFileAction : public Action<Ts...> {
   SdMmcWriteFileAction(SdMmc *parent) : parent_(parent) {}
   TEMPLATABLE_VALUE(std::string, path)
   TEMPLATABLE_VALUE(std::vector<uint8_t>, data)
+  void set_atomic(bool atomic) { this->atomic_ = atomic; }
+  void set_shard(ShardLevel shard) { this->shard_ = shard; }
 
   void play(Ts... x) {
     auto path = this->path_.value(x...);
+    if (!this->parent_->shard(path, this->shard_))
+      return;
     auto buffer = this->data_.value(x...);
-    this->parent_->write_file(path.c_str(), buffer.data(), buffer.size());
+    if (this->atomic_) {
+      this->parent_->write_file_atomic(path.c_str(), buffer.data(), buffer.size());
+    } else {
+      this->parent_->write_file(path.c_str(), buffer.data(), buffer.size());
+    }
   }
 
  protected:
   SdMmc *parent_;
+  bool atomic_{false};
+  ShardLevel shard_{ShardLevel::NONE};
 };
 
 template<typename... Ts> class SdMmcAppendFileAction : public Action<Ts...> {
@@ -134,13 +453,46 @@ template<typename... Ts> class SdMmcAppendFileAction : public Action<Ts...> {
   SdMmcAppendFileAction(SdMmc *parent) : parent_(parent) {}
   TEMPLATABLE_VALUE(std::string, path)
   TEMPLATABLE_VALUE(std::vector<uint8_t>, data)
+  void set_shard(ShardLevel shard) { this->shard_ = shard; }
 
   void play(Ts... x) {
     auto path = this->path_.value(x...);
+    if (!this->parent_->shard(path, this->shard_))
+      return;
     auto buffer = this->data_.value(x...);
     this->parent_->append_file(path.c_str(), buffer.data(), buffer.size());
   }
 
+ protected:
+  SdMmc *parent_;
+  ShardLevel shard_{ShardLevel::NONE};
+};
+
+template<typename... Ts> class SdMmcPreallocateFileAction : public Action<Ts...> {
+ public:
+  SdMmcPreallocateFileAction(SdMmc *parent) : parent_(parent) {}
+  TEMPLATABLE_VALUE(std::string, path)
+  TEMPLATABLE_VALUE(size_t, size)
+
+  void play(Ts... x) {
+    auto path = this->path_.value(x...);
+    this->parent_->open_preallocated(path.c_str(), this->size_.value(x...));
+  }
+
+ protected:
+  SdMmc *parent_;
+};
+
+template<typename... Ts> class SdMmcCloseFileAction : public Action<Ts...> {
+ public:
+  SdMmcCloseFileAction(SdMmc *parent) : parent_(parent) {}
+  TEMPLATABLE_VALUE(std::string, path)
+
+  void play(Ts... x) {
+    auto path = this->path_.value(x...);
+    this->parent_->close_preallocated(path.c_str());
+  }
+
  protected:
   SdMmc *parent_;
 };
@@ -149,14 +501,20 @@ template<typename... Ts> class SdMmcCreateDirectoryAction : public Action<Ts...>
  public:
   SdMmcCreateDirectoryAction(SdMmc *parent) : parent_(parent) {}
   TEMPLATABLE_VALUE(std::string, path)
+  void set_parents(bool parents) { this->parents_ = parents; }
 
   void play(Ts... x) {
     auto path = this->path_.value(x...);
-    this->parent_->create_directory(path.c_str());
+    if (this->parents_) {
+      this->parent_->create_directories(path.c_str());
+    } else {
+      this->parent_->create_directory(path.c_str());
+    }
   }
 
  protected:
   SdMmc *parent_;
+  bool parents_{false};
 };
 
 template<typename... Ts> class SdMmcRemoveDirectoryAction : public Action<Ts...> {
@@ -187,10 +545,49 @@ template<typename... Ts> class SdMmcDeleteFileAction : public Action<Ts...> {
   SdMmc *parent_;
 };
 
+template<typename... Ts> class SdMmcBenchmarkAction : public Action<Ts...> {
+ public:
+  SdMmcBenchmarkAction(SdMmc *parent) : parent_(parent) {}
+  TEMPLATABLE_VALUE(size_t, size)
+
+  void play(Ts... x) { this->parent_->start_benchmark(this->size_.value(x...)); }
+
+ protected:
+  SdMmc *parent_;
+};
+
+template<typename... Ts> class SdMmcDiscardFreeSpaceAction : public Action<Ts...> {
+ public:
+  SdMmcDiscardFreeSpaceAction(SdMmc *parent) : parent_(parent) {}
+
+  void play(Ts... x) { this->parent_->discard_free_space(); }
+
+ protected:
+  SdMmc *parent_;
+};
+
 long double convertBytes(uint64_t, MemoryUnits);
 std::string memory_unit_to_string(MemoryUnits);
-MemoryUnits memory_unit_from_size(size_t);
-std::string format_size(size_t);
+MemoryUnits memory_unit_from_size(uint64_t);
+std::string format_size(uint64_t);
+uint32_t crc32(uint32_t crc, const uint8_t *data, size_t len);
+/* Buffer the card driver reads and writes without an intermediate copy, released with free_dma_buffer */
+uint8_t *allocate_dma_buffer(size_t size);
+void free_dma_buffer(uint8_t *buffer);
+/* Match a file name against a pattern supporting '*' and '?' */
+bool glob_match(const char *pattern, const char *name);
+/* The file is kept open by the component while in use, a directory index log or the temporary file of an atomic
+ * write, and is never deleted by name
+ */
+bool is_internal_file(const char *path);
+/* Absolute vfs path of a path on the card */
+std::string build_path(const char *path);
+#ifdef USE_ESP_IDF
+/* Local time of a FatFs date and time */
+time_t fat_time(uint16_t date, uint16_t time);
+/* FatFs path of a path on the card, on the drive the card is mounted as */
+std::string fat_path(const char *path);
+#endif
 
 }  // namespace sd_mmc_card
 }  // namespace esphome
\ No newline at end of file
@@ -12,6 +12,9 @@ namespace esphome {
 namespace sd_mmc_card {
 
 static const char *TAG = "sd_mmc_card_esp32_arduino";
+static const std::string MOUNT_POINT("/sdcard");
+
+std::string build_path(const char *path) { return MOUNT_POINT + path; }
 
 void SdMmc::setup() {
   if (this->power_ctrl_pin_ != nullptr)
@@ -27,7 +30,8 @@ void SdMmc::setup() {
     return;
   }
 
-  bool beginResult = this->mode_1bit_ ? SD_MMC.begin("/sdcard", this->mode_1bit_) : SD_MMC.begin();
+  bool beginResult = this->mode_1bit_ ? SD_MMC.begin(MOUNT_POINT.c_str(), this->mode_1bit_)
+                                      : SD_MMC.begin(MOUNT_POINT.c_str());
   if (!beginResult) {
     this->init_error_ = ErrorCode::ERR_MOUNT;
     this->mark_failed();
@@ -48,32 +52,71 @@ void SdMmc::setup() {
   }
 
   update_sensors();
+  if (this->cache_.is_enabled())
+    this->set_interval("cache_sensors", 60000, [this]() { this->update_cache_sensors(); });
+  this->track_changes();
+  this->load_profile();
+  if (this->discard_)
+    ESP_LOGW(TAG, "Discarding the freed space is not supported with the Arduino framework");
 }
 
-void SdMmc::write_file(const char *path, const uint8_t *buffer, size_t len, const char *mode) {
+bool SdMmc::write_file(const char *path, const uint8_t *buffer, size_t len, const char *mode) {
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
+  this->cache_.invalidate(path);
   File file = SD_MMC.open(path, mode);
   if (!file) {
     ESP_LOGE(TAG, "Failed to open file for writing");
-    return;
+    return false;
   }
 
-  file.write(buffer, len);
+  bool ok = file.write(buffer, len) == len;
+  if (!ok) {
+    ESP_LOGE(TAG, "Failed to write to file");
+    if (this->retention_.is_enabled())
+      this->retention_.request_run();
+  }
+  if (this->sync_policy_ == SyncPolicy::ALWAYS)
+    file.flush();
   file.close();
+  // before for the index log, again now that the content is complete
+  this->cache_.invalidate(path);
   this->update_sensors();
+  return ok;
+}
+
+std::unique_ptr<FileHandle> SdMmc::open_file(const char *path, const char *mode) {
+  if (strpbrk(mode, "wa+") != nullptr)
+    this->cache_.invalidate(path);
+  // SD_MMC is mounted on the vfs, use it directly to get a stdio handle
+  std::string absolut_path = build_path(path);
+  FILE *file = fopen(absolut_path.c_str(), mode);
+  if (file == nullptr && mode[0] == 'r' && this->recover_file(path))
+    file = fopen(absolut_path.c_str(), mode);
+  if (file == nullptr) {
+    ESP_LOGE(TAG, "Failed to open file: %s", strerror(errno));
+    return nullptr;
+  }
+  bool writable = strpbrk(mode, "wa+") != nullptr;
+  bool sync = this->sync_policy_ == SyncPolicy::ALWAYS && writable;
+  return std::unique_ptr<FileHandle>(new FileHandle(file, sync, writable ? this : nullptr, path));
 }
 
 bool SdMmc::create_directory(const char *path) {
   ESP_LOGV(TAG, "Create directory: %s", path);
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
   if (!SD_MMC.mkdir(path)) {
     ESP_LOGE(TAG, "Failed to create directory");
     return false;
   }
+  this->cache_.invalidate(path);
   this->update_sensors();
   return true;
 }
 
 bool SdMmc::remove_directory(const char *path) {
   ESP_LOGV(TAG, "Remove directory: %s", path);
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
+  this->cache_.invalidate_prefix(path);
   if (!SD_MMC.rmdir(path)) {
     ESP_LOGE(TAG, "Failed to remove directory");
     return false;
@@ -84,6 +127,12 @@ bool SdMmc::remove_directory(const char *path) {
 
 bool SdMmc::delete_file(const char *path) {
   ESP_LOGV(TAG, "Delete File: %s", path);
+  if (is_internal_file(path)) {
+    ESP_LOGE(TAG, "Not deleting %s, it is used by the card component", path);
+    return false;
+  }
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
+  this->cache_.invalidate(path);
   if (!SD_MMC.remove(path)) {
     ESP_LOGE(TAG, "failed to remove file");
     return false;
@@ -94,7 +143,13 @@ bool SdMmc::delete_file(const char *path) {
 
 std::vector<uint8_t> SdMmc::read_file(char const *path) {
   ESP_LOGV(TAG, "Read File: %s", path);
+  auto cached = this->read_file_cached(path);
+  if (cached != nullptr)
+    return std::vector<uint8_t>(cached->data(), cached->data() + cached->size());
+
   File file = SD_MMC.open(path);
+  if (!file && this->recover_file(path))
+    file = SD_MMC.open(path);
   if (!file) {
     ESP_LOGE(TAG, "Failed to open file for reading");
     return std::vector<uint8_t>();
@@ -108,34 +163,53 @@ std::vector<uint8_t> SdMmc::read_file(char const *path) {
   return res;
 }
 
-std::vector<FileInfo> &SdMmc::list_directory_file_info_rec(const char *path, uint8_t depth,
-                                                           std::vector<FileInfo> &list) {
-  ESP_LOGV(TAG, "Listing directory file info: %s\n", path);
-
-  File root = SD_MMC.open(path);
-  if (!root) {
-    ESP_LOGE(TAG, "Failed to open directory");
-    return list;
+bool SdMmc::read_file_content(char const *path, uint8_t *buffer, size_t len) {
+  File file = SD_MMC.open(path);
+  if (!file) {
+    ESP_LOGE(TAG, "Failed to open file for reading");
+    return false;
   }
-  if (!root.isDirectory()) {
-    ESP_LOGE(TAG, "Not a directory");
-    return list;
+  size_t read = file.read(buffer, len);
+  file.close();
+  if (read != len) {
+    ESP_LOGE(TAG, "Failed to read file");
+    return false;
   }
+  return true;
+}
 
-  File file = root.openNextFile();
-  while (file) {
-    list.emplace_back(file.path(), file.size(), file.isDirectory());
-    if (file.isDirectory()) {
-      if (depth) {
-        list_directory_file_info_rec(file.path(), depth - 1, list);
-      }
-    }
-    file = root.openNextFile();
-  }
-  return list;
+struct DirectoryWalker::Handle {
+  File dir;
+};
+
+bool DirectoryWalker::open_level(Level &level) {
+  File dir = SD_MMC.open(level.path.c_str());
+  if (!dir || !dir.isDirectory())
+    return false;
+  level.handle = new Handle{dir};
+  return true;
+}
+
+optional<FileInfo> DirectoryWalker::read_level(Level &level) {
+  File file = level.handle->dir.openNextFile();
+  if (!file)
+    return {};
+  return FileInfo(file.path(), file.size(), file.isDirectory(), file.getLastWrite());
+}
+
+void DirectoryWalker::close_level(Level &level) {
+  if (level.handle == nullptr)
+    return;
+  level.handle->dir.close();
+  delete level.handle;
+  level.handle = nullptr;
 }
 
 bool SdMmc::is_directory(const char *path) {
+  DirectoryIndex::Entry entry;
+  auto lookup = this->lookup_index(path, entry);
+  if (lookup != DirectoryIndex::Lookup::UNKNOWN)
+    return lookup == DirectoryIndex::Lookup::FOUND && entry.is_directory;
   File root = SD_MMC.open(path);
   if (!root) {
     ESP_LOGE(TAG, "Failed to open directory");
@@ -144,9 +218,18 @@ bool SdMmc::is_directory(const char *path) {
   return root.isDirectory();
 }
 
-size_t SdMmc::file_size(const char *path) {
+optional<FileInfo> SdMmc::file_info(const char *path) {
+  DirectoryIndex::Entry entry;
+  auto lookup = this->lookup_index(path, entry);
+  if (lookup == DirectoryIndex::Lookup::FOUND)
+    return FileInfo(path, entry.size, entry.is_directory, entry.mtime);
+  if (lookup == DirectoryIndex::Lookup::MISSING)
+    return {};
+  // the File api of the framework reports sizes on 32 bits
   File file = SD_MMC.open(path);
-  return file.size();
+  if (!file)
+    return {};
+  return FileInfo(path, file.size(), file.isDirectory(), file.getLastWrite());
 }
 
 std::string SdMmc::sd_card_type_to_string(int type) const {
@@ -165,6 +248,20 @@ std::string SdMmc::sd_card_type_to_string(int type) const {
   }
 }
 
+optional<uint64_t> SdMmc::get_free_space() { return SD_MMC.totalBytes() - SD_MMC.usedBytes(); }
+
+// SD_MMC does not expose the file system, neither preallocation nor the cluster size are available
+bool SdMmc::preallocate_file(const char *path, size_t size) { return false; }
+
+bool SdMmc::discard_free_space() {
+  ESP_LOGW(TAG, "Discarding the free space is not supported with the Arduino framework");
+  return false;
+}
+
+uint64_t SdMmc::get_sectors_discarded() const { return 0; }
+
+optional<uint32_t> SdMmc::get_cluster_size() { return {}; }
+
 void SdMmc::update_sensors() {
 #ifdef USE_SENSOR
   uint64_t used_bytes = SD_MMC.usedBytes();
@@ -177,8 +274,10 @@ void SdMmc::update_sensors() {
     this->free_space_sensor_->publish_state(total_bytes - used_bytes);
 
   for (auto &sensor : this->file_size_sensors_) {
-    if (sensor.sensor != nullptr)
-      sensor.sensor->publish_state(this->file_size(sensor.path));
+    if (sensor.sensor == nullptr)
+      continue;
+    auto size = this->file_size(sensor.path);
+    sensor.sensor->publish_state(size.has_value() ? *size : NAN);
   }
 #endif
 }
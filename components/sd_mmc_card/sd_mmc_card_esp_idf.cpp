@@ -1,10 +1,14 @@
 #include "sd_mmc_card.h"
 
 #ifdef USE_ESP_IDF
+#include <unistd.h>
 #include "math.h"
+#include "esphome/core/hal.h"
 #include "esphome/core/log.h"
+#include "esp_idf_version.h"
 #include "esp_vfs.h"
 #include "esp_vfs_fat.h"
+#include "diskio_sdmmc.h"
 #include "sdmmc_cmd.h"
 #include "driver/sdmmc_host.h"
 #include "driver/sdmmc_types.h"
@@ -14,12 +18,45 @@ int constexpr SD_OCR_SDHC_CAP = (1 << 30);  // value defined in esp-idf/componen
 namespace esphome {
 namespace sd_mmc_card {
 
-static constexpr size_t FILE_PATH_MAX = ESP_VFS_PATH_MAX + CONFIG_SPIFFS_OBJ_NAME_LEN;
 static const char *TAG = "sd_mmc_card";
 static const std::string MOUNT_POINT("/sdcard");
 
+// drive of FatFs the card is mounted as, another mounted volume may have taken the first one
+static char fat_drive[4] = "0:";
+
 std::string build_path(const char *path) { return MOUNT_POINT + path; }
 
+std::string fat_path(const char *path) { return fat_drive + std::string(path); }
+
+time_t fat_time(uint16_t date, uint16_t time) {
+  struct tm tm = {};
+  tm.tm_year = ((date >> 9) & 0x7F) + 80;
+  tm.tm_mon = ((date >> 5) & 0x0F) - 1;
+  tm.tm_mday = date & 0x1F;
+  tm.tm_hour = (time >> 11) & 0x1F;
+  tm.tm_min = (time >> 5) & 0x3F;
+  tm.tm_sec = (time & 0x1F) * 2;
+  tm.tm_isdst = -1;
+  return mktime(&tm);
+}
+
+static const char *file_system_name(BYTE type) {
+  switch (type) {
+    case FS_FAT12:
+      return "FAT12";
+    case FS_FAT16:
+      return "FAT16";
+    case FS_FAT32:
+      return "FAT32";
+#if FF_FS_EXFAT
+    case FS_EXFAT:
+      return "exFAT";
+#endif
+    default:
+      return "unknown";
+  }
+}
+
 void SdMmc::setup() {
   if (this->power_ctrl_pin_ != nullptr)
     this->power_ctrl_pin_->setup();
@@ -64,6 +101,12 @@ void SdMmc::setup() {
     mark_failed();
     return;
   }
+  snprintf(fat_drive, sizeof(fat_drive), "%u:", ff_diskio_get_pdrv_card(this->card_));
+
+  FATFS *fs;
+  DWORD fre_clust;
+  if (f_getfree(fat_drive, &fre_clust, &fs) == FR_OK)
+    this->file_system_ = file_system_name(fs->fs_type);
 
 #ifdef USE_TEXT_SENSOR
   if (this->sd_card_type_text_sensor_ != nullptr)
@@ -71,41 +114,113 @@ void SdMmc::setup() {
 #endif
 
   update_sensors();
+  if (this->cache_.is_enabled())
+    this->set_interval("cache_sensors", 60000, [this]() { this->update_cache_sensors(); });
+  this->track_changes();
+  this->load_profile();
+  if (this->discard_) {
+    this->discard_task_.set_track_freed(true);
+    this->discard_task_.start(this);
+  }
+#ifdef USE_SENSOR
+  if (this->sectors_discarded_sensor_ != nullptr) {
+    this->update_discard_sensor();
+    this->set_interval("discard_sensor", 60000, [this]() { this->update_discard_sensor(); });
+  }
+#endif
 }
 
-void SdMmc::write_file(const char *path, const uint8_t *buffer, size_t len, const char *mode) {
+bool SdMmc::write_file(const char *path, const uint8_t *buffer, size_t len, const char *mode) {
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
+  this->cache_.invalidate(path);
   std::string absolut_path = build_path(path);
   FILE *file = NULL;
   file = fopen(absolut_path.c_str(), mode);
   if (file == NULL) {
     ESP_LOGE(TAG, "Failed to open file for writing");
-    return;
+    return false;
   }
-  bool ok = fwrite(buffer, 1, len, file);
+  bool ok = fwrite(buffer, 1, len, file) == len;
   if (!ok) {
     ESP_LOGE(TAG, "Failed to write to file");
+    if (this->retention_.is_enabled())
+      this->retention_.request_run();
   }
+  if (this->sync_policy_ == SyncPolicy::ALWAYS && (fflush(file) != 0 || fsync(fileno(file)) != 0))
+    ESP_LOGE(TAG, "Failed to sync file: %s", strerror(errno));
   fclose(file);
+  // before for the index log, again now that the content is complete
+  this->cache_.invalidate(path);
   this->update_sensors();
+  return ok;
+}
+
+std::unique_ptr<FileHandle> SdMmc::open_file(const char *path, const char *mode) {
+  if (strpbrk(mode, "wa+") != nullptr)
+    this->cache_.invalidate(path);
+  std::string absolut_path = build_path(path);
+  FILE *file = fopen(absolut_path.c_str(), mode);
+  if (file == nullptr && mode[0] == 'r' && this->recover_file(path))
+    file = fopen(absolut_path.c_str(), mode);
+  if (file == nullptr) {
+    ESP_LOGE(TAG, "Failed to open file: %s", strerror(errno));
+    return nullptr;
+  }
+  bool writable = strpbrk(mode, "wa+") != nullptr;
+  bool sync = this->sync_policy_ == SyncPolicy::ALWAYS && writable;
+  return std::unique_ptr<FileHandle>(new FileHandle(file, sync, writable ? this : nullptr, path));
+}
+
+bool SdMmc::preallocate_file(const char *path, size_t size) {
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 2, 0)
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
+  this->cache_.invalidate(path);
+  std::string absolut_path = build_path(path);
+  uint32_t start = millis();
+  // f_expand finds and allocates a contiguous free region, the file then never needs a new cluster
+  esp_err_t err = esp_vfs_fat_create_contiguous_file(MOUNT_POINT.c_str(), absolut_path.c_str(), size, true);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Failed to preallocate %s: %s", path, esp_err_to_name(err));
+    return false;
+  }
+  ESP_LOGD(TAG, "Preallocated %s for %s in %u ms", format_size(size).c_str(), path, millis() - start);
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool SdMmc::discard_free_space() {
+  if (!this->discard_task_.start(this))
+    return false;
+  ESP_LOGI(TAG, "Discarding the free space of the card");
+  this->discard_task_.discard_all();
+  return true;
 }
 
+uint64_t SdMmc::get_sectors_discarded() const { return this->discard_task_.get_sectors_discarded(); }
+
 bool SdMmc::create_directory(const char *path) {
   ESP_LOGV(TAG, "Create directory: %s", path);
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
   std::string absolut_path = build_path(path);
   if (mkdir(absolut_path.c_str(), 0777) < 0) {
     ESP_LOGE(TAG, "Failed to create a new directory: %s", strerror(errno));
     return false;
   }
+  this->cache_.invalidate(path);
   this->update_sensors();
   return true;
 }
 
 bool SdMmc::remove_directory(const char *path) {
   ESP_LOGV(TAG, "Remove directory: %s", path);
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
   if (!this->is_directory(path)) {
     ESP_LOGE(TAG, "Not a directory");
     return false;
   }
+  this->cache_.invalidate_prefix(path);
   std::string absolut_path = build_path(path);
   if (remove(absolut_path.c_str()) != 0) {
     ESP_LOGE(TAG, "Failed to remove directory: %s", strerror(errno));
@@ -116,10 +231,16 @@ bool SdMmc::remove_directory(const char *path) {
 
 bool SdMmc::delete_file(const char *path) {
   ESP_LOGV(TAG, "Delete File: %s", path);
+  std::lock_guard<std::recursive_mutex> guard(this->lock_);
   if (this->is_directory(path)) {
     ESP_LOGE(TAG, "Not a file");
     return false;
   }
+  if (is_internal_file(path)) {
+    ESP_LOGE(TAG, "Not deleting %s, it is used by the card component", path);
+    return false;
+  }
+  this->cache_.invalidate(path);
   std::string absolut_path = build_path(path);
   if (remove(absolut_path.c_str()) != 0) {
     ESP_LOGE(TAG, "Failed to remove file: %s", strerror(errno));
@@ -130,17 +251,27 @@ bool SdMmc::delete_file(const char *path) {
 
 std::vector<uint8_t> SdMmc::read_file(char const *path) {
   ESP_LOGV(TAG, "Read File: %s", path);
+  auto cached = this->read_file_cached(path);
+  if (cached != nullptr)
+    return std::vector<uint8_t>(cached->data(), cached->data() + cached->size());
 
   std::string absolut_path = build_path(path);
   FILE *file = nullptr;
   file = fopen(absolut_path.c_str(), "rb");
+  if (file == nullptr && this->recover_file(path))
+    file = fopen(absolut_path.c_str(), "rb");
   if (file == nullptr) {
     ESP_LOGE(TAG, "Failed to open file for reading");
     return std::vector<uint8_t>();
   }
 
   std::vector<uint8_t> res;
-  size_t fileSize = this->file_size(path);
+  uint64_t fileSize = this->file_size(path).value_or(0);
+  if (fileSize > res.max_size()) {
+    ESP_LOGE(TAG, "File too large to be read at once");
+    fclose(file);
+    return std::vector<uint8_t>();
+  }
   res.resize(fileSize);
   size_t len = fread(res.data(), 1, fileSize, file);
   fclose(file);
@@ -152,46 +283,62 @@ std::vector<uint8_t> SdMmc::read_file(char const *path) {
   return res;
 }
 
-std::vector<FileInfo> &SdMmc::list_directory_file_info_rec(const char *path, uint8_t depth,
-                                                           std::vector<FileInfo> &list) {
-  ESP_LOGV(TAG, "Listing directory file info: %s\n", path);
+bool SdMmc::read_file_content(char const *path, uint8_t *buffer, size_t len) {
   std::string absolut_path = build_path(path);
-  DIR *dir = opendir(absolut_path.c_str());
-  if (!dir) {
-    ESP_LOGE(TAG, "Failed to open directory: %s", strerror(errno));
-    return list;
+  FILE *file = fopen(absolut_path.c_str(), "rb");
+  if (file == nullptr) {
+    ESP_LOGE(TAG, "Failed to open file for reading");
+    return false;
   }
-  char entry_absolut_path[FILE_PATH_MAX];
-  char entry_path[FILE_PATH_MAX];
-  const size_t dirpath_len = MOUNT_POINT.size();
-  size_t entry_path_len = strlen(path);
-  strlcpy(entry_path, path, sizeof(entry_path));
-  strlcpy(entry_path + entry_path_len, "/", sizeof(entry_path) - entry_path_len);
-  entry_path_len = strlen(entry_path);
-
-  strlcpy(entry_absolut_path, MOUNT_POINT.c_str(), sizeof(entry_absolut_path));
-  struct dirent *entry;
-  while ((entry = readdir(dir)) != nullptr) {
-    size_t file_size = 0;
-    strlcpy(entry_path + entry_path_len, entry->d_name, sizeof(entry_path) - entry_path_len);
-    strlcpy(entry_absolut_path + dirpath_len, entry_path, sizeof(entry_absolut_path) - dirpath_len);
-    if (entry->d_type != DT_DIR) {
-      struct stat info;
-      if (stat(entry_absolut_path, &info) < 0) {
-        ESP_LOGE(TAG, "Failed to stat file: %s '%s' %s", strerror(errno), entry->d_name, entry_absolut_path);
-      } else {
-        file_size = info.st_size;
-      }
-    }
-    list.emplace_back(entry_path, file_size, entry->d_type == DT_DIR);
-    if (entry->d_type == DT_DIR && depth)
-      list_directory_file_info_rec(entry_absolut_path, depth - 1, list);
+  size_t read = fread(buffer, 1, len, file);
+  fclose(file);
+  if (read != len) {
+    ESP_LOGE(TAG, "Failed to read file: %s", strerror(errno));
+    return false;
   }
-  closedir(dir);
-  return list;
+  return true;
+}
+
+struct DirectoryWalker::Handle {
+  FF_DIR dir;
+};
+
+bool DirectoryWalker::open_level(Level &level) {
+  // FatFs reads the size and time along with the name, the vfs would need a stat per entry and truncates the sizes
+  // of the exFAT files larger than 4 GB
+  std::unique_ptr<Handle> handle(new Handle());
+  if (f_opendir(&handle->dir, fat_path(level.path.c_str()).c_str()) != FR_OK)
+    return false;
+  level.handle = handle.release();
+  return true;
+}
+
+optional<FileInfo> DirectoryWalker::read_level(Level &level) {
+  FILINFO info;
+  if (f_readdir(&level.handle->dir, &info) != FR_OK || info.fname[0] == '\0')
+    return {};
+  std::string path = level.path;
+  if (path.back() != '/')
+    path += '/';
+  path += info.fname;
+  bool is_directory = (info.fattrib & AM_DIR) != 0;
+  return FileInfo(path, is_directory ? 0 : static_cast<uint64_t>(info.fsize), is_directory,
+                  fat_time(info.fdate, info.ftime));
+}
+
+void DirectoryWalker::close_level(Level &level) {
+  if (level.handle == nullptr)
+    return;
+  f_closedir(&level.handle->dir);
+  delete level.handle;
+  level.handle = nullptr;
 }
 
 bool SdMmc::is_directory(const char *path) {
+  DirectoryIndex::Entry entry;
+  auto lookup = this->lookup_index(path, entry);
+  if (lookup != DirectoryIndex::Lookup::UNKNOWN)
+    return lookup == DirectoryIndex::Lookup::FOUND && entry.is_directory;
   std::string absolut_path = build_path(path);
   DIR *dir = opendir(absolut_path.c_str());
   if (dir) {
@@ -200,15 +347,24 @@ bool SdMmc::is_directory(const char *path) {
   return dir != nullptr;
 }
 
-size_t SdMmc::file_size(const char *path) {
-  std::string absolut_path = build_path(path);
-  struct stat info;
-  size_t file_size = 0;
-  if (stat(absolut_path.c_str(), &info) < 0) {
-    ESP_LOGE(TAG, "Failed to stat file: %s", strerror(errno));
-    return -1;
+optional<FileInfo> SdMmc::file_info(const char *path) {
+  DirectoryIndex::Entry entry;
+  auto lookup = this->lookup_index(path, entry);
+  if (lookup == DirectoryIndex::Lookup::FOUND)
+    return FileInfo(path, entry.size, entry.is_directory, entry.mtime);
+  if (lookup == DirectoryIndex::Lookup::MISSING)
+    return {};
+  // the size in the vfs stat is 32 bits
+  FILINFO info;
+  FRESULT res = f_stat(fat_path(path).c_str(), &info);
+  if (res != FR_OK) {
+    if (res != FR_NO_FILE && res != FR_NO_PATH)
+      ESP_LOGE(TAG, "Failed to stat %s: %d", path, res);
+    return {};
   }
-  return info.st_size;
+  bool is_directory = (info.fattrib & AM_DIR) != 0;
+  return FileInfo(path, is_directory ? 0 : static_cast<uint64_t>(info.fsize), is_directory,
+                  fat_time(info.fdate, info.ftime));
 }
 
 std::string SdMmc::sd_card_type() const {
@@ -222,21 +378,37 @@ std::string SdMmc::sd_card_type() const {
   return "UNKNOWN";
 }
 
+optional<uint64_t> SdMmc::get_free_space() {
+  FATFS *fs;
+  DWORD fre_clust;
+  if (f_getfree(fat_drive, &fre_clust, &fs) != FR_OK)
+    return {};
+  return static_cast<uint64_t>(fre_clust) * fs->csize * FF_SS_SDCARD;
+}
+
+optional<uint32_t> SdMmc::get_cluster_size() {
+  FATFS *fs;
+  DWORD fre_clust;
+  if (f_getfree(fat_drive, &fre_clust, &fs) != FR_OK)
+    return {};
+  return static_cast<uint32_t>(fs->csize) * FF_SS_SDCARD;
+}
+
 void SdMmc::update_sensors() {
 #ifdef USE_SENSOR
   if (this->card_ == nullptr)
     return;
 
   FATFS *fs;
-  DWORD fre_clust, fre_sect, tot_sect;
+  DWORD fre_clust;
   uint64_t total_bytes = -1, free_bytes = -1, used_bytes = -1;
-  auto res = f_getfree(MOUNT_POINT.c_str(), &fre_clust, &fs);
+  // exFAT counts the free clusters from its allocation bitmap, FAT32 walks the whole FAT unless its FSINFO is valid
+  auto res = f_getfree(fat_drive, &fre_clust, &fs);
   if (!res) {
-    tot_sect = (fs->n_fatent - 2) * fs->csize;
-    fre_sect = fre_clust * fs->csize;
-
-    total_bytes = static_cast<uint64_t>(tot_sect) * FF_SS_SDCARD;
-    free_bytes = static_cast<uint64_t>(fre_sect) * FF_SS_SDCARD;
+    // in bytes right away, the sector counts of a large card overflow 32 bits
+    uint64_t cluster_size = static_cast<uint64_t>(fs->csize) * FF_SS_SDCARD;
+    total_bytes = static_cast<uint64_t>(fs->n_fatent - 2) * cluster_size;
+    free_bytes = static_cast<uint64_t>(fre_clust) * cluster_size;
     used_bytes = total_bytes - free_bytes;
   }
 
@@ -248,8 +420,10 @@ void SdMmc::update_sensors() {
     this->free_space_sensor_->publish_state(free_bytes);
 
   for (auto &sensor : this->file_size_sensors_) {
-    if (sensor.sensor != nullptr)
-      sensor.sensor->publish_state(this->file_size(sensor.path));
+    if (sensor.sensor == nullptr)
+      continue;
+    auto size = this->file_size(sensor.path);
+    sensor.sensor->publish_state(size.has_value() ? *size : NAN);
   }
 #endif
 }
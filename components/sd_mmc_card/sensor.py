@@ -4,6 +4,7 @@ from esphome.components import sensor
 from esphome.const import (
     CONF_TYPE,
     STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
     UNIT_BYTES,
     ICON_MEMORY,
 )
@@ -19,9 +20,23 @@ CONF_USED_SPACE = "used_space"
 CONF_TOTAL_SPACE = "total_space"
 CONF_FREE_SPACE = "free_space"
 CONF_FILE_SIZE = "file_size"
+CONF_CACHE_HITS = "cache_hits"
+CONF_CACHE_MISSES = "cache_misses"
+CONF_BYTES_RECLAIMED = "bytes_reclaimed"
+CONF_SEQUENTIAL_WRITE_SPEED = "sequential_write_speed"
+CONF_SEQUENTIAL_READ_SPEED = "sequential_read_speed"
+CONF_RANDOM_WRITE_RATE = "random_write_rate"
+CONF_RANDOM_READ_RATE = "random_read_rate"
+CONF_FILE_OPERATION_RATE = "file_operation_rate"
+CONF_SECTORS_DISCARDED = "sectors_discarded"
+
+UNIT_BYTES_PER_SECOND = "B/s"
+UNIT_OPERATIONS_PER_SECOND = "op/s"
 
 TYPES = [CONF_USED_SPACE, CONF_TOTAL_SPACE, CONF_USED_SPACE, CONF_FREE_SPACE]
-SIMPLE_TYPES = [CONF_USED_SPACE, CONF_TOTAL_SPACE, CONF_FREE_SPACE]
+SIMPLE_TYPES = [CONF_USED_SPACE, CONF_TOTAL_SPACE, CONF_FREE_SPACE, CONF_CACHE_HITS, CONF_CACHE_MISSES,
+                CONF_BYTES_RECLAIMED, CONF_SEQUENTIAL_WRITE_SPEED, CONF_SEQUENTIAL_READ_SPEED, CONF_RANDOM_WRITE_RATE,
+                CONF_RANDOM_READ_RATE, CONF_FILE_OPERATION_RATE, CONF_SECTORS_DISCARDED]
 
 BASE_CONFIG_SCHEMA = sensor.sensor_schema(
     unit_of_measurement=UNIT_BYTES,
@@ -34,11 +49,61 @@ BASE_CONFIG_SCHEMA = sensor.sensor_schema(
     }
 )
 
+COUNTER_CONFIG_SCHEMA = sensor.sensor_schema(
+    accuracy_decimals=0,
+    state_class=STATE_CLASS_TOTAL_INCREASING,
+).extend(
+    {
+        cv.GenerateID(CONF_SD_MMC_CARD_ID): cv.use_id(SdMmc),
+    }
+)
+
+BYTES_COUNTER_CONFIG_SCHEMA = sensor.sensor_schema(
+    unit_of_measurement=UNIT_BYTES,
+    icon=ICON_MEMORY,
+    accuracy_decimals=0,
+    state_class=STATE_CLASS_TOTAL_INCREASING,
+).extend(
+    {
+        cv.GenerateID(CONF_SD_MMC_CARD_ID): cv.use_id(SdMmc),
+    }
+)
+
+SPEED_CONFIG_SCHEMA = sensor.sensor_schema(
+    unit_of_measurement=UNIT_BYTES_PER_SECOND,
+    icon=ICON_MEMORY,
+    accuracy_decimals=0,
+    state_class=STATE_CLASS_MEASUREMENT,
+).extend(
+    {
+        cv.GenerateID(CONF_SD_MMC_CARD_ID): cv.use_id(SdMmc),
+    }
+)
+
+RATE_CONFIG_SCHEMA = sensor.sensor_schema(
+    unit_of_measurement=UNIT_OPERATIONS_PER_SECOND,
+    accuracy_decimals=0,
+    state_class=STATE_CLASS_MEASUREMENT,
+).extend(
+    {
+        cv.GenerateID(CONF_SD_MMC_CARD_ID): cv.use_id(SdMmc),
+    }
+)
+
 CONFIG_SCHEMA = cv.typed_schema(
     {
         CONF_TOTAL_SPACE : BASE_CONFIG_SCHEMA,
         CONF_USED_SPACE : BASE_CONFIG_SCHEMA,
         CONF_FREE_SPACE: BASE_CONFIG_SCHEMA,
+        CONF_CACHE_HITS: COUNTER_CONFIG_SCHEMA,
+        CONF_CACHE_MISSES: COUNTER_CONFIG_SCHEMA,
+        CONF_BYTES_RECLAIMED: BYTES_COUNTER_CONFIG_SCHEMA,
+        CONF_SEQUENTIAL_WRITE_SPEED: SPEED_CONFIG_SCHEMA,
+        CONF_SEQUENTIAL_READ_SPEED: SPEED_CONFIG_SCHEMA,
+        CONF_RANDOM_WRITE_RATE: RATE_CONFIG_SCHEMA,
+        CONF_RANDOM_READ_RATE: RATE_CONFIG_SCHEMA,
+        CONF_FILE_OPERATION_RATE: RATE_CONFIG_SCHEMA,
+        CONF_SECTORS_DISCARDED: COUNTER_CONFIG_SCHEMA,
         CONF_FILE_SIZE: BASE_CONFIG_SCHEMA.extend(
             {
                 cv.Required(CONF_PATH): cv.templatable(cv.string_strict),
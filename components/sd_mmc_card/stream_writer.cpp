@@ -0,0 +1,180 @@
+#include "stream_writer.h"
+#include "sd_mmc_card.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+#ifdef USE_ESP32
+#include "esp_pthread.h"
+#endif
+
+namespace esphome {
+namespace sd_mmc_card {
+
+static const char *TAG = "sd_mmc_card.stream";
+
+StreamWriter::StreamWriter(SdMmc *card, uint8_t buffer_count, size_t buffer_size)
+    : card_(card), buffers_(std::max<uint8_t>(buffer_count, 2), Buffer{nullptr, 0}) {
+  if (buffer_size == 0)
+    buffer_size = card->get_profile().write_buffer_size;
+  // whole sectors, or whole clusters when a buffer holds at least one, keep the writes aligned in the file
+  size_t alignment = SECTOR_SIZE;
+  uint32_t cluster = card->get_cluster_size().value_or(0);
+  if (cluster > 0 && buffer_size >= cluster)
+    alignment = cluster;
+  this->buffer_size_ = std::max((buffer_size + alignment - 1) / alignment * alignment, SECTOR_SIZE);
+}
+
+StreamWriter::~StreamWriter() { this->stop(); }
+
+bool StreamWriter::start(const char *path, size_t preallocate) {
+  this->stop();
+  for (auto &buffer : this->buffers_) {
+    buffer.data = allocate_dma_buffer(this->buffer_size_);
+    buffer.used = 0;
+    if (buffer.data == nullptr) {
+      ESP_LOGE(TAG, "Failed to allocate %u buffers of %u bytes", this->buffers_.size(), this->buffer_size_);
+      this->release_buffers();
+      return false;
+    }
+  }
+  this->file_ = this->card_->open_file_preallocated(path, preallocate);
+  if (this->file_ == nullptr) {
+    this->release_buffers();
+    return false;
+  }
+
+  this->current_ = 0;
+  this->pending_ = 0;
+  this->flush_threshold_ = this->card_->get_profile().flush_threshold;
+  this->unsynced_ = 0;
+  this->stopping_ = false;
+  this->failed_ = false;
+  this->running_ = true;
+#ifdef USE_ESP32
+  esp_pthread_cfg_t config = esp_pthread_get_default_config();
+  config.thread_name = "sd_stream";
+  config.stack_size = 4096;
+  config.prio = 10;
+  esp_pthread_set_cfg(&config);
+#endif
+  this->task_ = std::thread(&StreamWriter::run, this);
+#ifdef USE_ESP32
+  config = esp_pthread_get_default_config();
+  esp_pthread_set_cfg(&config);
+#endif
+  ESP_LOGD(TAG, "Streaming to %s with %u buffers of %u bytes", path, this->buffers_.size(), this->buffer_size_);
+  return true;
+}
+
+size_t StreamWriter::write(const uint8_t *data, size_t len, uint32_t timeout_ms) {
+  std::unique_lock<std::mutex> lock(this->lock_);
+  if (!this->running_ || this->stopping_)
+    return 0;
+  size_t written = 0;
+  while (written < len) {
+    Buffer &buffer = this->buffers_[this->current_];
+    if (buffer.used == this->buffer_size_) {
+      // the next buffer is still waiting for the card
+      if (this->pending_ + 1 == this->buffers_.size()) {
+        this->backpressure_++;
+        auto available = [this] { return this->pending_ + 1 < this->buffers_.size() || this->stopping_; };
+        if (timeout_ms == 0 || !this->freed_.wait_for(lock, std::chrono::milliseconds(timeout_ms), available) ||
+            this->stopping_) {
+          this->overruns_++;
+          this->bytes_dropped_ += len - written;
+          return written;
+        }
+      }
+      this->queue_current();
+      continue;
+    }
+    size_t n = std::min(len - written, this->buffer_size_ - buffer.used);
+    memcpy(buffer.data + buffer.used, data + written, n);
+    buffer.used += n;
+    written += n;
+  }
+  // queue a full buffer right away, the next write may come after a while
+  if (this->buffers_[this->current_].used == this->buffer_size_ && this->pending_ + 1 < this->buffers_.size())
+    this->queue_current();
+  return written;
+}
+
+void StreamWriter::queue_current() {
+  this->pending_++;
+  this->current_ = (this->current_ + 1) % this->buffers_.size();
+  this->queued_.notify_one();
+}
+
+bool StreamWriter::stop() {
+  {
+    std::lock_guard<std::mutex> guard(this->lock_);
+    if (!this->running_)
+      return true;
+    // the partial buffer is written last, the preallocated file is cut after it
+    if (this->buffers_[this->current_].used > 0)
+      this->queue_current();
+    this->stopping_ = true;
+    this->queued_.notify_one();
+    this->freed_.notify_all();
+  }
+  this->task_.join();
+  bool ok = this->file_->close() && !this->failed_;
+  this->file_.reset();
+  this->release_buffers();
+  this->running_ = false;
+  ESP_LOGD(TAG, "Stream stopped, %llu bytes written, %llu dropped, %u overruns, longest write %u us",
+           this->bytes_written_, this->bytes_dropped_, this->overruns_, this->max_write_time_);
+  return ok;
+}
+
+void StreamWriter::run() {
+  std::unique_lock<std::mutex> lock(this->lock_);
+  while (true) {
+    this->queued_.wait(lock, [this] { return this->pending_ > 0 || this->stopping_; });
+    if (this->pending_ == 0)
+      return;
+    size_t index = (this->current_ + this->buffers_.size() - this->pending_) % this->buffers_.size();
+    Buffer &buffer = this->buffers_[index];
+    // the producers keep filling the current buffer during the card write
+    lock.unlock();
+    uint32_t start = micros();
+    size_t written = this->failed_ ? 0 : this->file_->write(buffer.data, buffer.used);
+    this->unsynced_ += written;
+    // a power loss then only loses the data written since the last sync
+    if (this->flush_threshold_ > 0 && this->unsynced_ >= this->flush_threshold_) {
+      this->file_->sync();
+      this->unsynced_ = 0;
+    }
+    uint32_t elapsed = micros() - start;
+    lock.lock();
+
+    this->max_write_time_ = std::max(this->max_write_time_, elapsed);
+    this->bytes_written_ += written;
+    if (written != buffer.used) {
+      if (!this->failed_)
+        ESP_LOGE(TAG, "Failed to write to %s", this->file_->get_path().c_str());
+      this->failed_ = true;
+      this->bytes_dropped_ += buffer.used - written;
+    }
+    buffer.used = 0;
+    this->pending_--;
+    this->freed_.notify_all();
+  }
+}
+
+void StreamWriter::release_buffers() {
+  for (auto &buffer : this->buffers_) {
+    if (buffer.data != nullptr)
+      free_dma_buffer(buffer.data);
+    buffer.data = nullptr;
+    buffer.used = 0;
+  }
+}
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
@@ -0,0 +1,93 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace esphome {
+namespace sd_mmc_card {
+
+class SdMmc;
+class PreallocatedFile;
+
+/* Writer for continuous capture streams like audio or camera frames.
+ *
+ * Producers copy their data into one of buffer_count buffers while a dedicated task writes the full ones to
+ * the card, a slow card write then only delays the task instead of the producer. The buffers are dma capable
+ * and a multiple of the sector size, the card driver writes them without an intermediate copy.
+ *
+ * When every buffer is waiting for the card, write() waits up to its timeout then drops the data, the
+ * backpressure and overrun counters report how often this happens.
+ *
+ * Without a buffer size the buffers follow the write buffer size of the card profile, and the file is synced each
+ * time its flush threshold of data was written.
+ */
+class StreamWriter {
+ public:
+  static constexpr size_t SECTOR_SIZE = 512;
+
+  StreamWriter(SdMmc *card, uint8_t buffer_count = 3, size_t buffer_size = 0);
+  ~StreamWriter();
+  StreamWriter(StreamWriter const &) = delete;
+  StreamWriter &operator=(StreamWriter const &) = delete;
+
+  /* Create the file, preallocated when a size is given, and start the writer task */
+  bool start(const char *path, size_t preallocate = 0);
+  /* Queue data for the card, return the number of bytes accepted */
+  size_t write(const uint8_t *data, size_t len, uint32_t timeout_ms = 0);
+  /* Write the queued data, stop the task and close the file, false if some data could not be written */
+  bool stop();
+  bool is_running() const { return this->running_; }
+
+  size_t get_buffer_size() const { return this->buffer_size_; }
+  uint64_t get_bytes_written() const { return this->bytes_written_; }
+  uint64_t get_bytes_dropped() const { return this->bytes_dropped_; }
+  /* Writes that found every buffer full and had to wait */
+  uint32_t get_backpressure() const { return this->backpressure_; }
+  /* Writes that dropped data because no buffer was freed in time */
+  uint32_t get_overruns() const { return this->overruns_; }
+  /* Longest write of one buffer to the card in microseconds */
+  uint32_t get_max_write_time() const { return this->max_write_time_; }
+  /* Buffers waiting for the card */
+  uint8_t get_pending() const { return this->pending_; }
+
+ protected:
+  struct Buffer {
+    uint8_t *data;
+    size_t used;
+  };
+
+  void run();
+  void queue_current();
+  void release_buffers();
+
+  SdMmc *card_;
+  std::unique_ptr<PreallocatedFile> file_;
+  std::vector<Buffer> buffers_;
+  size_t buffer_size_;
+  size_t flush_threshold_{0};
+  // bytes written by the task since the last sync
+  size_t unsynced_{0};
+  // buffer filled by the producers, the pending ones before it wait for the task in order
+  uint8_t current_{0};
+  uint8_t pending_{0};
+  bool running_{false};
+  bool stopping_{false};
+  bool failed_{false};
+  std::mutex lock_;
+  std::condition_variable queued_;
+  std::condition_variable freed_;
+  std::thread task_;
+
+  uint64_t bytes_written_{0};
+  uint64_t bytes_dropped_{0};
+  uint32_t backpressure_{0};
+  uint32_t overruns_{0};
+  uint32_t max_write_time_{0};
+};
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
@@ -0,0 +1,103 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome import automation
+from esphome.components import sensor
+from esphome.const import (
+    CONF_ID,
+    CONF_NAME,
+    CONF_PATH,
+    CONF_SENSOR_ID,
+    CONF_SENSORS,
+)
+from .. import sd_mmc_card
+
+CONF_SEGMENT_SIZE = "segment_size"
+CONF_FLUSH_INTERVAL = "flush_interval"
+CONF_BUFFER_SIZE = "buffer_size"
+
+DEPENDENCIES = ["sd_mmc_card"]
+AUTO_LOAD = ["sensor"]
+
+sd_recorder_ns = cg.esphome_ns.namespace("sd_recorder")
+SdRecorder = sd_recorder_ns.class_("SdRecorder", cg.Component)
+
+SdRecorderFlushAction = sd_recorder_ns.class_("SdRecorderFlushAction", automation.Action)
+
+
+def series_id(name):
+    # fnv-1a folded to 16 bits, the id stays the same when the sensors are reordered
+    value = 0x811C9DC5
+    for byte in name.encode("utf-8"):
+        value = ((value ^ byte) * 0x01000193) & 0xFFFFFFFF
+    return (value >> 16) ^ (value & 0xFFFF)
+
+
+def validate_path(value):
+    value = cv.string_strict(value)
+    if not value.startswith("/") or value == "/":
+        raise cv.Invalid("path must be an absolute directory other than the root")
+    return value.rstrip("/")
+
+
+def validate_series(config):
+    ids = {}
+    for conf in config[CONF_SENSORS]:
+        name = conf.get(CONF_NAME, conf[CONF_SENSOR_ID].id)
+        if "," in name or "\n" in name:
+            raise cv.Invalid(f"series name '{name}' can not contain a comma or a new line")
+        id_ = series_id(name)
+        if id_ in ids:
+            raise cv.Invalid(f"series '{name}' and '{ids[id_]}' have the same id, rename one of them")
+        ids[id_] = name
+    return config
+
+
+CONFIG_SCHEMA = cv.All(
+    cv.require_esphome_version(2025,7,0),
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.declare_id(SdRecorder),
+            cv.GenerateID(sd_mmc_card.CONF_SD_MMC_CARD_ID): cv.use_id(sd_mmc_card.SdMmc),
+            cv.Optional(CONF_PATH, default="/history"): validate_path,
+            cv.Optional(CONF_SEGMENT_SIZE, default="1MB"): cv.All(
+                sd_mmc_card.validate_bytes, cv.int_range(min=4096, max=0x7FFFFFFF)
+            ),
+            cv.Optional(CONF_FLUSH_INTERVAL, default="60s"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_BUFFER_SIZE, default=64): cv.int_range(min=1, max=4096),
+            cv.Required(CONF_SENSORS): cv.ensure_list(
+                cv.Schema(
+                    {
+                        cv.Required(CONF_SENSOR_ID): cv.use_id(sensor.Sensor),
+                        cv.Optional(CONF_NAME): cv.string_strict,
+                    }
+                )
+            ),
+        }
+    ).extend(cv.COMPONENT_SCHEMA),
+    validate_series,
+)
+
+async def to_code(config):
+    var = cg.new_Pvariable(config[CONF_ID])
+    await cg.register_component(var, config)
+    sdmmc = await cg.get_variable(config[sd_mmc_card.CONF_SD_MMC_CARD_ID])
+    cg.add(var.set_sd_mmc_card(sdmmc))
+    cg.add(var.set_path(config[CONF_PATH]))
+    cg.add(var.set_segment_size(config[CONF_SEGMENT_SIZE]))
+    cg.add(var.set_flush_interval(config[CONF_FLUSH_INTERVAL]))
+    cg.add(var.set_buffer_size(config[CONF_BUFFER_SIZE]))
+    for conf in config[CONF_SENSORS]:
+        sens = await cg.get_variable(conf[CONF_SENSOR_ID])
+        name = conf.get(CONF_NAME, conf[CONF_SENSOR_ID].id)
+        cg.add(var.add_series(sens, series_id(name), name))
+    cg.add_define("USE_SD_RECORDER")
+
+
+@automation.register_action(
+    "sd_recorder.flush",
+    SdRecorderFlushAction,
+    cv.Schema({cv.GenerateID(): cv.use_id(SdRecorder)}),
+)
+async def sd_recorder_flush_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    return cg.new_Pvariable(action_id, template_arg, parent)
@@ -0,0 +1,77 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace esphome {
+namespace sd_recorder {
+
+/* On card layout of the recorded history.
+ *
+ * The records of every series are appended to segment files named after the time of their first record,
+ * in hexadecimal so the name fits in 8.3 (665F1A00.rec). A segment never goes back in time.
+ * Each segment has a sparse index (665F1A00.idx) holding the time of the first record of every block of
+ * BLOCK_RECORDS records, a query reads the index and seeks directly to the block containing its start.
+ * series.csv maps the series ids to their names.
+ */
+
+/* time (le32, unix seconds), value (le32 float), series (le16), reserved (le16) */
+static constexpr size_t RECORD_SIZE = 12;
+static constexpr size_t BLOCK_RECORDS = 256;
+static constexpr size_t BLOCK_SIZE = RECORD_SIZE * BLOCK_RECORDS;
+static const char *const SEGMENT_EXTENSION = ".rec";
+static const char *const INDEX_EXTENSION = ".idx";
+static const char *const SERIES_FILE = "series.csv";
+
+struct Record {
+  uint32_t time;
+  float value;
+  uint16_t series;
+};
+
+inline void encode_record(Record const &record, uint8_t *buffer) {
+  uint32_t value;
+  memcpy(&value, &record.value, sizeof(value));
+  for (int i = 0; i < 4; i++) {
+    buffer[i] = (record.time >> (8 * i)) & 0xFF;
+    buffer[4 + i] = (value >> (8 * i)) & 0xFF;
+  }
+  buffer[8] = record.series & 0xFF;
+  buffer[9] = record.series >> 8;
+  buffer[10] = 0;
+  buffer[11] = 0;
+}
+
+inline Record decode_record(const uint8_t *buffer) {
+  Record record;
+  uint32_t value = 0;
+  record.time = 0;
+  for (int i = 0; i < 4; i++) {
+    record.time |= static_cast<uint32_t>(buffer[i]) << (8 * i);
+    value |= static_cast<uint32_t>(buffer[4 + i]) << (8 * i);
+  }
+  memcpy(&record.value, &value, sizeof(value));
+  record.series = buffer[8] | (buffer[9] << 8);
+  return record;
+}
+
+/* Name of the segment starting at the given time, without extension */
+inline std::string segment_name(uint32_t start) {
+  char name[9];
+  snprintf(name, sizeof(name), "%08X", static_cast<unsigned>(start));
+  return name;
+}
+
+/* Parse a segment file name, fat may return it in upper case */
+inline bool parse_segment_name(const char *name, uint32_t &start) {
+  if (strlen(name) != 12 || strcasecmp(name + 8, SEGMENT_EXTENSION) != 0)
+    return false;
+  char *end;
+  std::string digits(name, 8);
+  start = strtoul(digits.c_str(), &end, 16);
+  return *end == '\0';
+}
+
+}  // namespace sd_recorder
+}  // namespace esphome
@@ -0,0 +1,132 @@
+#include "record_reader.h"
+
+#include <algorithm>
+#include <dirent.h>
+
+namespace esphome {
+namespace sd_recorder {
+
+RecordReader::RecordReader(std::string const &directory, uint32_t from, uint32_t to, int32_t series)
+    : directory_(directory), from_(from), to_(to), series_(series) {
+  if (!this->directory_.empty() && this->directory_.back() != '/')
+    this->directory_ += '/';
+  DIR *dir = opendir(this->directory_.c_str());
+  if (dir == nullptr) {
+    this->done_ = true;
+    return;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    uint32_t start;
+    if (parse_segment_name(entry->d_name, start))
+      this->segments_.push_back(start);
+  }
+  closedir(dir);
+  std::sort(this->segments_.begin(), this->segments_.end());
+
+  // skip the segments ending before the range, a segment ends where the next one starts
+  auto first = std::upper_bound(this->segments_.begin(), this->segments_.end(), from);
+  if (first != this->segments_.begin())
+    --first;
+  this->segment_index_ = first - this->segments_.begin();
+}
+
+RecordReader::~RecordReader() {
+  if (this->file_ != nullptr)
+    fclose(this->file_);
+}
+
+bool RecordReader::next(Record &record) {
+  while (!this->done_) {
+    if (this->position_ >= this->buffered_) {
+      if (this->file_ != nullptr) {
+        this->buffered_ = fread(this->buffer_, 1, BLOCK_SIZE, this->file_);
+        this->buffered_ -= this->buffered_ % RECORD_SIZE;
+        this->position_ = 0;
+      }
+      if (this->buffered_ == 0 && !this->open_segment())
+        this->done_ = true;
+      continue;
+    }
+    record = decode_record(this->buffer_ + this->position_);
+    this->position_ += RECORD_SIZE;
+    if (record.time > this->to_) {
+      // the segments are in time order, nothing further can match
+      this->done_ = true;
+      break;
+    }
+    if (record.time >= this->from_ && (this->series_ < 0 || record.series == this->series_))
+      return true;
+  }
+  return false;
+}
+
+bool RecordReader::open_segment() {
+  if (this->file_ != nullptr) {
+    fclose(this->file_);
+    this->file_ = nullptr;
+  }
+  if (this->segment_index_ >= this->segments_.size())
+    return false;
+  uint32_t start = this->segments_[this->segment_index_++];
+  if (start > this->to_)
+    return false;
+
+  std::string name = this->directory_ + segment_name(start);
+  this->file_ = fopen((name + SEGMENT_EXTENSION).c_str(), "rb");
+  if (this->file_ == nullptr)
+    return this->open_segment();
+  // only the first segment of the range can start before it
+  if (start < this->from_) {
+    uint32_t offset = this->find_start(name + INDEX_EXTENSION);
+    if (offset > 0)
+      fseek(this->file_, offset, SEEK_SET);
+  }
+  this->buffered_ = 0;
+  this->position_ = 0;
+  return true;
+}
+
+uint32_t RecordReader::find_start(std::string const &index_path) const {
+  FILE *file = fopen(index_path.c_str(), "rb");
+  if (file == nullptr)
+    return 0;
+  // the index holds one 4 byte time per block, a full segment only needs a few hundred of them
+  std::vector<uint32_t> times;
+  uint8_t entry[4];
+  while (fread(entry, 1, sizeof(entry), file) == sizeof(entry))
+    times.push_back(entry[0] | (entry[1] << 8) | (entry[2] << 16) | (static_cast<uint32_t>(entry[3]) << 24));
+  fclose(file);
+
+  // the last block starting before the range, the blocks before it can not hold a match
+  auto it = std::lower_bound(times.begin(), times.end(), this->from_);
+  if (it == times.begin())
+    return 0;
+  return (it - times.begin() - 1) * BLOCK_SIZE;
+}
+
+std::map<uint16_t, std::string> RecordReader::read_series(std::string const &directory) {
+  std::map<uint16_t, std::string> series;
+  std::string path = directory;
+  if (!path.empty() && path.back() != '/')
+    path += '/';
+  FILE *file = fopen((path + SERIES_FILE).c_str(), "r");
+  if (file == nullptr)
+    return series;
+  char line[128];
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    char *separator = strchr(line, ',');
+    if (separator == nullptr)
+      continue;
+    *separator = '\0';
+    std::string name(separator + 1);
+    while (!name.empty() && (name.back() == '\n' || name.back() == '\r'))
+      name.pop_back();
+    series[strtoul(line, nullptr, 10)] = name;
+  }
+  fclose(file);
+  return series;
+}
+
+}  // namespace sd_recorder
+}  // namespace esphome
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+#include "record_format.h"
+
+namespace esphome {
+namespace sd_recorder {
+
+/* Iterate over the records of a time range, oldest first, reading one block at a time */
+class RecordReader {
+ public:
+  /* directory is the absolute vfs path of the recorder directory, series < 0 selects every series */
+  RecordReader(std::string const &directory, uint32_t from, uint32_t to, int32_t series);
+  ~RecordReader();
+  RecordReader(RecordReader const &) = delete;
+  RecordReader &operator=(RecordReader const &) = delete;
+
+  bool next(Record &record);
+
+  /* Read the series ids and names of a recorder directory */
+  static std::map<uint16_t, std::string> read_series(std::string const &directory);
+
+ protected:
+  bool open_segment();
+  uint32_t find_start(std::string const &index_path) const;
+
+  std::string directory_;
+  uint32_t from_;
+  uint32_t to_;
+  int32_t series_;
+  std::vector<uint32_t> segments_;
+  size_t segment_index_{0};
+  FILE *file_{nullptr};
+  uint8_t buffer_[BLOCK_SIZE];
+  size_t buffered_{0};
+  size_t position_{0};
+  bool done_{false};
+};
+
+}  // namespace sd_recorder
+}  // namespace esphome
@@ -0,0 +1,236 @@
+#include "sd_recorder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <unistd.h>
+
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+#include "record_reader.h"
+
+namespace esphome {
+namespace sd_recorder {
+
+static const char *TAG = "sd_recorder";
+// 2020-01-01, any earlier time means the clock has not been set yet
+static constexpr time_t VALID_TIME = 1577836800;
+
+void SdRecorder::setup() {
+  if (this->sd_mmc_card_->is_failed()) {
+    this->mark_failed();
+    return;
+  }
+  if (!this->sd_mmc_card_->is_directory(this->path_) && !this->sd_mmc_card_->create_directory(this->path_.c_str())) {
+    ESP_LOGE(TAG, "Failed to create %s", this->path_.c_str());
+    this->mark_failed();
+    return;
+  }
+  this->write_series();
+  this->load_segment();
+  this->buffer_.reserve(this->buffer_size_);
+  this->set_interval("flush", this->flush_interval_, [this]() { this->flush(); });
+}
+
+void SdRecorder::dump_config() {
+  ESP_LOGCONFIG(TAG, "SD Recorder:");
+  ESP_LOGCONFIG(TAG, "  Path: %s", this->path_.c_str());
+  ESP_LOGCONFIG(TAG, "  Segment size: %s", sd_mmc_card::format_size(this->segment_size_).c_str());
+  ESP_LOGCONFIG(TAG, "  Flush interval: %u ms", this->flush_interval_);
+  ESP_LOGCONFIG(TAG, "  Buffer size: %u records", this->buffer_size_);
+  for (auto const &series : this->series_)
+    ESP_LOGCONFIG(TAG, "  Series %u: %s", series.id, series.name.c_str());
+  if (this->is_failed())
+    ESP_LOGE(TAG, "  Failed to open the history");
+}
+
+void SdRecorder::on_shutdown() { this->flush(); }
+
+void SdRecorder::set_sd_mmc_card(sd_mmc_card::SdMmc *card) { this->sd_mmc_card_ = card; }
+
+void SdRecorder::set_path(std::string const &path) { this->path_ = path; }
+
+void SdRecorder::set_segment_size(uint32_t size) { this->segment_size_ = size; }
+
+void SdRecorder::set_flush_interval(uint32_t interval) { this->flush_interval_ = interval; }
+
+void SdRecorder::set_buffer_size(uint16_t size) { this->buffer_size_ = size; }
+
+void SdRecorder::add_series(sensor::Sensor *sensor, uint16_t id, std::string const &name) {
+  this->series_.push_back(Series{id, name});
+  sensor->add_on_state_callback([this, id](float value) { this->record(id, value); });
+}
+
+void SdRecorder::record(uint16_t series, float value) {
+  if (this->is_failed() || std::isnan(value))
+    return;
+  time_t now = ::time(nullptr);
+  if (now < VALID_TIME) {
+    ESP_LOGV(TAG, "Time not set, dropping a record");
+    return;
+  }
+  this->buffer_.push_back(Record{static_cast<uint32_t>(now), value, series});
+  if (this->buffer_.size() >= this->buffer_size_)
+    this->flush();
+}
+
+bool SdRecorder::flush() {
+  if (this->buffer_.empty() || this->is_failed())
+    return true;
+
+  bool ok = true;
+  size_t position = 0;
+  while (ok && position < this->buffer_.size()) {
+    Record const &first = this->buffer_[position];
+    uint32_t max_records = std::max<uint32_t>(this->segment_size_ / RECORD_SIZE, 1);
+    // a segment never goes back in time, the clock may have been corrected
+    if (!this->has_segment_ || this->segment_records_ >= max_records || first.time < this->last_time_) {
+      ok = this->start_segment(first.time);
+      continue;
+    }
+    size_t count = 1;
+    size_t limit = std::min<size_t>(this->buffer_.size() - position, max_records - this->segment_records_);
+    while (count < limit && this->buffer_[position + count].time >= this->buffer_[position + count - 1].time)
+      count++;
+    ok = this->append(&this->buffer_[position], count);
+    position += count;
+  }
+  // a failed write drops the buffer rather than growing it forever
+  this->buffer_.clear();
+  return ok;
+}
+
+bool SdRecorder::append(const Record *records, size_t count) {
+  std::vector<uint8_t> data(count * RECORD_SIZE);
+  std::vector<uint8_t> index;
+  for (size_t i = 0; i < count; i++) {
+    encode_record(records[i], data.data() + i * RECORD_SIZE);
+    // the first record of each block goes to the index
+    if ((this->segment_records_ + i) % BLOCK_RECORDS == 0) {
+      for (int shift = 0; shift < 32; shift += 8)
+        index.push_back((records[i].time >> shift) & 0xFF);
+    }
+  }
+
+  std::string path = this->segment_path(this->segment_start_, SEGMENT_EXTENSION);
+  auto file = this->sd_mmc_card_->open_file(path, "ab");
+  if (file == nullptr || file->write(data.data(), data.size()) != data.size() || !file->close()) {
+    ESP_LOGE(TAG, "Failed to write %s", path.c_str());
+    // do not leave a partial record before the next ones
+    file.reset();
+    truncate(sd_mmc_card::build_path(path.c_str()).c_str(), this->segment_records_ * RECORD_SIZE);
+    return false;
+  }
+  // the data is written first, load_segment() rebuilds an index entry lost on power loss
+  if (!index.empty()) {
+    auto index_file = this->sd_mmc_card_->open_file(this->segment_path(this->segment_start_, INDEX_EXTENSION), "ab");
+    if (index_file == nullptr || index_file->write(index.data(), index.size()) != index.size())
+      ESP_LOGW(TAG, "Failed to update the index of %s", path.c_str());
+  }
+  this->segment_records_ += count;
+  this->last_time_ = records[count - 1].time;
+  this->records_written_ += count;
+  return true;
+}
+
+bool SdRecorder::start_segment(uint32_t start) {
+  // two segments can not share a name, the new one starts after the current one
+  if (this->has_segment_ && start <= this->segment_start_)
+    start = this->segment_start_ + 1;
+  this->segment_start_ = start;
+  this->segment_records_ = 0;
+  this->last_time_ = 0;
+  this->has_segment_ = true;
+  ESP_LOGD(TAG, "Starting segment %s", this->segment_path(start, SEGMENT_EXTENSION).c_str());
+  return true;
+}
+
+void SdRecorder::load_segment() {
+  // the segment with the latest start is the one to append to
+  bool found = false;
+  uint32_t start = 0;
+  for (auto const &info : this->sd_mmc_card_->list_directory_file_info(this->path_, 0)) {
+    if (info.is_directory)
+      continue;
+    size_t pos = info.path.rfind('/');
+    uint32_t segment;
+    if (parse_segment_name(info.path.c_str() + (pos == std::string::npos ? 0 : pos + 1), segment) &&
+        (!found || segment > start)) {
+      start = segment;
+      found = true;
+    }
+  }
+  if (!found)
+    return;
+
+  std::string path = this->segment_path(start, SEGMENT_EXTENSION);
+  size_t size = this->sd_mmc_card_->file_size(path).value_or(0);
+  if (size % RECORD_SIZE != 0) {
+    ESP_LOGW(TAG, "Dropping a partial record at the end of %s", path.c_str());
+    size -= size % RECORD_SIZE;
+    truncate(sd_mmc_card::build_path(path.c_str()).c_str(), size);
+  }
+  this->segment_start_ = start;
+  this->segment_records_ = size / RECORD_SIZE;
+  this->has_segment_ = true;
+  if (this->segment_records_ == 0)
+    return;
+
+  auto file = this->sd_mmc_card_->open_file(path, "rb");
+  if (file == nullptr) {
+    // the next records go to a new segment
+    this->segment_records_ = UINT32_MAX;
+    return;
+  }
+  uint8_t data[RECORD_SIZE];
+  file->seek((this->segment_records_ - 1) * RECORD_SIZE);
+  if (file->read(data, RECORD_SIZE) == RECORD_SIZE)
+    this->last_time_ = decode_record(data).time;
+
+  // bring the index back in line with the data after a power loss
+  std::string index_path = this->segment_path(start, INDEX_EXTENSION);
+  size_t blocks = (this->segment_records_ + BLOCK_RECORDS - 1) / BLOCK_RECORDS;
+  size_t indexed = this->sd_mmc_card_->file_size(index_path).value_or(0) / 4;
+  if (indexed > blocks) {
+    truncate(sd_mmc_card::build_path(index_path.c_str()).c_str(), blocks * 4);
+  } else if (indexed < blocks) {
+    ESP_LOGW(TAG, "Rebuilding %u index entries of %s", blocks - indexed, path.c_str());
+    auto index_file = this->sd_mmc_card_->open_file(index_path, "ab");
+    for (size_t block = indexed; index_file != nullptr && block < blocks; block++) {
+      file->seek(block * BLOCK_SIZE);
+      if (file->read(data, RECORD_SIZE) != RECORD_SIZE)
+        break;
+      index_file->write(data, 4);
+    }
+  }
+  ESP_LOGD(TAG, "Appending to %s, %u records", path.c_str(), this->segment_records_);
+}
+
+void SdRecorder::write_series() {
+  // keep the names of series no longer configured, their records are still on the card
+  auto names = RecordReader::read_series(sd_mmc_card::build_path(this->path_.c_str()));
+  bool changed = false;
+  for (auto const &series : this->series_) {
+    auto it = names.find(series.id);
+    if (it == names.end() || it->second != series.name) {
+      names[series.id] = series.name;
+      changed = true;
+    }
+  }
+  if (!changed)
+    return;
+  std::string content;
+  for (auto const &it : names)
+    content += to_string(it.first) + "," + it.second + "\n";
+  std::string path = this->path_ + "/" + SERIES_FILE;
+  if (!this->sd_mmc_card_->write_file_atomic(path.c_str(), reinterpret_cast<const uint8_t *>(content.data()),
+                                              content.size()))
+    ESP_LOGE(TAG, "Failed to write %s", path.c_str());
+}
+
+std::string SdRecorder::segment_path(uint32_t start, const char *extension) const {
+  return this->path_ + "/" + segment_name(start) + extension;
+}
+
+}  // namespace sd_recorder
+}  // namespace esphome
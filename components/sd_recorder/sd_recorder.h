@@ -0,0 +1,76 @@
+#pragma once
+#include <vector>
+#include "esphome/core/component.h"
+#include "esphome/core/automation.h"
+#include "esphome/components/sensor/sensor.h"
+#include "../sd_mmc_card/sd_mmc_card.h"
+#include "record_format.h"
+
+namespace esphome {
+namespace sd_recorder {
+
+/* Record the states of sensors to append only segment files.
+ *
+ * The records are buffered in RAM and appended in one write per flush, a segment is closed once it
+ * reaches its maximum size so the history can grow without any rewrite of the existing data.
+ */
+class SdRecorder : public Component {
+ public:
+  void setup() override;
+  void dump_config() override;
+  void on_shutdown() override;
+  float get_setup_priority() const override { return setup_priority::DATA; }
+
+  void set_sd_mmc_card(sd_mmc_card::SdMmc *);
+  void set_path(std::string const &);
+  void set_segment_size(uint32_t);
+  void set_flush_interval(uint32_t);
+  void set_buffer_size(uint16_t);
+  void add_series(sensor::Sensor *sensor, uint16_t id, std::string const &name);
+
+  /* Add a record, the buffer is flushed when full */
+  void record(uint16_t series, float value);
+  /* Append the buffered records to the current segment */
+  bool flush();
+
+  std::string const &get_path() const { return this->path_; }
+  uint32_t get_records_written() const { return this->records_written_; }
+
+ protected:
+  struct Series {
+    uint16_t id;
+    std::string name;
+  };
+
+  void load_segment();
+  void write_series();
+  bool start_segment(uint32_t start);
+  bool append(const Record *records, size_t count);
+  std::string segment_path(uint32_t start, const char *extension) const;
+
+  sd_mmc_card::SdMmc *sd_mmc_card_;
+  std::string path_;
+  uint32_t segment_size_{1024 * 1024};
+  uint32_t flush_interval_{60000};
+  uint16_t buffer_size_{64};
+  std::vector<Series> series_;
+  std::vector<Record> buffer_;
+  uint32_t segment_start_{0};
+  uint32_t segment_records_{0};
+  uint32_t last_time_{0};
+  bool has_segment_{false};
+  uint32_t records_written_{0};
+};
+
+template<typename... Ts> class SdRecorderFlushAction : public Action<Ts...> {
+ public:
+  SdRecorderFlushAction(SdRecorder *parent) : parent_(parent) {}
+
+  void play(Ts... x) { this->parent_->flush(); }
+
+ protected:
+  SdRecorder *parent_;
+};
+
+}  // namespace sd_recorder
+}  // namespace esphome